@@ -39,6 +39,7 @@
 
 /* Include for socket IOCTLs */
 #include <linux/sockios.h>
+#include <linux/types.h>
 
 /* Maximum number of interfaces */
 #ifndef MAX_IFACE
@@ -450,6 +451,12 @@
  */
 #define SIOCREGREAD		SIOCDEVPRIVATE
 #define SIOCREGWRITE		(SIOCDEVPRIVATE + 1)
+#define SIOCREGREADMULTI	(SIOCDEVPRIVATE + 2)
+#define SIOCREGWRITEMULTI	(SIOCDEVPRIVATE + 3)
+#define SIOCRINGTXKICK		(SIOCDEVPRIVATE + 4)
+
+/* Maximum number of registers in one SIOCREG*MULTI call */
+#define NF2_REG_MULTI_MAX	256
 
 
 /* MDIO registers */
@@ -478,4 +485,66 @@ struct nf2reg {
 	unsigned int	val;
 };
 
+/*
+ * Structure for transferring a batch of registers via a single IOCTL.
+ * Registers are accessed in array order, reads fill in val. regs is the
+ * user address of the array, held in 64 bits so 32 and 64 bit processes
+ * pass the same layout.
+ */
+struct nf2reg_multi {
+	__u32		num;
+	__u32		pad;
+	__u64		regs;	/* struct nf2reg *, see NF2_REGS_PTR */
+};
+#define NF2_REGS_PTR(regs)	((__u64)(unsigned long)(regs))
+
+/*
+ * Packet ring shared with the user card char device through mmap().
+ *
+ * The mapping is NF2_RING_MMAP_SIZE bytes cut into NF2_RING_FRAME_SIZE
+ * slots: slot 0 holds struct nf2_ring_ctrl, followed by the rx frames
+ * and then the tx frames. Indices are free running counters, index i
+ * lives in frame (i % frames).
+ *
+ *  rx: the driver DMAs packets straight into frames and advances
+ *      rx_head, the application consumes them and advances rx_tail.
+ *  tx: the application fills frames and advances tx_head, the driver
+ *      DMAs them out and advances tx_tail.
+ *
+ * Fill in a frame before moving the index past it. Reception stalls on a
+ * full ring (rx_stalled) and resumes within a tick of a frame being
+ * consumed, or right away on poll(). Frames the card reports longer than
+ * a frame holds are dropped and counted in rx_dropped. SIOCRINGTXKICK
+ * starts transmission after a batch was queued. read() and write() are
+ * unavailable while mapped.
+ *
+ * A frame holds a whole DMA transfer (2048 bytes) after its header and
+ * divides the page size.
+ */
+#define NF2_RING_FRAME_SIZE	4096
+#define NF2_RING_RX_FRAMES	256
+#define NF2_RING_TX_FRAMES	256
+#define NF2_RING_MMAP_SIZE	\
+	((1 + NF2_RING_RX_FRAMES + NF2_RING_TX_FRAMES) * NF2_RING_FRAME_SIZE)
+
+struct nf2_ring_ctrl {
+	volatile unsigned int	rx_head;
+	volatile unsigned int	rx_tail;
+	volatile unsigned int	tx_head;
+	volatile unsigned int	tx_tail;
+	volatile unsigned int	rx_stalled;
+	unsigned int		frame_size;
+	unsigned int		rx_frames;
+	unsigned int		tx_frames;
+	unsigned int		rx_offset;	/* from the start of the mapping */
+	unsigned int		tx_offset;
+	volatile unsigned int	rx_dropped;
+};
+
+struct nf2_ring_frame {
+	unsigned int	len;
+	unsigned int	reserved;
+	unsigned char	data[NF2_RING_FRAME_SIZE - 8];
+};
+
 #endif
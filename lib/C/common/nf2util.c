@@ -36,6 +36,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -57,6 +58,11 @@ static int readRegFile(struct nf2device *nf2, unsigned reg, unsigned *val);
 static int writeRegNet(struct nf2device *nf2, unsigned reg, unsigned val);
 static int writeRegFile(struct nf2device *nf2, unsigned reg, unsigned val);
 static void readStr(struct nf2device *nf2, unsigned regStart, unsigned len, char *dst);
+static int accessRegs(struct nf2device *nf2, struct nf2reg *regs, unsigned num, int write);
+static int accessRegsLoop(struct nf2device *nf2, struct nf2reg *regs, unsigned num, int write);
+
+/* Set once a driver has rejected the multi register ioctls, indexed by net_iface */
+static int multiUnsupported[2];
 
 /*
  * readReg - read a register
@@ -205,6 +211,107 @@ static int writeRegFile(struct nf2device *nf2, unsigned reg, unsigned val)
 	}
 }
 
+/*
+ * readRegs - read a batch of registers, filling in regs[i].val
+ */
+int readRegs(struct nf2device *nf2, struct nf2reg *regs, unsigned num)
+{
+	return accessRegs(nf2, regs, num, 0);
+}
+
+/*
+ * writeRegs - write a batch of registers in array order
+ */
+int writeRegs(struct nf2device *nf2, struct nf2reg *regs, unsigned num)
+{
+	return accessRegs(nf2, regs, num, 1);
+}
+
+/*
+ * accessRegs - read or write a batch of registers with one ioctl per
+ * NF2_REG_MULTI_MAX registers, falling back to one ioctl per register
+ * on drivers that predate SIOCREGREADMULTI/SIOCREGWRITEMULTI
+ */
+static int accessRegs(struct nf2device *nf2, struct nf2reg *regs, unsigned num, int write)
+{
+        struct ifreq ifreq;
+	struct nf2reg_multi multi;
+	void *arg;
+	unsigned done;
+	int cmd = write ? SIOCREGWRITEMULTI : SIOCREGREADMULTI;
+	int net = nf2->net_iface ? 1 : 0;
+
+	if (multiUnsupported[net])
+	{
+		return accessRegsLoop(nf2, regs, num, write);
+	}
+
+	/* The net device takes the request through an ifreq */
+	if (net)
+	{
+		ifreq.ifr_data = (char *)&multi;
+		strncpy(ifreq.ifr_ifrn.ifrn_name, nf2->device_name, IFNAMSIZ);
+		arg = &ifreq;
+	}
+	else
+	{
+		arg = &multi;
+	}
+
+	for (done = 0; done < num; done += multi.num)
+	{
+		multi.num = num - done;
+		if (multi.num > NF2_REG_MULTI_MAX)
+		{
+			multi.num = NF2_REG_MULTI_MAX;
+		}
+		multi.pad = 0;
+		multi.regs = NF2_REGS_PTR(regs + done);
+
+		/* Call the ioctl */
+		if (ioctl(nf2->fd, cmd, arg) != 0)
+		{
+			if (errno == EOPNOTSUPP || errno == ENOTTY)
+			{
+				multiUnsupported[net] = 1;
+				return accessRegsLoop(nf2, regs + done, num - done, write);
+			}
+			perror("sendpacket: ioctl failed");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * accessRegsLoop - read or write a batch of registers one at a time
+ */
+static int accessRegsLoop(struct nf2device *nf2, struct nf2reg *regs, unsigned num, int write)
+{
+	unsigned i;
+
+	for (i = 0; i < num; i++)
+	{
+		if (write)
+		{
+			if (writeReg(nf2, regs[i].reg, regs[i].val))
+			{
+				return -1;
+			}
+		}
+		else
+		{
+			if (readReg(nf2, regs[i].reg, &regs[i].val))
+			{
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
 /*
  * Check the iface name to make sure we can find the interface
  */
@@ -53,13 +53,18 @@ struct nf2device {
 	int net_iface;
         char server_ip_addr[MAX_IPADDR_LEN];
         int server_port_num;
+        int proxy_version;	/* reg proxy protocol spoken, set by openDescriptor */
 };
 
 
+struct nf2reg;
+
 /* Function declarations */
 
 int readReg(struct nf2device *nf2, unsigned reg, unsigned *val);
 int writeReg(struct nf2device *nf2, unsigned reg, unsigned val);
+int readRegs(struct nf2device *nf2, struct nf2reg *regs, unsigned num);
+int writeRegs(struct nf2device *nf2, struct nf2reg *regs, unsigned num);
 int check_iface(struct nf2device *nf2);
 int openDescriptor(struct nf2device *nf2);
 int closeDescriptor(struct nf2device *nf2);
@@ -94,9 +94,22 @@
 /* Control card device number */
 static int devnum;
 
+/* Hand received skbs to the stack, directly when running from the poll */
+#ifdef NF2_NAPI
+#define nf2c_receive_skb(skb)	netif_receive_skb(skb)
+#else
+#define nf2c_receive_skb(skb)	netif_rx(skb)
+#endif
+
 /* Function declarations */
-static int nf2c_send(struct net_device *dev);
+static int nf2c_send(struct nf2_card_priv *card);
+static void nf2c_tx_stage(struct nf2_card_priv *card);
+static void nf2c_tx_unstage(struct nf2_card_priv *card);
+static void nf2c_tx_complete(struct nf2_card_priv *card, int sent);
+static void nf2c_tx_flush(struct nf2_card_priv *card);
 static void nf2c_rx(struct net_device *dev, struct nf2_packet *pkt);
+static int nf2c_rx_drain(struct nf2_card_priv *card, int budget);
+static void nf2c_rx_rearm(struct nf2_card_priv *card);
 static int nf2c_create_pool(struct nf2_card_priv *card);
 static void nf2c_destroy_pool(struct nf2_card_priv *card);
 static irqreturn_t nf2c_intr(int irq, void *dev_id
@@ -105,6 +118,7 @@ static irqreturn_t nf2c_intr(int irq, void *dev_id
 #endif
 			);
 
+static int nf2c_reg_multi(struct net_device *dev, void *arg, int write);
 static void nf2c_clear_dma_flags(struct nf2_card_priv *card);
 static void nf2c_check_link_status(struct nf2_card_priv *card,
 		struct net_device *dev, unsigned int ifnum);
@@ -140,10 +154,17 @@ static int nf2c_open(struct net_device *dev)
 	 */
 	if (!card->ifup) {
 		nf2_hw_reset(card);
+#ifdef NF2_NAPI
+		napi_enable(&card->napi);
+#endif
 		err = request_irq(card->pdev->irq, nf2c_intr, IRQF_SHARED,
 				card->ndev[0]->name, card->ndev[0]);
-		if (err)
+		if (err) {
+#ifdef NF2_NAPI
+			napi_disable(&card->napi);
+#endif
 			goto out;
+		}
 		nf2_enable_irq(card);
 	}
 
@@ -188,8 +209,8 @@ out:
  * Locking: state_lock - prevent the state variable and the corresponding
  *                       register from getting out of sync
  *
- *          no locking for txbuff variables as other functions that modify
- *          these variables will not execute concurrently if nf2c_release
+ *          no locking for the transmit queues as other functions that
+ *          modify them will not execute concurrently if nf2c_release
  *          has been called
  */
 static int nf2c_release(struct net_device *dev)
@@ -230,23 +251,17 @@ static int nf2c_release(struct net_device *dev)
 		/* No need to call nf2_disable_irq(card) as the reset will
 		 * disable the interrupts */
 
-		/* Free any skb's in the transmit queue */
-		if (card->free_txbuffs != tx_pool_size) {
-			if (atomic_read(&card->dma_tx_in_progress))
-				pci_unmap_single(card->pdev,
-					card->dma_tx_addr,
-					card->txbuff[card->rd_txbuff].skb->len,
-					PCI_DMA_TODEVICE);
-
-			while (card->free_txbuffs < tx_pool_size) {
-				dev_kfree_skb(
-					card->txbuff[card->rd_txbuff].skb);
-				card->rd_txbuff = (card->rd_txbuff + 1) %
-						  tx_pool_size;
-				card->free_txbuffs++;
-			}
-		}
-		atomic_set(&card->dma_tx_in_progress, 0);
+#ifdef NF2_NAPI
+		napi_disable(&card->napi);
+#endif
+		/* Drop anything the poll did not get to, the buffers stay
+		 * in the pool */
+		card->rd_pool = card->wr_pool;
+		atomic_set(&card->rx_pending, 0);
+		card->rx_stalled = 0;
+
+		/* Free any skb's in the transmit queues */
+		nf2c_tx_flush(card);
 		atomic_set(&card->dma_rx_in_progress, 0);
 	}
 
@@ -288,173 +303,393 @@ static int nf2c_config(struct net_device *dev, struct ifmap *map)
  * @skb:	socket buffer
  * @dev:	net device
  *
+ * Locking: none, each port has its own ring and the kernel serializes
+ *          calls for a device, nf2c_send is the only consumer
  */
 static int nf2c_tx(struct sk_buff *skb, struct net_device *dev)
 {
-	int err = 0;
-	unsigned long flags;
 	struct nf2_iface_priv *iface = netdev_priv(dev);
 	struct nf2_card_priv *card = iface->card;
+	struct nf2_txq *q = &card->txq[iface->iface];
+	struct txbuff *buff;
 
-	/* Aquire a spinlock for the buffs vbles */
-	spin_lock_irqsave(&card->txbuff_lock, flags);
-
-	if (card->free_txbuffs == 0) {
+	if (q->tail - q->head >= q->size) {
 		if (printk_ratelimit())
 			printk(KERN_ALERT "nf2: no available transmit/receive"
 					" buffers\n");
-		err = 1;
-	} else {
-		card->txbuff[card->wr_txbuff].skb = skb;
-		card->txbuff[card->wr_txbuff].iface = iface->iface;
-		card->wr_txbuff = (card->wr_txbuff + 1) % tx_pool_size;
-		card->free_txbuffs--;
-		card->free_txbuffs_port[iface->iface]--;
-
-		/* Stop the queue if the number of txbuffs drops to 0 */
-		if (card->free_txbuffs_port[iface->iface] == 0) {
-			PDEBUG(KERN_DFLT_DEBUG "nf2: stopping queue %d\n",
-					iface->iface);
-			netif_stop_queue(dev);
-		}
+		netif_stop_queue(dev);
+		return 1;
+	}
+
+	/* Pad the skb to be at least 60 bytes. Call the padding function
+	 * to ensure that there is no information leakage. Done here so
+	 * the interrupt handler only has to map the packet */
+	if (skb->len < 60 && skb_pad(skb, 60 - skb->len)) {
+		/* skb_pad freed the skb */
+		iface->stats.tx_dropped++;
+		return 0;
+	}
 
-		/* Attempt to send the actual packet */
-		nf2c_send(dev);
+	buff = &q->buffs[q->tail % q->size];
+	buff->skb = skb;
+	buff->iface = iface->iface;
 
-		/* save the timestamp */
-		dev->trans_start = jiffies;
+	/* Publish the slot before the tail that covers it */
+	smp_wmb();
+	q->tail++;
+
+	/* Stop the queue if the ring is full, nf2c_send wakes it */
+	if (q->tail - q->head >= q->size) {
+		PDEBUG(KERN_DFLT_DEBUG "nf2: stopping queue %d\n",
+				iface->iface);
+		netif_stop_queue(dev);
+
+		/* A slot may have been freed before the queue stopped */
+		smp_mb();
+		if (q->tail - q->head < q->size)
+			netif_wake_queue(dev);
 	}
 
-	/*err_unlock:*/
-	spin_unlock_irqrestore(&card->txbuff_lock, flags);
+	/* Attempt to send the actual packet */
+	nf2c_send(card);
 
-	return err;
+	/* save the timestamp */
+	dev->trans_start = jiffies;
+
+	return 0;
 }
 
 /**
- * nf2c_send - Send an actual packet
- * @dev:	net device
+ * nf2c_send - Start the next DMA transfer
+ * @card:	nf2 card private data
  *
- * Atomic variable dma_tx_lock is used to prevent multiple packets from
- * being sent simultaneously (the hardware can only transfer one at once)
+ * The hardware transfers one packet at a time so the next one is kept
+ * mapped in tx_next while the current transfer runs. When it completes
+ * the interrupt handler only has to write the DMA registers to start
+ * it, the one after is mapped before that write.
  *
- * Note: The txbuff lock is not used as an incorrect read of free_txbuffs is
- *       not fatal (this function will be called again).
+ * Atomic variable dma_tx_in_progress is used to prevent multiple packets
+ * from being sent simultaneously, whoever holds it is the only consumer
+ * of the transmit rings.
  */
-static int nf2c_send(struct net_device *dev)
+static int nf2c_send(struct nf2_card_priv *card)
 {
-	int err = 0;
-	int dma_len = 0;
-	/*unsigned long flags;*/
-	struct nf2_iface_priv *iface = netdev_priv(dev);
-	struct nf2_card_priv *card = iface->card;
-	struct sk_buff *skb;
-	unsigned int rd_iface;  /* iface of skb at front of Q*/
-
-	/* Aquire a spinlock for the dma variables */
-	/*spin_lock_irqsave(&card->dma_tx_lock, flags);*/
+	struct nf2_tx_dma *cur = &card->tx_cur;
+	struct nf2_tx_dma *next = &card->tx_next;
+	struct nf2_txq *q;
+	struct net_device *dev;
 
 	/* Check if a DMA transfer is in progress and record the fact that
 	 * we have started a transfer
 	 */
 	if (atomic_add_return(1, &card->dma_tx_in_progress) != 1) {
 		atomic_dec(&card->dma_tx_in_progress);
-		err = 1;
-		goto err_unlock;
+		return 1;
 	}
 
+	/* If the staged packet's port can no longer accept a packet let
+	 * the other ports go first rather than wait for it */
+	if (next->skb && (card->dma_can_wr_pkt & (1 << next->iface)) == 0)
+		nf2c_tx_unstage(card);
+	if (!next->skb)
+		nf2c_tx_stage(card);
+
 	/* Check if there's something to send */
-	if (card->free_txbuffs == tx_pool_size) {
+	if (!next->skb) {
 		atomic_dec(&card->dma_tx_in_progress);
-		err = 1;
-		goto err_unlock;
+		return 1;
 	}
 
-	/* Get the interface number of the skb we are sending. */
-	rd_iface = card->txbuff[card->rd_txbuff].iface;
+	*cur = *next;
+	next->skb = NULL;
+	card->tx_last_iface = cur->iface;
 
-	/* Verify that the TX queue can accept a packet */
-	if ((card->dma_can_wr_pkt & (1 << rd_iface)) == 0) {
-		atomic_dec(&card->dma_tx_in_progress);
-		err = 1;
-		goto err_unlock;
-	}
+	/* The packet has left the ring, wake the port if it was full */
+	q = &card->txq[cur->iface];
+	q->head++;
+	smp_mb();
+	dev = card->ndev[cur->iface];
+	if (netif_queue_stopped(dev) && q->tail - q->head < q->size)
+		netif_wake_queue(dev);
 
-	/* Grab the skb */
-	skb = card->txbuff[card->rd_txbuff].skb;
+	/* Map the following packet now, once the transfer is started the
+	 * completion interrupt may run nf2c_send again at any time */
+	nf2c_tx_stage(card);
 
-	/* Map the buffer into DMA space */
-	card->dma_tx_addr = pci_map_single(card->pdev,
-			skb->data, skb->len, PCI_DMA_TODEVICE);
+	PDEBUG(KERN_DFLT_DEBUG "nf2: sending DMA pkt to iface: %d\n",
+			cur->iface);
 
 	/* Start the transfer */
-	iowrite32(card->dma_tx_addr,
+	iowrite32(cur->dma_addr,
 			card->ioaddr + CPCI_REG_DMA_E_ADDR);
+	iowrite32(cur->len,
+			card->ioaddr + CPCI_REG_DMA_E_SIZE);
+	iowrite32(NF2_SET_DMA_CTRL_MAC(cur->iface) | DMA_CTRL_OWNER,
+			card->ioaddr + CPCI_REG_DMA_E_CTRL);
 
-	/* Pad the skb to be at least 60 bytes. Call the padding function
-	 * to ensure that there is no information leakage */
-	if (skb->len < 60) {
-		skb_pad(skb, 60 - skb->len);
-		dma_len = 60;
+	return 0;
+}
+
+/**
+ * nf2c_tx_stage - Map the next packet to send into tx_next
+ * @card:	nf2 card private data
+ *
+ * Ports are served round robin starting after the last one sent on,
+ * skipping ports whose hardware queue is full (dma_can_wr_pkt) so that
+ * one congested port does not hold up the others. The packet stays at
+ * the head of its ring until nf2c_send starts it.
+ */
+static void nf2c_tx_stage(struct nf2_card_priv *card)
+{
+	struct nf2_tx_dma *next = &card->tx_next;
+	struct nf2_txq *q;
+	struct sk_buff *skb;
+	unsigned int i, ifnum;
+
+	for (i = 1; i <= MAX_IFACE; i++) {
+		ifnum = (card->tx_last_iface + i) % MAX_IFACE;
+		q = &card->txq[ifnum];
+		if (q->head == q->tail ||
+		    (card->dma_can_wr_pkt & (1 << ifnum)) == 0)
+			continue;
+
+		/* Read the slot only after seeing the tail that covers it */
+		smp_rmb();
+		skb = q->buffs[q->head % q->size].skb;
+
+		next->skb = skb;
+		next->iface = ifnum;
+		next->len = max_t(u32, skb->len, 60);
+		next->dma_addr = pci_map_single(card->pdev,
+				skb->data, next->len, PCI_DMA_TODEVICE);
+		return;
+	}
+}
+
+/**
+ * nf2c_tx_unstage - Drop the mapping of the staged packet
+ * @card:	nf2 card private data
+ *
+ * The packet is still at the head of its ring and will be staged again.
+ */
+static void nf2c_tx_unstage(struct nf2_card_priv *card)
+{
+	struct nf2_tx_dma *next = &card->tx_next;
+
+	if (!next->skb)
+		return;
+
+	pci_unmap_single(card->pdev, next->dma_addr, next->len,
+			PCI_DMA_TODEVICE);
+	next->skb = NULL;
+}
+
+/**
+ * nf2c_tx_complete - Finish the transfer in progress
+ * @card:	nf2 card private data
+ * @sent:	the packet went out, otherwise it is counted as dropped
+ *
+ */
+static void nf2c_tx_complete(struct nf2_card_priv *card, int sent)
+{
+	struct nf2_tx_dma *cur = &card->tx_cur;
+	struct nf2_iface_priv *tx_iface = netdev_priv(card->ndev[cur->iface]);
+
+	pci_unmap_single(card->pdev, cur->dma_addr, cur->len,
+			PCI_DMA_TODEVICE);
+
+	/* Update the statistics */
+	if (sent) {
+		tx_iface->stats.tx_packets++;
+		tx_iface->stats.tx_bytes += cur->skb->len;
 	} else {
-		dma_len = skb->len;
+		tx_iface->stats.tx_dropped++;
 	}
-	iowrite32(dma_len,
-			card->ioaddr + CPCI_REG_DMA_E_SIZE);
 
-	iowrite32(NF2_SET_DMA_CTRL_MAC(rd_iface) | DMA_CTRL_OWNER,
-			card->ioaddr + CPCI_REG_DMA_E_CTRL);
+	/* Free the skb */
+	dev_kfree_skb_irq(cur->skb);
+	cur->skb = NULL;
 
-	PDEBUG(KERN_DFLT_DEBUG "nf2: sending DMA pkt to iface: %d\n",
-			rd_iface);
+	atomic_dec(&card->dma_tx_in_progress);
+}
 
-err_unlock:
-	/*spin_unlock_irqrestore(&priv->card->dma_tx_lock, flags);*/
+/**
+ * nf2c_tx_flush - Drop every packet waiting to be sent
+ * @card:	nf2 card private data
+ *
+ * Only call with the interrupt handler detached.
+ */
+static void nf2c_tx_flush(struct nf2_card_priv *card)
+{
+	struct nf2_txq *q;
+	int i;
 
-	return err;
+	if (card->tx_cur.skb)
+		nf2c_tx_complete(card, 0);
+	nf2c_tx_unstage(card);
+
+	for (i = 0; i < MAX_IFACE; i++) {
+		q = &card->txq[i];
+		while (q->head != q->tail) {
+			dev_kfree_skb(q->buffs[q->head % q->size].skb);
+			q->head++;
+		}
+	}
+
+	atomic_set(&card->dma_tx_in_progress, 0);
 }
 
 /**
  * nf2c_rx - Receive a packet: retrieve, encapsulate,pass over to upper levels
  * @dev:	net device
- * @pkt:	nf2 packet
+ * @pkt:	nf2 packet, the data is in pkt->skb
  *
- * Note: This is called from the interrupt handler. netif_rx schedules
- * the skb to be delivered to the kernel later (ie. bottom-half delivery).
+ * Short packets are copied into a new skb and the receive buffer is
+ * recycled in place. Longer ones are handed up in the buffer they were
+ * DMAed into and the pool gets a fresh skb, if none can be allocated the
+ * packet is dropped and the buffer recycled.
  */
 static void nf2c_rx(struct net_device *dev, struct nf2_packet *pkt)
 {
 	struct sk_buff *skb;
 	struct nf2_iface_priv *iface = netdev_priv(dev);
+	struct nf2_card_priv *card = iface->card;
+
+	if (pkt->len < rx_copybreak) {
+		skb = dev_alloc_skb(pkt->len + 2);
+		if (skb) {
+			skb_reserve(skb, 2); /* align IP on 16B boundary */
+			memcpy(skb_put(skb, pkt->len), pkt->skb->data,
+					pkt->len);
+			card->rx_stats.copybreak++;
+			card->rx_stats.recycled++;
+		}
+	} else {
+		skb = pkt->skb;
+		pkt->skb = dev_alloc_skb(MAX_DMA_LEN);
+		if (pkt->skb) {
+			skb_put(skb, pkt->len);
+		} else {
+			pkt->skb = skb;
+			skb = NULL;
+			card->rx_stats.recycled++;
+		}
+	}
 
-	/*
-	 * The packet has been retrieved from the transmission
-	 * medium. Build an skb around it, so upper layers can handle it
-	 */
-	skb = dev_alloc_skb(pkt->len + 2);
 	if (!skb) {
 		if (printk_ratelimit())
 			printk(KERN_NOTICE "nf2 rx: low on mem - packet"
 					" dropped\n");
 		iface->stats.rx_dropped++;
+		card->rx_stats.alloc_failed++;
 		goto out;
 	}
 
-	skb_reserve(skb, 2); /* align IP on 16B boundary */
-	memcpy(skb_put(skb, pkt->len), pkt->data, pkt->len);
-
 	/* Write metadata, and then pass to the receive level */
 	skb->dev = dev;
 	skb->protocol = eth_type_trans(skb, dev);
 	skb->ip_summed = CHECKSUM_NONE; /* Check the checksum */
 	iface->stats.rx_packets++;
 	iface->stats.rx_bytes += pkt->len;
-	netif_rx(skb);
+	nf2c_receive_skb(skb);
 
 out:
 	return;
 }
 
+/**
+ * nf2c_rx_drain - Hand received packets to the stack
+ * @card:	nf2 card private data
+ * @budget:	maximum number of packets to hand up
+ *
+ * Buffers between rd_pool and the one being DMAed into have been filled
+ * by the interrupt handler, each one handed up goes back to it.
+ *
+ * Returns: the number of packets handed up
+ */
+static int nf2c_rx_drain(struct nf2_card_priv *card, int budget)
+{
+	struct nf2_packet *pkt;
+	int done = 0;
+
+	while (done < budget && atomic_read(&card->rx_pending)) {
+		/* Read the packet only after seeing it counted */
+		smp_rmb();
+
+		pkt = card->rd_pool;
+		nf2c_rx(pkt->dev, pkt);
+		card->rd_pool = pkt->next;
+
+		/* The interrupt handler may DMA into the buffer now */
+		smp_wmb();
+		atomic_dec(&card->rx_pending);
+		done++;
+	}
+
+	return done;
+}
+
+/**
+ * nf2c_rx_rearm - Unmask PKT_AVAIL once a stalled pool has room again
+ * @card:	nf2 card private data
+ *
+ * Locking: intr_lock - the interrupt handler rewrites the mask on exit
+ */
+static void nf2c_rx_rearm(struct nf2_card_priv *card)
+{
+	unsigned long flags;
+	u32 int_mask;
+
+	spin_lock_irqsave(&card->intr_lock, flags);
+	if (card->rx_stalled &&
+	    atomic_read(&card->rx_pending) < rx_pool_size) {
+		card->rx_stalled = 0;
+		int_mask = ioread32(card->ioaddr + CPCI_REG_INTERRUPT_MASK);
+		int_mask &= ~INT_PKT_AVAIL;
+		iowrite32(int_mask, card->ioaddr + CPCI_REG_INTERRUPT_MASK);
+		card->rx_stats.irq_rearms++;
+	}
+	spin_unlock_irqrestore(&card->intr_lock, flags);
+}
+
+#ifdef NF2_NAPI
+/**
+ * nf2c_poll - NAPI poll, hands up packets received by the interrupt handler
+ * @napi:	the card's napi_struct
+ * @budget:	maximum number of packets to hand up
+ *
+ * The interrupt handler only moves packets into the pool and schedules
+ * this poll, so under load many packets go up per softirq. Once the pool
+ * is drained the poll completes and receive interrupts are rearmed.
+ */
+static int nf2c_poll(struct napi_struct *napi, int budget)
+{
+	struct nf2_card_priv *card =
+		container_of(napi, struct nf2_card_priv, napi);
+	int done;
+
+	done = nf2c_rx_drain(card, min(budget, card->rx_budget));
+	card->rx_stats.polls++;
+	card->rx_stats.poll_packets += done;
+
+	/* Stay in polled mode while there is a backlog */
+	if (done >= budget || atomic_read(&card->rx_pending)) {
+		card->rx_stats.budget_exhausted++;
+		nf2c_rx_rearm(card);
+		return budget;
+	}
+
+	napi_complete(napi);
+	nf2c_rx_rearm(card);
+
+	/* Catch a packet that arrived before napi_complete */
+	if (atomic_read(&card->rx_pending))
+		napi_schedule(napi);
+
+	return done;
+}
+#endif
+
 /**
  * nf2c_clear_dma_flags - Clear the DMA flags
  * @card: nf2 card private data
@@ -463,9 +698,6 @@ out:
  */
 static void nf2c_clear_dma_flags(struct nf2_card_priv *card)
 {
-	unsigned long flags;
-	unsigned int ifnum;
-
 	PDEBUG(KERN_DFLT_DEBUG "nf2: clearing dma flags\n");
 
 	/* Clear the dma_rx_in_progress flag */
@@ -479,33 +711,8 @@ static void nf2c_clear_dma_flags(struct nf2_card_priv *card)
 
 	/* Clear the dma_tx_in_progress flag
 	 * Note: also frees the skb */
-	if (atomic_read(&card->dma_tx_in_progress)) {
-		pci_unmap_single(card->pdev, card->dma_tx_addr,
-				card->txbuff[card->rd_txbuff].skb->len,
-				PCI_DMA_TODEVICE);
-
-		/* Aquire a spinlock for the buffs vbles */
-		spin_lock_irqsave(&card->txbuff_lock, flags);
-
-		/* Free the skb */
-		dev_kfree_skb_irq(card->txbuff[card->rd_txbuff].skb);
-
-		/* Note: make sure that txbuffs is incremented before
-		 * dma_tx_in_progress is decremented due to the lack of
-		 * locking in nf2c_send()
-		 */
-		ifnum = card->txbuff[card->rd_txbuff].iface;
-		card->rd_txbuff = (card->rd_txbuff + 1) % tx_pool_size;
-		card->free_txbuffs++;
-		card->free_txbuffs_port[ifnum]++;
-		atomic_dec(&card->dma_tx_in_progress);
-
-		/* Re-enable the queues if necessary */
-		if (card->free_txbuffs_port[ifnum] == 1)
-			netif_wake_queue(card->ndev[ifnum]);
-
-		spin_unlock_irqrestore(&card->txbuff_lock, flags);
-	}
+	if (card->tx_cur.skb)
+		nf2c_tx_complete(card, 0);
 }
 
 /**
@@ -558,6 +765,13 @@ static int nf2c_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
 			nf2k_reg_write(dev, reg.reg, &(reg.val));
 			return 0;
 
+			/* Read/write a batch of registers */
+	case SIOCREGREADMULTI:
+			return nf2c_reg_multi(dev, rq->ifr_data, 0);
+
+	case SIOCREGWRITEMULTI:
+			return nf2c_reg_multi(dev, rq->ifr_data, 1);
+
 			/* Read address of MII PHY in use */
 	case SIOCGMIIPHY:
 			phy_id_lo = ioread32(card->ioaddr +
@@ -586,6 +800,68 @@ static int nf2c_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
 	return -EOPNOTSUPP;
 }
 
+/**
+ * nf2c_reg_multi - Handle a batch of register reads or writes
+ * @dev:	net device
+ * @arg:	user space struct nf2reg_multi
+ * @write:	write the registers if non-zero, otherwise read them
+ *
+ * Registers are accessed in array order, a batch stops at the first
+ * register that is out of bounds.
+ */
+static int nf2c_reg_multi(struct net_device *dev, void *arg, int write)
+{
+	struct nf2reg_multi multi;
+	struct nf2reg *regs;
+	void __user *uregs;
+	size_t len;
+	unsigned int i;
+	int err = 0;
+
+	if (copy_from_user(&multi, arg, sizeof(struct nf2reg_multi))) {
+		printk(KERN_ERR "nf2: Unable to copy data from user space\n");
+		return -EFAULT;
+	}
+	uregs = (void __user *)(unsigned long)multi.regs;
+
+	if (multi.num == 0)
+		return 0;
+	if (multi.num > NF2_REG_MULTI_MAX)
+		return -EINVAL;
+
+	len = multi.num * sizeof(struct nf2reg);
+	regs = kmalloc(len, GFP_KERNEL);
+	if (!regs)
+		return -ENOMEM;
+
+	if (copy_from_user(regs, uregs, len)) {
+		printk(KERN_ERR "nf2: Unable to copy data from user space\n");
+		err = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < multi.num; i++) {
+		if (write)
+			err = nf2k_reg_write(dev, regs[i].reg, &(regs[i].val));
+		else
+			err = nf2k_reg_read(dev, regs[i].reg, &(regs[i].val));
+
+		if (err) {
+			err = -EINVAL;
+			goto out;
+		}
+	}
+
+	if (!write && copy_to_user(uregs, regs, len)) {
+		printk(KERN_ERR "nf2: Unable to copy data to user space\n");
+		err = -EFAULT;
+	}
+
+out:
+	kfree(regs);
+	return err;
+}
+
 /**
  * nf2k_reg_read - handle register reads
  * @dev:	net device
@@ -725,8 +1001,7 @@ static void nf2c_tx_timeout(struct net_device *dev)
 	nf2c_clear_dma_flags(card);
 
 	/* Call the send function if there's packets to send */
-	if (card->free_txbuffs != tx_pool_size)
-		nf2c_send(dev);
+	nf2c_send(card);
 
 	/* Wake the stalled queue */
 	netif_wake_queue(dev);
@@ -751,9 +1026,6 @@ static irqreturn_t nf2c_intr(int irq, void *dev_id
 	struct net_device *netdev = dev_id;
 	struct nf2_iface_priv *iface = netdev_priv(netdev);
 	struct nf2_card_priv *card = iface->card;
-	struct nf2_iface_priv *tx_iface;
-	unsigned long flags;
-	unsigned int ifnum;
 	u32 err;
 	u32 ctrl;
 	u32 status;
@@ -765,6 +1037,8 @@ static irqreturn_t nf2c_intr(int irq, void *dev_id
 	unsigned int phy_intr_status;
 	int i;
 
+	spin_lock(&card->intr_lock);
+
 	/* get the interrupt mask */
 	int_mask = ioread32(card->ioaddr + CPCI_REG_INTERRUPT_MASK);
 
@@ -801,17 +1075,14 @@ static irqreturn_t nf2c_intr(int irq, void *dev_id
 
 			/* Call the send function if there are other
 			 * packets to send */
-			if (atomic_add_return(1, &card->dma_rx_in_progress) == 1) {
-				if (card->free_txbuffs != tx_pool_size)
-					nf2c_send(netdev);
-			}
+			if (atomic_add_return(1, &card->dma_rx_in_progress) == 1)
+				nf2c_send(card);
 			atomic_dec(&card->dma_rx_in_progress);
 		}
 
 		/* Handle packet RX complete
-		 * Note: don't care about the rx pool here as the packet is
-		 * copied to an skb immediately so there is no need to have
-		 * multiple packets in the rx pool
+		 * Note: the packet is only queued in the rx pool here, it
+		 * is handed to the stack by nf2c_rx_drain
 		 */
 		if (status & INT_DMA_RX_COMPLETE) {
 			PDEBUG(KERN_DFLT_DEBUG "nf2: intr: "
@@ -826,13 +1097,27 @@ static irqreturn_t nf2c_intr(int irq, void *dev_id
 
 			ctrl = ioread32(card->ioaddr + CPCI_REG_DMA_I_CTRL);
 			card->wr_pool->dev = card->ndev[(ctrl & 0x300) >> 8];
+			card->wr_pool = card->wr_pool->next;
 
+			/* Publish the packet before counting it */
+			smp_wmb();
+			atomic_inc(&card->rx_pending);
 			atomic_dec(&card->dma_rx_in_progress);
 
-			nf2c_rx(card->wr_pool->dev, card->wr_pool);
+#ifdef NF2_NAPI
+			napi_schedule(&card->napi);
+#else
+			nf2c_rx_drain(card, rx_pool_size);
+#endif
 
-			/* reenable PKT_AVAIL interrupts */
-			int_mask &= ~INT_PKT_AVAIL;
+			/* reenable PKT_AVAIL interrupts if there is a free
+			 * buffer, otherwise the poll does once it drained */
+			if (atomic_read(&card->rx_pending) < rx_pool_size) {
+				int_mask &= ~INT_PKT_AVAIL;
+			} else if (!card->rx_stalled) {
+				card->rx_stalled = 1;
+				card->rx_stats.stalls++;
+			}
 		}
 
 		/* Handle packet TX complete */
@@ -841,49 +1126,11 @@ static irqreturn_t nf2c_intr(int irq, void *dev_id
 					"INT_DMA_TX_COMPLETE\n");
 
 			/* make sure there is a tx dma in progress */
-			if (atomic_read(&card->dma_tx_in_progress)) {
-				pci_unmap_single(card->pdev, card->dma_tx_addr,
-					card->txbuff[card->rd_txbuff].skb->len,
-					PCI_DMA_TODEVICE);
-
-				/* Establish which iface we were sending the
-				 * packet on */
-				ifnum = card->txbuff[card->rd_txbuff].iface;
-				tx_iface = netdev_priv(card->ndev[ifnum]);
-
-				/* Update the statistics */
-				tx_iface->stats.tx_packets++;
-				tx_iface->stats.tx_bytes +=
-					card->txbuff[card->rd_txbuff].skb->len;
-
-				/* Free the skb */
-				dev_kfree_skb_irq(
-					card->txbuff[card->rd_txbuff].skb);
-
-				/* Aquire a spinlock for the buffs vbles */
-				spin_lock_irqsave(&card->txbuff_lock, flags);
-
-				/* Note: make sure that txbuffs is incremented
-				 * before dma_tx_in_progress is decremented due
-				 * to the lack of locking in nf2c_send()
-				 */
-				card->rd_txbuff = (card->rd_txbuff + 1) %
-						  tx_pool_size;
-				card->free_txbuffs++;
-				card->free_txbuffs_port[ifnum]++;
-				atomic_dec(&card->dma_tx_in_progress);
-
-				/* Re-enable the queues if necessary */
-				if (card->free_txbuffs_port[ifnum] == 1)
-					netif_wake_queue(card->ndev[ifnum]);
-
-				spin_unlock_irqrestore(&card->txbuff_lock,
-						flags);
-
-				/* Call the send function if there are other
-				 * packets to send */
-				if (card->free_txbuffs != tx_pool_size)
-					nf2c_send(netdev);
+			if (card->tx_cur.skb) {
+				nf2c_tx_complete(card, 1);
+
+				/* Start the staged packet, if any */
+				nf2c_send(card);
 			}
 		}
 
@@ -921,13 +1168,19 @@ static irqreturn_t nf2c_intr(int irq, void *dev_id
 		if (status & INT_PKT_AVAIL) {
 			PDEBUG(KERN_DFLT_DEBUG "nf2: intr: INT_PKT_AVAIL\n");
 
-			if (atomic_add_return(1, &card->dma_rx_in_progress)
-					== 1) {
+			if (atomic_read(&card->rx_pending) >= rx_pool_size) {
+				/* Every buffer is waiting for the poll */
+				if (!card->rx_stalled) {
+					card->rx_stalled = 1;
+					card->rx_stats.stalls++;
+				}
+			} else if (atomic_add_return(1,
+					&card->dma_rx_in_progress) == 1) {
 				PDEBUG(KERN_DFLT_DEBUG "nf2: dma_rx_in_progress"
 					" is %d\n",
 					atomic_read(&card->dma_rx_in_progress));
 				card->dma_rx_addr = pci_map_single(card->pdev,
-						card->wr_pool->data,
+						card->wr_pool->skb->data,
 						MAX_DMA_LEN,
 						PCI_DMA_FROMDEVICE);
 				/* Start the transfer */
@@ -998,8 +1251,7 @@ static irqreturn_t nf2c_intr(int irq, void *dev_id
 			nf2c_clear_dma_flags(card);
 
 			/* Call the send function if there's packets to send */
-			if (card->free_txbuffs != tx_pool_size)
-				nf2c_send(netdev);
+			nf2c_send(card);
 		}
 
 		/* DMA setup error */
@@ -1041,8 +1293,7 @@ static irqreturn_t nf2c_intr(int irq, void *dev_id
 			nf2c_clear_dma_flags(card);
 
 			/* Call the send function if there's packets to send */
-			if (card->free_txbuffs != tx_pool_size)
-				nf2c_send(netdev);
+			nf2c_send(card);
 		}
 
 		/* DMA fatal error */
@@ -1055,8 +1306,7 @@ static irqreturn_t nf2c_intr(int irq, void *dev_id
 			nf2c_clear_dma_flags(card);
 
 			/* Call the send function if there's packets to send */
-			if (card->free_txbuffs != tx_pool_size)
-				nf2c_send(netdev);
+			nf2c_send(card);
 		}
 
 		/* Check for unknown errors */
@@ -1073,6 +1323,8 @@ static irqreturn_t nf2c_intr(int irq, void *dev_id
 	/* Rewrite the interrupt mask including any changes */
 	iowrite32(int_mask, card->ioaddr + CPCI_REG_INTERRUPT_MASK);
 
+	spin_unlock(&card->intr_lock);
+
 	if (status)
 		return IRQ_HANDLED;
 	else
@@ -1157,22 +1409,45 @@ static void nf2c_init(struct net_device *dev)
  * nf2c_create_pool - Create the pool of buffers for DMA transfers
  * @card:	nf2 card private data
  *
- * Only one is used by the control card
+ * Packets are DMAed straight into the skbs, which are handed up and
+ * replaced or recycled by nf2c_rx.
+ *
+ * Note: the skb data is not offset to align the IP header as DMA
+ * transfers must start on a word boundary
  */
 static int nf2c_create_pool(struct nf2_card_priv *card)
 {
-	card->ppool = kmalloc(sizeof(struct nf2_packet), GFP_KERNEL);
-	if (card->ppool == NULL) {
-		printk(KERN_NOTICE "nf2: Out of memory while allocating "
-				"packet pool\n");
-		return -ENOMEM;
+	struct nf2_packet *pkt;
+	int i;
+
+	for (i = 0; i < rx_pool_size; i++) {
+		pkt = kmalloc(offsetof(struct nf2_packet, data), GFP_KERNEL);
+		if (pkt == NULL)
+			goto err_nomem;
+		pkt->dev = NULL;
+		pkt->skb = dev_alloc_skb(MAX_DMA_LEN);
+		if (pkt->skb == NULL) {
+			kfree(pkt);
+			goto err_nomem;
+		}
+		if (i == 0) {
+			pkt->next = pkt;
+			card->ppool = pkt;
+		} else {
+			pkt->next = card->ppool->next;
+			card->ppool->next = pkt;
+		}
 	}
-	card->ppool->dev = NULL;
-	card->ppool->next = card->ppool;
 
 	card->rd_pool = card->wr_pool = card->ppool;
 
 	return 0;
+
+err_nomem:
+	printk(KERN_NOTICE "nf2: Out of memory while allocating "
+			"packet pool\n");
+	nf2c_destroy_pool(card);
+	return -ENOMEM;
 }
 
 /**
@@ -1182,7 +1457,21 @@ static int nf2c_create_pool(struct nf2_card_priv *card)
  */
 static void nf2c_destroy_pool(struct nf2_card_priv *card)
 {
-	kfree(card->ppool);
+	struct nf2_packet *pkt, *next;
+
+	if (card->ppool == NULL)
+		return;
+
+	pkt = card->ppool->next;
+	card->ppool->next = NULL;
+	while (pkt != NULL) {
+		next = pkt->next;
+		dev_kfree_skb(pkt->skb);
+		kfree(pkt);
+		pkt = next;
+	}
+
+	card->rd_pool = card->wr_pool = card->ppool = NULL;
 }
 
 /**
@@ -1204,6 +1493,7 @@ int nf2c_probe(struct pci_dev *pdev, const struct pci_device_id *id,
 
 	int i;
 	int result;
+	int per_port;
 
 	int err;
 
@@ -1216,9 +1506,10 @@ int nf2c_probe(struct pci_dev *pdev, const struct pci_device_id *id,
 		goto err_out_free_none;
 	}
 
-	/* Create the tx pool */
+	/* Create the tx pool, split evenly between the ports */
 	PDEBUG(KERN_DFLT_DEBUG "nf2: kmallocing memory for tx buffers\n");
-	card->txbuff = kmalloc(sizeof(struct txbuff) * tx_pool_size,
+	per_port = max(tx_pool_size / MAX_IFACE, 1);
+	card->txbuff = kmalloc(sizeof(struct txbuff) * per_port * MAX_IFACE,
 			GFP_KERNEL);
 	if (card->txbuff == NULL) {
 		printk(KERN_ERR "nf2: Could not allocate nf2 user card "
@@ -1226,9 +1517,13 @@ int nf2c_probe(struct pci_dev *pdev, const struct pci_device_id *id,
 		ret = -ENOMEM;
 		goto err_out_free_rx_pool;
 	}
-	card->free_txbuffs = tx_pool_size;
-	for (i = 0; i < MAX_IFACE; i++)
-		card->free_txbuffs_port[i] = tx_pool_size / MAX_IFACE;
+	for (i = 0; i < MAX_IFACE; i++) {
+		card->txq[i].buffs = card->txbuff + i * per_port;
+		card->txq[i].size = per_port;
+		card->txq[i].head = card->txq[i].tail = 0;
+	}
+
+	card->rx_budget = NF2_NAPI_WEIGHT;
 
 	/* Set up the network device... */
 	for (i = 0; i < MAX_IFACE; i++) {
@@ -1258,6 +1553,14 @@ int nf2c_probe(struct pci_dev *pdev, const struct pci_device_id *id,
 		/* call the ethtool ops */
 		nf2_set_ethtool_ops(netdev);
 
+#ifdef NF2_NAPI
+		/* The card has a single receive DMA engine, poll it from
+		 * the device the interrupt is attached to */
+		if (i == 0)
+			netif_napi_add(netdev, &card->napi, nf2c_poll,
+					NF2_NAPI_WEIGHT);
+#endif
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0)
                 SET_NETDEV_DEV(netdev, &(pdev->dev));
 #endif
@@ -1308,7 +1611,15 @@ void nf2c_remove(struct pci_dev *pdev, struct nf2_card_priv *card)
 {
 	int i;
 
+	/* Free any skb's in the transmit queues, the stats they update
+	 * live in the net devices */
+	nf2c_tx_flush(card);
+
 	/* Release the ethernet data structures */
+#ifdef NF2_NAPI
+	if (card->ndev[0])
+		netif_napi_del(&card->napi);
+#endif
 	for (i = 0; i < MAX_IFACE; i++) {
 		if (card->ndev[i]) {
 			unregister_netdev(card->ndev[i]);
@@ -1316,15 +1627,6 @@ void nf2c_remove(struct pci_dev *pdev, struct nf2_card_priv *card)
 		}
 	}
 
-	/* Free any skb's in the transmit queue */
-	if (card->free_txbuffs != tx_pool_size) {
-		while (card->free_txbuffs < tx_pool_size) {
-			dev_kfree_skb(card->txbuff[card->rd_txbuff].skb);
-			card->rd_txbuff = (card->rd_txbuff + 1) % tx_pool_size;
-			card->free_txbuffs++;
-		}
-	}
-
 	/* Destroy the txbuffs */
 	if (card->txbuff != NULL)
 		kfree(card->txbuff);
@@ -43,6 +43,22 @@
 #include <linux/netdevice.h>
 #include <linux/ethtool.h>
 
+#include "../common/nf2.h"
+#include "nf2kernel.h"
+
+/* Names of the nf2_rx_stats counters, in structure order */
+static const char nf2_rx_stats_strings[][ETH_GSTRING_LEN] = {
+	"rxq0_polls",
+	"rxq0_poll_packets",
+	"rxq0_budget_exhausted",
+	"rxq0_stalls",
+	"rxq0_irq_rearms",
+	"rxq0_copybreak",
+	"rxq0_recycled",
+	"rxq0_alloc_failed",
+};
+#define NF2_RX_STATS_LEN	ARRAY_SIZE(nf2_rx_stats_strings)
+
 /**
  * nf2_get_settings - get settings for ethtool
  * @dev:	net_device pointer
@@ -91,12 +107,112 @@ static int nf2_phys_id(struct net_device *dev, __u32 data)
 	return 0;
 }
 
+/**
+ * nf2_get_coalesce - report receive interrupt mitigation settings
+ * @dev:	net_device pointer
+ * @ec:		coalescing parameters
+ *
+ * rx-frames is the most packets handed up per poll, rx-frames-irq the
+ * number of buffered packets after which PKT_AVAIL stays masked until
+ * the poll catches up (the rx_pool_size module parameter).
+ */
+static int nf2_get_coalesce(struct net_device *dev,
+		struct ethtool_coalesce *ec)
+{
+	struct nf2_iface_priv *iface = netdev_priv(dev);
+
+	ec->rx_max_coalesced_frames = iface->card->rx_budget;
+	ec->rx_max_coalesced_frames_irq = rx_pool_size;
+
+	return 0;
+}
+
+/**
+ * nf2_set_coalesce - change the receive poll budget
+ * @dev:	net_device pointer
+ * @ec:		coalescing parameters
+ *
+ * The budget is shared by all the ports of a card. Only rx-frames can
+ * be changed, the pool size is fixed at load time.
+ */
+static int nf2_set_coalesce(struct net_device *dev,
+		struct ethtool_coalesce *ec)
+{
+	struct nf2_iface_priv *iface = netdev_priv(dev);
+
+	if (ec->rx_max_coalesced_frames < 1 ||
+	    ec->rx_max_coalesced_frames > NF2_NAPI_WEIGHT)
+		return -EINVAL;
+	if (ec->rx_max_coalesced_frames_irq != rx_pool_size)
+		return -EINVAL;
+
+	iface->card->rx_budget = ec->rx_max_coalesced_frames;
+
+	return 0;
+}
+
+static void nf2_get_strings(struct net_device *dev, u32 stringset, u8 *data)
+{
+	if (stringset == ETH_SS_STATS)
+		memcpy(data, nf2_rx_stats_strings,
+				sizeof(nf2_rx_stats_strings));
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 24)
+static int nf2_get_sset_count(struct net_device *dev, int sset)
+{
+	if (sset == ETH_SS_STATS)
+		return NF2_RX_STATS_LEN;
+	return -EOPNOTSUPP;
+}
+#else
+static int nf2_get_stats_count(struct net_device *dev)
+{
+	return NF2_RX_STATS_LEN;
+}
+#endif
+
+/**
+ * nf2_get_ethtool_stats - report the receive poll statistics
+ * @dev:	net_device pointer
+ * @stats:	ethtool stats request
+ * @data:	one value per nf2_rx_stats_strings entry
+ *
+ * The card has a single receive queue so every port reports the same
+ * values.
+ */
+static void nf2_get_ethtool_stats(struct net_device *dev,
+		struct ethtool_stats *stats, u64 *data)
+{
+	struct nf2_iface_priv *iface = netdev_priv(dev);
+	struct nf2_rx_stats *rx = &iface->card->rx_stats;
+	int i = 0;
+
+	data[i++] = rx->polls;
+	data[i++] = rx->poll_packets;
+	data[i++] = rx->budget_exhausted;
+	data[i++] = rx->stalls;
+	data[i++] = rx->irq_rearms;
+	data[i++] = rx->copybreak;
+	data[i++] = rx->recycled;
+	data[i++] = rx->alloc_failed;
+}
+
 static const struct ethtool_ops nf2_ethtool_ops = {
 	.get_settings		= nf2_get_settings,
 	.set_settings		= nf2_set_settings,
 	.get_drvinfo		= nf2_get_drvinfo,
 	.get_link		= ethtool_op_get_link,
 	.phys_id		= nf2_phys_id,
+	.get_coalesce		= nf2_get_coalesce,
+	.set_coalesce		= nf2_set_coalesce,
+	.get_strings		= nf2_get_strings,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 24)
+	.get_sset_count		= nf2_get_sset_count,
+#else
+	.get_stats_count	= nf2_get_stats_count,
+#endif
+	.get_ethtool_stats	= nf2_get_ethtool_stats,
 };
 
 void nf2_set_ethtool_ops(struct net_device *dev)
@@ -48,6 +48,10 @@
 
 #include <linux/cdev.h>
 #include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/compat.h>
+#include <linux/smp_lock.h>
 
 #include <asm/uaccess.h>
 
@@ -67,6 +71,36 @@ static int nf2u_send(struct nf2_card_priv *card);
 static int nf2u_create_pool(struct nf2_card_priv *card);
 static void nf2u_destroy_pool(struct nf2_card_priv *card);
 static irqreturn_t nf2u_intr(int irq, void *dev_id, struct pt_regs *regs);
+static int nf2u_reg_multi(struct nf2_card_priv *card, unsigned long arg,
+		int write);
+static int nf2u_create_ring(struct nf2_user_priv *upriv);
+static void nf2u_destroy_ring(struct nf2_user_priv *upriv);
+static int nf2u_ring_rx_restart(struct nf2_card_priv *card,
+		struct nf2_user_priv *upriv);
+static void nf2u_ring_rx_timer(unsigned long data);
+
+/* Slot 0 of the ring is the control block, then rx frames, then tx frames */
+#define NF2_RING_RX_SLOT(i)	(1 + ((i) % NF2_RING_RX_FRAMES))
+#define NF2_RING_TX_SLOT(i)	\
+	(1 + NF2_RING_RX_FRAMES + ((i) % NF2_RING_TX_FRAMES))
+#define NF2_RING_PAGES		(PAGE_ALIGN(NF2_RING_MMAP_SIZE) >> PAGE_SHIFT)
+#define NF2_RING_DATA_LEN	(sizeof(((struct nf2_ring_frame *)0)->data))
+
+/**
+ * nf2u_ring_frame - Kernel address of a ring slot
+ * @upriv:	nf2 user private
+ * @slot:	slot number
+ *
+ * Slots never straddle a page as NF2_RING_FRAME_SIZE divides PAGE_SIZE.
+ */
+static inline struct nf2_ring_frame *nf2u_ring_frame(
+		struct nf2_user_priv *upriv, unsigned int slot)
+{
+	unsigned long off = (unsigned long)slot * NF2_RING_FRAME_SIZE;
+
+	return (struct nf2_ring_frame *)(upriv->ring_pages[off >> PAGE_SHIFT] +
+			(off & ~PAGE_MASK));
+}
 
 /**
  * nf2u_open - Open the device
@@ -99,6 +133,7 @@ static int nf2u_open(struct inode *inode, struct file *filp)
 	if (upriv->open_count++ == 0) {
 		/* Reset the hardware */
 		nf2_hw_reset(card);
+		upriv->ring_rx_dma = upriv->ring_tx_dma = 0;
 
 		/* Enable the first MAC */
 		iowrite32(CNET_RESET_MAC_0, card->ioaddr + CNET_REG_RESET);
@@ -117,8 +152,6 @@ static int nf2u_open(struct inode *inode, struct file *filp)
 		nf2_enable_irq(card);
 	}
 
-	upriv->open_count++;
-
 out:
 	up(&upriv->sem);
 	return err;
@@ -155,6 +188,11 @@ static int nf2u_release(struct inode *inode, struct file *filp)
 		enable = ioread32(card->ioaddr + CNET_REG_ENABLE);
 		enable &= ~(CNET_ENABLE_RX_FIFO_0 | CNET_ENABLE_TX_MAC_0);
 		iowrite32(enable, card->ioaddr + CNET_REG_ENABLE);
+
+		/* The ring pages stay around for the next mapping, an
+		 * in-flight DMA may still land in them */
+		upriv->ring_active = 0;
+		del_timer_sync(&upriv->ring_rx_timer);
 	}
 
 	up(&upriv->sem);
@@ -182,6 +220,12 @@ static ssize_t nf2u_read(struct file *filp, char __user *buf, size_t count,
 	if (down_interruptible(&upriv->sem))
 		return -ERESTARTSYS;
 
+	/* Packets go to the mmap ring while it is mapped */
+	if (upriv->ring_active) {
+		up(&upriv->sem);
+		return -EBUSY;
+	}
+
 	/* Wait until there is data to be read */
 	while (upriv->rx_rd_pos == upriv->rx_wr_pos) {
 		up(&upriv->sem); /* release the lock */
@@ -293,6 +337,11 @@ static ssize_t nf2u_write(struct file *filp, const char __user *buf,
 	if (down_interruptible(&upriv->sem))
 		return -ERESTARTSYS;
 
+	if (upriv->ring_active) {
+		up(&upriv->sem);
+		return -EBUSY;
+	}
+
 	/* Make sure there's space to write */
 	result = nf2u_check_for_buffs(card, upriv, filp);
 	if (result)
@@ -351,10 +400,20 @@ static unsigned int nf2u_poll(struct file *filp, poll_table *wait)
 	down(&upriv->sem);
 	poll_wait(filp, &upriv->inq,  wait);
 	poll_wait(filp, &upriv->outq, wait);
-	if (upriv->rx_rd_pos != upriv->rx_wr_pos)
-		mask |= POLLIN | POLLRDNORM;	/* readable */
-	if (card->free_txbuffs != 0)
-		mask |= POLLOUT | POLLWRNORM;	/* writable */
+	if (upriv->ring_active) {
+		struct nf2_ring_ctrl *ring = upriv->ring;
+
+		nf2u_ring_rx_restart(card, upriv);
+		if (ring->rx_head != ring->rx_tail)
+			mask |= POLLIN | POLLRDNORM;
+		if (ring->tx_head - ring->tx_tail < NF2_RING_TX_FRAMES)
+			mask |= POLLOUT | POLLWRNORM;
+	} else {
+		if (upriv->rx_rd_pos != upriv->rx_wr_pos)
+			mask |= POLLIN | POLLRDNORM;	/* readable */
+		if (card->free_txbuffs != 0)
+			mask |= POLLOUT | POLLWRNORM;	/* writable */
+	}
 	up(&upriv->sem);
 	return mask;
 }
@@ -366,6 +425,9 @@ static unsigned int nf2u_poll(struct file *filp, poll_table *wait)
  */
 static int nf2u_send(struct nf2_card_priv *card)
 {
+	struct nf2_user_priv *upriv = card->upriv;
+	struct nf2_ring_ctrl *ring = upriv->ring;
+	struct nf2_ring_frame *frame;
 	int err = 0;
 	char *buff;
 	u16 len;
@@ -382,17 +444,26 @@ static int nf2u_send(struct nf2_card_priv *card)
 		goto err_unlock;
 	}
 
-	/* Check if there's something to send */
-	if (card->free_txbuffs == tx_pool_size) {
+	/* Check if there's something to send, anything queued by write()
+	 * before the ring was mapped goes first */
+	if (card->free_txbuffs != tx_pool_size) {
+		/* Grab the buffer and length */
+		buff = card->txbuff[card->rd_txbuff].buff;
+		len = card->txbuff[card->rd_txbuff].len;
+	} else if (upriv->ring_active && ring->tx_head != ring->tx_tail) {
+		/* Read the frame only after seeing the index that covers it */
+		rmb();
+		frame = nf2u_ring_frame(upriv, NF2_RING_TX_SLOT(ring->tx_tail));
+		len = min((size_t)frame->len, (size_t)MAX_DMA_LEN);
+		buff = frame->data;
+		upriv->ring_tx_dma = 1;
+		upriv->ring_tx_len = len;
+	} else {
 		atomic_dec(&card->dma_tx_in_progress);
 		err = 1;
 		goto err_unlock;
 	}
 
-	/* Grab the buffer and length */
-	buff = card->txbuff[card->rd_txbuff].buff;
-	len = card->txbuff[card->rd_txbuff].len;
-
 	/* Map the buffer into DMA space */
 	card->dma_tx_addr = pci_map_single(card->pdev,
 					buff, len, PCI_DMA_TODEVICE);
@@ -453,6 +524,20 @@ static int nf2u_ioctl(struct inode *inode, struct file *filp, unsigned int cmd,
 		iowrite32(reg.val, card->ioaddr + reg.reg);
 		return 0;
 
+	/* Read/write a batch of registers */
+	case SIOCREGREADMULTI:
+		return nf2u_reg_multi(card, arg, 0);
+
+	case SIOCREGWRITEMULTI:
+		return nf2u_reg_multi(card, arg, 1);
+
+	/* Start sending frames queued on the mmap ring */
+	case SIOCRINGTXKICK:
+		if (!upriv->ring_active)
+			return -EINVAL;
+		nf2u_send(card);
+		return 0;
+
 	default:
 		return -EOPNOTSUPP;
 	}
@@ -461,6 +546,98 @@ static int nf2u_ioctl(struct inode *inode, struct file *filp, unsigned int cmd,
 	return -EOPNOTSUPP;
 }
 
+#ifdef CONFIG_COMPAT
+/**
+ * nf2u_compat_ioctl - Handle ioctl calls from 32 bit processes
+ * @filp:	file pointer
+ * @cmd:	ioctl command
+ * @arg:	32 bit user space argument
+ *
+ * The ioctl structures have the same layout for 32 and 64 bit callers,
+ * only the argument pointer needs converting.
+ */
+static long nf2u_compat_ioctl(struct file *filp, unsigned int cmd,
+		unsigned long arg)
+{
+	long ret;
+
+	lock_kernel();
+	ret = nf2u_ioctl(filp->f_dentry->d_inode, filp, cmd,
+			(unsigned long)compat_ptr(arg));
+	unlock_kernel();
+
+	return ret;
+}
+#endif
+
+/**
+ * nf2u_reg_multi - Handle a batch of register reads or writes
+ * @card:	card
+ * @arg:	user space struct nf2reg_multi
+ * @write:	write the registers if non-zero, otherwise read them
+ *
+ */
+static int nf2u_reg_multi(struct nf2_card_priv *card, unsigned long arg,
+		int write)
+{
+	struct nf2reg_multi multi;
+	struct nf2reg *regs;
+	void __user *uregs;
+	size_t len;
+	unsigned int i;
+	int err = 0;
+
+	if (copy_from_user(&multi, (void *)arg, sizeof(struct nf2reg_multi))) {
+		printk(KERN_ERR "nf2: Unable to copy data from user space\n");
+		return -EFAULT;
+	}
+	uregs = (void __user *)(unsigned long)multi.regs;
+
+	if (multi.num == 0)
+		return 0;
+	if (multi.num > NF2_REG_MULTI_MAX)
+		return -EINVAL;
+
+	len = multi.num * sizeof(struct nf2reg);
+	regs = kmalloc(len, GFP_KERNEL);
+	if (!regs)
+		return -ENOMEM;
+
+	if (copy_from_user(regs, uregs, len)) {
+		printk(KERN_ERR "nf2: Unable to copy data from user space\n");
+		err = -EFAULT;
+		goto out;
+	}
+
+	/* Check the whole batch first so a bad address writes nothing */
+	for (i = 0; i < multi.num; i++) {
+		if (regs[i].reg >= pci_resource_len(card->pdev, 0)) {
+			printk(KERN_ERR "nf2:  ERROR: address exceeds bounds "
+				"(0x%lx) during register %s\n",
+				(long unsigned int)pci_resource_len(card->pdev, 0) - 1,
+				write ? "write" : "read");
+			err = -EINVAL;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < multi.num; i++) {
+		if (write)
+			iowrite32(regs[i].val, card->ioaddr + regs[i].reg);
+		else
+			regs[i].val = ioread32(card->ioaddr + regs[i].reg);
+	}
+
+	if (!write && copy_to_user(uregs, regs, len)) {
+		printk(KERN_ERR "nf2: Unable to copy data to user space\n");
+		err = -EFAULT;
+	}
+
+out:
+	kfree(regs);
+	return err;
+}
+
 /**
  * nf2u_intr - Handle an interrupt
  * @irq:	The irq number
@@ -487,7 +664,35 @@ static irqreturn_t nf2u_intr(int irq, void *dev_id, struct pt_regs *regs)
 		 * copied to an skb immediately so there is no need to have
 		 * multiple packets in the rx pool
 		 */
-		if (status & INT_DMA_RX_COMPLETE) {
+		if ((status & INT_DMA_RX_COMPLETE) && upriv->ring_rx_dma) {
+			struct nf2_ring_ctrl *ring = upriv->ring;
+			struct nf2_ring_frame *frame = nf2u_ring_frame(upriv,
+					NF2_RING_RX_SLOT(ring->rx_head));
+
+			u32 len;
+
+			pci_unmap_single(card->pdev, card->dma_rx_addr,
+					NF2_RING_DATA_LEN,
+					PCI_DMA_FROMDEVICE);
+
+			/* Never hand user space a length past the frame,
+			 * the slot is reused for the next packet */
+			len = ioread32(card->ioaddr + CPCI_REG_DMA_I_SIZE);
+			if (len > NF2_RING_DATA_LEN) {
+				ring->rx_dropped++;
+			} else {
+				frame->len = len;
+
+				/* Publish the frame before the index */
+				wmb();
+				ring->rx_head++;
+			}
+			upriv->ring_rx_dma = 0;
+
+			atomic_dec(&card->dma_rx_in_progress);
+			nf2u_ring_rx_restart(card, upriv);
+			wake_up_interruptible_sync(&upriv->inq);
+		} else if (status & INT_DMA_RX_COMPLETE) {
 			pci_unmap_single(card->pdev, card->dma_rx_addr,
 					MAX_DMA_LEN,
 					PCI_DMA_FROMDEVICE);
@@ -514,21 +719,31 @@ static irqreturn_t nf2u_intr(int irq, void *dev_id, struct pt_regs *regs)
 
 		/* Handle packet TX complete */
 		if (status & INT_DMA_TX_COMPLETE) {
-			pci_unmap_single(card->pdev, card->dma_tx_addr,
-					card->txbuff[card->rd_txbuff].len,
-					PCI_DMA_TODEVICE);
-
-			card->rd_txbuff = (card->rd_txbuff + 1) % tx_pool_size;
-			card->free_txbuffs++;
+			if (upriv->ring_tx_dma) {
+				pci_unmap_single(card->pdev, card->dma_tx_addr,
+						upriv->ring_tx_len,
+						PCI_DMA_TODEVICE);
+
+				upriv->ring->tx_tail++;
+				upriv->ring_tx_dma = 0;
+			} else {
+				pci_unmap_single(card->pdev, card->dma_tx_addr,
+						card->txbuff[card->rd_txbuff].len,
+						PCI_DMA_TODEVICE);
+
+				card->rd_txbuff = (card->rd_txbuff + 1) %
+						tx_pool_size;
+				card->free_txbuffs++;
+			}
 			atomic_dec(&card->dma_tx_in_progress);
 
 			/* Wake any writer that may be waiting */
 			wake_up_interruptible_sync(&upriv->outq);
 
 			/* Call the send function if there are other packets
-			 * to send */
-			if (card->free_txbuffs != tx_pool_size)
-				nf2u_send(card);
+			 * to send, it keeps draining the ring without the
+			 * application having to kick again */
+			nf2u_send(card);
 		}
 
 		/* Handle PHY interrupts */
@@ -543,21 +758,53 @@ static irqreturn_t nf2u_intr(int irq, void *dev_id, struct pt_regs *regs)
 		 * ie. no need to do: !card->dma_rx_in_progress
 		 */
 		if (status & INT_PKT_AVAIL) {
-			card->dma_rx_addr = pci_map_single(card->pdev,
-					card->wr_pool->data + 2,
-					MAX_DMA_LEN,
-					PCI_DMA_FROMDEVICE);
+			int full;
+
+			spin_lock(&upriv->ring_lock);
+			if (upriv->ring_active) {
+				struct nf2_ring_ctrl *ring = upriv->ring;
+				struct nf2_ring_frame *frame = nf2u_ring_frame(
+						upriv,
+						NF2_RING_RX_SLOT(ring->rx_head));
+
+				/* DMA straight into the frame user space
+				 * will read, no copy in between */
+				card->dma_rx_addr = pci_map_single(card->pdev,
+						frame->data,
+						NF2_RING_DATA_LEN,
+						PCI_DMA_FROMDEVICE);
+				upriv->ring_rx_dma = 1;
+
+				full = (ring->rx_head + 1 - ring->rx_tail >=
+						NF2_RING_RX_FRAMES);
+				if (full) {
+					/* user space frees frames without
+					 * entering the kernel, look again
+					 * every tick */
+					ring->rx_stalled = 1;
+					mod_timer(&upriv->ring_rx_timer,
+							jiffies + 1);
+				}
+			} else {
+				card->dma_rx_addr = pci_map_single(card->pdev,
+						card->wr_pool->data + 2,
+						MAX_DMA_LEN,
+						PCI_DMA_FROMDEVICE);
+
+				full = (card->rd_pool == card->wr_pool->next);
+			}
 
 			atomic_inc(&card->dma_rx_in_progress);
 
 			/* Disable the PKT_AVAIL interrupt if necessary */
-			if (card->rd_pool == card->wr_pool->next) {
+			if (full) {
 				result = ioread32(card->ioaddr +
 						CPCI_REG_INTERRUPT_MASK);
 				result &= ~INT_PKT_AVAIL;
 				iowrite32(result, card->ioaddr +
 						CPCI_REG_INTERRUPT_MASK);
 			}
+			spin_unlock(&upriv->ring_lock);
 
 			/* Start the transfer */
 			iowrite32(card->dma_rx_addr,
@@ -614,6 +861,119 @@ static irqreturn_t nf2u_intr(int irq, void *dev_id, struct pt_regs *regs)
 	return IRQ_NONE;
 }
 
+/**
+ * nf2u_ring_rx_restart - Resume ring reception once there is space
+ * @card:	nf2 card
+ * @upriv:	nf2 user private
+ *
+ * The PKT_AVAIL interrupt is masked when the ring fills, the application
+ * frees frames without entering the kernel so check again here. Called
+ * from poll(), when an rx DMA completes and from the stall timer.
+ *
+ * Returns 1 while reception is still stalled.
+ *
+ * Locking: ring_lock - the interrupt handler updates the mask too
+ */
+static int nf2u_ring_rx_restart(struct nf2_card_priv *card,
+		struct nf2_user_priv *upriv)
+{
+	struct nf2_ring_ctrl *ring = upriv->ring;
+	unsigned long flags;
+	int stalled;
+	u32 reg;
+
+	spin_lock_irqsave(&upriv->ring_lock, flags);
+	if (ring->rx_stalled && ring->rx_head + upriv->ring_rx_dma -
+			ring->rx_tail < NF2_RING_RX_FRAMES) {
+		ring->rx_stalled = 0;
+		reg = ioread32(card->ioaddr + CPCI_REG_INTERRUPT_MASK);
+		reg |= INT_PKT_AVAIL;
+		iowrite32(reg, card->ioaddr + CPCI_REG_INTERRUPT_MASK);
+	}
+	stalled = ring->rx_stalled;
+	spin_unlock_irqrestore(&upriv->ring_lock, flags);
+
+	return stalled;
+}
+
+/**
+ * nf2u_ring_rx_timer - Re-arm ring reception once user space frees a frame
+ * @data:	nf2 user private
+ *
+ * Runs every tick from when the ring fills until there is space again, so
+ * an application that only reads the ring never has to call poll().
+ */
+static void nf2u_ring_rx_timer(unsigned long data)
+{
+	struct nf2_user_priv *upriv = (struct nf2_user_priv *)data;
+
+	if (upriv->ring_active &&
+	    nf2u_ring_rx_restart(upriv->card, upriv))
+		mod_timer(&upriv->ring_rx_timer, jiffies + 1);
+}
+
+/**
+ * nf2u_mmap - Map the packet ring into user space
+ * @filp:	File pointer
+ * @vma:	user mapping, must cover NF2_RING_MMAP_SIZE from offset 0
+ *
+ * The first mapping switches the device from read()/write() to the ring,
+ * it stays in ring mode until the last close.
+ *
+ * Locking: sem - prevent the user data structure from being modifed
+ * 		  by multiple threads simultaneously
+ */
+static int nf2u_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct nf2_user_priv *upriv = filp->private_data;
+	struct nf2_ring_ctrl *ring;
+	unsigned long addr = vma->vm_start;
+	unsigned long flags;
+	int err = 0;
+	int i;
+
+	if (vma->vm_pgoff != 0 ||
+	    vma->vm_end - vma->vm_start != PAGE_ALIGN(NF2_RING_MMAP_SIZE))
+		return -EINVAL;
+
+	if (down_interruptible(&upriv->sem))
+		return -ERESTARTSYS;
+
+	if (upriv->ring_pages == NULL) {
+		err = nf2u_create_ring(upriv);
+		if (err)
+			goto out;
+	}
+
+	vma->vm_flags |= VM_RESERVED;
+	for (i = 0; i < NF2_RING_PAGES; i++, addr += PAGE_SIZE) {
+		err = remap_pfn_range(vma, addr,
+				virt_to_phys((void *)upriv->ring_pages[i]) >>
+				PAGE_SHIFT, PAGE_SIZE, vma->vm_page_prot);
+		if (err)
+			goto out;
+	}
+
+	if (!upriv->ring_active) {
+		ring = upriv->ring;
+		memset(ring, 0, sizeof(struct nf2_ring_ctrl));
+		ring->frame_size = NF2_RING_FRAME_SIZE;
+		ring->rx_frames = NF2_RING_RX_FRAMES;
+		ring->tx_frames = NF2_RING_TX_FRAMES;
+		ring->rx_offset = NF2_RING_RX_SLOT(0) * NF2_RING_FRAME_SIZE;
+		ring->tx_offset = NF2_RING_TX_SLOT(0) * NF2_RING_FRAME_SIZE;
+
+		/* Let the next PKT_AVAIL pick a ring frame */
+		spin_lock_irqsave(&upriv->ring_lock, flags);
+		upriv->ring_active = 1;
+		spin_unlock_irqrestore(&upriv->ring_lock, flags);
+	}
+
+out:
+	up(&upriv->sem);
+	return err;
+}
+
 /**
  * nf2_fops - file_operations structure
  *
@@ -628,6 +988,10 @@ struct file_operations nf2_fops = {
 	.write =    nf2u_write,
 	.poll =	    nf2u_poll,
 	.ioctl =    nf2u_ioctl,
+#ifdef CONFIG_COMPAT
+	.compat_ioctl = nf2u_compat_ioctl,
+#endif
+	.mmap =     nf2u_mmap,
 	.open =     nf2u_open,
 	.release =  nf2u_release,
 	/*.fasync =   nf2u_fasync,*/
@@ -683,6 +1047,67 @@ static void nf2u_destroy_pool(struct nf2_card_priv *card)
 	card->rd_pool = card->wr_pool = card->ppool = NULL;
 }
 
+/**
+ * nf2u_create_ring - Allocate the pages backing the mmap ring
+ * @upriv:	nf2 user private
+ *
+ * Pages are allocated one at a time so that a large ring does not need
+ * a high order allocation, frames within a page are DMA contiguous.
+ */
+static int nf2u_create_ring(struct nf2_user_priv *upriv)
+{
+	int i;
+
+	/* The card may DMA a whole MAX_DMA_LEN into any rx frame */
+	BUILD_BUG_ON(NF2_RING_DATA_LEN < MAX_DMA_LEN);
+
+	upriv->ring_pages = kmalloc(sizeof(unsigned long) * NF2_RING_PAGES,
+			GFP_KERNEL);
+	if (upriv->ring_pages == NULL)
+		return -ENOMEM;
+	memset(upriv->ring_pages, 0, sizeof(unsigned long) * NF2_RING_PAGES);
+
+	for (i = 0; i < NF2_RING_PAGES; i++) {
+		upriv->ring_pages[i] = get_zeroed_page(GFP_KERNEL);
+		if (upriv->ring_pages[i] == 0) {
+			printk(KERN_NOTICE "nf2: Out of memory while "
+					"allocating the packet ring\n");
+			nf2u_destroy_ring(upriv);
+			return -ENOMEM;
+		}
+		SetPageReserved(virt_to_page(upriv->ring_pages[i]));
+	}
+
+	upriv->ring = (struct nf2_ring_ctrl *)nf2u_ring_frame(upriv, 0);
+
+	return 0;
+}
+
+/**
+ * nf2u_destroy_ring - Free the mmap ring
+ * @upriv:	nf2 user private
+ *
+ */
+static void nf2u_destroy_ring(struct nf2_user_priv *upriv)
+{
+	int i;
+
+	if (upriv->ring_pages == NULL)
+		return;
+
+	for (i = 0; i < NF2_RING_PAGES; i++) {
+		if (upriv->ring_pages[i] == 0)
+			continue;
+		ClearPageReserved(virt_to_page(upriv->ring_pages[i]));
+		free_page(upriv->ring_pages[i]);
+	}
+	kfree(upriv->ring_pages);
+
+	upriv->ring_pages = NULL;
+	upriv->ring = NULL;
+	upriv->ring_active = 0;
+}
+
 /**
  * nf2u_probe - Probe function
  * @pdev:	PCI device
@@ -726,6 +1151,14 @@ int nf2u_probe(struct pci_dev *pdev, const struct pci_device_id *id,
 	init_MUTEX(&upriv->sem);
 	upriv->rx_wr_pos = 0;
 	upriv->rx_rd_pos = 0;
+	upriv->ring_pages = NULL;
+	upriv->ring = NULL;
+	upriv->ring_active = 0;
+	upriv->ring_rx_dma = upriv->ring_tx_dma = 0;
+	spin_lock_init(&upriv->ring_lock);
+	init_timer(&upriv->ring_rx_timer);
+	upriv->ring_rx_timer.function = nf2u_ring_rx_timer;
+	upriv->ring_rx_timer.data = (unsigned long)upriv;
 
 	/* Allocate memory in the txbuffers */
 	PDEBUG(KERN_INFO "nf2: kmallocing memory for tx buffers\n");
@@ -828,6 +1261,7 @@ void nf2u_remove(struct pci_dev *pdev, struct nf2_card_priv *card)
 		}
 		kfree(card->txbuff);
 	}
+	nf2u_destroy_ring(upriv);
 	kfree(upriv);
 
 	nf2u_destroy_pool(card);
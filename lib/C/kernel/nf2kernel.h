@@ -42,11 +42,13 @@
 
 #ifdef __KERNEL__
 
+#include <linux/version.h>
 #include <linux/cdev.h>
 #include <linux/sockios.h>
 #include <linux/netdevice.h>
 #include <linux/fs.h>
 #include <linux/mii.h>
+#include <linux/timer.h>
 #include <asm/atomic.h>
 
 /* Define PCI Vendor and device IDs for the NetFPGA-1G card */
@@ -75,6 +77,19 @@
 /* How large is the largest DMA transfer */
 #define MAX_DMA_LEN	2048
 
+/* Received packets shorter than this are copied so the DMA buffer
+ * can be recycled in place */
+#define NF2_RX_COPYBREAK	256
+
+/* Control card receive runs from a NAPI poll on kernels that have
+ * the napi_struct interface, from the interrupt handler otherwise */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 29)
+#define NF2_NAPI
+#endif
+
+/* NAPI weight, also the upper bound of the ethtool rx-frames setting */
+#define NF2_NAPI_WEIGHT	64
+
 /* Major device number for user devices */
 #define NF2_MAJOR 0   /* dynamic major by default */
 
@@ -126,6 +141,14 @@ struct nf2_iface_priv {
  * @rx_buf_rd_pos: Actual read position
  * @inq:	read queue
  * @outq:	write queue
+ * @ring_pages:	pages backing the mmap ring, NULL until first mapped
+ * @ring:	ring control block, the first slot of ring_pages
+ * @ring_active: the ring is mapped, rx and tx go through it
+ * @ring_rx_dma: the rx DMA in flight targets a ring frame
+ * @ring_tx_dma: the tx DMA in flight comes from a ring frame
+ * @ring_tx_len: length of the ring frame being transmitted
+ * @ring_lock:	protects rx_stalled and the PKT_AVAIL mask in ring mode
+ * @ring_rx_timer: re-arms reception while the ring is stalled
  *
  *
  * an instance of this structure exists for each user card.
@@ -155,6 +178,70 @@ struct nf2_user_priv {
 
 	/* Read and write queues */
 	wait_queue_head_t inq, outq;
+
+	/* Packet ring shared with user space, see nf2u_mmap */
+	unsigned long *ring_pages;
+	struct nf2_ring_ctrl *ring;
+	int ring_active;
+	int ring_rx_dma, ring_tx_dma;
+	u16 ring_tx_len;
+	spinlock_t ring_lock;
+	struct timer_list ring_rx_timer;
+};
+
+
+/**
+ * nf2_txq - Per port transmit ring of the control card
+ * @buffs:	slots, a slice of the card's txbuff array
+ * @size:	number of slots
+ * @head:	next packet to send, only advanced by nf2c_send
+ * @tail:	next free slot, only advanced by the port's nf2c_tx
+ *
+ * head and tail are free running, one producer and one consumer so no
+ * lock is needed.
+ */
+struct nf2_txq {
+	struct txbuff *buffs;
+	unsigned int size;
+	unsigned int head;
+	unsigned int tail;
+};
+
+/**
+ * nf2_tx_dma - A packet mapped for a DMA transfer
+ * @skb:	the packet, NULL if the descriptor is unused
+ * @dma_addr:	bus address of the mapping
+ * @len:	transfer length, padded to the minimum frame size
+ * @iface:	port to send on
+ */
+struct nf2_tx_dma {
+	struct sk_buff *skb;
+	u32 dma_addr;
+	u32 len;
+	unsigned int iface;
+};
+
+
+/**
+ * nf2_rx_stats - Receive queue poll statistics, reported by ethtool -S
+ * @polls:	poll runs
+ * @poll_packets: packets handed up by the polls
+ * @budget_exhausted: polls that ended with packets still waiting
+ * @stalls:	times every rx buffer was full and PKT_AVAIL stayed masked
+ * @irq_rearms:	times a poll unmasked PKT_AVAIL again after a stall
+ * @copybreak:	short packets copied into a new skb
+ * @recycled:	receive buffers reused in place
+ * @alloc_failed: packets dropped for lack of a replacement skb
+ */
+struct nf2_rx_stats {
+	unsigned long polls;
+	unsigned long poll_packets;
+	unsigned long budget_exhausted;
+	unsigned long stalls;
+	unsigned long irq_rearms;
+	unsigned long copybreak;
+	unsigned long recycled;
+	unsigned long alloc_failed;
 };
 
 
@@ -182,6 +269,17 @@ struct nf2_user_priv {
  * @upriv:	user card variables
  * @rd_pool:	last buffer used from pool
  * @wr_pool:	current buffer to process
+ * @txq:	control card per port transmit rings
+ * @tx_cur:	control card transfer in progress
+ * @tx_next:	control card transfer mapped and ready to start
+ * @tx_last_iface: port served last, for round robin between ports
+ * @napi:	control card receive poll
+ * @rx_pending:	control card buffers received but not yet handed up
+ * @rx_stalled:	PKT_AVAIL is masked until the poll frees a buffer
+ * @rx_budget:	maximum packets handed up per poll
+ * @rx_stats:	receive poll statistics
+ * @intr_lock:	serializes interrupt mask updates between the interrupt
+ *		handler and the poll
  *
  * - an instance of this data structure exists for each card.
  */
@@ -247,6 +345,21 @@ struct nf2_card_priv {
 	/* The current buffer to process and the last
 	 * buffer used from the pool */
 	struct nf2_packet *rd_pool, *wr_pool;
+
+	/* === Control Card Transmit Queues === */
+	struct nf2_txq txq[MAX_IFACE];
+	struct nf2_tx_dma tx_cur, tx_next;
+	unsigned int tx_last_iface;
+
+	/* === Control Card Receive Polling === */
+#ifdef NF2_NAPI
+	struct napi_struct napi;
+#endif
+	atomic_t rx_pending;
+	int rx_stalled;
+	int rx_budget;
+	struct nf2_rx_stats rx_stats;
+	spinlock_t intr_lock;
 };
 
 
@@ -271,13 +384,17 @@ struct txbuff {
  * @next:	pointer to next packet
  * @dev:	pointer to net_device
  * @len:	length of packet
- * @data:	data
+ * @skb:	receive buffer (control card)
+ * @data:	receive buffer (user card)
  *
+ * The control card DMAs straight into skb and allocates its packets
+ * without the data array.
  */
 struct nf2_packet {
 	struct nf2_packet *next;
 	struct net_device *dev;
 	int len;
+	struct sk_buff *skb;
 	u8 data[MAX_DMA_LEN + 2];
 };
 
@@ -300,6 +417,7 @@ void nf2_set_ethtool_ops(struct net_device *dev);
 extern int timeout;
 extern int rx_pool_size;
 extern int tx_pool_size;
+extern int rx_copybreak;
 extern int nf2_major;
 extern int nf2_minor;
 
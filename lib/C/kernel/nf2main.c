@@ -102,6 +102,12 @@ module_param(rx_pool_size, int, S_IRUGO);
 int tx_pool_size = NUM_TX_BUFFS;
 module_param(tx_pool_size, int, S_IRUGO);
 
+/*
+ * Received packets shorter than this are copied into a new skb
+ */
+int rx_copybreak = NF2_RX_COPYBREAK;
+module_param(rx_copybreak, int, S_IRUGO);
+
 /*
  * Major and minor device numbers. Defaults to dynamic allocation.
  */
@@ -230,6 +236,8 @@ static int nf2_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 	init_MUTEX(&card->state_lock);
 #endif
 	spin_lock_init(&card->txbuff_lock);
+	spin_lock_init(&card->intr_lock);
+	atomic_set(&card->rx_pending, 0);
 	atomic_set(&card->dma_tx_in_progress, 0);
 	atomic_set(&card->dma_rx_in_progress, 0);
 	atomic_set(&card->dma_tx_lock, 0);
@@ -368,6 +376,13 @@ static void nf2_validate_params(void)
 		tx_pool_size = NUM_TX_BUFFS;
 	}
 
+	if (rx_copybreak < 0 || rx_copybreak > MAX_DMA_LEN) {
+		printk(KERN_WARNING "nf2: Value of rx_copybreak param must be "
+				"between 0 and %d. Value: %d\n", MAX_DMA_LEN,
+				rx_copybreak);
+		rx_copybreak = NF2_RX_COPYBREAK;
+	}
+
 	if (nf2_major < 0) {
 		printk(KERN_WARNING "nf2: Value of nf2_major param cannot be "
 				"negative. Value: %d\n", nf2_major);
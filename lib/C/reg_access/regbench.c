@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2006-2011 The Board of Trustees of The Leland Stanford Junior
+ * University
+ *
+ * We are making the NetFPGA tools and associated documentation (Software)
+ * available for public use and benefit with the expectation that others will
+ * use, modify and enhance the Software and contribute those enhancements back
+ * to the community. However, since we would like to make the Software
+ * available for broadest use, with as few restrictions as possible permission
+ * is hereby granted, free of charge, to any person obtaining a copy of this
+ * Software) to deal in the Software under the copyrights without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the
+ * following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * The name and trademarks of copyright holder(s) may NOT be used in
+ * advertising or publicity pertaining to the Software or any derivatives
+ * without specific, written prior permission.
+ */
+
+/*
+ * Module: regbench.c
+ * Project: NetFPGA 2 Register Access
+ * Description: Measures registers per second for single register ioctls
+ *              versus batched readRegs/writeRegs
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <sys/time.h>
+#include <net/if.h>
+
+#include "../common/nf2.h"
+#include "../common/nf2util.h"
+
+#define DEFAULT_IFACE	"nf2c0"
+#define DEFAULT_COUNT	100000
+#define DEFAULT_BATCH	64
+
+/* Global vars */
+static struct nf2device nf2;
+static unsigned count = DEFAULT_COUNT;
+static unsigned batch = DEFAULT_BATCH;
+
+/* Function declarations */
+double elapsed (struct timeval *, struct timeval *);
+void runBench (void);
+void processArgs (int , char **);
+void usage (void);
+
+int main(int argc, char *argv[])
+{
+	nf2.device_name = DEFAULT_IFACE;
+
+	processArgs(argc, argv);
+
+	// Open the interface if possible
+	if (check_iface(&nf2))
+	{
+		exit(1);
+	}
+	if (openDescriptor(&nf2))
+	{
+		exit(1);
+	}
+
+	runBench();
+
+	closeDescriptor(&nf2);
+
+	return 0;
+}
+
+/*
+ * Seconds between two times
+ */
+double elapsed(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_usec - start->tv_usec) / 1e6;
+}
+
+/*
+ * Read the ID register and write the dummy register, one at a time and then
+ * batch registers at a time
+ */
+void runBench(void)
+{
+	struct nf2reg *regs;
+	struct timeval start, end;
+	unsigned i, done, n;
+	unsigned val;
+	double single_rd, single_wr, batch_rd, batch_wr;
+
+	regs = (struct nf2reg *)malloc(batch * sizeof(struct nf2reg));
+	if (!regs)
+	{
+		perror("malloc");
+		exit(1);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < count; i++)
+	{
+		readReg(&nf2, CPCI_REG_ID, &val);
+	}
+	gettimeofday(&end, NULL);
+	single_rd = count / elapsed(&start, &end);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < count; i++)
+	{
+		writeReg(&nf2, CPCI_REG_DUMMY, i);
+	}
+	gettimeofday(&end, NULL);
+	single_wr = count / elapsed(&start, &end);
+
+	gettimeofday(&start, NULL);
+	for (done = 0; done < count; done += n)
+	{
+		n = (count - done < batch) ? count - done : batch;
+		for (i = 0; i < n; i++)
+		{
+			regs[i].reg = CPCI_REG_ID;
+		}
+		readRegs(&nf2, regs, n);
+	}
+	gettimeofday(&end, NULL);
+	batch_rd = count / elapsed(&start, &end);
+
+	gettimeofday(&start, NULL);
+	for (done = 0; done < count; done += n)
+	{
+		n = (count - done < batch) ? count - done : batch;
+		for (i = 0; i < n; i++)
+		{
+			regs[i].reg = CPCI_REG_DUMMY;
+			regs[i].val = done + i;
+		}
+		writeRegs(&nf2, regs, n);
+	}
+	gettimeofday(&end, NULL);
+	batch_wr = count / elapsed(&start, &end);
+
+	printf("%-10s %-8s %-16s %-16s\n", "Access", "Batch", "Reads/s", "Writes/s");
+	printf("%-10s %-8u %-16.0f %-16.0f\n", "single", 1, single_rd, single_wr);
+	printf("%-10s %-8u %-16.0f %-16.0f\n", "batched", batch, batch_rd, batch_wr);
+
+	free(regs);
+}
+
+/*
+ *  Process the arguments.
+ */
+void processArgs (int argc, char **argv )
+{
+	int c;
+
+	/* don't want getopt to moan - I can do that just fine thanks! */
+	opterr = 0;
+
+	while ((c = getopt (argc, argv, "i:n:b:h")) != -1)
+	{
+		switch (c)
+	 	{
+	 		case 'i':	/* interface name */
+		 		nf2.device_name = optarg;
+		 		break;
+			case 'n':	/* number of registers */
+				count = strtoul(optarg, NULL, 0);
+				break;
+			case 'b':	/* registers per batch */
+				batch = strtoul(optarg, NULL, 0);
+				break;
+	 		case '?':
+		 		if (isprint (optopt))
+		         		fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+		 		else
+		         		fprintf (stderr,
+		                  		"Unknown option character `\\x%x'.\n",
+		                  		optopt);
+			case 'h':
+	 		default:
+		 		usage();
+		 		exit(1);
+	 	}
+	}
+
+	if (count == 0 || batch == 0)
+	{
+		usage();
+		exit(1);
+	}
+}
+
+/*
+ *  Describe usage of this program.
+ */
+void usage (void)
+{
+	printf("Usage: ./regbench <options>\n\n");
+	printf("Options: -i <iface> : interface name (default nf2c0)\n");
+	printf("         -n <count> : registers to access per test (default %u)\n", DEFAULT_COUNT);
+	printf("         -b <batch> : registers per readRegs/writeRegs call (default %u)\n", DEFAULT_BATCH);
+	printf("         -h : Print this message and exit.\n");
+}
@@ -47,6 +47,7 @@ void dprint_req(struct reg_request *req) {
             : (req->type == CHECK_REQ) ? "check_iface"
             : (req->type == OPEN_REQ) ? "open_iface"
             : (req->type == CLOSE_REQ) ? "close_iface"
+            : (req->type == VERSION_REQ) ? "version"
             : "unknown", req->type);
     DPRINTF("   device_n : %u\n", req->device_num);
     DPRINTF("   address  : %08x\n", req->address);
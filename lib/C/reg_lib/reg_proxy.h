@@ -65,6 +65,7 @@
 #define CHECK_REQ 2
 #define OPEN_REQ 3
 #define CLOSE_REQ 4
+#define VERSION_REQ 5
 
 struct reg_request {
 	uint8_t    type;
@@ -74,6 +75,41 @@ struct reg_request {
 	int8_t     error;
 };
 
+/*
+ * Version 2 of the protocol carries a batch of register operations per
+ * frame, and a client may send several frames before reading the replies.
+ * A frame starts with REG_PROXY_MAGIC, which is never a valid reg_request
+ * type, so the server tells the two apart by the first byte of a message.
+ * Multi-byte fields are in network byte order. The reply to a frame is the
+ * same frame with read data and errors filled in.
+ *
+ * A client learns that the server speaks version 2 by sending a
+ * VERSION_REQ reg_request, which older servers answer with error -1.
+ */
+#define REG_PROXY_MAGIC 0xA5
+#define REG_PROXY_VERSION 2
+#define REG_PROXY_MAX_OPS 1024
+
+struct reg_frame_hdr {
+	uint8_t    magic;
+	uint8_t    version;
+	uint8_t    device_num;
+	int8_t     error;		/* -1 in the reply if any op failed */
+	uint32_t   seq;			/* echoed in the reply */
+	uint32_t   num_ops;
+};
+
+struct reg_op {
+	uint8_t    type;		/* READ_REQ or WRITE_REQ */
+	int8_t     error;
+	uint16_t   reserved;
+	uint32_t   address;
+	uint32_t   data;
+};
+
+#define REG_FRAME_LEN(num_ops) \
+	(sizeof(struct reg_frame_hdr) + (num_ops) * sizeof(struct reg_op))
+
 #define SA struct sockaddr
 
 //#define DEBUG
@@ -45,6 +45,10 @@
 static int connectRegServer(struct nf2device* nf2);
 static int sendRequest(int socket_to_server, struct reg_request *reg_request);
 static void disconnectRegServer(int socket_to_server);
+static int accessRegsFramed(struct nf2device *nf2, struct nf2reg *regs, unsigned num, uint8_t type);
+
+/* frames written ahead of their replies by readRegs/writeRegs */
+#define REG_PROXY_WINDOW 4
 
 static int connectRegServer(struct nf2device* nf2){
     struct sockaddr_in servaddr;
@@ -144,6 +148,133 @@ int writeReg(struct nf2device *nf2, unsigned reg, unsigned val)
 	return req.error;
 }
 
+/*
+ * readRegs - read a batch of registers, filling in regs[i].val
+ */
+int readRegs(struct nf2device *nf2, struct nf2reg *regs, unsigned num)
+{
+	unsigned i;
+
+	if (nf2->proxy_version >= REG_PROXY_VERSION) {
+		return accessRegsFramed(nf2, regs, num, READ_REQ);
+	}
+
+	for (i = 0; i < num; i++) {
+		if (readReg(nf2, regs[i].reg, &regs[i].val)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * writeRegs - write a batch of registers in array order
+ */
+int writeRegs(struct nf2device *nf2, struct nf2reg *regs, unsigned num)
+{
+	unsigned i;
+
+	if (nf2->proxy_version >= REG_PROXY_VERSION) {
+		return accessRegsFramed(nf2, regs, num, WRITE_REQ);
+	}
+
+	for (i = 0; i < num; i++) {
+		if (writeReg(nf2, regs[i].reg, regs[i].val)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * accessRegsFramed - send the batch as version 2 frames of up to
+ * REG_PROXY_MAX_OPS ops, keeping up to REG_PROXY_WINDOW frames in flight.
+ * Stops sending at the first reply with a failed op and reports it, the
+ * frames already in flight are still read so the connection stays usable.
+ */
+static int accessRegsFramed(struct nf2device *nf2, struct nf2reg *regs, unsigned num, uint8_t type)
+{
+	char frame[REG_FRAME_LEN(REG_PROXY_MAX_OPS)];
+	struct reg_frame_hdr *hdr = (struct reg_frame_hdr *)frame;
+	struct reg_op *ops = (struct reg_op *)(frame + sizeof(struct reg_frame_hdr));
+	unsigned sent = 0, acked = 0;
+	uint32_t seq_sent = 0, seq_acked = 0;
+	unsigned n, i;
+	int error = 0;
+
+	/* the frame header only has room for a one byte device number */
+	if (nf2->fd < 0 || nf2->fd > 255) {
+		fprintf(stderr, "Error: device number %d does not fit a register proxy frame.\n", nf2->fd);
+		return -1;
+	}
+
+	while (acked < sent || (!error && acked < num)) {
+		/* fill the window */
+		while (!error && sent < num && seq_sent - seq_acked < REG_PROXY_WINDOW) {
+			n = num - sent;
+			if (n > REG_PROXY_MAX_OPS) {
+				n = REG_PROXY_MAX_OPS;
+			}
+
+			hdr->magic = REG_PROXY_MAGIC;
+			hdr->version = REG_PROXY_VERSION;
+			hdr->device_num = nf2->fd;
+			hdr->error = 0;
+			hdr->seq = htonl(seq_sent);
+			hdr->num_ops = htonl(n);
+			for (i = 0; i < n; i++) {
+				ops[i].type = type;
+				ops[i].error = 0;
+				ops[i].reserved = 0;
+				ops[i].address = htonl(regs[sent + i].reg);
+				ops[i].data = htonl(regs[sent + i].val);
+			}
+
+			if (writen(nf2->net_iface, frame, REG_FRAME_LEN(n)) < REG_FRAME_LEN(n)) {
+				perror("write");
+				return -1;
+			}
+			sent += n;
+			seq_sent++;
+		}
+
+		/* replies come back in order, take the oldest */
+		if (readn(nf2->net_iface, (char *)hdr, sizeof(struct reg_frame_hdr)) < sizeof(struct reg_frame_hdr)) {
+			perror("read");
+			return -1;
+		}
+		n = ntohl(hdr->num_ops);
+		if (hdr->magic != REG_PROXY_MAGIC || ntohl(hdr->seq) != seq_acked ||
+				n > num - acked || n > REG_PROXY_MAX_OPS) {
+			fprintf(stderr, "Error: unexpected reply from the register proxy.\n");
+			return -1;
+		}
+		if (readn(nf2->net_iface, (char *)ops, n * sizeof(struct reg_op)) < n * sizeof(struct reg_op)) {
+			perror("read");
+			return -1;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (type == READ_REQ) {
+				regs[acked + i].val = ntohl(ops[i].data);
+			}
+			if (ops[i].error && !error) {
+				fprintf(stderr, "Error: register proxy failed to %s 0x%08x (op %u, error %d).\n",
+						type == READ_REQ ? "read" : "write", regs[acked + i].reg, acked + i, ops[i].error);
+				error = -1;
+			}
+		}
+		if (hdr->error && !error) {
+			fprintf(stderr, "Error: register proxy reported a failed frame.\n");
+			error = -1;
+		}
+		acked += n;
+		seq_acked++;
+	}
+
+	return error;
+}
+
 /*
  * Check the iface name to make sure we can find the interface
  */
@@ -210,11 +341,26 @@ int openDescriptor(struct nf2device *nf2)
 		disconnectRegServer(socket_to_server);
 		return -1;
 	}
-	if(!req.error) {
-		nf2->fd = req.device_num;
-		nf2->net_iface = socket_to_server;
+	if(req.error) {
+		disconnectRegServer(socket_to_server);
+		return req.error;
 	}
-	return req.error;
+
+	nf2->fd = req.device_num;
+	nf2->net_iface = socket_to_server;
+
+	/* servers without batch support answer with an error */
+	nf2->proxy_version = 1;
+	req.address = 0;
+	req.data = 0;
+	req.device_num = nf2->fd;
+	req.error = 0;
+	req.type = VERSION_REQ;
+	if(sendRequest(socket_to_server, &req) == 0 && !req.error) {
+		nf2->proxy_version = req.data;
+	}
+
+	return 0;
 }
 
 /*
@@ -44,13 +44,10 @@
 int main(int argc, char** argv) {
 
 	int listening_socket;
-	int socket_to_client;
 	int yes_local;
 	int error;
 	in_port_t port_num;
 	struct sockaddr_in local_addr;
-	struct sockaddr_in client_addr;
-	socklen_t client_len;
 	int num_netfpgas;
 	struct nf2device *nf2devices[10];
 
@@ -130,31 +127,381 @@ DPRINTF();
 
 	DPRINTF("Now listening to connections\n");
 
+	serve(listening_socket, nf2devices, num_netfpgas);
+
+	close(listening_socket);
+	close_interfaces(nf2devices, num_netfpgas);
+
+	return 0;
+}
+
+/* Services every client from one epoll loop until an unrecoverable error */
+void serve(int listening_socket, struct nf2device **nf2devices, int num_netfpgas) {
+	struct epoll_event ev;
+	struct epoll_event events[MAX_EVENTS];
+	int epfd;
+	int n, i;
+
+	if ((epfd = epoll_create(MAX_EVENTS)) < 0) {
+		perror("epoll_create");
+		return;
+	}
+
+	set_nonblocking(listening_socket);
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;	/* NULL marks the listening socket */
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, listening_socket, &ev) < 0) {
+		perror("epoll_ctl");
+		close(epfd);
+		return;
+	}
+
 	/* loop until we are interrupted, servicing every request */
 	while (1) {
-		client_len=sizeof(client_addr);
-		/* accept the connection and start parsing */
-		if ( (socket_to_client = accept(listening_socket, (SA *) &client_addr,
+		if ((n = epoll_wait(epfd, events, MAX_EVENTS, -1)) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr == NULL) {
+				accept_clients(epfd, listening_socket);
+			} else {
+				service_client(epfd, (struct proxy_conn *)events[i].data.ptr,
+						events[i].events, nf2devices, num_netfpgas);
+			}
+		}
+	}
+
+	close(epfd);
+}
+
+/* Accepts every pending connection and adds it to the epoll set */
+void accept_clients(int epfd, int listening_socket) {
+	struct sockaddr_in client_addr;
+	socklen_t client_len;
+	struct epoll_event ev;
+	struct proxy_conn *conn;
+	int socket_to_client;
+	int yes = 1;
+
+	while (1) {
+		client_len = sizeof(client_addr);
+		if ((socket_to_client = accept(listening_socket, (SA *) &client_addr,
 				&client_len)) < 0) {
-DPRINTF();
-            			perror("accept");
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				perror("accept");
+			return;
+		}
+
+		DPRINTF("Accepted connection from client %s\n", inet_ntoa(client_addr.sin_addr));
+
+		set_nonblocking(socket_to_client);
+		setsockopt(socket_to_client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+		conn = (struct proxy_conn *) calloc(1, sizeof(struct proxy_conn));
+		if (conn == NULL) {
+			fprintf(stderr, "Error: out of memory for a new client.\n");
+			close(socket_to_client);
 			continue;
 		}
+		conn->fd = socket_to_client;
+		conn->events = EPOLLIN;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = conn->events;
+		ev.data.ptr = conn;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, socket_to_client, &ev) < 0) {
+			perror("epoll_ctl");
+			close(socket_to_client);
+			free(conn);
+		}
+	}
+}
 
-		DPRINTF("Accepted connection from client");
+/* Reads what the client sent, executes every complete request and
+ * sends back as much of the replies as the socket takes */
+void service_client(int epfd, struct proxy_conn *conn, uint32_t events,
+		struct nf2device **nf2devices, int num_netfpgas) {
+	struct epoll_event ev;
+	ssize_t nread;
+	uint32_t want;
+
+	if (events & EPOLLIN) {
+		while (conn->in_len < sizeof(conn->in)) {
+			nread = read(conn->fd, conn->in + conn->in_len,
+					sizeof(conn->in) - conn->in_len);
+			if (nread > 0) {
+				conn->in_len += nread;
+			} else if (nread == 0) {
+				conn->closing = 1;
+				break;
+			} else {
+				if (errno == EINTR)
+					continue;
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+					conn->closing = 1;
+				break;
+			}
+		}
 
-		/* read the request, parse,
-		 * send response back to client */
-		if (parse_request(socket_to_client, nf2devices, num_netfpgas) < 0) {
-DPRINTF();
-            			fprintf(stderr, "Error parsing the request\n");
+		if (parse_requests(conn, nf2devices, num_netfpgas) < 0) {
+			fprintf(stderr, "Error parsing the request\n");
+			conn->closing = 1;
+		}
+	} else if (events & (EPOLLERR | EPOLLHUP)) {
+		close_client(epfd, conn);
+		return;
+	}
+
+	if (flush_client(conn) < 0 || (conn->closing && conn->out_len == 0)) {
+		close_client(epfd, conn);
+		return;
+	}
+
+	/* stop reading while the client is not draining its replies */
+	want = 0;
+	if (!conn->closing && conn->out_len < OUT_HIGH_WATER)
+		want |= EPOLLIN;
+	if (conn->out_len > 0)
+		want |= EPOLLOUT;
+
+	if (want != conn->events) {
+		conn->events = want;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = want;
+		ev.data.ptr = conn;
+		epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+	}
+}
+
+void close_client(int epfd, struct proxy_conn *conn) {
+	DPRINTF("Closing connection to client\n");
+	epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	free(conn->out);
+	free(conn);
+}
+
+/* Writes queued replies until the socket would block.
+ * Returns -1 if the connection has failed */
+int flush_client(struct proxy_conn *conn) {
+	ssize_t nwritten;
+
+	while (conn->out_off < conn->out_len) {
+		nwritten = write(conn->fd, conn->out + conn->out_off,
+				conn->out_len - conn->out_off);
+		if (nwritten < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			perror("write");
+			return -1;
 		}
-		close(socket_to_client);
+		conn->out_off += nwritten;
 	}
 
+	if (conn->out_off == conn->out_len) {
+		conn->out_off = 0;
+		conn->out_len = 0;
+	}
 	return 0;
 }
 
+/* Queues a reply for the client */
+int queue_reply(struct proxy_conn *conn, const void *data, size_t len) {
+	char *out;
+	size_t cap;
+
+	if (conn->out_len + len > conn->out_cap) {
+		cap = conn->out_cap ? conn->out_cap : sizeof(conn->in);
+		while (cap < conn->out_len + len)
+			cap *= 2;
+		if ((out = (char *) realloc(conn->out, cap)) == NULL) {
+			fprintf(stderr, "Error: out of memory for a reply.\n");
+			return -1;
+		}
+		conn->out = out;
+		conn->out_cap = cap;
+	}
+
+	memcpy(conn->out + conn->out_len, data, len);
+	conn->out_len += len;
+	return 0;
+}
+
+/* Implements the register protocol:
+ * - Execute every complete legacy request (struct reg_request) or
+ *   version 2 frame in the input buffer, in order
+ * - Queue the replies
+ * Returns -1 if the connection should be dropped */
+int parse_requests(struct proxy_conn *conn, struct nf2device **nf2devices,
+		int num_netfpgas) {
+	size_t used = 0;
+	size_t len;
+	int ret = 0;
+
+	while (!conn->closing && used < conn->in_len) {
+		if ((uint8_t) conn->in[used] == REG_PROXY_MAGIC) {
+			ret = handle_frame(conn, conn->in + used, conn->in_len - used,
+					&len, nf2devices, num_netfpgas);
+		} else {
+			ret = handle_request(conn, conn->in + used, conn->in_len - used,
+					&len, nf2devices, num_netfpgas);
+		}
+
+		/* incomplete message, wait for the rest */
+		if (ret < 0 || len == 0)
+			break;
+		used += len;
+	}
+
+	/* keep any partial message at the start of the buffer */
+	if (used > 0) {
+		memmove(conn->in, conn->in + used, conn->in_len - used);
+		conn->in_len -= used;
+	}
+
+	return ret;
+}
+
+/* Executes one legacy request, *len is set to 0 if it is incomplete */
+int handle_request(struct proxy_conn *conn, const char *buf, size_t avail,
+		size_t *len, struct nf2device **nf2devices, int num_netfpgas) {
+	struct reg_request req;
+
+	*len = 0;
+	if (avail < sizeof(struct reg_request))
+		return 0;
+	*len = sizeof(struct reg_request);
+
+	memcpy(&req, buf, sizeof(struct reg_request));
+	DPRINTF("Received reg_request:\n");
+	dprint_req(&req);
+
+	/* execute request */
+	if (req.device_num < num_netfpgas) {
+		DPRINTF("Device num checks out.\n");
+		if (req.type == READ_REQ) {
+			DPRINTF("Executing read.\n");
+			readReg(nf2devices[req.device_num], req.address, &req.data);
+		} else if (req.type == WRITE_REQ) {
+			DPRINTF("Executing write.\n");
+			writeReg(nf2devices[req.device_num], req.address, req.data);
+		} else if (req.type == CHECK_REQ) {
+			DPRINTF("Executing check.\n");
+			req.data = 1;
+		} else if (req.type == OPEN_REQ) {
+			DPRINTF("Executing open.\n");
+			req.data = 1;
+		} else if (req.type == CLOSE_REQ) {
+			DPRINTF("Executing close.\n");
+			conn->closing = 1;
+		} else if (req.type == VERSION_REQ) {
+			DPRINTF("Executing version.\n");
+			req.data = REG_PROXY_VERSION;
+		} else {
+			fprintf(stderr, "Error: Unknown request type %u.\n", req.type);
+			req.error = -1;
+		}
+	} else {
+		DPRINTF("Device number bad.\n");
+		if (req.type == CHECK_REQ) {
+			DPRINTF("Executing check_req.\n");
+			req.data = 0;
+		} else {
+			DPRINTF("Executing else.\n");
+			req.error = -1;
+		}
+	}
+
+	/* send response */
+	DPRINTF("Sending response:\n");
+	dprint_req(&req);
+	return queue_reply(conn, &req, sizeof(struct reg_request));
+}
+
+/* Executes one version 2 frame, *len is set to 0 if it is incomplete.
+ * Runs of reads or writes go to the driver as one readRegs/writeRegs batch. */
+int handle_frame(struct proxy_conn *conn, const char *buf, size_t avail,
+		size_t *len, struct nf2device **nf2devices, int num_netfpgas) {
+	struct reg_frame_hdr hdr;
+	struct reg_op *ops;
+	struct nf2reg regs[REG_PROXY_MAX_OPS];
+	uint32_t num_ops, i, j, k;
+	int ret;
+
+	*len = 0;
+	if (avail < sizeof(struct reg_frame_hdr))
+		return 0;
+
+	memcpy(&hdr, buf, sizeof(struct reg_frame_hdr));
+	num_ops = ntohl(hdr.num_ops);
+	if (hdr.version != REG_PROXY_VERSION || num_ops > REG_PROXY_MAX_OPS) {
+		fprintf(stderr, "Error: bad frame, version %u with %u ops.\n",
+				hdr.version, num_ops);
+		hdr.error = -1;
+		hdr.num_ops = 0;
+		queue_reply(conn, &hdr, sizeof(struct reg_frame_hdr));
+		return -1;
+	}
+
+	if (avail < REG_FRAME_LEN(num_ops))
+		return 0;
+	*len = REG_FRAME_LEN(num_ops);
+
+	/* reply in place in a copy of the frame */
+	ops = (struct reg_op *) malloc(num_ops * sizeof(struct reg_op) + 1);
+	if (ops == NULL) {
+		fprintf(stderr, "Error: out of memory for a frame.\n");
+		return -1;
+	}
+	memcpy(ops, buf + sizeof(struct reg_frame_hdr), num_ops * sizeof(struct reg_op));
+
+	hdr.error = 0;
+	for (i = 0; i < num_ops; i = j) {
+		/* find the run of ops of the same type starting at i */
+		for (j = i + 1; j < num_ops && ops[j].type == ops[i].type; j++)
+			;
+
+		if (hdr.device_num >= num_netfpgas ||
+				(ops[i].type != READ_REQ && ops[i].type != WRITE_REQ)) {
+			for (k = i; k < j; k++)
+				ops[k].error = -1;
+			hdr.error = -1;
+			continue;
+		}
+
+		for (k = i; k < j; k++) {
+			regs[k - i].reg = ntohl(ops[k].address);
+			regs[k - i].val = ntohl(ops[k].data);
+		}
+
+		if (ops[i].type == READ_REQ)
+			ret = readRegs(nf2devices[hdr.device_num], regs, j - i);
+		else
+			ret = writeRegs(nf2devices[hdr.device_num], regs, j - i);
+
+		for (k = i; k < j; k++) {
+			ops[k].data = htonl(regs[k - i].val);
+			ops[k].error = ret < 0 ? -1 : 0;
+		}
+		if (ret < 0)
+			hdr.error = -1;
+	}
+
+	ret = queue_reply(conn, &hdr, sizeof(struct reg_frame_hdr));
+	if (ret == 0)
+		ret = queue_reply(conn, ops, num_ops * sizeof(struct reg_op));
+
+	free(ops);
+	return ret;
+}
+
 /* mallocs the array of nf2device structs and
  * populates them */
 void open_interfaces(struct nf2device **nf2devices, int num_netfpgas) {
@@ -202,80 +549,11 @@ void close_interfaces(struct nf2device **nf2devices, int num_netfpgas) {
 	}
 }
 
-/* Implements the register protocol:
- * - Read which device
- * - Read request (struct reg_request)
- * - Return result
- */
-int parse_request(int socket_to_client, struct nf2device **nf2devices,
-		int num_netfpgas) {
-	int nread;
-	struct reg_request req;
+void set_nonblocking(int fd) {
+	int flags;
 
-	/* Read the request struct */
-	while ( (nread=readn(socket_to_client, (char *)&req,
-			sizeof(struct reg_request))) == sizeof(struct reg_request)) {
-		DPRINTF("Received reg_request:\n");
-		dprint_req(&req);
-
-		/* execute request */
-		if (req.device_num < num_netfpgas) {
-			DPRINTF("Device num checks out.\n");
-			if (req.type == READ_REQ) {
-				DPRINTF("Executing read.\n");
-				readReg(nf2devices[req.device_num], req.address, &req.data);
-			} else if (req.type == WRITE_REQ) {
-				DPRINTF("Executing write.\n");
-				writeReg(nf2devices[req.device_num], req.address, req.data);
-			} else if (req.type == CHECK_REQ) {
-				DPRINTF("Executing check.\n");
-				req.data = 1;
-			} else if (req.type == OPEN_REQ) {
-				DPRINTF("Executing open.\n");
-				req.data = 1;
-			} else if (req.type == CLOSE_REQ) {
-				DPRINTF("Executing close.\n");
-				DPRINTF("Sending response:\n");
-				dprint_req(&req);
-				if (writen(socket_to_client, (const char *)&req,
-						sizeof(struct reg_request))
-						< sizeof(struct reg_request)) {
-					fprintf(stderr, "Error: could not write to client.\n");
-					return -1;
-				}
-				return 0;
-			} else {
-				fprintf(stderr, "Error: Unknown request type %u.\n", req.type);
-				req.error = -1;
-			}
-		} else {
-			DPRINTF("Device number bad.\n");
-			if (req.type == CHECK_REQ) {
-				DPRINTF("Executing check_req.\n");
-				req.data = 0;
-			} else {
-				DPRINTF("Executing else.\n");
-				req.error = -1;
-			}
-		}
-
-		/* send response */
-		DPRINTF("Sending response:\n");
-		dprint_req(&req);
-		if (writen(socket_to_client, (const char *)&req,
-				sizeof(struct reg_request)) < sizeof(struct reg_request)) {
-			fprintf(stderr, "Error: could not write to client.\n");
-			return -1;
-		}
-	}
-
-	if (nread == 0) {
-		return 0;
-	} else if (nread < 0) {
-		fprintf(stderr, "Error reading the reg_request struct.\n");
-		return -1;
-	} else if (nread < sizeof(struct reg_request)) {
-		fprintf(stderr, "Error: Did not read full reg_request struct.\n");
-		return -1;
+	if ((flags = fcntl(fd, F_GETFL, 0)) < 0 ||
+			fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		perror("fcntl");
 	}
 }
@@ -43,10 +43,47 @@
 
 #include "reg_proxy.h"
 
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+
 #define NF2C "nf2c"
 
+#define MAX_EVENTS 64
+
+/* stop reading from a client with this much unsent reply data */
+#define OUT_HIGH_WATER (4 * REG_FRAME_LEN(REG_PROXY_MAX_OPS))
+
+/*
+ * A client connection. The input buffer holds at least one maximum size
+ * frame so any complete message can be parsed in place.
+ */
+struct proxy_conn {
+	int fd;
+	uint32_t events;		/* epoll events currently registered */
+	int closing;			/* close once the replies are flushed */
+	char in[REG_FRAME_LEN(REG_PROXY_MAX_OPS)];
+	size_t in_len;
+	char *out;
+	size_t out_len;
+	size_t out_off;
+	size_t out_cap;
+};
+
 void open_interfaces(struct nf2device **nf2devices, int num_netfpgas);
 void close_interfaces(struct nf2device **nf2devices, int num_netfpgas);
-int parse_request (int socket_to_client, struct nf2device **nf2devices, int num_netfpgas);
+void set_nonblocking(int fd);
+void serve(int listening_socket, struct nf2device **nf2devices, int num_netfpgas);
+void accept_clients(int epfd, int listening_socket);
+void service_client(int epfd, struct proxy_conn *conn, uint32_t events,
+		struct nf2device **nf2devices, int num_netfpgas);
+void close_client(int epfd, struct proxy_conn *conn);
+int flush_client(struct proxy_conn *conn);
+int queue_reply(struct proxy_conn *conn, const void *data, size_t len);
+int parse_requests(struct proxy_conn *conn, struct nf2device **nf2devices, int num_netfpgas);
+int handle_request(struct proxy_conn *conn, const char *buf, size_t avail,
+		size_t *len, struct nf2device **nf2devices, int num_netfpgas);
+int handle_frame(struct proxy_conn *conn, const char *buf, size_t avail,
+		size_t *len, struct nf2device **nf2devices, int num_netfpgas);
 
 #endif /*REG_PROXY_SERVER_H_*/
@@ -33,3 +33,52 @@
 
 #define OQ_SHIFT        27
 #define LEN_SHIFT       19
+
+// layout of an event packet: eth, ip and udp headers, then the event system
+// version and number of monitored events, the packet sequence number, the size
+// of each output queue in words and packets, then the event words
+#define EVT_PKT_VER_OFF       42
+#define EVT_PKT_SEQ_OFF       44
+#define EVT_PKT_QSIZE_OFF     48
+#define EVT_PKT_HDR_LEN       112
+#define EVT_NUM_OQS           8
+
+#include <stdint.h>
+
+// binary record streams written by rcv_evts -w <prefix>, one file per output
+// queue (<prefix>.oq0 .. <prefix>.oq7) and one of queue sizes (<prefix>.qsize).
+// Each file starts with an evt_file_hdr followed by fixed size records in
+// capture order. Times are in ticks of the event capture timer.
+#define EVT_FILE_MAGIC        0x51545645  // "EVTQ" little endian
+#define EVT_FILE_VERSION      1
+#define EVT_FILE_QSIZE        0xff        // evt_file_hdr.oq of the queue size file
+
+#define EVT_REC_STORE         (ST_EVENT >> 30)
+#define EVT_REC_REMOVE        (RM_EVENT >> 30)
+#define EVT_REC_DROP          (DR_EVENT >> 30)
+
+#define EVT_REC_NO_TS         0x01        // no timestamp event seen yet, the upper time bits are unknown
+
+struct evt_file_hdr {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t  oq;
+  uint8_t  record_len;
+  uint64_t reserved;
+};
+
+struct evt_record {
+  uint64_t time;      // full timestamp rebuilt from the last TS event
+  uint32_t seq;       // sequence number of the event packet it came in
+  uint16_t len;       // packet length field of the event, in words
+  uint8_t  type;      // EVT_REC_STORE, EVT_REC_REMOVE or EVT_REC_DROP
+  uint8_t  flags;
+};
+
+struct evt_qsize_record {
+  uint64_t time;      // time of the first event in the packet
+  uint32_t seq;
+  uint32_t reserved;
+  uint32_t words[EVT_NUM_OQS];
+  uint32_t pkts[EVT_NUM_OQS];
+};
@@ -3,7 +3,17 @@
  *
  * Module: rcv_evts.c
  * Project: UNET-SWITCH4-with_buffer_sizing
- * Description:
+ * Description: receives event capture packets and decodes the store, remove
+ *              and drop events in them. Events go to one binary record file
+ *              per output queue (-w), written through a memory mapped window,
+ *              with full timestamps rebuilt from the timestamp events. Text
+ *              output is optional: per event with -v, totals with -s.
+ *              Offline captures (-o, -f) are replayed from a memory mapped
+ *              pcap file.
+ *              The occupancy of each output queue is rebuilt from the events
+ *              and the queue size snapshots as they arrive, and kept in
+ *              histograms of occupancy (weighted by time) and of the sojourn
+ *              time of each packet; -I prints their percentiles per interval.
  *
  * Change history:
  *
@@ -13,12 +23,17 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include <time.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 
 #include <net/if.h>
 
@@ -34,14 +49,42 @@
 #define PATHLEN         80
 
 #define DEFAULT_IFACE   "nf2c0"
+#define DEFAULT_OFFLINE_FILE "teth_file"
 
 #define SNAPLEN 1518
 
+#define DEFAULT_BUFFER_MB 32      // kernel capture buffer, a full one is where the drops come from
+#define READ_TIMEOUT_MS 100
+
+#define COLUMN_WINDOW (4 << 20)   // bytes of a record file mapped at a time
+
+#define DEFAULT_TICK_NS 8         // event timer resolution
+#define SUMMARY_INTERVAL_MS 1000  // how often the totals are brought up to date without -I
+#define MAX_EMPTY_INTERVALS 1000  // idle intervals printed before skipping to the next event
+#define FIFO_INITIAL 1024
+
+/*
+  Log-linear histogram in the manner of HdrHistogram: values below HIST_SUB are
+  counted exactly, above that each power of two is split into HIST_HALF buckets
+  so a value is known to within 1/HIST_HALF of itself. Only the range of buckets
+  touched is walked when merging or clearing.
+*/
+#define HIST_SUB_BITS   8
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_HALF       (HIST_SUB / 2)
+#define HIST_BUCKETS    (HIST_SUB + ((64 - HIST_SUB_BITS) * HIST_HALF))
+
 /* Global vars */
 static struct nf2device nf2;
 static int verbose = 0;
 static int very_verbose = 0;
+static int summary = 0;
 static u_short cap_ethertype = CAP_ETHERTYPE;
+static char *offline_file = NULL;
+static char *out_prefix = NULL;
+static unsigned buffer_mb = DEFAULT_BUFFER_MB;
+static unsigned interval_ms = 0;
+static unsigned tick_ns = DEFAULT_TICK_NS;
 
 /*  Libnet variables */
 char libnet_errbuf[LIBNET_ERRBUF_SIZE];
@@ -51,6 +94,86 @@ libnet_t *lt;   // Main libnet data structure
 char pcap_errbuf[PCAP_ERRBUF_SIZE];
 pcap_t *pcap_capture_descr; // for capturing received packets
 
+/*
+  A record file, appended to through a window of it mapped at a time. The file
+  is grown a window ahead and cut to what was written when it is closed.
+*/
+struct column {
+  int fd;
+  char *map;          // the mapped window
+  off_t map_off;      // file offset of the window
+  size_t used;        // bytes written into the window
+  uint64_t records;
+};
+
+/* Decoder state, carried across packets */
+struct decoder {
+  uint64_t time_hi;   // timestamp of the last TS event with the low TIME bits cleared
+  uint32_t last_low;  // low TIME bits of the last event
+  int have_ts;
+  uint32_t last_seq;
+  int have_seq;
+
+  uint64_t store_events[EVT_NUM_OQS];
+  uint64_t remove_events[EVT_NUM_OQS];
+  uint64_t drop_events[EVT_NUM_OQS];
+  uint64_t ts_events;
+  uint64_t time_wraps;    // low TIME bits rolled over with no TS event between
+  uint64_t evt_pkts;
+  uint64_t other_pkts;    // wrong ethertype
+  uint64_t short_pkts;    // truncated before the end of the queue sizes
+  uint64_t seq_gaps;      // event packets missing by sequence number
+  uint64_t bytes;
+};
+
+struct hist {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total;     // sum of the counts
+  uint64_t max;
+  int lo, hi;         // buckets touched, lo > hi when empty
+};
+
+/*
+  What is known of an output queue. A queue is synced from a queue size
+  snapshot, and out of sync again from the first event packet lost until the
+  next snapshot: occupancy is only accounted while it is known.
+*/
+struct oq_state {
+  int synced;
+  int64_t words;
+  int64_t pkts;
+  uint64_t last_change;   // time the occupancy has been accounted up to
+
+  uint64_t *fifo;         // store times of the packets in the queue, oldest first
+  size_t fifo_size;
+  size_t fifo_head;
+  size_t fifo_count;
+  uint64_t unknown;       // packets already queued at the last sync, their store times unseen
+
+  uint64_t stores, removes, drops;  // this interval
+  uint64_t resyncs;
+  uint64_t underflows;    // removes that took the queue below empty
+  uint64_t orphans;       // removes with no packet left to match
+
+  struct hist occ;        // occupancy in words, weighted by ticks, this interval
+  struct hist occ_total;
+  struct hist sojourn;    // ticks from store to remove, this interval
+  struct hist sojourn_total;
+};
+
+struct occupancy {
+  int enabled;
+  int started;
+  uint64_t interval;      // in ticks
+  uint64_t interval_end;
+  struct oq_state oq[EVT_NUM_OQS];
+};
+
+static struct decoder dec;
+static struct occupancy occ;
+static struct column columns[EVT_NUM_OQS];
+static struct column qsize_column;
+
 
 /* Function declarations */
 void processArgs (int , char **);
@@ -60,27 +183,28 @@ void CloseNetwork(void);
 void ReceivePackets(void);
 void ReceiveSinglePacket(u_char *, const struct pcap_pkthdr*, const u_char* );
 void processOfflinePkts ();
-
-int store_events[8];
-int drop_events[8];
-int remove_events[8];
-double running_time=0;
+int replayMappedFile(const char *, double *);
+void openColumns(const char *);
+void closeColumns(void);
+void printSummary(FILE *);
+void occInit(void);
+void occFinish(void);
+
+unsigned running_time=0;
 u_char offline=0;
 
 int main(int argc, char *argv[])
 {
-  unsigned val;
-  int i;
-
   nf2.device_name = DEFAULT_IFACE;
 
-
   processArgs(argc, argv);
 
-  for(i=0; i<8; i++){
-    store_events[i]=0;
-    drop_events[i]=0;
-    remove_events[i]=0;
+  memset(&dec, 0, sizeof(dec));
+  if (out_prefix) {
+    openColumns(out_prefix);
+  }
+  if (interval_ms || summary) {
+    occInit();
   }
 
   if(!offline){
@@ -91,214 +215,730 @@ int main(int argc, char *argv[])
     processOfflinePkts();
   }
 
+  if (out_prefix) {
+    closeColumns();
+  }
+  if (occ.enabled) {
+    occFinish();
+  }
+  if (summary) {
+    printSummary(stdout);
+  }
+
   return 0;
 }
 
+static inline uint32_t be32(const u_char *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static double now_sec()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + (tv.tv_usec / 1e6);
+}
+
+/*
+  Record files
+*/
+
+static void columnMap(struct column *col)
+{
+  if (ftruncate(col->fd, col->map_off + COLUMN_WINDOW) != 0) {
+    perror("ftruncate");
+    exit(1);
+  }
+  col->map = mmap(NULL, COLUMN_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED, col->fd, col->map_off);
+  if (col->map == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  col->used = 0;
+}
+
+static inline void columnAppend(struct column *col, const void *rec, size_t len)
+{
+  size_t room = COLUMN_WINDOW - col->used;
+
+  if (len <= room) {
+    memcpy(col->map + col->used, rec, len);
+    col->used += len;
+  } else {
+    /* the record straddles two windows */
+    memcpy(col->map + col->used, rec, room);
+    munmap(col->map, COLUMN_WINDOW);
+    col->map_off += COLUMN_WINDOW;
+    columnMap(col);
+    memcpy(col->map, (const char *)rec + room, len - room);
+    col->used = len - room;
+  }
+  col->records++;
+}
+
+static void columnOpen(struct column *col, const char *path, uint8_t oq, uint8_t record_len)
+{
+  struct evt_file_hdr hdr;
+
+  col->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (col->fd < 0) {
+    fprintf(stderr, "Err: unable to open %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+  col->map_off = 0;
+  col->records = 0;
+  columnMap(col);
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = EVT_FILE_MAGIC;
+  hdr.version = EVT_FILE_VERSION;
+  hdr.oq = oq;
+  hdr.record_len = record_len;
+  columnAppend(col, &hdr, sizeof(hdr));
+  col->records = 0;
+}
+
+static void columnClose(struct column *col)
+{
+  munmap(col->map, COLUMN_WINDOW);
+  if (ftruncate(col->fd, col->map_off + col->used) != 0) {
+    perror("ftruncate");
+  }
+  close(col->fd);
+}
+
+void openColumns(const char *prefix)
+{
+  char path[PATHLEN + 16];
+  int i;
+
+  for (i = 0; i < EVT_NUM_OQS; i++) {
+    snprintf(path, sizeof(path), "%s.oq%d", prefix, i);
+    columnOpen(&columns[i], path, i, sizeof(struct evt_record));
+  }
+  snprintf(path, sizeof(path), "%s.qsize", prefix);
+  columnOpen(&qsize_column, path, EVT_FILE_QSIZE, sizeof(struct evt_qsize_record));
+}
+
+void closeColumns()
+{
+  int i;
+
+  for (i = 0; i < EVT_NUM_OQS; i++) {
+    columnClose(&columns[i]);
+  }
+  columnClose(&qsize_column);
+}
+
+/*
+  Histograms
+*/
+
+static inline int histIndex(uint64_t v)
+{
+  if (v < HIST_SUB) {
+    return v;
+  }
+  int e = (63 - __builtin_clzll(v)) - (HIST_SUB_BITS - 1);
+  return HIST_SUB + ((e - 1) * HIST_HALF) + (int)(v >> e) - HIST_HALF;
+}
+
+/* the highest value counted in a bucket */
+static uint64_t histBucketValue(int idx)
+{
+  if (idx < HIST_SUB) {
+    return idx;
+  }
+  int e = ((idx - HIST_SUB) / HIST_HALF) + 1;
+  uint64_t m = ((idx - HIST_SUB) % HIST_HALF) + HIST_HALF;
+  return ((m + 1) << e) - 1;
+}
+
+static void histClear(struct hist *h)
+{
+  if (h->lo <= h->hi) {
+    memset(&h->counts[h->lo], 0, (h->hi - h->lo + 1) * sizeof(uint64_t));
+  }
+  h->total = 0;
+  h->max = 0;
+  h->lo = HIST_BUCKETS;
+  h->hi = -1;
+}
+
+static inline void histRecord(struct hist *h, uint64_t v, uint64_t n)
+{
+  int idx = histIndex(v);
+
+  h->counts[idx] += n;
+  h->total += n;
+  if (v > h->max) h->max = v;
+  if (idx < h->lo) h->lo = idx;
+  if (idx > h->hi) h->hi = idx;
+}
+
+static void histMerge(struct hist *dst, const struct hist *src)
+{
+  int i;
+
+  for (i = src->lo; i <= src->hi; i++) {
+    dst->counts[i] += src->counts[i];
+  }
+  dst->total += src->total;
+  if (src->max > dst->max) dst->max = src->max;
+  if (src->lo < dst->lo) dst->lo = src->lo;
+  if (src->hi > dst->hi) dst->hi = src->hi;
+}
+
+/* the value at or below which the fraction p of the counts lie */
+static uint64_t histPercentile(const struct hist *h, double p)
+{
+  uint64_t target = (uint64_t)(p * h->total);
+  uint64_t seen = 0;
+  int i;
+
+  if (h->total == 0) {
+    return 0;
+  }
+  if (target == 0) {
+    target = 1;
+  }
+  for (i = h->lo; i <= h->hi; i++) {
+    seen += h->counts[i];
+    if (seen >= target) {
+      uint64_t v = histBucketValue(i);
+      return (v < h->max) ? v : h->max;
+    }
+  }
+  return h->max;
+}
+
+/*
+  Queue occupancy. Stores and removes move the occupancy of their queue and the
+  time spent at each occupancy goes into its histogram. A packet's store time
+  waits in the queue's fifo for its remove, output queues being first in first
+  out, and the difference is its sojourn time. Drops never enter the queue.
+*/
+
+static double ticksToUs(uint64_t ticks)
+{
+  return (ticks * (double)tick_ns) / 1e3;
+}
+
+void occInit()
+{
+  int i;
+
+  memset(&occ, 0, sizeof(occ));
+  occ.enabled = 1;
+  occ.interval = ((interval_ms ? interval_ms : SUMMARY_INTERVAL_MS) * 1000000ULL) / tick_ns;
+  for (i = 0; i < EVT_NUM_OQS; i++) {
+    struct oq_state *q = &occ.oq[i];
+    q->fifo_size = FIFO_INITIAL;
+    q->fifo = malloc(q->fifo_size * sizeof(uint64_t));
+    if (q->fifo == NULL) {
+      perror("malloc");
+      exit(1);
+    }
+    histClear(&q->occ);
+    histClear(&q->occ_total);
+    histClear(&q->sojourn);
+    histClear(&q->sojourn_total);
+  }
+  if (interval_ms) {
+    printf("# time_s oq stores removes drops occ_p50 occ_p99 occ_p99.9 occ_max"
+           " sojourn_p50_us sojourn_p99_us sojourn_p99.9_us sojourn_max_us\n");
+  }
+}
+
+static inline void occAccount(struct oq_state *q, uint64_t t)
+{
+  if (t > q->last_change) {
+    histRecord(&q->occ, q->words, t - q->last_change);
+    q->last_change = t;
+  }
+}
+
+static void fifoPush(struct oq_state *q, uint64_t t)
+{
+  if (q->fifo_count == q->fifo_size) {
+    uint64_t *bigger = malloc(2 * q->fifo_size * sizeof(uint64_t));
+    size_t i;
+    if (bigger == NULL) {
+      perror("malloc");
+      exit(1);
+    }
+    for (i = 0; i < q->fifo_count; i++) {
+      bigger[i] = q->fifo[(q->fifo_head + i) & (q->fifo_size - 1)];
+    }
+    free(q->fifo);
+    q->fifo = bigger;
+    q->fifo_size *= 2;
+    q->fifo_head = 0;
+  }
+  q->fifo[(q->fifo_head + q->fifo_count) & (q->fifo_size - 1)] = t;
+  q->fifo_count++;
+}
+
+static void occPrintInterval(int oq, struct oq_state *q, uint64_t end)
+{
+  printf("%.6f %d %llu %llu %llu %llu %llu %llu %llu %.3f %.3f %.3f %.3f\n",
+         (end * (double)tick_ns) / 1e9, oq,
+         (unsigned long long)q->stores, (unsigned long long)q->removes, (unsigned long long)q->drops,
+         (unsigned long long)histPercentile(&q->occ, 0.5), (unsigned long long)histPercentile(&q->occ, 0.99),
+         (unsigned long long)histPercentile(&q->occ, 0.999), (unsigned long long)q->occ.max,
+         ticksToUs(histPercentile(&q->sojourn, 0.5)), ticksToUs(histPercentile(&q->sojourn, 0.99)),
+         ticksToUs(histPercentile(&q->sojourn, 0.999)), ticksToUs(q->sojourn.max));
+}
+
+/* close the interval at end: print it and fold it into the totals */
+static void occFlush(uint64_t end)
+{
+  int i;
+
+  for (i = 0; i < EVT_NUM_OQS; i++) {
+    struct oq_state *q = &occ.oq[i];
+    if (q->synced) {
+      occAccount(q, end);
+    }
+    if (interval_ms && (q->occ.max || q->stores || q->removes || q->drops)) {
+      occPrintInterval(i, q, end);
+    }
+    histMerge(&q->occ_total, &q->occ);
+    histMerge(&q->sojourn_total, &q->sojourn);
+    histClear(&q->occ);
+    histClear(&q->sojourn);
+    q->stores = q->removes = q->drops = 0;
+  }
+  if (interval_ms) {
+    fflush(stdout);
+  }
+}
+
+static inline void occAdvance(uint64_t t)
+{
+  if (!occ.started) {
+    occ.interval_end = ((t / occ.interval) + 1) * occ.interval;
+    occ.started = 1;
+  }
+  if (t < occ.interval_end) {
+    return;
+  }
+  if ((t - occ.interval_end) / occ.interval > MAX_EMPTY_INTERVALS) {
+    /* a long quiet spell, or the timers were reset: one interval up to here */
+    occFlush(t);
+    occ.interval_end = ((t / occ.interval) + 1) * occ.interval;
+    return;
+  }
+  while (t >= occ.interval_end) {
+    occFlush(occ.interval_end);
+    occ.interval_end += occ.interval;
+  }
+}
+
+static inline void occEvent(uint32_t oq, uint32_t type, uint32_t len, uint64_t t)
+{
+  struct oq_state *q = &occ.oq[oq];
+
+  occAdvance(t);
+  switch (type) {
+  case ST_EVENT:
+    q->stores++;
+    if (!q->synced) break;
+    occAccount(q, t);
+    q->words += len;
+    q->pkts++;
+    fifoPush(q, t);
+    break;
+  case RM_EVENT:
+    q->removes++;
+    if (!q->synced) break;
+    occAccount(q, t);
+    q->words -= len;
+    q->pkts--;
+    if (q->words < 0 || q->pkts < 0) {
+      q->underflows++;
+      q->words = (q->words < 0) ? 0 : q->words;
+      q->pkts = (q->pkts < 0) ? 0 : q->pkts;
+    }
+    if (q->unknown) {
+      q->unknown--;
+    } else if (q->fifo_count) {
+      histRecord(&q->sojourn, t - q->fifo[q->fifo_head], 1);
+      q->fifo_head = (q->fifo_head + 1) & (q->fifo_size - 1);
+      q->fifo_count--;
+    } else {
+      q->orphans++;
+    }
+    break;
+  default:
+    q->drops++;
+    break;
+  }
+}
+
+/* events were lost, nothing is known of the queues until the next snapshot */
+static void occDesync()
+{
+  int i;
+
+  for (i = 0; i < EVT_NUM_OQS; i++) {
+    occ.oq[i].synced = 0;
+  }
+}
+
+/*
+  The queue sizes in an event packet are read as it is sent, after the last of
+  its events: queues out of sync take them as their occupancy from then on.
+*/
+static void occSnapshot(const u_char *packet, uint64_t t)
+{
+  int i;
+
+  occAdvance(t);
+  for (i = 0; i < EVT_NUM_OQS; i++) {
+    struct oq_state *q = &occ.oq[i];
+    if (q->synced) {
+      continue;
+    }
+    q->words = be32(packet + EVT_PKT_QSIZE_OFF + (8 * i));
+    q->pkts = be32(packet + EVT_PKT_QSIZE_OFF + (8 * i) + 4);
+    q->unknown = q->pkts;
+    q->fifo_head = q->fifo_count = 0;
+    q->last_change = t;
+    q->synced = 1;
+    q->resyncs++;
+  }
+}
+
+void occFinish()
+{
+  int i;
+
+  if (occ.started) {
+    occFlush(dec.time_hi | dec.last_low);
+  }
+  for (i = 0; i < EVT_NUM_OQS; i++) {
+    free(occ.oq[i].fifo);
+    occ.oq[i].fifo = NULL;
+  }
+}
+
+static void printOccupancy(FILE *fp)
+{
+  int i;
+
+  fprintf(fp, "Queue  occupancy (words) p50/p99/p99.9/max       sojourn (us) p50/p99/p99.9/max        syncs underflows orphans\n");
+  for (i = 0; i < EVT_NUM_OQS; i++) {
+    struct oq_state *q = &occ.oq[i];
+    fprintf(fp, "oq%d    %-8llu %-8llu %-8llu %-8llu        %-10.3f %-10.3f %-10.3f %-10.3f %-5llu %-10llu %llu\n", i,
+            (unsigned long long)histPercentile(&q->occ_total, 0.5), (unsigned long long)histPercentile(&q->occ_total, 0.99),
+            (unsigned long long)histPercentile(&q->occ_total, 0.999), (unsigned long long)q->occ_total.max,
+            ticksToUs(histPercentile(&q->sojourn_total, 0.5)), ticksToUs(histPercentile(&q->sojourn_total, 0.99)),
+            ticksToUs(histPercentile(&q->sojourn_total, 0.999)), ticksToUs(q->sojourn_total.max),
+            (unsigned long long)q->resyncs, (unsigned long long)q->underflows, (unsigned long long)q->orphans);
+  }
+}
+
+/*
+  Offline replay
+*/
+
 void processOfflinePkts () {
   u_char rcv_finished = 0;
-  char *ebuf;
+  double start = now_sec();
+  double mbytes = 0;
 
   if(very_verbose) printf("starting offline process\n");
 
-  fflush(NULL);
+  /* classic pcap files are walked in place, anything else goes through libpcap */
+  if (replayMappedFile(offline_file, &mbytes) != 0) {
+    pcap_t *p_descr=pcap_open_offline(offline_file, pcap_errbuf);
+    if(p_descr==NULL){
+      printf("couldn't open offline file for processing. Error: %s\n", pcap_errbuf);
+      return;
+    }
+    if(very_verbose) printf("offline file opened\n");
 
-  pcap_t *p_descr=pcap_open_offline("teth_file", ebuf);
-  if(p_descr==NULL){
-    printf("couldn't open offline file for processing. Error: %s\n", ebuf);
-    return;
+    pcap_loop(p_descr, 0, ReceiveSinglePacket, &rcv_finished);
+    pcap_close(p_descr);
+    mbytes = dec.bytes / 1e6;
   }
-  if(very_verbose) printf("offline file opened\n");
 
-  fflush(NULL);
+  double elapsed = now_sec() - start;
+  fprintf(stderr, "Replayed %llu packets, %.1f MB in %.3f s (%.1f MB/s)\n",
+          (unsigned long long)(dec.evt_pkts + dec.other_pkts + dec.short_pkts), mbytes, elapsed,
+          (elapsed > 0) ? mbytes / elapsed : 0.0);
+}
 
-  pcap_loop(p_descr, 0, ReceiveSinglePacket, &rcv_finished);
+#define PCAP_MAGIC_US         0xa1b2c3d4
+#define PCAP_MAGIC_NS         0xa1b23c4d
+#define PCAP_SWAP32(x)        ((((x) & 0xff) << 24) | (((x) & 0xff00) << 8) | (((x) >> 8) & 0xff00) | ((x) >> 24))
 
-  if(very_verbose) printf("Looping over offline file\n");
-  fflush(NULL);
+struct mapped_pcap_rec {
+  uint32_t ts_sec;
+  uint32_t ts_frac;
+  uint32_t caplen;
+  uint32_t len;
+};
 
-  pcap_close(p_descr);
+/*
+  Walks a classic pcap file mapped in memory, handing each packet to the decoder
+  without copying it. Returns -1 if the file is not one, pcapng for instance.
+*/
+int replayMappedFile(const char *path, double *mbytes)
+{
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct pcap_file_header)) {
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+
+  u_char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  uint32_t magic = ((struct pcap_file_header *)map)->magic;
+  int swapped = (magic == PCAP_SWAP32(PCAP_MAGIC_US)) || (magic == PCAP_SWAP32(PCAP_MAGIC_NS));
+  if (swapped) {
+    magic = PCAP_SWAP32(magic);
+  }
+  if (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS) {
+    munmap(map, st.st_size);
+    return -1;
+  }
+
+  u_char rcv_finished = 0;
+  struct pcap_pkthdr hdr;
+  size_t off = sizeof(struct pcap_file_header);
+  while (off + sizeof(struct mapped_pcap_rec) <= (size_t)st.st_size) {
+    struct mapped_pcap_rec *rec = (struct mapped_pcap_rec *)(map + off);
+    uint32_t caplen = swapped ? PCAP_SWAP32(rec->caplen) : rec->caplen;
+    uint32_t frac = swapped ? PCAP_SWAP32(rec->ts_frac) : rec->ts_frac;
+
+    off += sizeof(struct mapped_pcap_rec);
+    if (off + caplen > (size_t)st.st_size) {
+      fprintf(stderr, "Warning: capture truncated in the last packet\n");
+      break;
+    }
+
+    hdr.ts.tv_sec = swapped ? PCAP_SWAP32(rec->ts_sec) : rec->ts_sec;
+    hdr.ts.tv_usec = (magic == PCAP_MAGIC_NS) ? frac / 1000 : frac;
+    hdr.caplen = caplen;
+    hdr.len = swapped ? PCAP_SWAP32(rec->len) : rec->len;
+    ReceiveSinglePacket(&rcv_finished, &hdr, map + off);
+    off += caplen;
+  }
+
+  *mbytes = st.st_size / 1e6;
+  munmap(map, st.st_size);
+  return 0;
 }
 
 /*
-  Keep calling the pcap_dispatch forever.
+  Keep calling the pcap_dispatch until the running time is up, forever without
+  one. With -s the totals and the pcap drops are printed every second.
 */
 
 void ReceivePackets ()
 {
   u_char rcv_finished = 0;
-  int rc=1;
+  int rc=0;
 
-  time_t initial_time=time(NULL);
-  double diff_time=0;
+  double initial_time=now_sec();
+  double last_summary=initial_time;
+  double now;
 
-  while (rc==1)
+  while (rc >= 0)
     {
-      rc=pcap_dispatch(pcap_capture_descr, 0, ReceiveSinglePacket, &rcv_finished);
-      diff_time=difftime(time(NULL), initial_time);
-      if(very_verbose) printf("i've been running for %u \n", diff_time);
+      rc=pcap_dispatch(pcap_capture_descr, -1, ReceiveSinglePacket, &rcv_finished);
+      now=now_sec();
+      if (running_time && (now - initial_time >= running_time)) {
+        break;
+      }
+      if (summary && (now - last_summary >= 1)) {
+        printSummary(stdout);
+        last_summary = now;
+      }
     }
+  if (rc < 0) {
+    fprintf(stderr, "pcap_dispatch(): %s\n", pcap_geterr(pcap_capture_descr));
+  }
 }
 
 
+static const char *evt_names[] = { "Timestamp", "Store ", "Remove", "Drop  " };
 
 /*
   ReceiveSinglePacket is the callback used to process
-  a single incoming packet.
+  a single incoming packet. Each event word is loaded once, text is only
+  produced when asked for.
 */
 
 void ReceiveSinglePacket(u_char *rcv_finished,
                          const struct pcap_pkthdr* pkthdr,
                          const u_char* packet) {
 
-  unsigned int* payload = NULL;
-  u_short ethertype;
+  u_int len = (pkthdr->caplen < pkthdr->len) ? pkthdr->caplen : pkthdr->len;
+  u_int i;
 
-  u_int len;
-  u_int len_off_wire;
-  char c;
-  unsigned char *pkt_ptr=(unsigned char *)packet;
-
-  long total_time=0;
-  long time_diff;
-  long time_LSB;
-  long time_MSB;
-
-  unsigned char oq;
-  int evt_len;
-
-  // fprintf(stderr,"\ncaplen %d  len %d\n", pkthdr->caplen, pkthdr->len );
-
-  int i;
-  //for (i=0;i<26;i++) { c = packet[i]; fprintf(stderr, "%02x ", (uint8_t) c); }
-  //fprintf(stderr,"\n");
+  dec.bytes += pkthdr->caplen;
 
   /*
      Extract the ethertype and just return if the ethertype doesnt match the
      ethertype of packets we care about.
   */
-
-  memcpy(&ethertype, (u_char *)(packet+12), sizeof(u_short)); // get ethertype
-  ethertype = ntohs(ethertype);
-
-  if (ethertype != cap_ethertype)
+  if (len < 14 || (((packet[12] << 8) | packet[13]) != cap_ethertype))
     {
-      if (very_verbose) { fprintf(stderr,"Ethertype 0x%04x doesn't match desired ethertype 0x%04x\n",
-                                  ethertype, cap_ethertype); }
+      if (very_verbose && len >= 14) { fprintf(stderr,"Ethertype 0x%04x doesn't match desired ethertype 0x%04x\n",
+                                               (packet[12] << 8) | packet[13], cap_ethertype); }
+      dec.other_pkts++;
       return;
     }
+  if (len < EVT_PKT_HDR_LEN) {
+    dec.short_pkts++;
+    return;
+  }
+  dec.evt_pkts++;
 
-  len_off_wire =  pkthdr->len;
   if(very_verbose) { //print out the raw data
-    for (i=0; i<len_off_wire; i+=4){
-      printf("[%04u] %02x %02x %02x %02x\n", i, pkt_ptr[i], pkt_ptr[i+1], pkt_ptr[i+2], pkt_ptr[i+3]);
+    for (i=0; i+4<=len; i+=4){
+      printf("[%04u] %02x %02x %02x %02x\n", i, packet[i], packet[i+1], packet[i+2], packet[i+3]);
     }
   }
-  payload = (unsigned int *) packet;
-
-  // print the packet header
-  printf("Dst Mac          : %08x%04x\n", ntohl(*payload++), (ntohl(*payload)&0xffff0000)>>16);
-  printf("Src Mac          : %04x%08x\n", (ntohl(*payload++) & 0xffff), ntohl(*payload++));
-  printf("Ethertype        : %04x\n", (ntohl(*payload) & 0xffff0000)>>16);
-  printf("IP version       : %u\n", (ntohl(*payload) & 0x0000f000)>>12);
-  printf("IP Hdr length    : %u\n", (ntohl(*payload) & 0x00000f00)>>8);
-  printf("TOS              : %02x\n", (ntohl(*payload++) & 0x000000ff));
-  printf("IP total length  : %u\n", (ntohl(*payload) & 0xffff0000)>>16);
-  printf("IP id            : %04x\n", (ntohl(*payload++) & 0xffff));
-  printf("IP flags & frags : %04x\n", (ntohl(*payload) & 0xffff0000)>>16);
-  printf("IP TTL           : %u\n", (ntohl(*payload) & 0x0000ff00)>>8);
-  printf("IP protocol      : %02x\n", (ntohl(*payload++) & 0xff));
-  printf("IP checksum      : %04x\n", (ntohl(*payload) & 0xffff0000)>>16);
-  printf("IP src addr      : %08x\n", (ntohl(*payload++) & 0xffff), (ntohl(*payload) & 0xffff0000)>>16);
-  printf("IP dst addr      : %08x\n", (ntohl(*payload++) & 0xffff), (ntohl(*payload) & 0xffff0000)>>16);
-  printf("UDP src port     : %u\n", (ntohl(*payload++) & 0xffff));
-  printf("UDP dst port     : %u\n", (ntohl(*payload) & 0xffff0000)>>16);
-  printf("UDP length       : %u\n", (ntohl(*payload++) & 0xffff));
-  printf("UDP checksum     : %04x\n", (ntohl(*payload) & 0xffff0000)>>16);
-  printf("Evt system ver   : %01x\n", (ntohl(*payload) & 0x0f00)>>8);
-  printf("Num mon'ed evts  : %u\n", (ntohl(*payload++) & 0x00ff));
-  printf("Packet seq num   : %u\n", ntohl(*payload++));
-  printf("Queue 0 size (word)      : %u\n", ntohl(*payload++));
-  printf("Queue 0 size (packet)    : %u\n", ntohl(*payload++));
-  printf("Queue 1 size (word)      : %u\n", ntohl(*payload++));
-  printf("Queue 1 size (packet)    : %u\n", ntohl(*payload++));
-  printf("Queue 2 size (word)      : %u\n", ntohl(*payload++));
-  printf("Queue 2 size (packet)    : %u\n", ntohl(*payload++));
-  printf("Queue 3 size (word)      : %u\n", ntohl(*payload++));
-  printf("Queue 3 size (packet)    : %u\n", ntohl(*payload++));
-  printf("Queue 4 size (word)      : %u\n", ntohl(*payload++));
-  printf("Queue 4 size (packet)    : %u\n", ntohl(*payload++));
-  printf("Queue 5 size (word)      : %u\n", ntohl(*payload++));
-  printf("Queue 5 size (packet)    : %u\n", ntohl(*payload++));
-  printf("Queue 6 size (word)      : %u\n", ntohl(*payload++));
-  printf("Queue 6 size (packet)    : %u\n", ntohl(*payload++));
-  printf("Queue 7 size (word)      : %u\n", ntohl(*payload++));
-  printf("Queue 7 size (packet)    : %u\n", ntohl(*payload++));
-
-  printf("Real Packet len  : %u\n", len_off_wire);
-  //len=len_off_wire-14-20-8-6-8*4; // remove header length
-  len = len_off_wire-14*8;
-  len=len/4;    // turn into 32-bit words
-
-  for (i=0;i<len;i++){
-    if(very_verbose){
-      printf("Payload word: 0x%08x\n", ntohl(*payload));
-      printf("Event type: 0x%08x\n", ntohl(*payload)&EVENT_TYPE_MASK);
+
+  uint32_t seq = be32(packet + EVT_PKT_SEQ_OFF);
+  if (dec.have_seq && seq != dec.last_seq + 1) {
+    dec.seq_gaps += seq - dec.last_seq - 1;
+    if (occ.enabled) {
+      occDesync();
     }
-    switch(ntohl(*payload)&EVENT_TYPE_MASK){
-    case TS_EVENT:
+  }
+  dec.last_seq = seq;
+  dec.have_seq = 1;
 
-      total_time=0;
-      time_MSB = ntohl(*payload++) & (~EVENT_TYPE_MASK);
-      time_LSB = ntohl(*payload++) & (~TIME_MASK); payload = payload - 2;
+  if (verbose) {
+    printf("Packet seq num   : %u, %u mon'ed evts, len %u\n", seq, packet[EVT_PKT_VER_OFF + 1], len);
+  }
 
-      if (verbose) {
-         printf("Timestamp Event  : 0x%08x", ntohl(*payload++)&(~EVENT_TYPE_MASK));
-         printf("%08x\n", ntohl(*payload++));
-        payload = payload - 2;
+  struct evt_qsize_record qs;
+  struct evt_record rec;
+  if (out_prefix) {
+    qs.seq = seq;
+    qs.reserved = 0;
+    for (i = 0; i < EVT_NUM_OQS; i++) {
+      qs.words[i] = be32(packet + EVT_PKT_QSIZE_OFF + (8 * i));
+      qs.pkts[i] = be32(packet + EVT_PKT_QSIZE_OFF + (8 * i) + 4);
+    }
+  }
+
+  const u_char *p = packet + EVT_PKT_HDR_LEN;
+  const u_char *end = packet + EVT_PKT_HDR_LEN + (((len - EVT_PKT_HDR_LEN) / 4) * 4);
+  int first = 1;
+
+  while (p < end) {
+    uint32_t word = be32(p);
+    uint32_t type = word & EVENT_TYPE_MASK;
+    p += 4;
+
+    if (type == TS_EVENT) {
+      if (p >= end) {
+        break;
       }
-      payload = payload + 2;
-      i++;
-      break;
-    case ST_EVENT:
-      oq = ((ntohl(*payload) & OQ_MASK)>>OQ_SHIFT);
-      evt_len = (ntohl(*payload) & LENGTH_MASK) >> LEN_SHIFT;
-      time_diff = ((ntohl(*payload++) & TIME_MASK));
-      total_time += time_diff;
+      uint32_t lsb = be32(p);
+      p += 4;
+      dec.time_hi = ((uint64_t)(word & ~EVENT_TYPE_MASK) << 32) | (lsb & ~TIME_MASK);
+      dec.last_low = lsb & TIME_MASK;
+      dec.have_ts = 1;
+      dec.ts_events++;
       if (verbose) {
-         printf("Store  Event     : Q: %u, Pkt len: %u, Time: %08x", oq, evt_len, time_MSB);
-         printf("%08x\n", time_diff + time_LSB);
+        printf("Timestamp Event  : 0x%08x%08x\n", word & ~EVENT_TYPE_MASK, lsb);
       }
-      store_events[oq]+=1;
-      break;
+      continue;
+    }
 
-    case RM_EVENT:
-      oq = ((ntohl(*payload) & OQ_MASK)>>OQ_SHIFT);
-      evt_len = (ntohl(*payload) & LENGTH_MASK) >> LEN_SHIFT;
-      time_diff = ((ntohl(*payload++) & TIME_MASK));
-      total_time += time_diff;
-      if (verbose) {
-        printf("Remove Event     : Q: %u, Pkt len: %u, Time: %08x", oq, evt_len, time_MSB);
-        printf("%08x\n", time_diff + time_LSB);
-      }
-      remove_events[oq]+=1;
-      break;
-    case DR_EVENT:
-      oq = ((ntohl(*payload) & OQ_MASK)>>OQ_SHIFT);
-      evt_len = (ntohl(*payload) & LENGTH_MASK) >> LEN_SHIFT;
-      time_diff = ((ntohl(*payload++) & TIME_MASK));
-      total_time += time_diff;
-      if (verbose) {
-        printf("Drop   Event     : Q: %u, Pkt len: %u, Time: %08x", oq, evt_len, time_MSB);
-        printf("%08x\n", time_diff + time_LSB);
+    uint32_t oq = (word & OQ_MASK) >> OQ_SHIFT;
+    uint32_t low = word & TIME_MASK;
+    if (low < dec.last_low) {
+      /* the hardware sends a TS event when the low bits roll over, this covers a lost one */
+      dec.time_hi += (uint64_t)TIME_MASK + 1;
+      dec.time_wraps++;
+    }
+    dec.last_low = low;
+    uint64_t t = dec.time_hi | low;
+
+    switch (type) {
+    case ST_EVENT: dec.store_events[oq]++; break;
+    case RM_EVENT: dec.remove_events[oq]++; break;
+    default:       dec.drop_events[oq]++; break;
+    }
+    if (occ.enabled && dec.have_ts) {
+      occEvent(oq, type, (word & LENGTH_MASK) >> LEN_SHIFT, t);
+    }
+
+    if (out_prefix) {
+      rec.time = t;
+      rec.seq = seq;
+      rec.len = (word & LENGTH_MASK) >> LEN_SHIFT;
+      rec.type = type >> 30;
+      rec.flags = dec.have_ts ? 0 : EVT_REC_NO_TS;
+      columnAppend(&columns[oq], &rec, sizeof(rec));
+      if (first) {
+        qs.time = t;
       }
-      drop_events[oq]+=1;
-      break;
+    }
+    first = 0;
+
+    if (verbose) {
+      printf("%s Event     : Q: %u, Pkt len: %u, Time: %016llx\n", evt_names[type >> 30], oq,
+             (word & LENGTH_MASK) >> LEN_SHIFT, (unsigned long long)t);
     }
   }
-  printf("Total store  events: oq0: %d, oq1: %d, oq2: %d, oq3: %d, oq4: %d, oq5: %d, oq6: %d, oq7: %d\n",store_events[0], store_events[1], store_events[2], store_events[3], store_events[4], store_events[5], store_events[6], store_events[7]);
-  printf("Total drop   events: oq0: %d, oq1: %d, oq2: %d, oq3: %d, oq4: %d, oq5: %d, oq6: %d, oq7: %d\n",drop_events[0], drop_events[1], drop_events[2], drop_events[3], drop_events[4], drop_events[5], drop_events[6], drop_events[7]);
-  printf("Total remove events: oq0: %d, oq1: %d, oq2: %d, oq3: %d, oq4: %d, oq5: %d, oq6: %d, oq7: %d\n",remove_events[0], remove_events[1], remove_events[2], remove_events[3], remove_events[4], remove_events[5], remove_events[6], remove_events[7]);
-  fflush(NULL);
+
+  if (out_prefix) {
+    if (first) {
+      qs.time = dec.time_hi | dec.last_low;
+    }
+    columnAppend(&qsize_column, &qs, sizeof(qs));
+  }
+  if (occ.enabled && dec.have_ts) {
+    occSnapshot(packet, dec.time_hi | dec.last_low);
+  }
+}
+
+static void printTotals(FILE *fp, const char *name, uint64_t *events)
+{
+  fprintf(fp, "Total %-7s events: oq0: %llu, oq1: %llu, oq2: %llu, oq3: %llu, oq4: %llu, oq5: %llu, oq6: %llu, oq7: %llu\n",
+          name, (unsigned long long)events[0], (unsigned long long)events[1], (unsigned long long)events[2],
+          (unsigned long long)events[3], (unsigned long long)events[4], (unsigned long long)events[5],
+          (unsigned long long)events[6], (unsigned long long)events[7]);
+}
+
+/*
+  Totals so far, and the capture drops when capturing live.
+*/
+void printSummary(FILE *fp)
+{
+  struct pcap_stat p_stats;
+
+  printTotals(fp, "store", dec.store_events);
+  printTotals(fp, "drop", dec.drop_events);
+  printTotals(fp, "remove", dec.remove_events);
+  fprintf(fp, "Event packets: %llu, missing by seq: %llu, short: %llu, other: %llu, TS events: %llu, time wraps: %llu\n",
+          (unsigned long long)dec.evt_pkts, (unsigned long long)dec.seq_gaps, (unsigned long long)dec.short_pkts,
+          (unsigned long long)dec.other_pkts, (unsigned long long)dec.ts_events, (unsigned long long)dec.time_wraps);
+  if (occ.enabled) {
+    printOccupancy(fp);
+  }
+  if (!offline && pcap_capture_descr && pcap_stats(pcap_capture_descr, &p_stats) == 0) {
+    fprintf(fp, "Pcap stats: %u packets captured, %u dropped by the kernel, %u by the interface\n",
+            p_stats.ps_recv, p_stats.ps_drop, p_stats.ps_ifdrop);
+  }
+  fflush(fp);
 }
 
 /*
@@ -306,12 +946,12 @@ void ReceiveSinglePacket(u_char *rcv_finished,
  */
 void processArgs (int argc, char **argv )
 {
-  char c;
+  int c;
 
   /* don't want getopt to moan - I can do that just fine thanks! */
   opterr = 0;
 
-  while ((c = getopt (argc, argv, "vVi:e:r:o")) != -1)
+  while ((c = getopt (argc, argv, "vVi:e:r:of:w:sb:I:t:")) != -1)
     {
       switch (c)
         {
@@ -325,11 +965,14 @@ void processArgs (int argc, char **argv )
           nf2.device_name = optarg;
           break;
         case 'e':       /* Ethertype to use */
-          if (sscanf(optarg,"0x%x",&cap_ethertype) != 1) {
-            printf("Bad value for ethertype - expected number of format 0xHHHH\n");
-            exit(1);
+          {
+            unsigned ethertype;
+            if (sscanf(optarg,"0x%x",&ethertype) != 1) {
+              printf("Bad value for ethertype - expected number of format 0xHHHH\n");
+              exit(1);
+            }
+            cap_ethertype = ethertype & 0xffff;
           }
-          cap_ethertype &= 0xffff;
           printf("Info: Will look for ethertype: 0x%04x\n", cap_ethertype);
           break;
         case 'r':       /* number of seconds to run */
@@ -341,6 +984,35 @@ void processArgs (int argc, char **argv )
           break;
         case 'o':
           offline = 1;
+          if (!offline_file) offline_file = DEFAULT_OFFLINE_FILE;
+          break;
+        case 'f':       /* offline capture file */
+          offline = 1;
+          offline_file = optarg;
+          break;
+        case 'w':       /* binary record files */
+          out_prefix = optarg;
+          break;
+        case 's':       /* text summary */
+          summary = 1;
+          break;
+        case 'b':       /* capture buffer size */
+          if (sscanf(optarg,"%u",&buffer_mb) != 1) {
+            printf("Bad value for buffer size - expected a number of MB\n");
+            exit(1);
+          }
+          break;
+        case 'I':       /* occupancy interval */
+          if (sscanf(optarg,"%u",&interval_ms) != 1 || interval_ms == 0) {
+            printf("Bad value for interval - expected a number of ms\n");
+            exit(1);
+          }
+          break;
+        case 't':       /* event timer resolution */
+          if (sscanf(optarg,"%u",&tick_ns) != 1 || tick_ns == 0) {
+            printf("Bad value for timer resolution - expected a number of ns\n");
+            exit(1);
+          }
           break;
         case '?':
           if (isprint (optopt))
@@ -361,45 +1033,56 @@ void processArgs (int argc, char **argv )
  */
 void usage (void)
 {
-  printf("Usage: ./show_events <options>  filename.bin\n");
+  printf("Usage: ./rcv_evts <options>\n");
   printf("\nOptions: \n");
   printf("         -i <iface> : interface name such nf2c0 (default nf2c0).\n");
-  printf("         -v : be verbose.\n");
+  printf("         -v : print every event.\n");
   printf("         -V : be REALLY verbose.\n");
   printf("         -e <ethertype>: Specify ethertype of packets containing events.\n");
   printf("                         e.g. -e 0x5678.  Default: 0x%x\n", CAP_ETHERTYPE);
   printf("         -r <running time>: the number of seconds to run. Default: forever.\n");
-  printf("         -o : process the offline data store din file \"teth_out\".\n");
+  printf("         -o : process the offline data stored in file \"%s\".\n", DEFAULT_OFFLINE_FILE);
+  printf("         -f <file> : process the offline data stored in file.\n");
+  printf("         -w <prefix> : write the events to <prefix>.oq0 .. <prefix>.oq7 and\n");
+  printf("                       the queue sizes to <prefix>.qsize (see evts.h).\n");
+  printf("         -s : print event totals, capture drops and occupancy percentiles,\n");
+  printf("              every second when live.\n");
+  printf("         -b <MB> : capture buffer size. Default: %u.\n", DEFAULT_BUFFER_MB);
+  printf("         -I <ms> : print queue occupancy and sojourn time percentiles every\n");
+  printf("                   <ms> of event time, one line per active queue.\n");
+  printf("         -t <ns> : event timer resolution. Default: %u.\n", DEFAULT_TICK_NS);
 }
 
 /*
-  Initialize the pcap and libnet interfaces
+  Initialize the pcap interface with a capture buffer big enough to ride out
+  bursts of events
 */
 
 void InitNetwork(char *device_name) {
 
   printf("Opening interface:%s\n", device_name);
 
-  int snaplen;  // num bytes to actually vapture. More == slower...
-
   // NOTE: defaults to promiscuous mode
-  //
-
-  snaplen = SNAPLEN;
-  // only change minimum snaplen if we have packet content checking turned on.
-
-  pcap_capture_descr = pcap_open_live(device_name, snaplen, 1, running_time*1000, pcap_errbuf);
+  pcap_capture_descr = pcap_create(device_name, pcap_errbuf);
   if(pcap_capture_descr == NULL) {
-    fprintf(stderr, "pcap_open_live(): %s\n",pcap_errbuf);
-    fprintf(stderr, "This error may be caused by a non-root user running this file.  Make sure that this binary is SETUID.");
+    fprintf(stderr, "pcap_create(): %s\n",pcap_errbuf);
+    exit(1);
+  }
+  pcap_set_snaplen(pcap_capture_descr, SNAPLEN);
+  pcap_set_promisc(pcap_capture_descr, 1);
+  pcap_set_timeout(pcap_capture_descr, READ_TIMEOUT_MS);
+  pcap_set_buffer_size(pcap_capture_descr, buffer_mb << 20);
+
+  if (pcap_activate(pcap_capture_descr) < 0) {
+    fprintf(stderr, "pcap_activate(): %s\n", pcap_geterr(pcap_capture_descr));
+    fprintf(stderr, "This error may be caused by a non-root user running this file.  Make sure that this binary is SETUID.\n");
+    exit(1);
   }
 }
 
 
 /*
-  Closes down the dats structures used by libpcap an libnet, prints out pcap stats.
-  If your dump file is not properly formatted, it is likely the result of not calling
-  this function at the end of packet capture.
+  Closes down the dats structures used by libpcap, prints out pcap stats.
 */
 void CloseNetwork(){
 
@@ -412,4 +1095,5 @@ void CloseNetwork(){
             p_stats.ps_recv, p_stats.ps_drop);
   }
   pcap_close(pcap_capture_descr);
+  pcap_capture_descr = NULL;
 }
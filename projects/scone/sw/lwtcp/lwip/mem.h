@@ -53,6 +53,7 @@ void *mem_malloc2(mem_size_t size);
 void mem_free(void *mem);
 void *mem_realloc(void *mem, mem_size_t size);
 void *mem_reallocm(void *mem, mem_size_t size);
+int mem_sprint(char *buf, int size);
 
 #ifdef MEM_PERF
 void mem_perf_start(void);
@@ -72,7 +73,7 @@ void mem_reclaim(unsigned int size);
                              ((((size) % MEM_ALIGNMENT) == 0)? 0 : \
                              (MEM_ALIGNMENT - ((size) % MEM_ALIGNMENT))))
 
-#define MEM_ALIGN(addr) (void *)MEM_ALIGN_SIZE((uint32_t)addr)
+#define MEM_ALIGN(addr) (void *)MEM_ALIGN_SIZE((unsigned long)addr)
 
 #endif /* __LWIP_MEM_H__ */
 
@@ -58,6 +58,8 @@ typedef enum {
 } memp_t;
 
 void memp_init(void);
+void memp_configure(memp_t type, uint16_t num);
+const char *memp_name(memp_t type);
 
 void *memp_malloc(memp_t type);
 void *memp_mallocp(memp_t type);
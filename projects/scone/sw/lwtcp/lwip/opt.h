@@ -71,6 +71,18 @@
 #define MEM_ALIGNMENT           1
 #endif
 
+/* MEM_PAGE_SIZE: the heap is handed out in pages of this size, each
+   carved into blocks of one size or part of a run for a bigger request. */
+#ifndef MEM_PAGE_SIZE
+#define MEM_PAGE_SIZE           65536
+#endif
+
+/* MEM_CACHE_BYTES: about how many bytes of free blocks of each size a
+   thread keeps to itself before giving some back to the heap. */
+#ifndef MEM_CACHE_BYTES
+#define MEM_CACHE_BYTES         32768
+#endif
+
 #ifndef PBUF_POOL_SIZE
 #define PBUF_POOL_SIZE          16
 #endif
@@ -43,6 +43,12 @@
 #define PBUF_TRANSPORT_HLEN 20
 #define PBUF_IP_HLEN        20
 
+/* The pool data sizes pbuf_pool_configure() takes: room for the
+   headers of a PBUF_TRANSPORT pbuf and a byte of payload, and no more
+   than still fits a uint16_t once rounded up to MEM_ALIGNMENT. */
+#define PBUF_POOL_BUFSIZE_MIN (PBUF_TRANSPORT_HLEN + PBUF_IP_HLEN + PBUF_LINK_HLEN + 1)
+#define PBUF_POOL_BUFSIZE_MAX (0x10000 - MEM_ALIGNMENT)
+
 typedef enum {
   PBUF_TRANSPORT,
   PBUF_IP,
@@ -53,7 +59,8 @@ typedef enum {
 typedef enum {
   PBUF_RAM,
   PBUF_ROM,
-  PBUF_POOL
+  PBUF_POOL,
+  PBUF_REF
 } pbuf_flag;
 
 /* Definitions for the pbuf flag field (these are not the flags that
@@ -62,6 +69,10 @@ typedef enum {
 #define PBUF_FLAG_ROM   0x01    /* Flags that pbuf data is stored in ROM. */
 #define PBUF_FLAG_POOL  0x02    /* Flags that the pbuf comes from the
 				   pbuf pool. */
+#define PBUF_FLAG_REF   0x03    /* Flags that pbuf data is on loan from
+				   outside lwip and is handed back
+				   through pbuf_ref_release when the
+				   pbuf is freed. */
 
 struct pbuf {
   struct pbuf *next;
@@ -84,6 +95,20 @@ struct pbuf {
    parameter specifies the size of the data allocated to those.  */
 void pbuf_init(void);
 
+/* pbuf_pool_configure():
+
+   Sets the number of pbufs in the pool and the size of the data of
+   each, in place of PBUF_POOL_SIZE and PBUF_POOL_BUFSIZE. bufsize must
+   be within PBUF_POOL_BUFSIZE_MIN and PBUF_POOL_BUFSIZE_MAX. Must be
+   called before pbuf_init(). */
+void pbuf_pool_configure(uint16_t num, uint16_t bufsize);
+
+/* pbuf_ref_release:
+
+   Called with the payload of a PBUF_REF pbuf when it is freed, the
+   payload may have been moved on by pbuf_header() since. */
+extern void (* pbuf_ref_release)(void *payload);
+
 /* pbuf_alloc():
 
    Allocates a pbuf at protocol layer l. The actual memory allocated
@@ -101,7 +126,10 @@ void pbuf_init(void);
                 the front of the ROM pbuf.
 
    * PBUF_ROOL: the pbuf is allocated as a pbuf chain, with pbufs from
-                the pbuf pool that is allocated during pbuf_init().  */
+                the pbuf pool that is allocated during pbuf_init().
+
+   * PBUF_REF: like PBUF_ROM, but the payload the caller sets belongs
+               to someone else until the pbuf is freed.  */
 struct pbuf *pbuf_alloc(pbuf_layer l, uint16_t size, pbuf_flag flag);
 
 /* pbuf_realloc():
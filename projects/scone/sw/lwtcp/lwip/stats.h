@@ -66,6 +66,16 @@ struct stats_mem {
   uint16_t reclaimed;
 };
 
+struct stats_heap {
+  uint32_t avail;     /* bytes in the heap */
+  uint32_t used;      /* bytes off the free pages, in use or cached by a thread */
+  uint32_t max;
+  uint32_t err;
+  uint32_t reclaimed;
+  uint32_t pages;     /* pages carved into blocks or in large runs */
+  uint32_t pages_max;
+};
+
 struct stats_pbuf {
   uint16_t avail;
   uint16_t used;
@@ -75,6 +85,12 @@ struct stats_pbuf {
 
   uint16_t alloc_locked;
   uint16_t refresh_locked;
+
+  /* PBUF_REF pbufs, wrapping data lent to lwip */
+  uint32_t refs;          /* wrapped in all */
+  uint16_t ref_used;
+  uint16_t ref_max;
+  uint32_t ref_err;       /* out of pbuf structures, the data had to be copied */
 };
 
 struct stats_syselem {
@@ -95,7 +111,7 @@ struct stats_ {
   struct stats_proto udp;
   struct stats_proto tcp;
   struct stats_pbuf pbuf;
-  struct stats_mem mem;
+  struct stats_heap mem;
   struct stats_mem memp[MEMP_MAX];
   struct stats_sys sys;
 };
@@ -105,6 +121,7 @@ extern struct stats_ stats;
 #endif /* STATS */
 
 void stats_init(void);
+int stats_sprint(char *buf, int size);
 #endif /* __LWIP_STATS_H__ */
 
 
@@ -90,6 +90,8 @@ void sys_sem_wait(sys_sem_t sem);
 sys_mbox_t sys_mbox_new(void);
 void sys_mbox_post(sys_mbox_t mbox, void *msg);
 uint16_t sys_arch_mbox_fetch(sys_mbox_t mbox, void **msg, uint16_t timeout);
+/* Fetches up to max messages already waiting, without blocking. Returns how many. */
+uint16_t sys_arch_mbox_tryfetch(sys_mbox_t mbox, void **msgs, uint16_t max);
 void sys_mbox_free(sys_mbox_t mbox);
 
 void sys_mbox_fetch(sys_mbox_t mbox, void **msg);
@@ -38,12 +38,25 @@
  *
  * Memory manager.
  *
+ * The heap is cut into MEM_PAGE_SIZE pages. A page is either carved into
+ * blocks of one size class, or is part of a run of whole pages for a
+ * request bigger than the largest class. Finding the page of a pointer is
+ * a division, so blocks carry no header and freeing never searches.
+ *
+ * Every thread keeps a small cache of free blocks per class and allocates
+ * and frees from it without locking; mem_sem is only taken to move a batch
+ * of blocks between a cache and the pages, and for the large runs. A page
+ * whose blocks have all come back is returned to the heap, so memory that
+ * once held one size of block can later serve any other.
+ *
  */
 /*-----------------------------------------------------------------------------------*/
 #include "lwip/debug.h"
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 #include "lwip/arch.h"
 #include "lwip/opt.h"
@@ -62,94 +75,381 @@ struct mem_reclaim_ {
 };
 #endif /* MEM_RECLAIM */
 
-struct mem {
-  mem_size_t next, prev;
-  uint8_t used;
-#if MEM_ALIGNMENT == 2
-  uint8_t dummy;
-#endif /* MEM_ALIGNEMNT == 2 */
+/* Block sizes, two per power of two so rounding up wastes at most a third. */
+#define MEM_CLASSES 22
+static const mem_size_t mem_class_size[MEM_CLASSES] = {
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768,
+  1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384, 24576, 32768
+};
+#define MEM_GRAIN 16
+#define MEM_MAX_CLASS_SIZE 32768
+#define MEM_CACHE_MAX 64          /* most blocks of one class a thread keeps */
+
+#define MEM_PAGE_FREE  0
+#define MEM_PAGE_SLAB  1          /* carved into blocks of one class */
+#define MEM_PAGE_LARGE 2          /* first page of a large run */
+#define MEM_PAGE_TAIL  3          /* rest of a large run */
+
+struct mem_block {
+  struct mem_block *next;
+};
+
+struct mem_page {
+  uint8_t kind;
+  uint8_t class;
+  uint32_t free_count;            /* slab pages: blocks on free */
+  uint32_t run;                   /* large runs: pages in the run */
+  struct mem_block *free;
+  struct mem_page *next, *prev;   /* slab pages with free blocks */
+};
+
+struct mem_class {
+  mem_size_t size;
+  uint32_t per_page;
+  uint32_t cache_max;
+  struct mem_page *partial;       /* pages with free blocks */
+  uint32_t pages;
+  uint32_t out;                   /* blocks off the pages, in use or cached */
+  uint32_t out_max;
 };
 
-static struct mem *ram_end;
-static uint8_t ram[MEM_ALIGN_SIZE(MEM_SIZE + sizeof(struct mem))];
+struct mem_cache {
+  struct mem_block *free[MEM_CLASSES];
+  uint32_t count[MEM_CLASSES];
 
-#define MIN_SIZE 12
-#define SIZEOF_STRUCT_MEM MEM_ALIGN_SIZE(sizeof(struct mem))
-/*#define SIZEOF_STRUCT_MEM (sizeof(struct mem) + \
-                          (((sizeof(struct mem) % MEM_ALIGNMENT) == 0)? 0 : \
-                          (4 - (sizeof(struct mem) % MEM_ALIGNMENT))))*/
+  /* counters, only written by the owning thread */
+  uint64_t allocs[MEM_CLASSES];
+  uint64_t frees[MEM_CLASSES];
+  uint64_t requested;             /* bytes asked for */
+  uint64_t handed;                /* bytes handed out for them */
 
+  volatile int owned;             /* cleared when the thread exits */
+  struct mem_cache *volatile next;
+};
+
+static uint8_t *ram;
+static uint32_t mem_npages;
+static struct mem_page *mem_pages;
+static struct mem_class mem_classes[MEM_CLASSES];
+static uint8_t mem_size_class[MEM_MAX_CLASS_SIZE / MEM_GRAIN + 1];
 
-static struct mem *lfree;   /* pointer to the lowest free block */
+/* every cache ever created, they are never freed so readers walk it lock free */
+static struct mem_cache *volatile mem_caches;
+static __thread struct mem_cache *mem_local;
+static pthread_key_t mem_cache_key;
 
 #if MEM_RECLAIM
 static struct mem_reclaim_ *mrlist;
 #endif /* MEM_RECLAIM */
 
+/* Taken with sys_arch_sem_wait(), a thread waiting for the heap must not
+   run its timeouts, they may well allocate. */
 static sys_sem_t mem_sem;
 
+#define MEM_LOCK()   sys_arch_sem_wait(mem_sem, 0)
+#define MEM_UNLOCK() sys_sem_signal(mem_sem)
+
+#define PAGE_ADDR(i) (ram + (i) * (unsigned long)MEM_PAGE_SIZE)
+#define PAGE_OF(p)   (&mem_pages[((uint8_t *)(p) - ram) / MEM_PAGE_SIZE])
+
+/*-----------------------------------------------------------------------------------*/
+/* mem_pages_take():
+ *
+ * Finds the lowest run of n free pages and marks it used. Call with
+ * mem_sem held. Returns the index of the first page, -1 if there is no
+ * such run.
+ */
+static int
+mem_pages_take(uint32_t n)
+{
+  uint32_t i, run = 0;
+
+  for(i = 0; i < mem_npages; ++i) {
+    if(mem_pages[i].kind != MEM_PAGE_FREE) {
+      run = 0;
+      continue;
+    }
+    if(++run == n) {
+      i -= n - 1;
+      for(run = 0; run < n; ++run) {
+        mem_pages[i + run].kind = MEM_PAGE_TAIL;
+      }
+#ifdef MEM_STATS
+      stats.mem.pages += n;
+      if(stats.mem.pages > stats.mem.pages_max) {
+        stats.mem.pages_max = stats.mem.pages;
+      }
+#endif /* MEM_STATS */
+      return i;
+    }
+  }
+  return -1;
+}
 /*-----------------------------------------------------------------------------------*/
 static void
-plug_holes(struct mem *mem)
+mem_pages_release(uint32_t first, uint32_t n)
 {
-  struct mem *nmem;
-  struct mem *pmem;
+  uint32_t i;
 
-  ASSERT("plug_holes: mem >= ram", (uint8_t *)mem >= ram);
-  ASSERT("plug_holes: mem < ram_end", (uint8_t *)mem < (uint8_t *)ram_end);
-  ASSERT("plug_holes: mem->used == 0", mem->used == 0);
+  for(i = first; i < first + n; ++i) {
+    mem_pages[i].kind = MEM_PAGE_FREE;
+    mem_pages[i].run = 0;
+  }
+#ifdef MEM_STATS
+  stats.mem.pages -= n;
+#endif /* MEM_STATS */
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+mem_partial_link(struct mem_class *c, struct mem_page *page)
+{
+  page->prev = NULL;
+  page->next = c->partial;
+  if(c->partial != NULL) {
+    c->partial->prev = page;
+  }
+  c->partial = page;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+mem_partial_unlink(struct mem_class *c, struct mem_page *page)
+{
+  if(page->prev != NULL) {
+    page->prev->next = page->next;
+  } else {
+    c->partial = page->next;
+  }
+  if(page->next != NULL) {
+    page->next->prev = page->prev;
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/* mem_class_grow():
+ *
+ * Carves a free page into blocks for class ci. Call with mem_sem held.
+ */
+static int
+mem_class_grow(uint8_t ci)
+{
+  struct mem_class *c = &mem_classes[ci];
+  struct mem_page *page;
+  struct mem_block *b;
+  uint8_t *base;
+  int i, idx;
+
+  idx = mem_pages_take(1);
+  if(idx < 0) {
+    return 0;
+  }
+  page = &mem_pages[idx];
+  page->kind = MEM_PAGE_SLAB;
+  page->class = ci;
+  page->free = NULL;
+
+  /* lowest address first */
+  base = PAGE_ADDR(idx);
+  for(i = c->per_page - 1; i >= 0; --i) {
+    b = (struct mem_block *)(base + i * c->size);
+    b->next = page->free;
+    page->free = b;
+  }
+  page->free_count = c->per_page;
 
-  /* plug hole forward */
-  ASSERT("plug_holes: mem->next <= MEM_SIZE", mem->next <= MEM_SIZE);
+  mem_partial_link(c, page);
+  ++c->pages;
+  return 1;
+}
+/*-----------------------------------------------------------------------------------*/
+/* mem_refill():
+ *
+ * Moves up to half a cache worth of class ci blocks from the pages into
+ * the cache, carving new pages as needed. Returns the number moved.
+ */
+static uint32_t
+mem_refill(struct mem_cache *cache, uint8_t ci)
+{
+  struct mem_class *c = &mem_classes[ci];
+  struct mem_page *page;
+  struct mem_block *b;
+  uint32_t want = (c->cache_max + 1) / 2, got = 0;
+
+  MEM_LOCK();
+  while(got < want) {
+    page = c->partial;
+    if(page == NULL) {
+      if(!mem_class_grow(ci)) {
+        break;
+      }
+      page = c->partial;
+    }
+    while(got < want && page->free != NULL) {
+      b = page->free;
+      page->free = b->next;
+      b->next = cache->free[ci];
+      cache->free[ci] = b;
+      --page->free_count;
+      ++got;
+    }
+    if(page->free == NULL) {
+      mem_partial_unlink(c, page);
+    }
+  }
+  c->out += got;
+  if(c->out > c->out_max) {
+    c->out_max = c->out;
+  }
+#ifdef MEM_STATS
+  stats.mem.used += got * c->size;
+  if(stats.mem.used > stats.mem.max) {
+    stats.mem.max = stats.mem.used;
+  }
+#endif /* MEM_STATS */
+  MEM_UNLOCK();
 
-  nmem = (struct mem *)&ram[mem->next];
-  if(mem != nmem && nmem->used == 0 && (uint8_t *)nmem != (uint8_t *)ram_end) {
-    if(lfree == nmem) {
-      lfree = mem;
+  cache->count[ci] += got;
+  return got;
+}
+/*-----------------------------------------------------------------------------------*/
+/* mem_flush():
+ *
+ * Returns n class ci blocks from the cache to their pages. A page that
+ * gets all its blocks back goes back to the heap, unless it is the only
+ * page of the class with free blocks.
+ */
+static void
+mem_flush(struct mem_cache *cache, uint8_t ci, uint32_t n)
+{
+  struct mem_class *c = &mem_classes[ci];
+  struct mem_page *page;
+  struct mem_block *b;
+  uint32_t i;
+
+  MEM_LOCK();
+  for(i = 0; i < n && cache->free[ci] != NULL; ++i) {
+    b = cache->free[ci];
+    cache->free[ci] = b->next;
+
+    page = PAGE_OF(b);
+    ASSERT("mem_flush: block on a page of its class",
+           page->kind == MEM_PAGE_SLAB && page->class == ci);
+    b->next = page->free;
+    page->free = b;
+    if(page->free_count++ == 0) {
+      mem_partial_link(c, page);
+    }
+    if(page->free_count == c->per_page &&
+       (page->prev != NULL || page->next != NULL)) {
+      mem_partial_unlink(c, page);
+      mem_pages_release(page - mem_pages, 1);
+      --c->pages;
     }
-    mem->next = nmem->next;
-    ((struct mem *)&ram[nmem->next])->prev = (uint8_t *)mem - ram;
   }
+  c->out -= i;
+#ifdef MEM_STATS
+  stats.mem.used -= i * c->size;
+#endif /* MEM_STATS */
+  MEM_UNLOCK();
 
-  /* plug hole backward */
-  pmem = (struct mem *)&ram[mem->prev];
-  if(pmem != mem && pmem->used == 0) {
-    if(lfree == mem) {
-      lfree = pmem;
+  cache->count[ci] -= i;
+}
+/*-----------------------------------------------------------------------------------*/
+/* mem_cache_drain():
+ *
+ * Returns every block in the cache to the pages.
+ */
+static void
+mem_cache_drain(struct mem_cache *cache)
+{
+  uint8_t ci;
+
+  for(ci = 0; ci < MEM_CLASSES; ++ci) {
+    if(cache->count[ci] > 0) {
+      mem_flush(cache, ci, cache->count[ci]);
     }
-    pmem->next = mem->next;
-    ((struct mem *)&ram[mem->next])->prev = (uint8_t *)pmem - ram;
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+mem_cache_exit(void *arg)
+{
+  struct mem_cache *cache = (struct mem_cache *)arg;
+
+  mem_cache_drain(cache);
+  __sync_synchronize();
+  cache->owned = 0;
+}
+/*-----------------------------------------------------------------------------------*/
+/* mem_cache_local():
+ *
+ * Returns the cache of the calling thread, taking over the cache of a
+ * thread that has exited or adding a new one on the first call.
+ */
+static struct mem_cache *
+mem_cache_local(void)
+{
+  struct mem_cache *cache;
+
+  if(mem_local != NULL) {
+    return mem_local;
+  }
+
+  for(cache = mem_caches; cache != NULL; cache = cache->next) {
+    if(!cache->owned && __sync_bool_compare_and_swap(&cache->owned, 0, 1)) {
+      break;
+    }
+  }
+  if(cache == NULL) {
+    cache = (struct mem_cache *)calloc(1, sizeof(struct mem_cache));
+    assert(cache);
+    cache->owned = 1;
+    do {
+      cache->next = mem_caches;
+    } while(!__sync_bool_compare_and_swap(&mem_caches, cache->next, cache));
   }
 
+  mem_local = cache;
+  pthread_setspecific(mem_cache_key, cache);
+  return cache;
 }
 /*-----------------------------------------------------------------------------------*/
 void
 mem_init(void)
 {
-  struct mem *mem;
-
-  bzero(ram, MEM_SIZE);
-  mem = (struct mem *)ram;
-  mem->next = MEM_SIZE;
-  mem->prev = 0;
-  mem->used = 0;
-  ram_end = (struct mem *)&ram[MEM_SIZE];
-  ram_end->used = 1;
-  ram_end->next = MEM_SIZE;
-  ram_end->prev = MEM_SIZE;
-
-  fflush(stdout);
+  uint32_t i;
+  uint8_t ci;
+
+  mem_npages = (MEM_SIZE + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE;
+  ram = (uint8_t *)malloc(mem_npages * (unsigned long)MEM_PAGE_SIZE);
+  mem_pages = (struct mem_page *)calloc(mem_npages, sizeof(struct mem_page));
+  assert(ram && mem_pages);
+
+  for(ci = 0; ci < MEM_CLASSES; ++ci) {
+    mem_classes[ci].size = mem_class_size[ci];
+    mem_classes[ci].per_page = MEM_PAGE_SIZE / mem_class_size[ci];
+    mem_classes[ci].cache_max = MEM_CACHE_BYTES / mem_class_size[ci];
+    if(mem_classes[ci].cache_max < 2) {
+      mem_classes[ci].cache_max = 2;
+    } else if(mem_classes[ci].cache_max > MEM_CACHE_MAX) {
+      mem_classes[ci].cache_max = MEM_CACHE_MAX;
+    }
+  }
+  for(i = 0, ci = 0; i <= MEM_MAX_CLASS_SIZE / MEM_GRAIN; ++i) {
+    while(mem_class_size[ci] < i * MEM_GRAIN) {
+      ++ci;
+    }
+    mem_size_class[i] = ci;
+  }
+
   mem_sem = sys_sem_new(1);
   assert(mem_sem);
-
-  lfree = (struct mem *)ram;
+  pthread_key_create(&mem_cache_key, mem_cache_exit);
 
 #if MEM_RECLAIM
   mrlist = NULL;
 #endif /* MEM_RECLAIM */
 
 #ifdef MEM_STATS
-  stats.mem.avail = (uint16_t)MEM_SIZE;
+  stats.mem.avail = mem_npages * MEM_PAGE_SIZE;
 #endif /* MEM_STATS */
 }
 /*-----------------------------------------------------------------------------------*/
@@ -186,121 +486,135 @@ mem_malloc2(mem_size_t size)
   return mem;
 }
 /*-----------------------------------------------------------------------------------*/
+static void *
+mem_malloc_large(mem_size_t size)
+{
+  struct mem_cache *cache = mem_cache_local();
+  uint32_t n = (size + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE;
+  int idx;
+
+  MEM_LOCK();
+  idx = mem_pages_take(n);
+  if(idx < 0) {
+    MEM_UNLOCK();
+    /* pages may be sitting in our own cache */
+    mem_cache_drain(cache);
+    MEM_LOCK();
+    idx = mem_pages_take(n);
+  }
+  if(idx < 0) {
+    DEBUGF(MEM_DEBUG, ("mem_malloc: could not allocate %d bytes\n", (int)size));
+#ifdef MEM_STATS
+    ++stats.mem.err;
+#endif /* MEM_STATS */
+    MEM_UNLOCK();
+    return NULL;
+  }
+  mem_pages[idx].kind = MEM_PAGE_LARGE;
+  mem_pages[idx].run = n;
+#ifdef MEM_STATS
+  stats.mem.used += n * MEM_PAGE_SIZE;
+  if(stats.mem.used > stats.mem.max) {
+    stats.mem.max = stats.mem.used;
+  }
+#endif /* MEM_STATS */
+  MEM_UNLOCK();
+
+  cache->requested += size;
+  cache->handed += n * MEM_PAGE_SIZE;
+  return PAGE_ADDR(idx);
+}
+/*-----------------------------------------------------------------------------------*/
 void *
 mem_malloc(mem_size_t size)
 {
-  mem_size_t ptr, ptr2;
-  struct mem *mem, *mem2;
+  struct mem_cache *cache;
+  struct mem_block *b;
+  uint8_t ci;
 
   if(size == 0) {
     return NULL;
   }
-
-  /* Expand the size of the allocated memory region so that we can
-     adjust for alignment. */
-  if((size % MEM_ALIGNMENT) != 0) {
-    size += MEM_ALIGNMENT - ((size + SIZEOF_STRUCT_MEM) % MEM_ALIGNMENT);
+  if(size > MEM_MAX_CLASS_SIZE) {
+    return mem_malloc_large(size);
   }
 
-  if(size > MEM_SIZE) {
-    return NULL;
-  }
-
-  sys_sem_wait(mem_sem);
-
-  for(ptr = (uint8_t *)lfree - ram; ptr < MEM_SIZE; ptr = ((struct mem *)&ram[ptr])->next) {
-    mem = (struct mem *)&ram[ptr];
-    if(!mem->used &&
-       mem->next - (ptr + SIZEOF_STRUCT_MEM) >= size + SIZEOF_STRUCT_MEM) {
-      ptr2 = ptr + SIZEOF_STRUCT_MEM + size;
-      mem2 = (struct mem *)&ram[ptr2];
+  ci = mem_size_class[(size + MEM_GRAIN - 1) / MEM_GRAIN];
+  cache = mem_cache_local();
 
-      mem2->prev = ptr;
-      mem2->next = mem->next;
-      mem->next = ptr2;
-      if(mem2->next != MEM_SIZE) {
-        ((struct mem *)&ram[mem2->next])->prev = ptr2;
-      }
-
-      mem2->used = 0;
-      mem->used = 1;
+  if(cache->free[ci] == NULL && mem_refill(cache, ci) == 0) {
+    /* out of pages, give back what we hold of the other classes and retry */
+    mem_cache_drain(cache);
+    if(mem_refill(cache, ci) == 0) {
+      DEBUGF(MEM_DEBUG, ("mem_malloc: could not allocate %d bytes\n", (int)size));
 #ifdef MEM_STATS
-      stats.mem.used += size;
-      /*      if(stats.mem.max < stats.mem.used) {
-        stats.mem.max = stats.mem.used;
-	} */
-      if(stats.mem.max < ptr2) {
-        stats.mem.max = ptr2;
-      }
-#ifdef MEM_PERF
-      mem_perf_output();
-#endif /* MEM_PERF */
+      __sync_fetch_and_add(&stats.mem.err, 1);
 #endif /* MEM_STATS */
-
-      if(mem == lfree) {
-	/* Find next free block after mem */
-        while(lfree->used && lfree != ram_end) {
-	  lfree = (struct mem *)&ram[lfree->next];
-        }
-        ASSERT("mem_malloc: !lfree->used", !lfree->used);
-      }
-      sys_sem_signal(mem_sem);
-      ASSERT("mem_malloc: allocated memory not above ram_end.",
-	     (uint32_t)mem + SIZEOF_STRUCT_MEM + size <= (uint32_t)ram_end);
-      ASSERT("mem_malloc: allocated memory properly aligned.",
-	     (unsigned long)((uint8_t *)mem + SIZEOF_STRUCT_MEM) % MEM_ALIGNMENT == 0);
-      return (uint8_t *)mem + SIZEOF_STRUCT_MEM;
+      return NULL;
     }
   }
-  DEBUGF(MEM_DEBUG, ("mem_malloc: could not allocate %d bytes\n", (int)size));
-#ifdef MEM_STATS
-  ++stats.mem.err;
-#endif /* MEM_STATS */
-  sys_sem_signal(mem_sem);
-  return NULL;
+
+  b = cache->free[ci];
+  cache->free[ci] = b->next;
+  --cache->count[ci];
+
+  ++cache->allocs[ci];
+  cache->requested += size;
+  cache->handed += mem_class_size[ci];
+
+  ASSERT("mem_malloc: allocated memory properly aligned.",
+         (unsigned long)b % MEM_ALIGNMENT == 0);
+  return b;
 }
 /*-----------------------------------------------------------------------------------*/
 void
 mem_free(void *rmem)
 {
-  struct mem *mem;
+  struct mem_cache *cache;
+  struct mem_page *page;
+  struct mem_block *b;
+  uint8_t ci;
 
   if(rmem == NULL) {
     return;
   }
 
-  sys_sem_wait(mem_sem);
+  ASSERT("mem_free: legal memory", (uint8_t *)rmem >= ram &&
+         (uint8_t *)rmem < PAGE_ADDR(mem_npages));
 
-  ASSERT("mem_free: legal memory", (uint8_t *)rmem >= (uint8_t *)ram &&
-	 (uint8_t *)rmem < (uint8_t *)ram_end);
-
-
-  if((uint8_t *)rmem < (uint8_t *)ram || (uint8_t *)rmem >= (uint8_t *)ram_end) {
+  if((uint8_t *)rmem < ram || (uint8_t *)rmem >= PAGE_ADDR(mem_npages)) {
     DEBUGF(MEM_DEBUG, ("mem_free: illegal memory\n"));
 #ifdef MEM_STATS
-    ++stats.mem.err;
+    __sync_fetch_and_add(&stats.mem.err, 1);
 #endif /* MEM_STATS */
     return;
   }
-  mem = (struct mem *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM);
 
-  ASSERT("mem_free: mem->used", mem->used);
+  page = PAGE_OF(rmem);
+  if(page->kind == MEM_PAGE_SLAB) {
+    ci = page->class;
+    cache = mem_cache_local();
 
-  mem->used = 0;
+    b = (struct mem_block *)rmem;
+    b->next = cache->free[ci];
+    cache->free[ci] = b;
+    ++cache->frees[ci];
 
-  if(mem < lfree) {
-    lfree = mem;
+    if(++cache->count[ci] > mem_classes[ci].cache_max) {
+      mem_flush(cache, ci, cache->count[ci] - mem_classes[ci].cache_max / 2);
+    }
+    return;
   }
 
-#ifdef MEM_STATS
-  stats.mem.used -= mem->next - ((uint8_t *)mem - ram) - SIZEOF_STRUCT_MEM;
-#ifdef MEM_PERF
-  mem_perf_output();
-#endif /* MEM_PERF */
+  ASSERT("mem_free: start of a large run",
+         page->kind == MEM_PAGE_LARGE && (uint8_t *)rmem == PAGE_ADDR(page - mem_pages));
 
+  MEM_LOCK();
+#ifdef MEM_STATS
+  stats.mem.used -= page->run * MEM_PAGE_SIZE;
 #endif /* MEM_STATS */
-  plug_holes(mem);
-  sys_sem_signal(mem_sem);
+  mem_pages_release(page - mem_pages, page->run);
+  MEM_UNLOCK();
 }
 /*-----------------------------------------------------------------------------------*/
 void *
@@ -316,49 +630,123 @@ mem_reallocm(void *rmem, mem_size_t newsize)
   return nmem;
 }
 /*-----------------------------------------------------------------------------------*/
+/* mem_realloc():
+ *
+ * Shrinks an allocation in place. Blocks keep their class, a large run
+ * gives back the pages it no longer needs.
+ */
 void *
 mem_realloc(void *rmem, mem_size_t newsize)
 {
-  mem_size_t size;
-  mem_size_t ptr, ptr2;
-  struct mem *mem, *mem2;
+  struct mem_page *page;
+  uint32_t n;
 
-  sys_sem_wait(mem_sem);
+  ASSERT("mem_realloc: legal memory", (uint8_t *)rmem >= ram &&
+         (uint8_t *)rmem < PAGE_ADDR(mem_npages));
 
-  ASSERT("mem_realloc: legal memory", (uint8_t *)rmem >= (uint8_t *)ram &&
-	 (uint8_t *)rmem < (uint8_t *)ram_end);
+  if((uint8_t *)rmem < ram || (uint8_t *)rmem >= PAGE_ADDR(mem_npages)) {
+    DEBUGF(MEM_DEBUG, ("mem_realloc: illegal memory\n"));
+    return rmem;
+  }
 
-  if((uint8_t *)rmem < (uint8_t *)ram || (uint8_t *)rmem >= (uint8_t *)ram_end) {
-    DEBUGF(MEM_DEBUG, ("mem_free: illegal memory\n"));
+  page = PAGE_OF(rmem);
+  if(page->kind == MEM_PAGE_SLAB) {
+    ASSERT("mem_realloc: shrinking", newsize <= mem_class_size[page->class]);
     return rmem;
   }
-  mem = (struct mem *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM);
 
-  ptr = (uint8_t *)mem - ram;
+  n = (newsize + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE;
+  if(n == 0) {
+    n = 1;
+  }
+  ASSERT("mem_realloc: shrinking", n <= page->run);
 
-  size = mem->next - ptr - SIZEOF_STRUCT_MEM;
+  if(n < page->run) {
+    MEM_LOCK();
+    mem_pages_release(page - mem_pages + n, page->run - n);
 #ifdef MEM_STATS
-  stats.mem.used -= (size - newsize);
-#ifdef MEM_PERF
-  mem_perf_output();
-#endif /* MEM_PERF */
+    stats.mem.used -= (page->run - n) * MEM_PAGE_SIZE;
 #endif /* MEM_STATS */
+    page->run = n;
+    MEM_UNLOCK();
+  }
+  return rmem;
+}
+/*-----------------------------------------------------------------------------------*/
+/* mem_sprint():
+ *
+ * Writes the use of each block size and of the pages into buf, and how
+ * much of the heap is lost to rounding requests up to a block size and
+ * to free blocks on carved pages. Returns the length written, like
+ * snprintf.
+ */
+int
+mem_sprint(char *buf, int size)
+{
+  struct mem_cache *cache;
+  uint64_t allocs[MEM_CLASSES], frees[MEM_CLASSES];
+  uint64_t requested = 0, handed = 0, carved = 0, in_use = 0;
+  uint32_t cached[MEM_CLASSES], pages[MEM_CLASSES], out_max[MEM_CLASSES];
+  uint32_t i, run, free_pages = 0, largest = 0, large_pages = 0;
+  int len = 0;
+  uint8_t ci;
+
+#define MEM_PRINT(...) do { \
+    len += snprintf(buf + len, (len < size) ? size - len : 0, __VA_ARGS__); \
+  } while(0)
+
+  bzero(allocs, sizeof(allocs));
+  bzero(frees, sizeof(frees));
+  bzero(cached, sizeof(cached));
+  for(cache = mem_caches; cache != NULL; cache = cache->next) {
+    for(ci = 0; ci < MEM_CLASSES; ++ci) {
+      allocs[ci] += cache->allocs[ci];
+      frees[ci] += cache->frees[ci];
+      cached[ci] += cache->count[ci];
+    }
+    requested += cache->requested;
+    handed += cache->handed;
+  }
 
-  if(newsize + SIZEOF_STRUCT_MEM + MIN_SIZE < size) {
-    ptr2 = ptr + SIZEOF_STRUCT_MEM + newsize;
-    mem2 = (struct mem *)&ram[ptr2];
-    mem2->used = 0;
-    mem2->next = mem->next;
-    mem2->prev = ptr;
-    mem->next = ptr2;
-    if(mem2->next != MEM_SIZE) {
-      ((struct mem *)&ram[mem2->next])->prev = ptr2;
+  MEM_LOCK();
+  for(ci = 0; ci < MEM_CLASSES; ++ci) {
+    pages[ci] = mem_classes[ci].pages;
+    out_max[ci] = mem_classes[ci].out_max;
+  }
+  for(i = 0, run = 0; i < mem_npages; ++i) {
+    if(mem_pages[i].kind == MEM_PAGE_FREE) {
+      ++free_pages;
+      if(++run > largest) {
+        largest = run;
+      }
+    } else {
+      run = 0;
+      if(mem_pages[i].kind != MEM_PAGE_SLAB) {
+        ++large_pages;
+      }
     }
+  }
+  MEM_UNLOCK();
 
-    plug_holes(mem2);
+  MEM_PRINT("%-12s %-8s %-8s %-8s %-8s\n", "Heap block", "Pages", "In use", "Cached", "Max out");
+  for(ci = 0; ci < MEM_CLASSES; ++ci) {
+    if(out_max[ci] == 0) {
+      continue;
+    }
+    MEM_PRINT("%-12u %-8u %-8llu %-8u %-8u\n", (unsigned int)mem_class_size[ci], pages[ci],
+              (unsigned long long)(allocs[ci] - frees[ci]), cached[ci], out_max[ci]);
+    carved += (uint64_t)pages[ci] * mem_classes[ci].per_page * mem_class_size[ci];
+    in_use += (allocs[ci] - frees[ci]) * mem_class_size[ci];
   }
-  sys_sem_signal(mem_sem);
-  return rmem;
+  MEM_PRINT("%-12s %-8u\n", "large", large_pages);
+  MEM_PRINT("heap pages: %u of %u in use, largest free run %u, page size %u\n",
+            mem_npages - free_pages, mem_npages, largest, (unsigned int)MEM_PAGE_SIZE);
+  MEM_PRINT("fragmentation: %.1f%% of allocated bytes lost to rounding, %.1f%% of carved blocks free\n",
+            handed ? 100.0 * (handed - requested) / handed : 0.0,
+            carved ? 100.0 * (carved - in_use) / carved : 0.0);
+
+#undef MEM_PRINT
+  return len;
 }
 /*-----------------------------------------------------------------------------------*/
 #if MEM_RECLAIM
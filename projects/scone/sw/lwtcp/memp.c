@@ -35,6 +35,8 @@
 
 #include "lwip/lwipopts.h"
 
+#include <stdlib.h>
+
 #include "lwip/memp.h"
 
 #include "lwip/pbuf.h"
@@ -68,7 +70,7 @@ static const uint16_t memp_sizes[MEMP_MAX] = {
   sizeof(struct sys_timeout)
 };
 
-static const uint16_t memp_num[MEMP_MAX] = {
+static uint16_t memp_num[MEMP_MAX] = {
   MEMP_NUM_PBUF,
   MEMP_NUM_UDP_PCB,
   MEMP_NUM_TCP_PCB,
@@ -81,36 +83,21 @@ static const uint16_t memp_num[MEMP_MAX] = {
   MEMP_NUM_SYS_TIMEOUT
 };
 
-static uint8_t memp_memory[(MEMP_NUM_PBUF *
-			 MEM_ALIGN_SIZE(sizeof(struct pbuf) +
-					sizeof(struct memp)) +
-			MEMP_NUM_UDP_PCB *
-			 MEM_ALIGN_SIZE(sizeof(struct udp_pcb) +
-					sizeof(struct memp)) +
-			MEMP_NUM_TCP_PCB *
-			 MEM_ALIGN_SIZE(sizeof(struct tcp_pcb) +
-					sizeof(struct memp)) +
-			MEMP_NUM_TCP_PCB_LISTEN *
-			 MEM_ALIGN_SIZE(sizeof(struct tcp_pcb_listen) +
-					sizeof(struct memp)) +
-			MEMP_NUM_TCP_SEG *
-			 MEM_ALIGN_SIZE(sizeof(struct tcp_seg) +
-					sizeof(struct memp)) +
-			MEMP_NUM_NETBUF *
-			 MEM_ALIGN_SIZE(sizeof(struct netbuf) +
-					sizeof(struct memp)) +
-			MEMP_NUM_NETCONN *
-			 MEM_ALIGN_SIZE(sizeof(struct netconn) +
-					sizeof(struct memp)) +
-			MEMP_NUM_API_MSG *
-			 MEM_ALIGN_SIZE(sizeof(struct api_msg) +
-					sizeof(struct memp)) +
-			MEMP_NUM_TCPIP_MSG *
-			 MEM_ALIGN_SIZE(sizeof(struct tcpip_msg) +
-					sizeof(struct memp)) +
-			MEMP_NUM_SYS_TIMEOUT *
-			 MEM_ALIGN_SIZE(sizeof(struct sys_timeout) +
-					sizeof(struct memp)))];
+static const char *memp_names[MEMP_MAX] = {
+  "pbuf",
+  "udp pcb",
+  "tcp pcb",
+  "tcp listen",
+  "tcp seg",
+  "netbuf",
+  "netconn",
+  "api msg",
+  "tcp msg",
+  "sys timeout"
+};
+
+/* allocated by memp_init() once the sizes are known */
+static uint8_t *memp_memory = NULL;
 
 #if MEMP_RECLAIM
 struct memp_reclaim_ {
@@ -150,12 +137,29 @@ memp_sanity(void)
 }
 #endif /* LWIP_DEBUG */
 /*-----------------------------------------------------------------------------------*/
+/* Sets the number of elements of a pool in place of its MEMP_NUM_ option, must be
+   called before memp_init(). */
+void
+memp_configure(memp_t type, uint16_t num)
+{
+  ASSERT("memp_configure: before memp_init", memp_memory == NULL);
+  ASSERT("memp_configure: type < MEMP_MAX", type < MEMP_MAX);
+  memp_num[type] = num;
+}
+/*-----------------------------------------------------------------------------------*/
+const char *
+memp_name(memp_t type)
+{
+  return memp_names[type];
+}
+/*-----------------------------------------------------------------------------------*/
 void
 memp_init(void)
 {
     struct memp *m, *memp;
     uint16_t i, j;
     uint16_t size;
+    unsigned long total;
 
 #ifdef MEMP_STATS
     for(i = 0; i < MEMP_MAX; ++i) {
@@ -165,7 +169,14 @@ memp_init(void)
     }
 #endif /* MEMP_STATS */
 
-    memp = (struct memp *)&memp_memory[0];
+    total = MEM_ALIGNMENT;
+    for(i = 0; i < MEMP_MAX; ++i) {
+        total += (unsigned long)memp_num[i] * MEM_ALIGN_SIZE(memp_sizes[i] + sizeof(struct memp));
+    }
+    memp_memory = malloc(total);
+    ASSERT("memp_init: pools allocated", memp_memory != NULL);
+
+    memp = (struct memp *)MEM_ALIGN(memp_memory);
     for(i = 0; i < MEMP_MAX; ++i) {
         size = MEM_ALIGN_SIZE(memp_sizes[i] + sizeof(struct memp));
         if(memp_num[i] > 0) {
@@ -43,6 +43,8 @@
 /*-----------------------------------------------------------------------------------*/
 #include "lwip/debug.h"
 
+#include <stdlib.h>
+
 #include "lwip/stats.h"
 
 #include "lwip/def.h"
@@ -52,13 +54,34 @@
 
 #include "lwip/sys.h"
 
-static uint8_t pbuf_pool_memory[(PBUF_POOL_SIZE * MEM_ALIGN_SIZE(PBUF_POOL_BUFSIZE + sizeof(struct pbuf)))];
+static uint8_t *pbuf_pool_memory = NULL;
+static uint16_t pbuf_pool_num = PBUF_POOL_SIZE;
+static uint16_t pbuf_pool_bufsize = MEM_ALIGN_SIZE(PBUF_POOL_BUFSIZE);
 static volatile uint8_t pbuf_pool_free_lock, pbuf_pool_alloc_lock;
 static sys_sem_t pbuf_pool_free_sem;
 static struct pbuf *pbuf_pool = NULL;
 static struct pbuf *pbuf_pool_alloc_cache = NULL;
 static struct pbuf *pbuf_pool_free_cache = NULL;
 
+void (* pbuf_ref_release)(void *payload) = NULL;
+
+/*-----------------------------------------------------------------------------------*/
+/* pbuf_pool_configure():
+ *
+ * Sets the size of the pool pbuf_init() sets up, the data size is
+ * rounded up to keep the pbufs aligned.
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+pbuf_pool_configure(uint16_t num, uint16_t bufsize)
+{
+  ASSERT("pbuf_pool_configure: before pbuf_init", pbuf_pool_memory == NULL);
+  ASSERT("pbuf_pool_configure: bufsize in range",
+         bufsize >= PBUF_POOL_BUFSIZE_MIN && bufsize <= PBUF_POOL_BUFSIZE_MAX);
+  pbuf_pool_num = num;
+  pbuf_pool_bufsize = MEM_ALIGN_SIZE(bufsize);
+}
+
 /*-----------------------------------------------------------------------------------*/
 /* pbuf_init():
  *
@@ -76,21 +99,24 @@ void
 pbuf_init(void)
 {
   struct pbuf *p, *q;
-  uint8_t i;
+  uint16_t i;
 
-  pbuf_pool = (struct pbuf *)&pbuf_pool_memory[0];
+  pbuf_pool_memory = malloc(pbuf_pool_num * MEM_ALIGN_SIZE(pbuf_pool_bufsize + sizeof(struct pbuf)) + MEM_ALIGNMENT);
+  ASSERT("pbuf_init: pool allocated", pbuf_pool_memory != NULL);
+  pbuf_pool = (struct pbuf *)MEM_ALIGN(pbuf_pool_memory);
   ASSERT("pbuf_init: pool aligned", (long)pbuf_pool % MEM_ALIGNMENT == 0);
 
 #ifdef PBUF_STATS
-  stats.pbuf.avail = PBUF_POOL_SIZE;
+  stats.pbuf.avail = pbuf_pool_num;
 #endif /* PBUF_STATS */
 
   /* Set up ->next pointers to link the pbufs of the pool together. */
   p = pbuf_pool;
+  q = NULL;
 
-  for(i = 0; i < PBUF_POOL_SIZE; ++i) {
-    p->next = (struct pbuf *)((uint8_t *)p + PBUF_POOL_BUFSIZE + sizeof(struct pbuf));
-    p->len = p->tot_len = PBUF_POOL_BUFSIZE;
+  for(i = 0; i < pbuf_pool_num; ++i) {
+    p->next = (struct pbuf *)((uint8_t *)p + MEM_ALIGN_SIZE(pbuf_pool_bufsize + sizeof(struct pbuf)));
+    p->len = p->tot_len = pbuf_pool_bufsize;
     p->payload = MEM_ALIGN((void *)((uint8_t *)p + sizeof(struct pbuf)));
     q = p;
     p = p->next;
@@ -98,7 +124,11 @@ pbuf_init(void)
 
   /* The ->next pointer of last pbuf is NULL to indicate that there
      are no more pbufs in the pool. */
-  q->next = NULL;
+  if(q != NULL) {
+    q->next = NULL;
+  } else {
+    pbuf_pool = NULL;
+  }
 
   pbuf_pool_alloc_lock = 0;
   pbuf_pool_free_lock = 0;
@@ -237,7 +267,7 @@ pbuf_alloc(pbuf_layer l, uint16_t size, pbuf_flag flag)
 		  p->tot_len = size;
 
 		  /* Set the length of the first pbuf is the chain. */
-		  p->len = size > PBUF_POOL_BUFSIZE - offset? PBUF_POOL_BUFSIZE - offset: size;
+		  p->len = size > pbuf_pool_bufsize - offset? pbuf_pool_bufsize - offset: size;
 
 		  p->flags = PBUF_FLAG_POOL;
 
@@ -256,13 +286,13 @@ pbuf_alloc(pbuf_layer l, uint16_t size, pbuf_flag flag)
 			  }
 			  q->next = NULL;
 			  r->next = q;
-			  q->len = rsize > PBUF_POOL_BUFSIZE? PBUF_POOL_BUFSIZE: rsize;
+			  q->len = rsize > pbuf_pool_bufsize? pbuf_pool_bufsize: rsize;
 			  q->flags = PBUF_FLAG_POOL;
 			  q->payload = (void *)((uint8_t *)q + sizeof(struct pbuf));
 			  r = q;
 			  q->ref = 1;
 			  q = q->next;
-			  rsize -= PBUF_POOL_BUFSIZE;
+			  rsize -= pbuf_pool_bufsize;
 		  }
 		  r->next = NULL;
 
@@ -296,6 +326,26 @@ pbuf_alloc(pbuf_layer l, uint16_t size, pbuf_flag flag)
 		  p->next = NULL;
 		  p->flags = PBUF_FLAG_ROM;
 		  break;
+	  case PBUF_REF:
+		  /* Only the pbuf structure, the caller points it at the data. */
+		  p = (struct pbuf*)memp_mallocp(MEMP_PBUF);
+		  if(p == NULL) {
+#ifdef PBUF_STATS
+			  __sync_fetch_and_add(&stats.pbuf.ref_err, 1);
+#endif /* PBUF_STATS */
+			  return NULL;
+		  }
+		  p->payload = NULL;
+		  p->len = p->tot_len = size;
+		  p->next = NULL;
+		  p->flags = PBUF_FLAG_REF;
+#ifdef PBUF_STATS
+		  __sync_fetch_and_add(&stats.pbuf.refs, 1);
+		  if(__sync_add_and_fetch(&stats.pbuf.ref_used, 1) > stats.pbuf.ref_max) {
+			  stats.pbuf.ref_max = stats.pbuf.ref_used;
+		  }
+#endif /* PBUF_STATS */
+		  break;
 	  default:
 		  ASSERT("pbuf_alloc: erroneous flag", 0);
 		  return NULL;
@@ -365,7 +415,8 @@ pbuf_realloc(struct pbuf *p, uint16_t size)
 
   ASSERT("pbuf_realloc: sane p->flags", p->flags == PBUF_FLAG_POOL ||
          p->flags == PBUF_FLAG_ROM ||
-         p->flags == PBUF_FLAG_RAM);
+         p->flags == PBUF_FLAG_RAM ||
+         p->flags == PBUF_FLAG_REF);
 
 
   if(p->tot_len <= size) {
@@ -398,6 +449,7 @@ pbuf_realloc(struct pbuf *p, uint16_t size)
     }
     break;
   case PBUF_FLAG_ROM:
+  case PBUF_FLAG_REF:
     p->len = size;
     break;
   case PBUF_FLAG_RAM:
@@ -442,6 +494,17 @@ pbuf_header(struct pbuf *p, int16_t header_size)
 {
   void *payload;
 
+  if(p->flags == PBUF_FLAG_REF) {
+    /* the data is not ours, headers can be hidden but there is no room for new ones */
+    if(header_size > 0 || -header_size > p->len) {
+      return -1;
+    }
+    p->payload = (uint8_t *)p->payload - header_size;
+    p->len += header_size;
+    p->tot_len += header_size;
+    return 0;
+  }
+
   payload = p->payload;
   p->payload = (uint8_t *)p->payload - header_size/sizeof(uint8_t);
 
@@ -479,7 +542,8 @@ pbuf_free(struct pbuf *p)
 
   ASSERT("pbuf_free: sane flags", p->flags == PBUF_FLAG_POOL ||
          p->flags == PBUF_FLAG_ROM ||
-         p->flags == PBUF_FLAG_RAM);
+         p->flags == PBUF_FLAG_RAM ||
+         p->flags == PBUF_FLAG_REF);
 
   ASSERT("pbuf_free: p->ref > 0", p->ref > 0);
 
@@ -493,7 +557,7 @@ pbuf_free(struct pbuf *p)
     while(p != NULL) {
       /* Check if this is a pbuf from the pool. */
       if(p->flags == PBUF_FLAG_POOL) {
-	p->len = p->tot_len = PBUF_POOL_BUFSIZE;
+	p->len = p->tot_len = pbuf_pool_bufsize;
 	p->payload = (void *)((uint8_t *)p + sizeof(struct pbuf));
 	q = p->next;
 	PBUF_POOL_FREE(p);
@@ -503,6 +567,15 @@ pbuf_free(struct pbuf *p)
       } else if(p->flags == PBUF_FLAG_ROM) {
 	q = p->next;
 	memp_freep(MEMP_PBUF, p);
+      } else if(p->flags == PBUF_FLAG_REF) {
+	q = p->next;
+	if(pbuf_ref_release != NULL) {
+	  pbuf_ref_release(p->payload);
+	}
+	memp_freep(MEMP_PBUF, p);
+#ifdef PBUF_STATS
+	__sync_fetch_and_sub(&stats.pbuf.ref_used, 1);
+#endif /* PBUF_STATS */
       } else {
 	q = p->next;
 	mem_free(p);
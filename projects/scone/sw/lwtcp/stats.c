@@ -41,6 +41,9 @@
 
 #include "lwip/stats.h"
 #include "lwip/mem.h"
+#include "lwip/memp.h"
+
+#include <stdio.h>
 
 
 #ifdef STATS
@@ -55,3 +58,52 @@ stats_init(void)
 #endif /* STATS */
 }
 /*-----------------------------------------------------------------------------------*/
+/* stats_sprint():
+ *
+ * Writes the use of the pbufs, the heap and the pools into buf, one
+ * line each, followed by the heap detail from mem_sprint(). Returns the
+ * length written, like snprintf.
+ */
+/*-----------------------------------------------------------------------------------*/
+int
+stats_sprint(char *buf, int size)
+{
+  int len = 0;
+#ifdef STATS
+  int i;
+
+#define STATS_PRINT(...) do { \
+    len += snprintf(buf + len, (len < size) ? size - len : 0, __VA_ARGS__); \
+  } while(0)
+
+  STATS_PRINT("%-12s %-8s %-8s %-8s %-8s %s\n", "Pool", "Avail", "Used", "Max", "Err", "");
+#ifdef PBUF_STATS
+  STATS_PRINT("%-12s %-8u %-8u %-8u %-8u locked %u/%u\n", "pbuf pool", stats.pbuf.avail, stats.pbuf.used,
+              stats.pbuf.max, stats.pbuf.err, stats.pbuf.alloc_locked, stats.pbuf.refresh_locked);
+  STATS_PRINT("%-12s %-8s %-8u %-8u %-8u %u wrapped\n", "pbuf ref", "-", stats.pbuf.ref_used,
+              stats.pbuf.ref_max, stats.pbuf.ref_err, stats.pbuf.refs);
+#endif /* PBUF_STATS */
+#ifdef MEM_STATS
+  STATS_PRINT("%-12s %-8u %-8u %-8u %-8u bytes, pages %u max %u\n", "heap", stats.mem.avail, stats.mem.used,
+              stats.mem.max, stats.mem.err, stats.mem.pages, stats.mem.pages_max);
+#endif /* MEM_STATS */
+#ifdef MEMP_STATS
+  for(i = 0; i < MEMP_MAX; ++i) {
+    STATS_PRINT("%-12s %-8u %-8u %-8u %-8u\n", memp_name(i), stats.memp[i].avail, stats.memp[i].used,
+                stats.memp[i].max, stats.memp[i].err);
+  }
+#endif /* MEMP_STATS */
+#ifdef SYS_STATS
+  STATS_PRINT("%-12s %-8s %-8u %-8u %-8u\n", "sem", "-", stats.sys.sem.used, stats.sys.sem.max, stats.sys.sem.err);
+  STATS_PRINT("%-12s %-8s %-8u %-8u %-8u full\n", "mbox", "-", stats.sys.mbox.used, stats.sys.mbox.max, stats.sys.mbox.err);
+#endif /* SYS_STATS */
+
+#ifdef MEM_STATS
+  len += mem_sprint(buf + len, (len < size) ? size - len : 0);
+#endif /* MEM_STATS */
+
+#undef STATS_PRINT
+#endif /* STATS */
+  return len;
+}
+/*-----------------------------------------------------------------------------------*/
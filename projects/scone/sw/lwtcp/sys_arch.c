@@ -45,6 +45,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 #include "lwip/sys.h"
 #include "lwip/opt.h"
@@ -59,13 +61,32 @@ struct sys_mbox_msg {
   void *msg;
 };
 
-#define SYS_MBOX_SIZE 100
+/*
+ * A mailbox is a bounded ring whose slots are claimed with a compare and
+ * swap, no lock is taken to post or fetch. Each slot carries a sequence
+ * number telling whether it is waiting to be posted to or fetched from on
+ * the current lap of the ring (Vyukov's bounded queue). A fetcher only
+ * sleeps, on an eventfd, when the ring is empty and a poster only writes the
+ * eventfd when a fetcher is asleep; the same goes the other way round for
+ * posters finding the ring full. Any thread may post, one thread fetches
+ * from a mailbox at a time as the api and transport threads do.
+ */
+#define SYS_MBOX_SIZE 128      /* a power of two */
+#define SYS_MBOX_MASK (SYS_MBOX_SIZE - 1)
+
+struct sys_mbox_slot {
+  volatile uint32_t seq;
+  void *msg;
+};
 
 struct sys_mbox {
-  uint16_t first, last;
-  void *msgs[SYS_MBOX_SIZE];
-  struct sys_sem *mail;
-  struct sys_sem *mutex;
+  volatile uint32_t head __attribute__((aligned(64)));   /* next slot to fetch */
+  volatile uint32_t tail __attribute__((aligned(64)));   /* next slot to post to */
+  volatile uint32_t fetchers __attribute__((aligned(64)));   /* asleep waiting for mail */
+  volatile uint32_t posters;   /* asleep waiting for room */
+  int mail_fd;
+  int room_fd;
+  struct sys_mbox_slot slots[SYS_MBOX_SIZE];
 };
 
 struct sys_sem {
@@ -166,11 +187,23 @@ struct sys_mbox *
 sys_mbox_new()
 {
   struct sys_mbox *mbox;
+  uint32_t i;
 
-  mbox = malloc(sizeof(struct sys_mbox));
-  mbox->first = mbox->last = 0;
-  mbox->mail = sys_sem_new_(0);
-  mbox->mutex = sys_sem_new_(1);
+  if(posix_memalign((void **)&mbox, 64, sizeof(struct sys_mbox)) != 0) {
+    return SYS_MBOX_NULL;
+  }
+  mbox->head = mbox->tail = 0;
+  mbox->fetchers = mbox->posters = 0;
+  for(i = 0; i < SYS_MBOX_SIZE; i++) {
+    mbox->slots[i].seq = i;
+    mbox->slots[i].msg = NULL;
+  }
+  mbox->mail_fd = eventfd(0, EFD_NONBLOCK);
+  mbox->room_fd = eventfd(0, EFD_NONBLOCK);
+  if(mbox->mail_fd < 0 || mbox->room_fd < 0) {
+    perror("sys_mbox_new: eventfd");
+    abort();
+  }
 
 #ifdef SYS_STATS
   stats.sys.mbox.used++;
@@ -189,87 +222,192 @@ sys_mbox_free(struct sys_mbox *mbox)
 #ifdef SYS_STATS
     stats.sys.mbox.used--;
 #endif /* SYS_STATS */
-    sys_sem_wait(mbox->mutex);
-
-    sys_sem_free_(mbox->mail);
-    sys_sem_free_(mbox->mutex);
-    mbox->mail = mbox->mutex = NULL;
+    close(mbox->mail_fd);
+    close(mbox->room_fd);
     /*  DEBUGF("sys_mbox_free: mbox 0x%lx\n", mbox);*/
     free(mbox);
   }
 }
 /*-----------------------------------------------------------------------------------*/
-void
-sys_mbox_post(struct sys_mbox *mbox, void *msg)
+static void
+mbox_wake(int fd)
 {
-  uint8_t first;
+  uint64_t one = 1;
 
-  sys_sem_wait(mbox->mutex);
-
-  DEBUGF(SYS_DEBUG, ("sys_mbox_post: mbox %p msg %p\n", mbox, msg));
+  /* a full counter means a wakeup is pending anyway */
+  if(write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    perror("sys_mbox: eventfd write");
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+mbox_sleep(int fd, int timeout)
+{
+  struct pollfd pfd;
+  uint64_t count;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  if(poll(&pfd, 1, timeout) > 0) {
+    if(read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+      perror("sys_mbox: eventfd read");
+    }
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+mbox_trypost(struct sys_mbox *mbox, void *msg)
+{
+  struct sys_mbox_slot *slot;
+  uint32_t pos;
+  int32_t dif;
+
+  pos = mbox->tail;
+  for(;;) {
+    slot = &mbox->slots[pos & SYS_MBOX_MASK];
+    dif = (int32_t)(slot->seq - pos);
+    if(dif == 0) {
+      if(__sync_bool_compare_and_swap(&mbox->tail, pos, pos + 1)) {
+        break;
+      }
+    } else if(dif < 0) {
+      /* the slot still holds mail from the last lap */
+      return 0;
+    }
+    pos = mbox->tail;
+  }
 
-  mbox->msgs[mbox->last] = msg;
+  slot->msg = msg;
+  __sync_synchronize();
+  slot->seq = pos + 1;
+  return 1;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * Takes up to max messages that were posted in a row with a single compare
+ * and swap of the head. msgs may be NULL to throw the mail away.
+ */
+static uint16_t
+mbox_tryfetch(struct sys_mbox *mbox, void **msgs, uint16_t max)
+{
+  uint32_t pos;
+  uint16_t n, i;
+
+  for(;;) {
+    pos = mbox->head;
+    for(n = 0; n < max; n++) {
+      if(mbox->slots[(pos + n) & SYS_MBOX_MASK].seq != pos + n + 1) {
+        break;
+      }
+    }
+    if(n == 0) {
+      if(pos == mbox->head) {
+        return 0;
+      }
+      continue;
+    }
+    if(__sync_bool_compare_and_swap(&mbox->head, pos, pos + n)) {
+      break;
+    }
+  }
 
-  if(mbox->last == mbox->first) {
-    first = 1;
-  } else {
-    first = 0;
+  for(i = 0; i < n; i++) {
+    if(msgs != NULL) {
+      msgs[i] = mbox->slots[(pos + i) & SYS_MBOX_MASK].msg;
+    }
+  }
+  __sync_synchronize();
+  for(i = 0; i < n; i++) {
+    mbox->slots[(pos + i) & SYS_MBOX_MASK].seq = pos + i + SYS_MBOX_SIZE;
   }
 
-  mbox->last++;
-  if(mbox->last == SYS_MBOX_SIZE) {
-    mbox->last = 0;
+  __sync_synchronize();
+  if(mbox->posters) {
+    mbox_wake(mbox->room_fd);
   }
+  return n;
+}
+/*-----------------------------------------------------------------------------------*/
+void
+sys_mbox_post(struct sys_mbox *mbox, void *msg)
+{
+  DEBUGF(SYS_DEBUG, ("sys_mbox_post: mbox %p msg %p\n", mbox, msg));
 
-  if(first) {
-    sys_sem_signal(mbox->mail);
+  while(!mbox_trypost(mbox, msg)) {
+    /* full: say we are waiting, then look again so a fetch in between is not missed */
+    __sync_fetch_and_add(&mbox->posters, 1);
+    if(mbox_trypost(mbox, msg)) {
+      __sync_fetch_and_sub(&mbox->posters, 1);
+      break;
+    }
+#ifdef SYS_STATS
+    stats.sys.mbox.err++;
+#endif /* SYS_STATS */
+    mbox_sleep(mbox->room_fd, -1);
+    __sync_fetch_and_sub(&mbox->posters, 1);
   }
 
-  sys_sem_signal(mbox->mutex);
+  __sync_synchronize();
+  if(mbox->fetchers) {
+    mbox_wake(mbox->mail_fd);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+static unsigned long
+ms_since(struct timeval *start)
+{
+  struct timeval now;
 
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_usec - start->tv_usec) / 1000;
 }
 /*-----------------------------------------------------------------------------------*/
 uint16_t
 sys_arch_mbox_fetch(struct sys_mbox *mbox, void **msg, uint16_t timeout)
 {
-  uint16_t time = 1;
-
-  /* The mutex lock is quick so we don't bother with the timeout
-     stuff here. */
-  sys_arch_sem_wait(mbox->mutex, 0);
-
-  while(mbox->first == mbox->last) {
-    sys_sem_signal(mbox->mutex);
+  struct timeval start;
+  unsigned long waited;
+  uint16_t got;
 
-    /* We block while waiting for a mail to arrive in the mailbox. We
-       must be prepared to timeout. */
-    if(timeout != 0) {
-      time = sys_arch_sem_wait(mbox->mail, timeout);
+  if(mbox_tryfetch(mbox, msg, 1)) {
+    DEBUGF(SYS_DEBUG, ("sys_mbox_fetch: mbox %p msg %p\n", mbox, msg ? *msg : NULL));
+    return 1;
+  }
 
-      /* If time == 0, the sem_wait timed out, and we return 0. */
-      if(time == 0) {
-	return 0;
+  /* We block while waiting for a mail to arrive in the mailbox. We
+     must be prepared to timeout. */
+  gettimeofday(&start, NULL);
+  for(;;) {
+    __sync_fetch_and_add(&mbox->fetchers, 1);
+    got = mbox_tryfetch(mbox, msg, 1);
+    if(!got) {
+      if(timeout != 0) {
+        waited = ms_since(&start);
+        if(waited >= timeout) {
+          __sync_fetch_and_sub(&mbox->fetchers, 1);
+          return 0;
+        }
+        mbox_sleep(mbox->mail_fd, timeout - waited);
+      } else {
+        mbox_sleep(mbox->mail_fd, -1);
       }
-    } else {
-      sys_arch_sem_wait(mbox->mail, 0);
+      got = mbox_tryfetch(mbox, msg, 1);
+    }
+    __sync_fetch_and_sub(&mbox->fetchers, 1);
+    if(got) {
+      break;
     }
-
-    sys_arch_sem_wait(mbox->mutex, 0);
-  }
-
-  if(msg != NULL) {
-    DEBUGF(SYS_DEBUG, ("sys_mbox_fetch: mbox %p msg %p\n", mbox, *msg));
-    *msg = mbox->msgs[mbox->first];
-  }
-
-  mbox->first++;
-  if(mbox->first == SYS_MBOX_SIZE) {
-    mbox->first = 0;
   }
 
-  sys_sem_signal(mbox->mutex);
-
-  return time;
+  DEBUGF(SYS_DEBUG, ("sys_mbox_fetch: mbox %p msg %p\n", mbox, msg ? *msg : NULL));
+  waited = ms_since(&start);
+  return (waited == 0) ? 1 : ((waited > 0xffff) ? 0xffff : waited);
+}
+/*-----------------------------------------------------------------------------------*/
+uint16_t
+sys_arch_mbox_tryfetch(struct sys_mbox *mbox, void **msgs, uint16_t max)
+{
+  return mbox_tryfetch(mbox, msgs, max);
 }
 /*-----------------------------------------------------------------------------------*/
 struct sys_sem *
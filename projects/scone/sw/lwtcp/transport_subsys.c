@@ -52,6 +52,8 @@ static void (* transport_init_done)(void *arg) = NULL;
 static void *transport_init_done_arg;
 static sys_mbox_t mbox;
 
+#define TRANSPORT_MSG_BATCH 32
+
 /*-----------------------------------------------------------------------------------*/
 static void
 transport_tcp_timer(void *arg)
@@ -61,11 +63,30 @@ transport_tcp_timer(void *arg)
 }
 /*-----------------------------------------------------------------------------------*/
 
+/*-----------------------------------------------------------------------------------*/
+static void
+transport_msg_input(struct transport_msg *msg)
+{
+  switch(msg->type) {
+  case TCP_MSG_API:
+    DEBUGF(TCP_DEBUG, ("transport_thread: API message %p\n", msg));
+    api_msg_input(msg->msg.apimsg);
+    break;
+  case TCP_MSG_INPUT:
+    DEBUGF(TCP_DEBUG, ("transport_thread: TCP input packet %p\n", msg));
+    tcp_input(msg->msg.inp.p, msg->msg.inp.netif);
+    break;
+  default:
+    break;
+  }
+  memp_freep(MEMP_TCP_MSG, msg);
+}
 /*-----------------------------------------------------------------------------------*/
 static void
 transport_thread(void *arg)
 {
-  struct transport_msg *msg;
+  struct transport_msg *msgs[TRANSPORT_MSG_BATCH];
+  uint16_t i, n;
 
   udp_init();
   tcp_init();
@@ -77,20 +98,12 @@ transport_thread(void *arg)
   }
 
   while(1) {                          /* MAIN Loop */
-    sys_mbox_fetch(mbox, (void *)&msg);
-    switch(msg->type) {
-    case TCP_MSG_API:
-      DEBUGF(TCP_DEBUG, ("transport_thread: API message %p\n", msg));
-      api_msg_input(msg->msg.apimsg);
-      break;
-    case TCP_MSG_INPUT:
-      DEBUGF(TCP_DEBUG, ("transport_thread: TCP input packet %p\n", msg));
-      tcp_input(msg->msg.inp.p, msg->msg.inp.netif);
-      break;
-    default:
-      break;
+    /* wait for one message, timers run meanwhile, then take what else is waiting */
+    sys_mbox_fetch(mbox, (void *)&msgs[0]);
+    n = 1 + sys_arch_mbox_tryfetch(mbox, (void **)&msgs[1], TRANSPORT_MSG_BATCH - 1);
+    for(i = 0; i < n; i++) {
+      transport_msg_input(msgs[i]);
     }
-    memp_freep(MEMP_TCP_MSG, msg);
   }
 }
 /*-----------------------------------------------------------------------------------*/
@@ -16,6 +16,7 @@
 
 /* Include for socket IOCTLs */
 #include <linux/sockios.h>
+#include <linux/types.h>
 
 /* Maximum number of interfaces */
 #ifndef MAX_IFACE
@@ -424,6 +425,11 @@
  */
 #define SIOCREGREAD		SIOCDEVPRIVATE
 #define SIOCREGWRITE		(SIOCDEVPRIVATE + 1)
+#define SIOCREGREADMULTI	(SIOCDEVPRIVATE + 2)
+#define SIOCREGWRITEMULTI	(SIOCDEVPRIVATE + 3)
+
+/* Maximum number of registers in one SIOCREG*MULTI call */
+#define NF2_REG_MULTI_MAX	256
 
 /*
  * Structure for transferring register data via an IOCTL
@@ -433,4 +439,17 @@ struct nf2reg {
 	unsigned int	val;
 };
 
+/*
+ * Structure for transferring a batch of registers via a single IOCTL.
+ * Registers are accessed in array order, reads fill in val. regs is the
+ * user address of the array, held in 64 bits so 32 and 64 bit processes
+ * pass the same layout.
+ */
+struct nf2reg_multi {
+	__u32		num;
+	__u32		pad;
+	__u64		regs;	/* struct nf2reg *, see NF2_REGS_PTR */
+};
+#define NF2_REGS_PTR(regs)	((__u64)(unsigned long)(regs))
+
 #endif
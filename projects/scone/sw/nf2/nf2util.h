@@ -26,10 +26,14 @@ struct nf2device {
 };
 typedef struct nf2device nf2device;
 
+struct nf2reg;
+
 /* Function declarations */
 
 int readReg(struct nf2device *nf2, unsigned reg, unsigned *val);
 int writeReg(struct nf2device *nf2, unsigned reg, unsigned val);
+int readRegs(struct nf2device *nf2, struct nf2reg *regs, unsigned num);
+int writeRegs(struct nf2device *nf2, struct nf2reg *regs, unsigned num);
 int check_iface(struct nf2device *nf2);
 int openDescriptor(struct nf2device *nf2);
 int closeDescriptor(struct nf2device *nf2);
@@ -6,19 +6,25 @@
  *   	- processes an ARP request/reply packet
  *   	- sends an ARP request
  *   	- maintainins the ARP cache
- *
- *   TO DO : maintaining the ARP queue
+ *   	- maintains the ARP queue of packets waiting on a next hop
  */
 
 #include "or_arp.h"
 #include "or_main.h"
 #include "or_utils.h"
+#include "or_pktbuf.h"
 #include "or_iface.h"
 #include "sr_base_internal.h"
 #include "or_output.h"
 #include "or_ip.h"
 #include "or_icmp.h"
 #include "or_rtable.h"
+#include "or_hw_table.h"
+#include "or_twheel.h"
+#include "or_trace.h"
+#include "or_sched.h"
+#include "or_export.h"
+#include "nf2/nf2.h"
 #include "reg_defines.h"
 
 
@@ -26,6 +32,10 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static void arp_queue_remove(router_state* rs, arp_queue_entry* aqe);
 
 void process_arp_packet( struct sr_instance *sr, const uint8_t *packet, unsigned int len, const char *interface) {
 
@@ -99,7 +109,7 @@ void send_arp_reply(struct sr_instance *sr, const uint8_t *packet, unsigned int
 
 	/* Send the reply */
 	if (send_packet(sr, new_packet, sizeof(eth_hdr) + sizeof(arp_hdr), iface->name) != 0) {
-		printf("Error sending ARP reply\n");
+		TRACE(TRACE_WARN, "Error sending ARP reply out %s", iface->name);
 	}
 
 	free(new_packet);
@@ -132,7 +142,7 @@ void send_arp_request(struct sr_instance* sr, uint32_t tip /* Net byte order */,
 
 	/* send the ARP reply */
 	if (send_packet(sr, request_packet, len, interface) != 0) {
-		printf("Failure sending arp request\n");
+		TRACE(TRACE_WARN, "Failure sending arp request out %s", interface);
 	}
 
 	/* recover allocated memory */
@@ -164,42 +174,32 @@ void process_arp_reply( struct sr_instance *sr, const uint8_t *packet, unsigned
 }
 
 /*
+ * Sends everything that was waiting on dest_ip, called as soon as its reply is in the cache.
  * NOT THREAD SAFE! Lock cache rd, queue wr
- *
- *
  */
 void send_queued_packets(struct sr_instance* sr, struct in_addr* dest_ip, char* dest_mac) {
-	node* n = get_router_state(sr)->arp_queue;
-	node* next = NULL;
-
-	while (n) {
-		next = n->next;
-
-		arp_queue_entry* aqe = (arp_queue_entry*)n->data;
-
-		/* match the arp reply sip to our entry next hop ip */
-		if (dest_ip->s_addr == aqe->next_hop.s_addr) {
-			node* cur_packet_node = aqe->head;
-			node* next_packet_node = NULL;
-
-			while (cur_packet_node) {
-				next_packet_node = cur_packet_node->next;
+	router_state* rs = get_router_state(sr);
+	arp_queue_entry* aqe = get_from_arp_queue(sr, dest_ip);
 
-				/* send the packet */
-				arp_queue_packet_entry* aqpe = (arp_queue_packet_entry*)cur_packet_node->data;
+	if (!aqe) {
+		return;
+	}
 
-				send_ip(sr, aqpe->packet, aqpe->len, &(aqe->next_hop), aqe->out_iface_name);
-				node_remove(&(aqe->head), cur_packet_node);
+	/* unlink it first, send_ip queues anew if the entry was dropped from the cache meanwhile */
+	arp_queue_remove(rs, aqe);
 
-				cur_packet_node = next_packet_node;
-			}
+	arp_queue_packet_entry* aqpe = aqe->head;
+	while (aqpe) {
+		arp_queue_packet_entry* next = aqpe->next;
 
-			/* free the arp queue entry for this destination ip, and patch the list */
-			node_remove(&(get_router_state(sr)->arp_queue), n);
-		}
+		/* send_ip takes responsibility for the packet so we don't need to free it */
+		send_ip(sr, aqpe->packet, aqpe->len, &(aqe->next_hop), aqe->out_iface_name);
+		free(aqpe);
 
-		n = next;
+		aqpe = next;
 	}
+
+	free(aqe);
 }
 
 
@@ -211,6 +211,93 @@ arp_hdr* get_arp_hdr(const uint8_t* packet, unsigned int len) {
 
 
 
+/* the index stays at most half full so probe runs stay short */
+#define ARP_CACHE_HASH_MIN_SIZE 64
+
+/* an unresolved next hop is asked for once a second, five times, before its packets are bounced */
+#define ARP_REQUEST_INTERVAL_MS 1000
+#define ARP_MAX_REQUESTS 5
+
+/* spreads ip addresses for both the cache index and the queue chains */
+static inline uint32_t arp_hash_ip(uint32_t ip) {
+	ip ^= ip >> 16;
+	ip *= 0x45D9F3B;
+	ip ^= ip >> 16;
+	return ip;
+}
+
+static void arp_cache_hash_place(arp_cache_entry** slots, uint32_t size, arp_cache_entry* entry) {
+	uint32_t i = arp_hash_ip(entry->ip.s_addr) & (size - 1);
+	while (slots[i]) {
+		i = (i + 1) & (size - 1);
+	}
+	slots[i] = entry;
+}
+
+/* NOT THREAD SAFE: lock the arp cache for writing */
+static void arp_cache_hash_insert(router_state* rs, arp_cache_entry* entry) {
+	uint32_t i;
+
+	if ((rs->arp_cache_hash_count + 1) * 2 > rs->arp_cache_hash_size) {
+		uint32_t size = rs->arp_cache_hash_size ? (rs->arp_cache_hash_size * 2) : ARP_CACHE_HASH_MIN_SIZE;
+		arp_cache_entry** slots = (arp_cache_entry**)calloc(size, sizeof(arp_cache_entry*));
+		assert(slots);
+
+		for (i = 0; i < rs->arp_cache_hash_size; ++i) {
+			if (rs->arp_cache_hash[i]) {
+				arp_cache_hash_place(slots, size, rs->arp_cache_hash[i]);
+			}
+		}
+
+		free(rs->arp_cache_hash);
+		rs->arp_cache_hash = slots;
+		rs->arp_cache_hash_size = size;
+	}
+
+	arp_cache_hash_place(rs->arp_cache_hash, rs->arp_cache_hash_size, entry);
+	++rs->arp_cache_hash_count;
+}
+
+/* NOT THREAD SAFE: lock the arp cache for writing */
+static void arp_cache_hash_remove(router_state* rs, arp_cache_entry* entry) {
+	uint32_t mask = rs->arp_cache_hash_size - 1;
+	uint32_t i, j;
+
+	if (!rs->arp_cache_hash) {
+		return;
+	}
+
+	i = arp_hash_ip(entry->ip.s_addr) & mask;
+	while (rs->arp_cache_hash[i] != entry) {
+		if (!rs->arp_cache_hash[i]) {
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+
+	/*
+	 * Shift later members of the probe run back into the hole rather than leaving a
+	 * tombstone. One can move to i unless its home slot lies cyclically in (i, j].
+	 */
+	j = i;
+	while (1) {
+		j = (j + 1) & mask;
+		arp_cache_entry* e = rs->arp_cache_hash[j];
+		if (!e) {
+			break;
+		}
+
+		uint32_t home = arp_hash_ip(e->ip.s_addr) & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			rs->arp_cache_hash[i] = e;
+			i = j;
+		}
+	}
+
+	rs->arp_cache_hash[i] = NULL;
+	--rs->arp_cache_hash_count;
+}
+
 /*
  * Not thread safe:
  * 	Acquire arp cache lock before invoking this procedure
@@ -220,23 +307,58 @@ arp_hdr* get_arp_hdr(const uint8_t* packet, unsigned int len) {
  * 	The two procedures are defined below.
  */
 arp_cache_entry *in_arp_cache(router_state *rs, struct in_addr* next_hop) {
-	node *arp_walker = 0;
-	arp_cache_entry *arp_entry = 0;
+	uint32_t mask = rs->arp_cache_hash_size - 1;
+	uint32_t i;
 
-	arp_walker = rs->arp_cache;
-	while(arp_walker)
-	{
-		arp_entry = (arp_cache_entry *)arp_walker->data;
+	if (!rs->arp_cache_hash) {
+		return NULL;
+	}
 
-		if (next_hop->s_addr == arp_entry->ip.s_addr) {
-			break;
+	i = arp_hash_ip(next_hop->s_addr) & mask;
+	while (rs->arp_cache_hash[i]) {
+		if (rs->arp_cache_hash[i]->ip.s_addr == next_hop->s_addr) {
+			return rs->arp_cache_hash[i];
 		}
+		i = (i + 1) & mask;
+	}
 
-		arp_entry = 0;
-		arp_walker = arp_walker->next;
+	return NULL;
+}
+
+/*
+ * Puts a dynamic entry on the wheel to go arp_ttl seconds after it was last
+ * refreshed, the same second the old once a second scan would have dropped it.
+ * NOT THREAD SAFE: lock the arp cache for writing
+ */
+static void arp_cache_schedule(router_state* rs, arp_cache_entry* entry) {
+	if (entry->is_static) {
+		twheel_del(rs->arp_cache_wheel, &(entry->expiry));
+	} else {
+		twheel_add(rs->arp_cache_wheel, &(entry->expiry), entry->TTL + rs->arp_ttl + 1);
+		if (rs->arp_cache_timer) {
+			sched_kick(rs->arp_cache_timer, arp_cache_delay(entry->expiry.expires));
+		}
 	}
+}
 
-	return arp_entry;
+/*
+ * Tells readers of the cache that an entry was added, removed or changed.
+ * NOT THREAD SAFE: lock the arp cache for writing
+ */
+static void arp_cache_changed(router_state* rs) {
+	++rs->arp_cache_version;
+	export_stamp(rs, EXPORT_ARP);
+}
+
+/*
+ * Unlinks entry from the list, the index and the wheel, and frees it.
+ * NOT THREAD SAFE: lock the arp cache for writing
+ */
+static void arp_cache_remove(router_state* rs, arp_cache_entry* entry) {
+	arp_cache_changed(rs);
+	arp_cache_hash_remove(rs, entry);
+	twheel_del(rs->arp_cache_wheel, &(entry->expiry));
+	node_remove(&(rs->arp_cache), entry->list_node);
 }
 
 
@@ -251,10 +373,16 @@ int update_arp_cache(struct sr_instance* sr, struct in_addr* remote_ip, char* re
 
 	router_state *rs = (router_state *)sr->interface_subsystem;
 	arp_cache_entry *arp_entry = 0;
+	int modified = 1;
 
 	arp_entry = in_arp_cache(rs, remote_ip);
 	if(arp_entry) {
 
+		/* a refresh that changes nothing the hardware holds needs no sync */
+		if ((memcmp(arp_entry->arp_ha, remote_mac, ETH_ADDR_LEN) == 0) && (arp_entry->is_static == is_static)) {
+			modified = 0;
+		}
+
 		/* if this remote ip is in the cache, update its data */
 		memcpy(arp_entry->arp_ha, remote_mac, ETH_ADDR_LEN);
 		if (is_static == 1) {
@@ -278,6 +406,8 @@ int update_arp_cache(struct sr_instance* sr, struct in_addr* remote_ip, char* re
 			time(&arp_entry->TTL);
 		}
 		arp_entry->is_static = is_static;
+		arp_entry->list_node = n;
+		arp_entry->expiry.data = arp_entry;
 
 		n->data = (void *)arp_entry;
 		if(rs->arp_cache == NULL) {
@@ -286,10 +416,16 @@ int update_arp_cache(struct sr_instance* sr, struct in_addr* remote_ip, char* re
 			node_push_back(rs->arp_cache, n);
 		}
 
+		arp_cache_hash_insert(rs, arp_entry);
 	}
 
+	arp_cache_schedule(rs, arp_entry);
+
 	/* update the hw arp cache copy */
-	trigger_arp_cache_modified(rs);
+	if (modified) {
+		arp_cache_changed(rs);
+		trigger_arp_cache_modified(rs);
+	}
 
 	return 0;
 }
@@ -300,65 +436,38 @@ int update_arp_cache(struct sr_instance* sr, struct in_addr* remote_ip, char* re
  */
 int del_arp_cache(struct sr_instance* sr, struct in_addr* ip) {
 	router_state* rs = get_router_state(sr);
-	node* cur = rs->arp_cache;
-	node* next = NULL;
-	int retval = 0;
-
-	while (cur) {
-		next = cur->next;
-		arp_cache_entry* entry = (arp_cache_entry*)cur->data;
+	arp_cache_entry* entry = in_arp_cache(rs, ip);
 
-		if (entry->ip.s_addr == ip->s_addr) {
-			node_remove(&(rs->arp_cache), cur);
-			++retval;
-		}
-
-		cur = next;
+	if (!entry) {
+		return 0;
 	}
 
-	return retval;
+	arp_cache_remove(rs, entry);
+	return 1;
 }
 
 
 void update_arp_queue(struct sr_instance* sr, arp_hdr* arp_header, const char* interface) {
-	router_state* rs = get_router_state(sr);
-	node* n = rs->arp_queue;
-	node* next = NULL;
-
-	while (n) {
-		next = n->next;
-		arp_queue_entry* aqe = (arp_queue_entry*)n->data;
-
-		/* Does this arp reply match an entry waiting for it? */
-		if (arp_header->arp_sip.s_addr == aqe->next_hop.s_addr) {
-			/* send out the packets */
-			node* cur_packet_node = aqe->head;
-			node* next_packet_node = NULL;
-
-			while (cur_packet_node) {
-				next_packet_node = cur_packet_node->next;
-				arp_queue_packet_entry* aqpe = (arp_queue_packet_entry*)cur_packet_node->data;
-
-				/* send_ip takes responsibility for the packet so we don't need to free it */
-				send_ip(sr, aqpe->packet, aqpe->len, &(aqe->next_hop), aqe->out_iface_name);
-
-				node_remove(&(aqe->head), cur_packet_node);
-				cur_packet_node = next_packet_node;
-			}
-
-			node_remove(&(rs->arp_queue), n);
-		}
-		n = next;
-	}
+	struct in_addr sip = arp_header->arp_sip;
+	send_queued_packets(sr, &sip, (char*)arp_header->arp_sha);
 }
 
 
+/*
+ * Lookup for the forwarding path, counts a hit towards the entry getting a hardware row.
+ * NOT THREAD SAFE: lock the arp cache, a read lock is enough
+ */
 arp_cache_entry* get_from_arp_cache(struct sr_instance* sr, struct in_addr* next_hop) {
 
 	assert(sr);
 	assert(next_hop);
 
-	return in_arp_cache(get_router_state(sr), next_hop);
+	arp_cache_entry* entry = in_arp_cache(get_router_state(sr), next_hop);
+	if (entry) {
+		__sync_fetch_and_add(&(entry->hits), 1);
+	}
+
+	return entry;
 }
 
 
@@ -393,26 +502,71 @@ void unlock_arp_cache(router_state *rs) {
 
 }
 
+/* milliseconds on a clock that does not jump, the unit of the retry wheel */
+uint64_t arp_queue_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/* milliseconds until time() reaches second, the cache wheel turns on time() */
+unsigned int arp_cache_delay(time_t second) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	if (second <= now.tv_sec) {
+		return 1;
+	}
+	return ((second - now.tv_sec) * 1000) - (now.tv_usec / 1000);
+}
+
+/*
+ * Takes aqe off its chain and the retry wheel and out of the byte count, its packets
+ * are left to the caller.
+ * NOT THREAD SAFE: lock the arp queue for writing
+ */
+static void arp_queue_remove(router_state* rs, arp_queue_entry* aqe) {
+	arp_queue_entry** walker = &(rs->arp_queue[arp_hash_ip(aqe->next_hop.s_addr) & (ARP_QUEUE_HASH_SIZE - 1)]);
+
+	while (*walker != aqe) {
+		walker = &((*walker)->hash_next);
+	}
+	*walker = aqe->hash_next;
+
+	twheel_del(rs->arp_queue_wheel, &(aqe->retry));
+	rs->arp_queue_bytes -= aqe->bytes;
+	--rs->arp_queue_entries;
+}
+
 /*
  * Helper function for arp_queue_add, not to be called externally
  */
-void arp_queue_entry_add_packet(arp_queue_entry* aqe, uint8_t* packet, unsigned int len) {
-	node* n = node_create();
+void arp_queue_entry_add_packet(router_state* rs, arp_queue_entry* aqe, uint8_t* packet, unsigned int len) {
 	arp_queue_packet_entry* aqpe = (arp_queue_packet_entry*)malloc(sizeof(arp_queue_packet_entry));
 
 	aqpe->packet = packet;
 	aqpe->len = len;
-	/* set the new nodes data to point to the packet entry */
-	n->data = aqpe;
-	/* add the new node to the arp queue entry */
-	if (aqe->head == NULL) {
-		aqe->head = n;
+	aqpe->next = NULL;
+
+	/* add it to the tail of the arp queue entry */
+	if (aqe->tail) {
+		aqe->tail->next = aqpe;
 	} else {
-		node_push_back(aqe->head, n);
+		aqe->head = aqpe;
 	}
+	aqe->tail = aqpe;
+
+	++aqe->packets;
+	aqe->bytes += len;
+	rs->arp_queue_bytes += len;
 }
 
 
+/*
+ * Queues the packet until next_hop resolves, taking responsibility for it. A packet that
+ * would take its next hop or the whole queue over budget is dropped instead.
+ * NOT THREAD SAFE: lock the arp queue for writing
+ */
 void arp_queue_add(struct sr_instance* sr, uint8_t* packet, unsigned int len, const char* out_iface_name, struct in_addr *next_hop)
 {
 	assert(sr);
@@ -424,33 +578,48 @@ void arp_queue_add(struct sr_instance* sr, uint8_t* packet, unsigned int len, co
 
 	/* Is there an existing queue entry for this IP? */
 	arp_queue_entry* aqe = get_from_arp_queue(sr, next_hop);
+
+	/* tail drop, the packets already waiting keep their place */
+	if (aqe && ((aqe->bytes + len) > rs->arp_queue_dest_limit)) {
+		++rs->arp_queue_dest_drops;
+		pkt_free(packet);
+		return;
+	}
+	if ((rs->arp_queue_bytes + len) > rs->arp_queue_limit) {
+		++rs->arp_queue_limit_drops;
+		pkt_free(packet);
+		return;
+	}
+
 	if (!aqe) {
 		/* create a new queue entry */
-		aqe = (arp_queue_entry*)malloc(sizeof(arp_queue_entry));
-		bzero(aqe, sizeof(arp_queue_entry));
+		aqe = (arp_queue_entry*)calloc(1, sizeof(arp_queue_entry));
 		memcpy(aqe->out_iface_name, out_iface_name, IF_LEN);
 		aqe->next_hop = *next_hop;
+		aqe->retry.data = aqe;
 
-		/* send a request */
-		time(&(aqe->last_req_time));
+		arp_queue_entry** chain = &(rs->arp_queue[arp_hash_ip(next_hop->s_addr) & (ARP_QUEUE_HASH_SIZE - 1)]);
+		aqe->hash_next = *chain;
+		*chain = aqe;
+		++rs->arp_queue_entries;
+
+		/* send a request, the retry timer only wakes for the next retry due */
 		aqe->requests = 1;
 		send_arp_request(sr, next_hop->s_addr, out_iface_name);
-
-		arp_queue_entry_add_packet(aqe, packet, len);
-
-		/* create a node, add this entry to the node, and push it into our linked list */
-		node* n = node_create();
-		n->data = aqe;
-
-		if (rs->arp_queue == NULL) {
-			rs->arp_queue = n;
-		} else {
-			node_push_back(rs->arp_queue, n);
+		twheel_add(rs->arp_queue_wheel, &(aqe->retry), arp_queue_now() + ARP_REQUEST_INTERVAL_MS);
+		if (rs->arp_queue_timer) {
+			sched_kick(rs->arp_queue_timer, ARP_REQUEST_INTERVAL_MS);
 		}
-	} else {
-		/* entry exists, just add the packet */
-		arp_queue_entry_add_packet(aqe, packet, len);
 	}
+
+	/* a packet larger than the per destination budget still gets the request out */
+	if (len > rs->arp_queue_dest_limit) {
+		++rs->arp_queue_dest_drops;
+		pkt_free(packet);
+		return;
+	}
+
+	arp_queue_entry_add_packet(rs, aqe, packet, len);
 }
 
 /*
@@ -459,15 +628,14 @@ void arp_queue_add(struct sr_instance* sr, uint8_t* packet, unsigned int len, co
  */
 arp_queue_entry* get_from_arp_queue(struct sr_instance* sr, struct in_addr* next_hop) {
 	router_state* rs = get_router_state(sr);
-	node* n = rs->arp_queue;
+	arp_queue_entry* aqe = rs->arp_queue[arp_hash_ip(next_hop->s_addr) & (ARP_QUEUE_HASH_SIZE - 1)];
 
-	while (n) {
-		arp_queue_entry* aqe = (arp_queue_entry*)n->data;
+	while (aqe) {
 		if (aqe->next_hop.s_addr == next_hop->s_addr) {
 			return aqe;
 		}
 
-		n = n->next;
+		aqe = aqe->hash_next;
 	}
 
 	return NULL;
@@ -505,120 +673,96 @@ void unlock_arp_queue(router_state *rs) {
 	}
 }
 
+static void arp_cache_expired(twheel_timer* t, void* arg) {
+	arp_cache_remove((router_state*)arg, (arp_cache_entry*)t->data);
+}
+
 /*
- * HELPER function called from arp_thread
+ * HELPER function called from arp_cache_tick, only the entries due this second are touched
  * NOT THREAD SAFE
  */
 void expire_arp_cache(struct sr_instance* sr) {
 	assert(sr);
 
 	router_state *rs = (router_state *)sr->interface_subsystem;
-	node *arp_walker = 0;
-	arp_cache_entry *arp_entry = 0;
-	time_t now;
-	double diff;
-	int timedout_entry = 0;
-
-	arp_walker = rs->arp_cache;
-	while(arp_walker) {
-		arp_entry = (arp_cache_entry *)arp_walker->data;
-		node *tmp = arp_walker;
-		arp_walker = arp_walker->next;
-
-		/** if not static, check that is TTL is within reason **/
-		if (arp_entry->is_static != 1) {
-			time(&now);
-			diff = difftime(now, arp_entry->TTL);
-
-			if (diff > rs->arp_ttl) {
-				node_remove(&rs->arp_cache, tmp);
-				timedout_entry = 1;
-			}
-		}
-	}
 
 	/* update the hw arp cache */
-	if(timedout_entry == 1) {
+	if (twheel_advance(rs->arp_cache_wheel, time(NULL), arp_cache_expired, rs) > 0) {
 		trigger_arp_cache_modified(rs);
 	}
 }
 
 /*
- * HELPER function called from arp_thread
+ * Retry timer of an unresolved next hop. Asks again or, once it has asked enough,
+ * returns its packets to their senders.
  */
-void process_arp_queue(struct sr_instance* sr) {
+static void arp_queue_retry(twheel_timer* t, void* arg) {
+	struct sr_instance* sr = (struct sr_instance*)arg;
 	router_state* rs = get_router_state(sr);
-	node* n = get_router_state(sr)->arp_queue;
-	node* next = NULL;
-	time_t now;
-	double diff;
+	arp_queue_entry* aqe = (arp_queue_entry*)t->data;
+
+	/* have we sent less than 5 arp requests? */
+	if (aqe->requests < ARP_MAX_REQUESTS) {
+		/* send another */
+		++(aqe->requests);
+		send_arp_request(sr, aqe->next_hop.s_addr, aqe->out_iface_name);
+		twheel_add(rs->arp_queue_wheel, t, rs->arp_queue_wheel->now + ARP_REQUEST_INTERVAL_MS);
+		return;
+	}
 
-	while (n) {
-		next = n->next;
-
-		arp_queue_entry* aqe = (arp_queue_entry*)n->data;
-
-		/* has it been over a second since the last arp request was sent? */
-		time(&now);
-		diff = difftime(now, aqe->last_req_time);
-		if (diff > 1) {
-			/* have we sent less than 5 arp requests? */
-			if (aqe->requests < 5) {
-				/* send another */
-				time(&(aqe->last_req_time));
-				++(aqe->requests);
-				send_arp_request(sr, aqe->next_hop.s_addr, aqe->out_iface_name);
-			} else {
-				/* we have exceeded the max arp requests, return packets to sender */
-				node* cur_packet_node = aqe->head;
-				node* next_packet_node = NULL;
-
-				while (cur_packet_node) {
-					/* send icmp for the packet, free it, and its encasing entry */
-					arp_queue_packet_entry* aqpe = (arp_queue_packet_entry*)cur_packet_node->data;
-
-					/* only send an icmp error if the packet is not icmp, or if it is, its an echo request or reply
-					 * also ensure we don't send an icmp error back to one of our interfaces
-					 */
-					if ((get_ip_hdr(aqpe->packet, aqpe->len)->ip_p != IP_PROTO_ICMP) ||
-							(get_icmp_hdr(aqpe->packet, aqpe->len)->icmp_type == ICMP_TYPE_ECHO_REPLY) ||
-							(get_icmp_hdr(aqpe->packet, aqpe->len)->icmp_type == ICMP_TYPE_ECHO_REQUEST)) {
-
-					 	/* also ensure we don't send an icmp error back to one of our interfaces */
-						if (!iface_match_ip(rs, get_ip_hdr(aqpe->packet, aqpe->len)->ip_src.s_addr)) {
-							/* Total hack here to increment the TTL since we already decremented it earlier in the pipeline
-							 * and the ICMP error should return the original packet.
-							 * TODO: Don't decrement the TTL until the packet is ready to be put on the wire
-							 * and we have the next hop ARP address, although checking should be done
-							 * where it is currently being decremented to minimize effort on a doomed packet */
-							ip_hdr *ip = get_ip_hdr(aqpe->packet, aqpe->len);
-							if (ip->ip_ttl < 255) {
-								ip->ip_ttl++;
-
-								/* recalculate checksum */
-								bzero(&ip->ip_sum, sizeof(uint16_t));
-								uint16_t checksum = htons(compute_ip_checksum(ip));
-								ip->ip_sum = checksum;
-							}
-
-							send_icmp_packet(sr, aqpe->packet, aqpe->len, ICMP_TYPE_DESTINATION_UNREACHABLE, ICMP_CODE_HOST_UNREACHABLE);
-						}
-					}
-
-					free(aqpe->packet);
-					next_packet_node = cur_packet_node->next;
-					//free(cur_packet_node);   /* IS THIS CORRECT TO FREE IT ? */
-					node_remove(&(aqe->head), cur_packet_node);
-					cur_packet_node = next_packet_node;
+	/* we have exceeded the max arp requests, return packets to sender */
+	arp_queue_remove(rs, aqe);
+
+	arp_queue_packet_entry* aqpe = aqe->head;
+	while (aqpe) {
+		arp_queue_packet_entry* next = aqpe->next;
+
+		/* only send an icmp error if the packet is not icmp, or if it is, its an echo request or reply
+		 * also ensure we don't send an icmp error back to one of our interfaces
+		 */
+		if ((get_ip_hdr(aqpe->packet, aqpe->len)->ip_p != IP_PROTO_ICMP) ||
+				(get_icmp_hdr(aqpe->packet, aqpe->len)->icmp_type == ICMP_TYPE_ECHO_REPLY) ||
+				(get_icmp_hdr(aqpe->packet, aqpe->len)->icmp_type == ICMP_TYPE_ECHO_REQUEST)) {
+
+		 	/* also ensure we don't send an icmp error back to one of our interfaces */
+			if (!iface_match_ip(rs, get_ip_hdr(aqpe->packet, aqpe->len)->ip_src.s_addr)) {
+				/* Total hack here to increment the TTL since we already decremented it earlier in the pipeline
+				 * and the ICMP error should return the original packet.
+				 * TODO: Don't decrement the TTL until the packet is ready to be put on the wire
+				 * and we have the next hop ARP address, although checking should be done
+				 * where it is currently being decremented to minimize effort on a doomed packet */
+				ip_hdr *ip = get_ip_hdr(aqpe->packet, aqpe->len);
+				if (ip->ip_ttl < 255) {
+					ip->ip_ttl++;
+
+					/* recalculate checksum */
+					bzero(&ip->ip_sum, sizeof(uint16_t));
+					uint16_t checksum = htons(compute_ip_checksum(ip));
+					ip->ip_sum = checksum;
 				}
 
-				/* free the arp queue entry for this destination ip, and patch the list */
-				node_remove(&(get_router_state(sr)->arp_queue), n);
+				send_icmp_packet(sr, aqpe->packet, aqpe->len, ICMP_TYPE_DESTINATION_UNREACHABLE, ICMP_CODE_HOST_UNREACHABLE);
 			}
 		}
 
-		n = next;
+		++rs->arp_queue_timeout_drops;
+		pkt_free(aqpe->packet);
+		free(aqpe);
+		aqpe = next;
 	}
+
+	free(aqe);
+}
+
+/*
+ * HELPER function called from arp_queue_tick, runs the retries that are due
+ * Returns: the millisecond the next retry is due at, 0 if nothing is waiting
+ */
+uint64_t process_arp_queue(struct sr_instance* sr) {
+	router_state* rs = get_router_state(sr);
+
+	twheel_advance(rs->arp_queue_wheel, arp_queue_now(), arp_queue_retry, sr);
+	return twheel_next(rs->arp_queue_wheel);
 }
 
 
@@ -648,76 +792,116 @@ void trigger_arp_cache_modified(router_state* rs) {
 	}
 }
 
+struct arp_cache_rank {
+	arp_cache_entry* entry;
+	uint32_t hits;
+};
+
+static int arp_cache_rank_cmp(const void* a, const void* b) {
+	uint32_t hits_a = ((const struct arp_cache_rank*)a)->hits;
+	uint32_t hits_b = ((const struct arp_cache_rank*)b)->hits;
+	return (hits_a < hits_b) ? 1 : ((hits_a > hits_b) ? -1 : 0);
+}
+
+/*
+ * Statics go in first so they survive if the cache holds more entries than hw has rows,
+ * the rows left go to the dynamic entries the forwarding path looked up most. Only rows
+ * that differ from what is already there get written.
+ */
 void write_arp_cache_to_hw(router_state* rs) {
+	uint32_t rows[ROUTER_OP_LUT_ARP_TABLE_DEPTH * ARP_CACHE_HW_WIDTH];
+	struct arp_cache_rank* ranks;
+	int num_rows = 0;
+	int num_ranks = 0;
+	int i;
 
-	/* iterate sequentially through the 16 slots in hw updating all entries */
-	int i = 0;
+	ranks = (struct arp_cache_rank*)malloc((rs->arp_cache_hash_count + 1) * sizeof(struct arp_cache_rank));
+	assert(ranks);
 
-	/* first write all the static entries */
 	node *cur = rs->arp_cache;
-	while((cur != NULL) && (i < ROUTER_OP_LUT_ARP_TABLE_DEPTH)) {
+	while(cur != NULL) {
 		arp_cache_entry* entry = (arp_cache_entry *)cur->data;
 
-		if(entry->is_static) {
-			write_arp_cache_entry_to_hw(rs, entry, i);
-			i++;
+		if (!entry->is_static) {
+			ranks[num_ranks].entry = entry;
+			ranks[num_ranks].hits = entry->hits;
+			++num_ranks;
+		} else if (num_rows < ROUTER_OP_LUT_ARP_TABLE_DEPTH) {
+			arp_cache_entry_to_hw_row(entry, rows + (num_rows * ARP_CACHE_HW_WIDTH));
+			num_rows++;
 		}
 
 		cur = cur->next;
 	}
 
-	/* second write all the non-static entries and zero out remaining entries in hw */
-	cur = rs->arp_cache;
-	while(i < ROUTER_OP_LUT_ARP_TABLE_DEPTH) {
-
-		if(cur) {
-			arp_cache_entry* entry = (arp_cache_entry *)cur->data;
-			if(entry->is_static == 0) {
-				write_arp_cache_entry_to_hw(rs, entry, i);
-				i++;
-			}
-			cur = cur->next;
+	/* only rank them when they do not all fit, otherwise keep the cache order */
+	if (num_ranks > (ROUTER_OP_LUT_ARP_TABLE_DEPTH - num_rows)) {
+		qsort(ranks, num_ranks, sizeof(struct arp_cache_rank), arp_cache_rank_cmp);
+	}
 
-		} else {
-			/* zero out the rest of the rows */
-			write_arp_cache_entry_to_hw(rs, NULL, i);
-			i++;
-		}
+	for (i = 0; (i < num_ranks) && (num_rows < ROUTER_OP_LUT_ARP_TABLE_DEPTH); ++i) {
+		arp_cache_entry_to_hw_row(ranks[i].entry, rows + (num_rows * ARP_CACHE_HW_WIDTH));
+		num_rows++;
 	}
+
+	free(ranks);
+	hw_table_sync(rs, rs->arp_cache_hw, rows, NULL, num_rows, NULL);
 }
 
+/*
+ * When there are more dynamic entries than hw rows the set in hw is chosen again by
+ * recent hits. Halving the counts afterwards lets old traffic fade out.
+ * NOT THREAD SAFE: lock the arp cache for writing
+ */
+void rebalance_arp_cache_hw(router_state* rs) {
+	if (!rs->is_netfpga || (rs->arp_cache_hash_count <= ROUTER_OP_LUT_ARP_TABLE_DEPTH)) {
+		return;
+	}
 
-void write_arp_cache_entry_to_hw(router_state* rs, arp_cache_entry *entry, int row) {
+	write_arp_cache_to_hw(rs);
 
-	if(entry != NULL) {
-		unsigned int mac_hi = 0;
-		unsigned int mac_lo = 0;
+	node* cur = rs->arp_cache;
+	while (cur) {
+		arp_cache_entry* entry = (arp_cache_entry*)cur->data;
+		entry->hits >>= 1;
+		cur = cur->next;
+	}
+}
 
-		/* write the mac hi data */
-		mac_hi |= ((unsigned int)entry->arp_ha[0]) << 8;
-		mac_hi |= ((unsigned int)entry->arp_ha[1]);
-		writeReg(&(rs->netfpga), ROUTER_OP_LUT_ARP_TABLE_ENTRY_MAC_HI_REG, mac_hi);
 
-		/* write the mac lo data */
-		mac_lo |= ((unsigned int)entry->arp_ha[2]) << 24;
-		mac_lo |= ((unsigned int)entry->arp_ha[3]) << 16;
-		mac_lo |= ((unsigned int)entry->arp_ha[4]) << 8;
-		mac_lo |= ((unsigned int)entry->arp_ha[5]);
-		writeReg(&(rs->netfpga), ROUTER_OP_LUT_ARP_TABLE_ENTRY_MAC_LO_REG, mac_lo);
+/*
+ * Packs an entry into the words written by write_arp_cache_row_to_hw
+ */
+void arp_cache_entry_to_hw_row(arp_cache_entry *entry, uint32_t *words) {
+	/* mac hi */
+	words[0] = ((uint32_t)entry->arp_ha[0]) << 8;
+	words[0] |= ((uint32_t)entry->arp_ha[1]);
+
+	/* mac lo */
+	words[1] = ((uint32_t)entry->arp_ha[2]) << 24;
+	words[1] |= ((uint32_t)entry->arp_ha[3]) << 16;
+	words[1] |= ((uint32_t)entry->arp_ha[4]) << 8;
+	words[1] |= ((uint32_t)entry->arp_ha[5]);
+
+	/* next hop ip */
+	words[2] = ntohl(entry->ip.s_addr);
+}
 
-		/* write the next hop ip data */
-		writeReg(&(rs->netfpga), ROUTER_OP_LUT_ARP_TABLE_ENTRY_NEXT_HOP_IP_REG, ntohl(entry->ip.s_addr));
 
-	} else {
+/*
+ * Row writer for rs->arp_cache_hw
+ */
+void write_arp_cache_row_to_hw(router_state* rs, int row, const uint32_t *words) {
 
-		/* zero out the rest of the rows */
-		writeReg(&(rs->netfpga), ROUTER_OP_LUT_ARP_TABLE_ENTRY_MAC_HI_REG, 0);
-		writeReg(&(rs->netfpga), ROUTER_OP_LUT_ARP_TABLE_ENTRY_MAC_LO_REG, 0);
-		writeReg(&(rs->netfpga), ROUTER_OP_LUT_ARP_TABLE_ENTRY_NEXT_HOP_IP_REG, 0);
-	}
+	/* mac hi, mac lo, next hop ip, then set the row, in one batch */
+	struct nf2reg regs[] = {
+		{ ROUTER_OP_LUT_ARP_TABLE_ENTRY_MAC_HI_REG, words[0] },
+		{ ROUTER_OP_LUT_ARP_TABLE_ENTRY_MAC_LO_REG, words[1] },
+		{ ROUTER_OP_LUT_ARP_TABLE_ENTRY_NEXT_HOP_IP_REG, words[2] },
+		{ ROUTER_OP_LUT_ARP_TABLE_WR_ADDR_REG, row }
+	};
 
-	/* set the row */
-	writeReg(&(rs->netfpga), ROUTER_OP_LUT_ARP_TABLE_WR_ADDR_REG, row);
+	writeRegs(&(rs->netfpga), regs, sizeof(regs) / sizeof(regs[0]));
 }
 
 
@@ -737,6 +921,18 @@ void cli_show_ip_arp(router_state* rs, cli_request* req) {
 	free(arp_cache_info);
 }
 
+void cli_show_ip_arp_queue(router_state* rs, cli_request* req) {
+	char *info;
+	int len;
+
+	lock_arp_queue_rd(rs);
+	sprint_arp_queue(rs, &info, &len);
+	unlock_arp_queue(rs);
+
+	send_to_socket(req->sockfd, info, len);
+	free(info);
+}
+
 void cli_show_ip_arp_help(router_state* rs, cli_request* req) {
 	char *usage = "usage: show ip arp\n";
 	send_to_socket(req->sockfd, usage, strlen(usage));
@@ -752,34 +948,61 @@ void cli_ip_arp_help(router_state *rs, cli_request* req) {
 
 	char *usage2 = "ip arp del ip\n";
 	send_to_socket(req->sockfd, usage2, strlen(usage2));
+
+	char *usage3 = "ip arp set queue dest_bytes total_bytes\n";
+	send_to_socket(req->sockfd, usage3, strlen(usage3));
 }
 
 
 
-void* arp_thread(void *param) {
-	assert(param);
-	struct sr_instance *sr = (struct sr_instance *)param;
+/*
+ * Timer callback, expires the cache entries that are due. Wakes again for the next
+ * expiry, or every second while the hw rows are rebalanced, new entries kick it.
+ */
+unsigned int arp_cache_tick(void* arg) {
+	struct sr_instance *sr = (struct sr_instance *)arg;
 	router_state *rs = get_router_state(sr);
+	unsigned int delay = 0;
 
-	while (1) {
-		lock_arp_cache_wr(rs);
-		expire_arp_cache(sr);
-		unlock_arp_cache(rs);
+	lock_arp_cache_wr(rs);
+	expire_arp_cache(sr);
+	rebalance_arp_cache_hw(rs);
 
-		lock_arp_cache_rd(rs);
-		lock_arp_queue_wr(rs);
-		lock_if_list_rd(rs);
-		lock_rtable_rd(rs); /* because we may send an icmp packet back, requiring get next hop */
+	uint64_t next = twheel_next(rs->arp_cache_wheel);
+	if (next != 0) {
+		delay = arp_cache_delay((time_t)next);
+	}
+	if (rs->is_netfpga && (rs->arp_cache_hash_count > ROUTER_OP_LUT_ARP_TABLE_DEPTH) && ((delay == 0) || (delay > 1000))) {
+		delay = 1000;
+	}
+	unlock_arp_cache(rs);
 
-		process_arp_queue(sr);
+	return delay;
+}
 
-		unlock_rtable(rs);
-		unlock_if_list(rs);
-		unlock_arp_queue(rs);
-		unlock_arp_cache(rs);
+/*
+ * Timer callback, runs the arp request retries that are due. Wakes again for the
+ * next retry, a newly queued next hop kicks it.
+ */
+unsigned int arp_queue_tick(void* arg) {
+	struct sr_instance *sr = (struct sr_instance *)arg;
+	router_state *rs = get_router_state(sr);
+
+	lock_arp_cache_rd(rs);
+	lock_arp_queue_wr(rs);
+	lock_if_list_rd(rs);
+
+	uint64_t next_retry = process_arp_queue(sr);
 
-		sleep(1);
+	unlock_if_list(rs);
+	unlock_arp_queue(rs);
+	unlock_arp_cache(rs);
+
+	if (next_retry == 0) {
+		return 0;
 	}
+	uint64_t now = arp_queue_now();
+	return (next_retry > now) ? (unsigned int)(next_retry - now) : 1;
 }
 
 void cli_ip_arp_add_help(router_state *rs, cli_request *req) {
@@ -897,12 +1120,8 @@ void cli_nuke_arp_cache(router_state *rs, cli_request *req) {
 	lock_arp_cache_wr(rs);
 
 	/* destroy the sw arp cache */
-	node *cur = rs->arp_cache;
-	while(cur) {
-		node *next = cur->next;
-		node_remove(&rs->arp_cache, cur);
-
-		cur = next;
+	while(rs->arp_cache) {
+		arp_cache_remove(rs, (arp_cache_entry*)rs->arp_cache->data);
 	}
 
 	/* zero out the hw arp cache */
@@ -934,11 +1153,10 @@ void cli_nuke_hw_arp_cache_entry(router_state *rs, cli_request *req) {
 		}
 
 
-		/* zero out the rest of the row */
-		writeReg(&(rs->netfpga), ROUTER_OP_LUT_ARP_TABLE_ENTRY_MAC_HI_REG, 0);
-		writeReg(&(rs->netfpga), ROUTER_OP_LUT_ARP_TABLE_ENTRY_MAC_LO_REG, 0);
-		writeReg(&(rs->netfpga), ROUTER_OP_LUT_ARP_TABLE_ENTRY_NEXT_HOP_IP_REG, 0);
-		writeReg(&(rs->netfpga), ROUTER_OP_LUT_ARP_TABLE_WR_ADDR_REG, row);
+		/* zero out the row, through the shadow so the next sync knows it is empty */
+		lock_arp_cache_wr(rs);
+		hw_table_clear_row(rs, rs->arp_cache_hw, row);
+		unlock_arp_cache(rs);
 
 		char *msg = (char *)calloc(80, sizeof(char));
 		snprintf(msg, 80, "Row %d has been nuked\n", row);
@@ -986,10 +1204,39 @@ void cli_ip_arp_set_ttl(router_state *rs, cli_request *req) {
 		return;
 	}
 
+	/* entries already on the wheel move to their new deadline */
+	lock_arp_cache_wr(rs);
 	rs->arp_ttl = timeout;
+	node* cur = rs->arp_cache;
+	while (cur) {
+		arp_cache_schedule(rs, (arp_cache_entry*)cur->data);
+		cur = cur->next;
+	}
+	unlock_arp_cache(rs);
 
 	char *info = (char *)calloc(80, sizeof(char));
 	snprintf(info, 80, "Arp entry TTL has been set to: %d\n", rs->arp_ttl);
 	send_to_socket(req->sockfd, info, strlen(info));
 	free(info);
 }
+
+void cli_ip_arp_set_queue(router_state *rs, cli_request *req) {
+
+	unsigned int dest_limit, limit;
+
+	if( sscanf(req->command, "ip arp set queue %u %u", &dest_limit, &limit) != 2 ) {
+		send_to_socket(req->sockfd, "Syntax error\n", strlen("Syntax error\n"));
+		return;
+	}
+
+	/* packets already queued over the new budget stay, only new ones are dropped */
+	lock_arp_queue_wr(rs);
+	rs->arp_queue_dest_limit = dest_limit;
+	rs->arp_queue_limit = limit;
+	unlock_arp_queue(rs);
+
+	char *info = (char *)calloc(80, sizeof(char));
+	snprintf(info, 80, "Arp queue limits set to: %u bytes per next hop, %u bytes total\n", dest_limit, limit);
+	send_to_socket(req->sockfd, info, strlen(info));
+	free(info);
+}
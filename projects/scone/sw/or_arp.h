@@ -9,6 +9,9 @@
 #include "sr_base_internal.h"
 #include "or_data_types.h"
 
+/* mac hi, mac lo, next hop ip */
+#define ARP_CACHE_HW_WIDTH 3
+
 void process_arp_packet(struct sr_instance* sr, const uint8_t* packet, unsigned int len, const char* interface);
 void process_arp_request( struct sr_instance* sr, const uint8_t* packet, unsigned int len, const char* interface);
 void process_arp_reply( struct sr_instance* sr, const uint8_t* packet, unsigned int len, const char* interface);
@@ -29,16 +32,21 @@ void arp_queue_add(struct sr_instance* sr, uint8_t* packet, unsigned int len, co
 arp_queue_entry* get_from_arp_queue(struct sr_instance* sr, struct in_addr* next_hop);
 void update_arp_queue(struct sr_instance* sr, arp_hdr* arp_header, const char* interface);
 void send_queued_packets(struct sr_instance* sr, struct in_addr* dest_ip, char* dest_mac);
+uint64_t arp_queue_now(void);
+unsigned int arp_cache_delay(time_t second);
 
 void trigger_arp_cache_modified(router_state *rs);
 void write_arp_cache_to_hw(router_state* rs);
-void write_arp_cache_entry_to_hw(router_state* rs, arp_cache_entry *entry, int row);
+void rebalance_arp_cache_hw(router_state* rs);
+void arp_cache_entry_to_hw_row(arp_cache_entry *entry, uint32_t *words);
+void write_arp_cache_row_to_hw(router_state* rs, int row, const uint32_t *words);
 
 void lock_arp_queue_rd(router_state *rs);
 void lock_arp_queue_wr(router_state *rs);
 void unlock_arp_queue(router_state *rs);
 
 void cli_show_ip_arp(router_state* rs, cli_request* req);
+void cli_show_ip_arp_queue(router_state* rs, cli_request* req);
 void cli_show_ip_arp_help(router_state* rs, cli_request* req);
 
 void cli_ip_arp_help(router_state *rs, cli_request *req);
@@ -47,6 +55,7 @@ void cli_ip_arp_add_help(router_state *rs, cli_request *req);
 void cli_ip_arp_del(router_state *rs, cli_request *req);
 void cli_ip_arp_del_help(router_state *rs, cli_request *req);
 void cli_ip_arp_set_ttl(router_state *rs, cli_request *req);
+void cli_ip_arp_set_queue(router_state *rs, cli_request *req);
 
 void cli_show_hw_arp_cache(router_state *rs, cli_request *req);
 void cli_nuke_arp_cache(router_state *rs, cli_request *req);
@@ -56,6 +65,7 @@ void cli_hw_num_pckts_fwd(router_state *rs, cli_request *req);
 
 
 
-void* arp_thread(void *param);
+unsigned int arp_cache_tick(void* arg);
+unsigned int arp_queue_tick(void* arg);
 
 #endif /*OR_ARP_H_*/
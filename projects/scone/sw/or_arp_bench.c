@@ -0,0 +1,197 @@
+/*
+ * Measures arp cache lookups and expiry as the cache grows. Lookups run once with
+ * the linear scan of the cache list that in_arp_cache used to do and once through
+ * the hash index, expiry runs once with the old scan of every entry each second and
+ * once by turning the timer wheel a second at a time. First checks that the wheel
+ * reports when its next timer is due, which the arp thread sleeps until, including
+ * timers on an upper level that are due before everything on the level below.
+ *
+ * usage: arp-bench [max_entries] [lookups]
+ */
+
+#include "or_arp.h"
+#include "or_main.h"
+#include "or_twheel.h"
+#include "or_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+volatile unsigned int sink = 0;
+
+double elapsed_ns(struct timeval* start, struct timeval* end) {
+	return ((end->tv_sec - start->tv_sec) * 1e9) + ((end->tv_usec - start->tv_usec) * 1e3);
+}
+
+/* the old in_arp_cache */
+arp_cache_entry* list_lookup(router_state* rs, struct in_addr* next_hop) {
+	node* n = rs->arp_cache;
+	while (n) {
+		arp_cache_entry* entry = (arp_cache_entry*)n->data;
+		if (entry->ip.s_addr == next_hop->s_addr) {
+			return entry;
+		}
+		n = n->next;
+	}
+	return NULL;
+}
+
+/* the old expire_arp_cache, minus the removals so every pass costs the same */
+int list_expire(router_state* rs) {
+	node* n = rs->arp_cache;
+	time_t now;
+	int expired = 0;
+
+	while (n) {
+		arp_cache_entry* entry = (arp_cache_entry*)n->data;
+		if (entry->is_static != 1) {
+			time(&now);
+			if (difftime(now, entry->TTL) > rs->arp_ttl) {
+				++expired;
+			}
+		}
+		n = n->next;
+	}
+	return expired;
+}
+
+void count_expired(twheel_timer* t, void* arg) {
+	++sink;
+}
+
+/* Returns: the number of times twheel_next disagreed with the earliest pending timer */
+int check_next(void) {
+	twheel_timer timers[256];
+	twheel* w = twheel_create(0);
+	unsigned int seed = 7;
+	int mismatches = 0;
+	int i, step;
+
+	/* a is on level 1 until tick 64, b goes on level 0 but is due after it */
+	memset(timers, 0, sizeof(timers));
+	twheel_add(w, &timers[0], 80);
+	twheel_advance(w, 30, count_expired, NULL);
+	twheel_add(w, &timers[1], 90);
+	if (twheel_next(w) != 80) {
+		printf("twheel_next after add 80, advance 30, add 90: %llu, want 80\n",
+			(unsigned long long)twheel_next(w));
+		++mismatches;
+	}
+	twheel_destroy(w);
+
+	/* random adds, deletes and turns against the earliest found by looking at every timer */
+	memset(timers, 0, sizeof(timers));
+	w = twheel_create(0);
+	for (step = 0; step < 100000; ++step) {
+		twheel_timer* t = &timers[rand_r(&seed) % 256];
+		switch (rand_r(&seed) % 4) {
+			case 0:
+				twheel_del(w, t);
+				break;
+			case 1:
+				twheel_advance(w, w->now + (rand_r(&seed) % 200), count_expired, NULL);
+				break;
+			default:
+				twheel_add(w, t, w->now + 1 + (rand_r(&seed) % ((rand_r(&seed) % 2) ? 100 : 300000)));
+				break;
+		}
+
+		uint64_t want = 0;
+		for (i = 0; i < 256; ++i) {
+			if (twheel_pending(&timers[i]) && ((want == 0) || (timers[i].expires < want))) {
+				want = timers[i].expires;
+			}
+		}
+		if (twheel_next(w) != want) {
+			++mismatches;
+		}
+	}
+	twheel_destroy(w);
+
+	printf("twheel_next: %i mismatches\n\n", mismatches);
+	return mismatches;
+}
+
+void run(int num_entries, int num_lookups) {
+	struct sr_instance* sr = (struct sr_instance*)calloc(1, sizeof(struct sr_instance));
+	router_state* rs = (router_state*)calloc(1, sizeof(router_state));
+	sr->interface_subsystem = rs;
+	rs->arp_ttl = INITIAL_ARP_TIMEOUT;
+	rs->arp_cache_wheel = twheel_create(time(NULL));
+
+	struct in_addr ip;
+	char mac[ETH_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0 };
+	int i;
+
+	for (i = 0; i < num_entries; ++i) {
+		ip.s_addr = htonl((10 << 24) | i);
+		update_arp_cache(sr, &ip, mac, 0);
+	}
+
+	struct timeval start, end;
+	unsigned int seed = 1;
+	double list_ns, hash_ns, scan_ns, wheel_ns;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_lookups; ++i) {
+		ip.s_addr = htonl((10 << 24) | (rand_r(&seed) % num_entries));
+		sink += list_lookup(rs, &ip)->hits;
+	}
+	gettimeofday(&end, NULL);
+	list_ns = elapsed_ns(&start, &end) / num_lookups;
+
+	seed = 1;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_lookups; ++i) {
+		ip.s_addr = htonl((10 << 24) | (rand_r(&seed) % num_entries));
+		sink += get_from_arp_cache(sr, &ip)->hits;
+	}
+	gettimeofday(&end, NULL);
+	hash_ns = elapsed_ns(&start, &end) / num_lookups;
+
+	/* one pass each second the arp thread wakes up before the entries come due */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < rs->arp_ttl; ++i) {
+		sink += list_expire(rs);
+	}
+	gettimeofday(&end, NULL);
+	scan_ns = elapsed_ns(&start, &end) / rs->arp_ttl;
+
+	/* the same seconds on the wheel plus the one everything fires in */
+	uint64_t now = rs->arp_cache_wheel->now;
+	gettimeofday(&start, NULL);
+	for (i = 1; i <= rs->arp_ttl + 2; ++i) {
+		twheel_advance(rs->arp_cache_wheel, now + i, count_expired, rs);
+	}
+	gettimeofday(&end, NULL);
+	wheel_ns = elapsed_ns(&start, &end) / (rs->arp_ttl + 2);
+
+	printf("%-8i %-12.1f %-12.1f %-14.1f %.1f\n", num_entries, list_ns, hash_ns, scan_ns, wheel_ns);
+
+	while (rs->arp_cache) {
+		node_remove(&(rs->arp_cache), rs->arp_cache);
+	}
+	twheel_destroy(rs->arp_cache_wheel);
+	free(rs->arp_cache_hash);
+	free(rs);
+	free(sr);
+}
+
+int main(int argc, char** argv)
+{
+	int max_entries = (argc > 1) ? atoi(argv[1]) : 8192;
+	int num_lookups = (argc > 2) ? atoi(argv[2]) : 200000;
+	int num_entries;
+
+	int mismatches = check_next();
+
+	printf("%-8s %-12s %-12s %-14s %s\n", "Entries", "List ns/op", "Hash ns/op", "Scan ns/sec", "Wheel ns/sec");
+	for (num_entries = 16; num_entries <= max_entries; num_entries *= 4) {
+		run(num_entries, num_lookups);
+	}
+
+	return mismatches ? 1 : 0;
+}
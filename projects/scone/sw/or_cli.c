@@ -24,6 +24,7 @@
 #include "or_cli.h"
 #include "or_utils.h"
 #include "or_sping.h"
+#include "sr_base.h"
 #include "nf2/nf2util.h"
 
 #define MAX_COMMAND_SIZE 128
@@ -57,20 +58,6 @@ int cli_main(void* subsystem) {
 	listen(bindfd, 10);
 
 
-	/* Spawn the sping queue cleanup thread */
-	#ifndef _NOLWIP_
-
-	sys_thread_new(sping_queue_cleanup_thread_np, (void *) rs);
-
-	#else
-
-	pthread_t thread;
-  if(pthread_create(&thread, NULL, sping_queue_cleanup_thread, (void *)rs) != 0) {
-    perror("Thread create error");
-  }
-
-  #endif
-
 	while (1) {
 	 		/* Grab new connection. */
 		clientfd = accept(bindfd, &client_addr, &sock_len);
@@ -250,6 +237,27 @@ void cli_help(router_state* rs, cli_request* req) {
 	send_to_socket(req->sockfd, usage, strlen(usage));
 
 
+	/* TIMERS */
+
+	usage = "\tshow sched\n";
+	send_to_socket(req->sockfd, usage, strlen(usage));
+
+
+	/* EXPORT */
+
+	usage = "\tshow state [since version]\n";
+	send_to_socket(req->sockfd, usage, strlen(usage));
+
+
+	/* TRACE */
+
+	usage = "\tshow trace [lines all]\n";
+	send_to_socket(req->sockfd, usage, strlen(usage));
+
+	usage = "\ttrace level [off error warn info debug packet]\n";
+	send_to_socket(req->sockfd, usage, strlen(usage));
+
+
 
 	/* HARDWARE */
 
@@ -262,6 +270,24 @@ void cli_help(router_state* rs, cli_request* req) {
 	usage = "\tshow hw iface\n";
 	send_to_socket(req->sockfd, usage, strlen(usage));
 
+	usage = "\tshow hw sync\n";
+	send_to_socket(req->sockfd, usage, strlen(usage));
+
+	usage = "\tshow hw pktio\n";
+	send_to_socket(req->sockfd, usage, strlen(usage));
+
+	usage = "\tshow hw stats [history [samples all]]\n";
+	send_to_socket(req->sockfd, usage, strlen(usage));
+
+	usage = "\tset hw stats interval [ms, 10 to 30000]\n";
+	send_to_socket(req->sockfd, usage, strlen(usage));
+
+	usage = "\tshow pktbuf\n";
+	send_to_socket(req->sockfd, usage, strlen(usage));
+
+	usage = "\tshow tcp stats\n";
+	send_to_socket(req->sockfd, usage, strlen(usage));
+
 	usage = "\thw iface add [eth0 eth1 eth2 eth3] [mac adress]\n";
 	send_to_socket(req->sockfd, usage, strlen(usage));
 
@@ -336,6 +362,16 @@ void cli_hw_help(router_state *rs, cli_request* req) {
 }
 
 
+void cli_show_tcp_stats(router_state *rs, cli_request *req) {
+	char buf[2048];
+	int len = sr_lwip_sprint_stats(buf, sizeof(buf));
+
+	if (len > sizeof(buf) - 1) {
+		len = sizeof(buf) - 1;
+	}
+	send_to_socket(req->sockfd, buf, len);
+}
+
 void cli_nat_test(router_state *rs, cli_request *req) {
 
 	char *msg;
@@ -390,12 +426,7 @@ void cli_nat_test(router_state *rs, cli_request *req) {
 	error = read(sockfd, line, 1024);
 	while(error > 0) {
 
-		error = write(req->sockfd, line, strlen(line));
-		if(error < 0) {
-			msg = "Write error\n";
-			send_to_socket(req->sockfd, msg, strlen(msg));
-			return;
-		}
+		send_to_socket(req->sockfd, line, error);
 
 		error = read(sockfd, line, 1024);
 		if(error < 0) {
@@ -22,6 +22,7 @@ void cli_help(router_state *rs, cli_request *req);
 void cli_show_help(router_state *rs, cli_request *req);
 void cli_hw_help(router_state *rs, cli_request *req);
 
+void cli_show_tcp_stats(router_state *rs, cli_request *req);
 void cli_nat_test(router_state *rs, cli_request *req);
 
 #endif /* OR_CLI_H_ */
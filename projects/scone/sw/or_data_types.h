@@ -11,6 +11,8 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include "nf2/nf2util.h"
 
 
@@ -199,6 +201,297 @@ struct node {
 typedef struct node node;
 
 
+/** PATH COMPRESSED (PATRICIA) TRIE FOR LONGEST PREFIX MATCH **/
+struct lpm_node {
+	uint32_t prefix;		/* host byte order, bits past len are zero */
+	uint8_t len;			/* prefix length, 0 - 32 */
+	struct lpm_node* child[2];
+	void* data;				/* NULL for internal branching nodes */
+};
+typedef struct lpm_node lpm_node;
+
+struct lpm_trie {
+	lpm_node* root;
+	uint32_t num_prefixes;
+	uint32_t num_nodes;
+};
+typedef struct lpm_trie lpm_trie;
+
+
+/** SHADOW COPY OF A HARDWARE LOOKUP TABLE **/
+#define HW_TABLE_MAX_WIDTH 8
+#define HW_TABLE_NAME_LEN 16
+
+struct router_state;
+typedef void (*hw_table_row_writer)(struct router_state* rs, int row, const uint32_t* words);
+
+struct hw_table {
+	char name[HW_TABLE_NAME_LEN];
+	int depth;				/* rows in hardware */
+	int width;				/* data words per row, the row address write is not counted */
+	uint32_t* shadow;		/* depth * width words, what we last wrote to each row */
+	uint32_t shadow_valid:1;	/* 0 until the first sync or after the hardware is reset */
+	hw_table_row_writer write_row;
+
+	/* counters */
+	uint64_t syncs;
+	uint64_t rows_written;
+	uint64_t regs_written;
+	uint64_t regs_saved;	/* versus rewriting every row on every sync */
+};
+typedef struct hw_table hw_table;
+
+
+/** NAT TABLE INDEX **/
+#define NAT_HASH_SIZE 16384		/* buckets in each index, power of two */
+#define NAT_PORT_MIN 1025		/* lowest external port handed out to a new flow */
+#define NAT_PORT_MAP_WORDS (65536 / 32)
+
+
+/** ARP QUEUE INDEX **/
+#define ARP_QUEUE_HASH_SIZE 256	/* power of two */
+
+
+/** HIERARCHICAL TIMER WHEEL, TICKS ARE WHATEVER UNIT THE OWNER ADVANCES IT IN **/
+#define TWHEEL_LEVELS 4
+#define TWHEEL_SLOT_BITS 6
+#define TWHEEL_SLOTS (1 << TWHEEL_SLOT_BITS)
+#define TWHEEL_MAX_DELTA ((1ULL << (TWHEEL_LEVELS * TWHEEL_SLOT_BITS)) - 1)
+
+struct twheel_timer {
+	struct twheel_timer* next;
+	struct twheel_timer** pprev;	/* NULL while the timer is not pending */
+	uint64_t expires;
+	void* data;
+};
+typedef struct twheel_timer twheel_timer;
+
+struct twheel {
+	uint64_t now;
+	twheel_timer* slots[TWHEEL_LEVELS][TWHEEL_SLOTS];
+	uint32_t pending;
+
+	/* counters */
+	uint64_t fired;
+	uint64_t cascaded;
+};
+typedef struct twheel twheel;
+
+typedef void (*twheel_expire)(twheel_timer* t, void* arg);
+
+
+/** TIMER SERVICE, ONE THREAD ON A TIMERFD RUNS THE PERIODIC WORK OF THE ROUTER **/
+#define SCHED_NAME_LEN 24
+#define SCHED_LATE_BUCKETS 6		/* late by under 100us, 1ms, 10ms, 100ms, 1s, and more */
+
+#define SCHED_TIMER_IDLE 0
+#define SCHED_TIMER_PENDING 1
+#define SCHED_TIMER_RUNNING 2
+
+/* returns the milliseconds until it should run again, 0 to wait for a kick */
+typedef unsigned int (*sched_callback)(void* arg);
+
+struct scheduler;
+
+struct sched_timer {
+	twheel_timer wheel;				/* ticks are milliseconds since the scheduler started */
+	struct scheduler* sched;
+	char name[SCHED_NAME_LEN];
+	sched_callback callback;
+	void* arg;
+	int state;
+	uint64_t requested;				/* tick asked for by a kick while running, 0 if none */
+	unsigned int cancelled:1;		/* deleted while running, not to be put back */
+	struct sched_timer* fire_next;	/* timers due in the same pass */
+	struct sched_timer* next;		/* every timer of the scheduler */
+
+	/* counters */
+	uint64_t runs;
+	uint64_t kicks;
+	uint64_t late_ns_total;
+	uint64_t late_ns_max;
+	uint64_t run_ns_total;
+};
+typedef struct sched_timer sched_timer;
+
+struct scheduler {
+	int timer_fd;
+	pthread_t thread;
+	pthread_mutex_t lock;			/* not held while callbacks run */
+	twheel* wheel;
+	uint64_t start_ns;				/* CLOCK_MONOTONIC at tick 0 */
+	uint64_t armed;					/* tick the timerfd is set for, 0 if disarmed */
+	sched_timer* timers;
+	volatile int running;
+
+	/* counters */
+	uint64_t wakeups;
+	uint64_t idle_wakeups;			/* woke with nothing due */
+	uint64_t runs;
+	uint64_t late[SCHED_LATE_BUCKETS];
+};
+typedef struct scheduler scheduler;
+
+
+/** HW COUNTER SAMPLER, EVERY PORT AND OUTPUT QUEUE COUNTER IN ONE BATCHED READ **/
+#define HWSTATS_PORTS 4
+#define HWSTATS_QUEUES 8
+
+#define HWSTATS_RX_PKTS 0
+#define HWSTATS_TX_PKTS 1
+#define HWSTATS_RX_BYTES 2
+#define HWSTATS_TX_BYTES 3
+#define HWSTATS_RX_DROPPED_FULL 4
+#define HWSTATS_RX_DROPPED_BAD 5
+#define HWSTATS_PORT_COUNTERS 6
+
+/* index of a counter in the sweep, the port counters then a drop counter per output queue */
+#define HWSTATS_PORT(port, counter) (((port) * HWSTATS_PORT_COUNTERS) + (counter))
+#define HWSTATS_OQ_DROPPED(queue) ((HWSTATS_PORTS * HWSTATS_PORT_COUNTERS) + (queue))
+#define HWSTATS_COUNTERS ((HWSTATS_PORTS * HWSTATS_PORT_COUNTERS) + HWSTATS_QUEUES)
+
+#define HWSTATS_DEFAULT_INTERVAL_MS 500
+#define HWSTATS_MIN_INTERVAL_MS 10
+#define HWSTATS_MAX_INTERVAL_MS 30000	/* a 32 bit byte counter wraps in 34 seconds at 1Gb/s */
+#define HWSTATS_EWMA_TAU_MS 2000		/* rates follow a change with this time constant */
+#define HWSTATS_RING_LEN 120			/* a minute of samples at the default interval */
+
+struct hw_sample {
+	uint64_t ns;							/* CLOCK_MONOTONIC of the sweep */
+	uint64_t total[HWSTATS_COUNTERS];
+};
+typedef struct hw_sample hw_sample;
+
+struct hw_stats {
+	uint32_t reg[HWSTATS_COUNTERS];			/* register of each counter */
+	uint32_t last_raw[HWSTATS_COUNTERS];	/* as read last sweep, the registers are 32 bits and wrap */
+	uint64_t total[HWSTATS_COUNTERS];		/* wrap corrected */
+	double rate[HWSTATS_COUNTERS];			/* per second, exponentially weighted */
+	uint64_t last_ns;						/* 0 before the first sweep */
+	unsigned int interval_ms;
+
+	hw_sample ring[HWSTATS_RING_LEN];		/* the last sweeps, oldest at ring_next once full */
+	unsigned int ring_next;
+
+	/* counters */
+	uint64_t sweeps;
+	uint64_t wraps;
+	uint64_t read_errors;
+	uint64_t read_ns_total;
+};
+typedef struct hw_stats hw_stats;
+
+
+/** REFERENCE COUNTED PACKET BUFFERS FROM PER THREAD POOLS **/
+#define PKTBUF_HEADROOM 128
+#define PKTBUF_DATA_LEN 2048		/* largest frame plus the tailroom to pad a runt in place */
+#define PKTBUF_SLAB_SIZE 128		/* buffers added each time a pool runs dry */
+
+struct pktbuf_pool;
+
+struct pktbuf {
+	struct pktbuf* next;		/* free list link */
+	struct pktbuf_pool* pool;	/* owner, the buffer goes back there when the last reference drops */
+	volatile int refcnt;
+	uint8_t buf[PKTBUF_HEADROOM + PKTBUF_DATA_LEN];
+};
+typedef struct pktbuf pktbuf;
+
+struct pktbuf_slab {
+	pktbuf* bufs;
+	int count;
+	struct pktbuf_slab* next;
+};
+typedef struct pktbuf_slab pktbuf_slab;
+
+struct pktbuf_pool {
+	pktbuf* free;					/* only touched by the owner */
+	pktbuf* volatile remote_free;	/* pushed by other threads, taken whole by the owner */
+	pktbuf_slab* volatile slabs;
+	struct pktbuf_pool* volatile next;
+
+	/* counters, remote_puts is bumped by other threads */
+	uint64_t gets;
+	uint64_t puts;
+	volatile uint64_t remote_puts;
+	uint64_t holds;			/* extra references taken instead of copying */
+	uint64_t copies;		/* holds of packets that were not pooled */
+	uint64_t pads;			/* runts padded in place */
+	uint64_t pad_misses;	/* runts that had to be padded into a malloc */
+	uint64_t grows;			/* slabs malloced */
+};
+typedef struct pktbuf_pool pktbuf_pool;
+
+
+/** BATCHED PACKET I/O OVER RAW SOCKETS OR PCAP HANDLES **/
+#define PKTIO_MAX_PORTS 4
+#define PKTIO_BATCH 32
+#define PKTIO_TX_FRAME_LEN 2048		/* larger packets bypass the tx batch */
+#define PKTIO_RX_BUDGET 4			/* batches drained from one port before moving to the next */
+
+typedef void (*pktio_rx_handler)(void* arg, int port, uint8_t* packet, unsigned int len);
+
+struct pktio_port {
+	int fd;					/* raw socket, or the selectable fd of the pcap handle */
+	void* pcap;				/* NULL for raw sockets */
+
+	/* receive batch into pooled buffers, only touched by the thread polling */
+	struct mmsghdr rx_msgs[PKTIO_BATCH];
+	struct iovec rx_iov[PKTIO_BATCH];
+	pktbuf* rx_pbs[PKTIO_BATCH];
+
+	/* transmit batch, pooled packets are referenced and others copied into tx_bufs */
+	pthread_mutex_t tx_lock;
+	struct mmsghdr tx_msgs[PKTIO_BATCH];
+	struct iovec tx_iov[PKTIO_BATCH];
+	pktbuf* tx_pbs[PKTIO_BATCH];
+	uint8_t* tx_bufs;
+	int tx_count;
+
+	/* counters */
+	uint64_t rx_packets;
+	uint64_t rx_batches;	/* recvmmsg or pcap_dispatch calls returning packets */
+	uint64_t rx_truncated;
+	uint64_t rx_refills;	/* rx buffers the handler kept a reference to */
+	uint64_t tx_packets;
+	uint64_t tx_batches;	/* sendmmsg calls */
+	uint64_t tx_errors;		/* packets dropped on a send error */
+};
+typedef struct pktio_port pktio_port;
+
+struct pktio {
+	int epoll_fd;
+	int num_ports;
+	pktio_port ports[PKTIO_MAX_PORTS];
+	pktio_rx_handler handler;
+	void* handler_arg;
+	uint64_t polls;
+};
+typedef struct pktio pktio;
+
+
+/** LEVELED TRACE INTO AN IN MEMORY RING **/
+#define TRACE_RING_SLOTS 4096		/* power of 2, the oldest entries are overwritten */
+#define TRACE_MSG_LEN 116			/* a line longer than this is cut */
+
+struct trace_entry {
+	volatile uint64_t seq;		/* position + 1 once written, all ones while being written */
+	struct timeval ts;
+	int level;
+	char msg[TRACE_MSG_LEN];
+};
+typedef struct trace_entry trace_entry;
+
+
+/** TABLES OF THE BULK STATE EXPORT, IN THE ORDER THEY ARE EXPORTED **/
+#define EXPORT_IFACES 0
+#define EXPORT_RTABLE 1
+#define EXPORT_ARP 2
+#define EXPORT_NAT 3
+#define EXPORT_COUNTERS 4
+#define EXPORT_TABLES 5
+
+
 /** ROUTER STATE STRUCT **/
 struct router_state {
 	void* sr;
@@ -210,7 +503,6 @@ struct router_state {
 	uint16_t pwospf_hello_interval;
 	uint32_t pwospf_lsu_interval;
 	uint32_t pwospf_lsu_broadcast;
-	uint32_t dijkstra_dirty;
 	uint16_t is_netfpga;
 	uint32_t arp_ttl;
 	uint32_t nat_timeout;
@@ -223,20 +515,48 @@ struct router_state {
 	char* pcap_errbuf[4];
 	pthread_t* input_threads[4];
 	int raw_sockets[4];
+	pktio* pktio;			/* batched I/O over raw_sockets or pcap_context */
 
 	pthread_mutex_t* write_lock;
 
 	node* rtable;
 	pthread_rwlock_t* rtable_lock;
 
+	/* published read only copies of the rtable, readers do not take rtable_lock */
+	volatile uint32_t rtable_current; /* slot of the latest snapshot */
+	struct rtable_snapshot* rtable_snapshots;
+	struct rtable_reader* volatile rtable_readers;
+	uint32_t rtable_version;
+
+	/* shadows of the hardware tables, synced under the lock of their software table */
+	hw_table* rtable_hw;
+	hw_table* arp_cache_hw;
+	hw_table* nat_table_hw;
+
 	node* arp_cache;
 	pthread_rwlock_t* arp_cache_lock;
+	volatile uint32_t arp_cache_version;	/* bumped when an entry is added, removed or changed */
+
+	/* open addressing index of arp_cache by ip, and the wheel expiring its entries */
+	struct arp_cache_entry** arp_cache_hash;
+	uint32_t arp_cache_hash_size;	/* power of two */
+	uint32_t arp_cache_hash_count;
+	twheel* arp_cache_wheel;
 
 	node* if_list;
 	pthread_rwlock_t* if_list_lock;
 
-	node* arp_queue;
+	/* packets waiting on arp, chained by next hop, with retries on a millisecond wheel */
+	struct arp_queue_entry* arp_queue[ARP_QUEUE_HASH_SIZE];
 	pthread_rwlock_t* arp_queue_lock;
+	twheel* arp_queue_wheel;
+	uint32_t arp_queue_entries;
+	uint32_t arp_queue_bytes;
+	uint32_t arp_queue_dest_limit;	/* bytes that may wait behind one next hop */
+	uint32_t arp_queue_limit;		/* bytes that may wait in total */
+	uint64_t arp_queue_dest_drops;
+	uint64_t arp_queue_limit_drops;
+	uint64_t arp_queue_timeout_drops;
 
 	node* cli_commands;
 	pthread_rwlock_t* cli_commands_lock;
@@ -252,18 +572,27 @@ struct router_state {
 	pthread_mutex_t* pwospf_lsu_queue_lock;
 
 	node* nat_table;
-	pthread_t* nat_maintenance_thread;
+	struct nat_entry** nat_int_hash;	/* chains by internal ip and port */
+	struct nat_entry** nat_ext_hash;	/* chains by external port */
+	uint32_t nat_port_map[NAT_PORT_MAP_WORDS];	/* external ports in use, host byte order bit index */
+	uint32_t nat_entries;
+	struct sched_timer* nat_maintenance_timer;
 	pthread_mutex_t* nat_table_mutex;
 	pthread_cond_t* nat_table_cond;
 
-	pthread_t* arp_thread;
-	pthread_t *pwospf_hello_thread;
-	pthread_t *pwospf_lsu_thread;
-	pthread_t *pwospf_lsu_timeout_thread;
+	/* the periodic work, all of it run by the one scheduler thread */
+	struct scheduler* sched;
+	struct sched_timer* arp_cache_timer;
+	struct sched_timer* arp_queue_timer;
+	struct sched_timer* pwospf_hello_timer;
+	struct sched_timer* pwospf_lsu_timer;
+	struct sched_timer* pwospf_lsu_timeout_timer;
+	struct sched_timer* sping_timer;
 
-	pthread_t* pwospf_dijkstra_thread;
-	pthread_mutex_t* dijkstra_mutex;
-	pthread_cond_t* dijkstra_cond;
+	struct sched_timer* dijkstra_timer;	/* kicked when the topology changes */
+	struct spf_graph* spf_graph;	/* the graph and tree of the last run, owned by the dijkstra timer */
+	uint64_t spf_full_runs;
+	uint64_t spf_incremental_runs;
 
 	pthread_t* pwospf_lsu_bcast_thread;
 	pthread_mutex_t* pwospf_lsu_bcast_mutex;
@@ -274,18 +603,20 @@ struct router_state {
 	node* www_request_queue;
 	pthread_mutex_t* www_mutex;
 	pthread_cond_t* www_cond;
+	struct www_cache* www_cache;	/* rendered pages and static files */
 
 	/* stats related */
-	pthread_t* stats_thread;
+	struct sched_timer* stats_timer;
 	pthread_mutex_t* stats_mutex;
-	struct timeval stats_last_time;
-	uint32_t stats_last[8][4];
-	double stats_avg[8][2];
+	struct hw_stats* hw_stats;		/* written by the stats timer, read under stats_mutex */
 
 	pthread_mutex_t* local_ip_filter_list_mutex;
 	node* local_ip_filter_list;
 
-	pthread_mutex_t* log_dumper_mutex;
+	/* bulk state export, each table is stamped with the next version under its own lock when it changes */
+	volatile uint64_t state_version;
+	uint64_t state_changed[EXPORT_TABLES];
+
 };
 typedef struct router_state router_state;
 
@@ -300,6 +631,35 @@ struct rtable_entry {
 };
 typedef struct rtable_entry rtable_entry;
 
+/*
+ * An immutable copy of the active rtable entries plus an lpm index over them.
+ * Writers publish a new snapshot on every change. The previous one is retired and
+ * freed by a later writer once no reader has it pinned, see rtable_snapshot_acquire.
+ */
+#define RTABLE_SNAPSHOT_SLOTS 64
+
+struct rtable_snapshot {
+	uint32_t version;
+	rtable_entry* entries;
+	uint32_t num_entries;
+	lpm_trie* lpm;		/* data pointers point into entries */
+	uint32_t in_use;	/* only touched by writers */
+	uint32_t retired;
+};
+typedef struct rtable_snapshot rtable_snapshot;
+
+/*
+ * One per thread that looks up routes, on its own cache line so readers never
+ * write to memory another reader touches. Records are never freed, the record of an
+ * exited thread is taken over by the next new one.
+ */
+struct rtable_reader {
+	volatile uint32_t pinned;	/* slot + 1 of the snapshot being read, 0 if none */
+	volatile uint32_t owned;	/* held by a live thread */
+	struct rtable_reader* next;
+} __attribute__((aligned(64)));
+typedef struct rtable_reader rtable_reader;
+
 
 /** ARP CACHE STRUCT **/
 #define IF_LEN 32
@@ -309,26 +669,34 @@ struct arp_cache_entry {
 	unsigned char arp_ha[ETH_ADDR_LEN];	/* target hardware address */
 	time_t TTL;				/* time expiration of entry */
 	int is_static;
+	volatile uint32_t hits;		/* software lookups, decayed as hardware rows are reassigned */
+	node* list_node;			/* this entry's node in rs->arp_cache */
+	twheel_timer expiry;		/* pending unless the entry is static */
 };
 typedef struct arp_cache_entry arp_cache_entry;
 
 
 /** ARP QUEUE STRUCT **/
+struct arp_queue_packet_entry {
+	uint8_t* packet;
+	unsigned int len;
+	struct arp_queue_packet_entry* next;
+};
+typedef struct arp_queue_packet_entry arp_queue_packet_entry;
+
 struct arp_queue_entry {
 	char out_iface_name[IF_LEN];
 	struct in_addr next_hop;
 	int requests;
-	time_t last_req_time;
-	node* head;
+	arp_queue_packet_entry* head;
+	arp_queue_packet_entry* tail;
+	uint32_t packets;
+	uint32_t bytes;
+	struct arp_queue_entry* hash_next;	/* next entry in the same rs->arp_queue chain */
+	twheel_timer retry;					/* sends the next request or gives up */
 };
 typedef struct arp_queue_entry arp_queue_entry;
 
-struct arp_queue_packet_entry {
-	uint8_t* packet;
-	unsigned int len;
-};
-typedef struct arp_queue_packet_entry arp_queue_packet_entry;
-
 
 /** SPING QUEUE STRUCT **/
 struct sping_queue_entry {
@@ -414,6 +782,45 @@ typedef struct nbr_router nbr_router;
 
  typedef struct pwospf_router pwospf_router;
 
+/*
+ * SPF graph, a snapshot of the pwospf router list indexed by router id. Vertices
+ * keep the order of the router list, the edges of vertex i are
+ * out[v[i].out_start .. v[i].out_start + v[i].out_count), sorted, and likewise in[].
+ */
+#define SPF_NONE -1
+#define SPF_INFINITY 0xFFFFFFFF
+
+struct spf_vertex {
+	pwospf_router* router;	/* only valid while the router list is locked */
+	uint32_t router_id;
+	int out_start;
+	int out_count;
+	int in_start;
+	int in_count;
+	uint32_t distance;
+	int prev;		/* vertex before this one on the shortest path, SPF_NONE if unreached */
+	int first_hop;	/* vertex after the source on that path, SPF_NONE until looked up */
+	int heap_pos;	/* SPF_NONE when not in the heap */
+};
+typedef struct spf_vertex spf_vertex;
+
+struct spf_graph {
+	spf_vertex* v;
+	int num_v;
+	int* out;
+	int* in;
+	int num_e;
+	int num_ifaces;	/* interfaces over all routers, bounds the route count */
+	int* rid_hash;	/* vertex by router id, open addressing, SPF_NONE when empty */
+	uint32_t hash_mask;
+	int* heap;		/* binary heap of vertices on (distance, vertex) */
+	int heap_len;
+	int source;		/* our vertex, SPF_NONE if we are not in the list yet */
+	int settled;	/* vertices the last run took off the heap */
+	int is_incremental;	/* the last run only repaired the affected subtrees */
+};
+typedef struct spf_graph spf_graph;
+
 
 
 struct pwospf_lsu_queue_entry {
@@ -449,6 +856,9 @@ struct nat_entry {
 	double avg_hits_per_second;
 	uint8_t hw_row;
 	uint8_t is_static;
+	struct nat_entry* int_next;	/* next entry in the same rs->nat_int_hash chain */
+	struct nat_entry* ext_next;	/* next entry in the same rs->nat_ext_hash chain */
+	node* list_node;			/* this entry's node in rs->nat_table */
 };
 
 typedef struct nat_entry nat_entry;
@@ -460,6 +870,154 @@ struct www_client_thread_info {
 };
 typedef struct www_client_thread_info www_client_thread_info;
 
+/** GROWABLE OUTPUT BUFFER **/
+struct out_buf {
+	char* data;
+	unsigned int len;
+	unsigned int size;
+};
+typedef struct out_buf out_buf;
+
+/** WEB SERVER **/
+#define WWW_PORT 8080
+#define WWW_THREADS 5				/* lwip only, linux sockets are served from one epoll loop */
+#define WWW_REQ_MAX 8192			/* longest request head */
+#define WWW_HEAD_MAX 512			/* longest response head */
+#define WWW_KEEPALIVE_MAX 100		/* requests on one connection before it is closed */
+#define WWW_IDLE_MS 15000			/* idle keep-alive connections are closed after this */
+#define WWW_CACHE_ENTRIES 64
+#define WWW_CACHE_FILE_MAX (1024 * 1024)	/* larger static files are not cached */
+
+/* a rendered response body, shared by the cache and the connections sending it */
+struct www_page {
+	volatile int refs;
+	uint64_t version;			/* of the state it shows, or the mtime and size of its file */
+	uint64_t rendered_ms;
+	const char* content_type;
+	char* data;
+	unsigned int len;
+};
+typedef struct www_page www_page;
+
+struct www_cache_entry {
+	char* key;					/* url or path */
+	www_page* page;
+};
+typedef struct www_cache_entry www_cache_entry;
+
+struct www_cache {
+	pthread_mutex_t lock;
+	www_cache_entry entries[WWW_CACHE_ENTRIES];
+	unsigned int num_entries;
+	unsigned int next_evict;
+	uint64_t hits;
+	uint64_t renders;
+};
+typedef struct www_cache www_cache;
+
+struct www_conn {
+	int sockfd;
+	router_state* rs;
+	uint64_t last_active_ms;
+	unsigned int requests;
+	int keep_alive;				/* after the response being sent */
+	int eof;					/* the client sent no more after what is in the input */
+
+	char in[WWW_REQ_MAX];		/* request heads, pipelined ones queue up behind the first */
+	unsigned int in_len;
+
+	/* the response being sent: head, then a body from a page, body or a file */
+	char head[WWW_HEAD_MAX];
+	unsigned int head_len;
+	unsigned int head_sent;
+	www_page* page;
+	out_buf body;				/* keeps its allocation from one response to the next */
+	const char* body_data;
+	unsigned int body_len;
+	unsigned int body_sent;
+	int file_fd;				/* linux sockets only, sent with sendfile */
+	long file_len;
+	long file_sent;
+
+	int want_out;				/* epoll is waiting for room to write */
+	struct www_conn* prev;
+	struct www_conn* next;
+};
+typedef struct www_conn www_conn;
+
+/** BULK STATE EXPORT, ROWS ARE COPIED OUT UNDER THE TABLE LOCKS AND FORMATTED AFTER **/
+#define EXPORT_MAGIC "SCST"
+#define EXPORT_FORMAT 1
+#define EXPORT_UNCHANGED 0x1		/* table flag, no rows follow */
+
+/* addresses and ports in network byte order as in the tables, the rest in host order */
+struct export_iface_row {
+	char name[IF_LEN];
+	uint8_t addr[ETH_ADDR_LEN];
+	uint8_t is_active;
+	uint8_t is_wan;
+	uint32_t ip;
+	uint32_t mask;
+	uint32_t speed;
+} __attribute__ ((packed));
+typedef struct export_iface_row export_iface_row;
+
+struct export_rtable_row {
+	uint32_t ip;
+	uint32_t gw;
+	uint32_t mask;
+	char iface[IF_LEN];
+	uint8_t is_static;
+	uint8_t is_active;
+} __attribute__ ((packed));
+typedef struct export_rtable_row export_rtable_row;
+
+struct export_arp_row {
+	uint32_t ip;
+	uint8_t ha[ETH_ADDR_LEN];
+	uint8_t is_static;
+	uint8_t pad;
+	int32_t ttl;				/* seconds left when copied, -1 for static entries */
+	uint32_t hits;
+} __attribute__ ((packed));
+typedef struct export_arp_row export_arp_row;
+
+struct export_nat_row {
+	uint32_t ext_ip;
+	uint32_t int_ip;
+	uint16_t ext_port;
+	uint16_t int_port;
+	uint32_t hits;
+	double avg_hits_per_second;
+	uint8_t hw_row;				/* 0xFF if not in hardware */
+	uint8_t is_static;
+} __attribute__ ((packed));
+typedef struct export_nat_row export_nat_row;
+
+/* one per hw stats counter, in the order of the HWSTATS_ indices */
+struct export_counter_row {
+	uint64_t total;
+	double rate;				/* per second */
+} __attribute__ ((packed));
+typedef struct export_counter_row export_counter_row;
+
+struct export_table {
+	uint64_t changed;			/* state_version the table was last stamped with */
+	uint32_t flags;
+	uint32_t row_size;
+	uint32_t num_rows;
+	uint32_t capacity;
+	void* rows;
+};
+typedef struct export_table export_table;
+
+struct export_snapshot {
+	uint64_t version;			/* ask for changes since this one next time */
+	uint64_t since;
+	export_table tables[EXPORT_TABLES];
+};
+typedef struct export_snapshot export_snapshot;
+
 /* Struct for LOCAL IP FILTER used by NETFPGA */
 #define LOCAL_IP_FILTER_ENTRY_NAME_LEN 32
 
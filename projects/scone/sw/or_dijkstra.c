@@ -10,6 +10,7 @@
 #include "or_rtable.h"
 #include "or_iface.h"
 #include "or_output.h"
+#include "or_sched.h"
 #include <assert.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
@@ -19,14 +20,8 @@
 #include <pthread.h>
 #include <errno.h>
 
-pwospf_router* get_shortest(node* pwospf_router_list);
-void update_neighbor_distance(pwospf_router* w, node* pwospf_router_list);
-node* build_route_wrapper_list(uint32_t our_rid, node* pwospf_router_list);
-void add_route_wrappers(uint32_t our_rid, node** head, pwospf_router* r);
-node* get_route_wrapper(node* head, struct in_addr* subnet, struct in_addr* mask);
 iface_entry* get_iface_by_rid(uint32_t rid, node* if_list);
 iface_entry* get_iface_by_subnet_mask(struct in_addr* subnet, struct in_addr* mask, node* if_list);
-void print_wrapper_list(node* route_wrapper_list);
 
 struct route_wrapper {
 	rtable_entry entry; /* entry being wrapped, lacking next hop ip */
@@ -36,76 +31,542 @@ struct route_wrapper {
 };
 typedef struct route_wrapper route_wrapper;
 
+/* router ids and subnets are in network byte order, mix the high bits down too */
+static inline uint32_t spf_hash(uint32_t key) {
+	key ^= key >> 16;
+	key *= 0x45D9F3B;
+	key ^= key >> 16;
+	return key;
+}
+
+static int spf_int_cmp(const void* a, const void* b) {
+	return *(const int*)a - *(const int*)b;
+}
+
+/* Returns: the vertex of the router with this id, SPF_NONE if it is not in the graph */
+int spf_graph_find(spf_graph* g, uint32_t rid) {
+	uint32_t i = spf_hash(rid) & g->hash_mask;
+	while (g->rid_hash[i] != SPF_NONE) {
+		if (g->v[g->rid_hash[i]].router_id == rid) {
+			return g->rid_hash[i];
+		}
+		i = (i + 1) & g->hash_mask;
+	}
+	return SPF_NONE;
+}
+
 /*
- * NOT thread safe, lock the pwospf_router_list_lock for writes
- * on the router_state object before passing it in, also the if_list
- * lock for reads.
+ * Snapshots the router list into vertices and sorted edge ranges, O(V + E). An edge
+ * runs along every active interface to a router we have an LSU for. A router id
+ * listed twice keeps its first vertex, the way get_router_by_rid finds it.
  *
- * Returns: a linked list representing the dynamic rtable
+ * NOT THREAD SAFE, lock the pwospf_router_list for the duration
+ */
+spf_graph* spf_graph_create(uint32_t our_router_id, node* pwospf_router_list) {
+	spf_graph* g = (spf_graph*)calloc(1, sizeof(spf_graph));
+	node* cur;
+	int i, j;
+
+	for (cur = pwospf_router_list; cur; cur = cur->next) {
+		++g->num_v;
+		g->num_ifaces += node_length(((pwospf_router*)cur->data)->interface_list);
+	}
+
+	uint32_t hash_size = 16;
+	while (hash_size < (2 * g->num_v)) {
+		hash_size <<= 1;
+	}
+	g->hash_mask = hash_size - 1;
+	g->rid_hash = (int*)malloc(hash_size * sizeof(int));
+	memset(g->rid_hash, 0xFF, hash_size * sizeof(int));
+
+	g->v = (spf_vertex*)calloc(g->num_v + 1, sizeof(spf_vertex));
+	g->out = (int*)malloc((g->num_ifaces + 1) * sizeof(int));
+	g->in = (int*)malloc((g->num_ifaces + 1) * sizeof(int));
+	g->heap = (int*)malloc((g->num_v + 1) * sizeof(int));
+
+	for (i = 0, cur = pwospf_router_list; cur; ++i, cur = cur->next) {
+		spf_vertex* v = &(g->v[i]);
+		v->router = (pwospf_router*)cur->data;
+		v->router_id = v->router->router_id;
+		v->distance = SPF_INFINITY;
+		v->prev = SPF_NONE;
+		v->first_hop = SPF_NONE;
+		v->heap_pos = SPF_NONE;
+
+		if (spf_graph_find(g, v->router_id) == SPF_NONE) {
+			uint32_t slot = spf_hash(v->router_id) & g->hash_mask;
+			while (g->rid_hash[slot] != SPF_NONE) {
+				slot = (slot + 1) & g->hash_mask;
+			}
+			g->rid_hash[slot] = i;
+		}
+	}
+	g->source = spf_graph_find(g, our_router_id);
+
+	/* out edges, each range sorted with repeats dropped */
+	for (i = 0; i < g->num_v; ++i) {
+		spf_vertex* v = &(g->v[i]);
+		v->out_start = g->num_e;
+		for (cur = v->router->interface_list; cur; cur = cur->next) {
+			pwospf_interface* iface = (pwospf_interface*)cur->data;
+			if ((iface->router_id != 0) && iface->is_active) {
+				int w = spf_graph_find(g, iface->router_id);
+				if ((w != SPF_NONE) && (w != i)) {
+					g->out[g->num_e++] = w;
+				}
+			}
+		}
+
+		int* out = &(g->out[v->out_start]);
+		int count = g->num_e - v->out_start;
+		qsort(out, count, sizeof(int), spf_int_cmp);
+		v->out_count = 0;
+		for (j = 0; j < count; ++j) {
+			if ((v->out_count == 0) || (out[v->out_count - 1] != out[j])) {
+				out[v->out_count++] = out[j];
+			}
+		}
+		g->num_e = v->out_start + v->out_count;
+	}
+
+	/* in edges by counting, filled in vertex order so each range comes out sorted */
+	for (i = 0; i < g->num_e; ++i) {
+		++g->v[g->out[i]].in_count;
+	}
+	for (i = 0, j = 0; i < g->num_v; ++i) {
+		g->v[i].in_start = j;
+		j += g->v[i].in_count;
+		g->v[i].in_count = 0;
+	}
+	for (i = 0; i < g->num_v; ++i) {
+		for (j = 0; j < g->v[i].out_count; ++j) {
+			spf_vertex* w = &(g->v[g->out[g->v[i].out_start + j]]);
+			g->in[w->in_start + w->in_count++] = i;
+		}
+	}
+
+	return g;
+}
+
+void spf_graph_destroy(spf_graph* g) {
+	if (!g) {
+		return;
+	}
+	free(g->v);
+	free(g->out);
+	free(g->in);
+	free(g->rid_hash);
+	free(g->heap);
+	free(g);
+}
+
+/*
+ * Ties on distance go to the lower vertex, which is the router earlier in the list,
+ * so routers come off the heap in the order the old linear scan picked them.
+ */
+static inline int spf_heap_less(spf_graph* g, int a, int b) {
+	return (g->v[a].distance < g->v[b].distance) ||
+		((g->v[a].distance == g->v[b].distance) && (a < b));
+}
+
+static void spf_heap_set(spf_graph* g, int pos, int vertex) {
+	g->heap[pos] = vertex;
+	g->v[vertex].heap_pos = pos;
+}
+
+static void spf_heap_up(spf_graph* g, int pos) {
+	int vertex = g->heap[pos];
+	while (pos > 0) {
+		int parent = (pos - 1) / 2;
+		if (!spf_heap_less(g, vertex, g->heap[parent])) {
+			break;
+		}
+		spf_heap_set(g, pos, g->heap[parent]);
+		pos = parent;
+	}
+	spf_heap_set(g, pos, vertex);
+}
+
+static void spf_heap_down(spf_graph* g, int pos) {
+	int vertex = g->heap[pos];
+	while (1) {
+		int child = (2 * pos) + 1;
+		if (child >= g->heap_len) {
+			break;
+		}
+		if (((child + 1) < g->heap_len) && spf_heap_less(g, g->heap[child + 1], g->heap[child])) {
+			++child;
+		}
+		if (!spf_heap_less(g, g->heap[child], vertex)) {
+			break;
+		}
+		spf_heap_set(g, pos, g->heap[child]);
+		pos = child;
+	}
+	spf_heap_set(g, pos, vertex);
+}
+
+/* inserts the vertex or, if it is already queued, moves it up to its lower distance */
+static void spf_heap_update(spf_graph* g, int vertex) {
+	if (g->v[vertex].heap_pos == SPF_NONE) {
+		g->heap[g->heap_len] = vertex;
+		g->v[vertex].heap_pos = g->heap_len++;
+	}
+	spf_heap_up(g, g->v[vertex].heap_pos);
+}
+
+static int spf_heap_pop(spf_graph* g) {
+	int vertex = g->heap[0];
+	g->v[vertex].heap_pos = SPF_NONE;
+	if (--g->heap_len > 0) {
+		spf_heap_set(g, 0, g->heap[g->heap_len]);
+		spf_heap_down(g, 0);
+	}
+	return vertex;
+}
+
+/*
+ * Dijkstra from whatever is queued. Every link costs one hop, so a router already
+ * taken off the heap can never be improved and needs no flag.
+ */
+static void spf_run(spf_graph* g) {
+	while (g->heap_len > 0) {
+		int u = spf_heap_pop(g);
+		uint32_t distance = g->v[u].distance + 1;
+		int i;
+
+		++g->settled;
+		for (i = 0; i < g->v[u].out_count; ++i) {
+			int w = g->out[g->v[u].out_start + i];
+			if (distance < g->v[w].distance) {
+				g->v[w].distance = distance;
+				g->v[w].prev = u;
+				spf_heap_update(g, w);
+			}
+		}
+	}
+}
+
+/* shortest paths to every router from scratch, O((V + E) log V) */
+void spf_full(spf_graph* g) {
+	int i;
+	for (i = 0; i < g->num_v; ++i) {
+		g->v[i].distance = SPF_INFINITY;
+		g->v[i].prev = SPF_NONE;
+		g->v[i].first_hop = SPF_NONE;
+		g->v[i].heap_pos = SPF_NONE;
+	}
+	g->heap_len = 0;
+	g->settled = 0;
+	g->is_incremental = 0;
+
+	if (g->source != SPF_NONE) {
+		g->v[g->source].distance = 0;
+		spf_heap_update(g, g->source);
+		spf_run(g);
+	}
+}
+
+/*
+ * Repairs the shortest path tree of old to fit g, which has to have the same routers
+ * (any order). The tree is carried across, every router below a tree link that went
+ * away loses its path, those routers are seeded from their links to the rest of
+ * the tree and from the links that are new, and Dijkstra runs from just those.
  *
+ * Returns: 0 if g now holds the shortest paths, -1 if a full run is needed instead
  */
+int spf_incremental(spf_graph* old, spf_graph* g) {
+	int* map;		/* old vertex to new */
+	int* mapped;	/* old out edges of one vertex, renumbered */
+	int* added;		/* pairs of vertices, new links */
+	int* roots;
+	int* children;
+	int* child_start;
+	char* affected;
+	int num_added = 0;
+	int num_roots = 0;
+	int num_affected = 0;
+	int i, j, k;
+	int result = 0;
 
-node* compute_rtable(uint32_t our_router_id, node* pwospf_router_list, node* if_list) {
-	/* initialize all the entriest to their max distance, except us */
-	node* cur = pwospf_router_list;
-	pwospf_router* r = NULL;
-	pwospf_router* r_shortest = NULL;
+	if (!old || (old->num_v != g->num_v) || (g->source == SPF_NONE) || (old->source == SPF_NONE)) {
+		return -1;
+	}
 
-	while (cur) {
-		r = (pwospf_router*)cur->data;
-		if (r->router_id == our_router_id) {
-			r->distance = 0;
-			r->shortest_path_found = 1;
-		} else if (r->router_id != 0) {
-			r->distance = 0xFFFFFFFF;
-			r->shortest_path_found = 0;
+	/* usually nothing joined or left and the list kept its order */
+	map = (int*)malloc(g->num_v * sizeof(int));
+	for (i = 0; i < g->num_v; ++i) {
+		if (old->v[i].router_id != g->v[i].router_id) {
+			break;
+		}
+		map[i] = i;
+	}
+	int same_order = (i == g->num_v);
+	if (!same_order) {
+		memset(map, 0xFF, g->num_v * sizeof(int));
+		for (i = 0; i < g->num_v; ++i) {
+			j = spf_graph_find(old, g->v[i].router_id);
+			if ((j == SPF_NONE) || (map[j] != SPF_NONE)) {
+				free(map);
+				return -1;
+			}
+			map[j] = i;
 		}
+	}
+	if (map[old->source] != g->source) {
+		free(map);
+		return -1;
+	}
 
-		cur = cur->next;
+	/* carry the old tree across */
+	for (j = 0; j < old->num_v; ++j) {
+		spf_vertex* v = &(g->v[map[j]]);
+		v->distance = old->v[j].distance;
+		v->prev = (old->v[j].prev == SPF_NONE) ? SPF_NONE : map[old->v[j].prev];
+		v->first_hop = SPF_NONE;
+		v->heap_pos = SPF_NONE;
 	}
+	g->heap_len = 0;
+	g->settled = 0;
+	g->is_incremental = 1;
+
+	/* diff the links of every router, both sides sorted */
+	mapped = (int*)malloc((old->num_e + 1) * sizeof(int));
+	added = (int*)malloc(((2 * g->num_e) + 1) * sizeof(int));
+	roots = (int*)malloc(g->num_v * sizeof(int));
+	for (j = 0; j < old->num_v; ++j) {
+		int u = map[j];
+		int num_old = old->v[j].out_count;
+		int* new_out = &(g->out[g->v[u].out_start]);
+		int num_new = g->v[u].out_count;
+
+		int* old_out = &(old->out[old->v[j].out_start]);
+		if (same_order) {
+			if ((num_old == num_new) && (memcmp(old_out, new_out, num_new * sizeof(int)) == 0)) {
+				continue;
+			}
+			memcpy(mapped, old_out, num_old * sizeof(int));
+		} else {
+			for (k = 0; k < num_old; ++k) {
+				mapped[k] = map[old_out[k]];
+			}
+			qsort(mapped, num_old, sizeof(int), spf_int_cmp);
+		}
 
-	/* Set our router as the shortest */
-	r_shortest = get_router_by_rid(our_router_id, pwospf_router_list);
+		i = 0;
+		k = 0;
+		while ((i < num_old) || (k < num_new)) {
+			if ((k == num_new) || ((i < num_old) && (mapped[i] < new_out[k]))) {
+				/* gone, only matters if the tree ran through it */
+				if (g->v[mapped[i]].prev == u) {
+					roots[num_roots++] = mapped[i];
+				}
+				++i;
+			} else if ((i == num_old) || (new_out[k] < mapped[i])) {
+				added[num_added++] = u;
+				added[num_added++] = new_out[k];
+				++k;
+			} else {
+				++i;
+				++k;
+			}
+		}
+	}
 
-	while (r_shortest) {
-		/* add this router to N' */
-		r_shortest->shortest_path_found = 1;
+	/* children of every router in the carried tree, to find what hangs below the roots */
+	child_start = (int*)calloc(g->num_v + 1, sizeof(int));
+	children = (int*)malloc((g->num_v + 1) * sizeof(int));
+	affected = (char*)calloc(g->num_v, sizeof(char));
+	if (num_roots > 0) {
+		for (i = 0; i < g->num_v; ++i) {
+			if (g->v[i].prev != SPF_NONE) {
+				++child_start[g->v[i].prev + 1];
+			}
+		}
+		for (i = 0; i < g->num_v; ++i) {
+			child_start[i + 1] += child_start[i];
+		}
+		for (i = 0; i < g->num_v; ++i) {
+			if (g->v[i].prev != SPF_NONE) {
+				children[child_start[g->v[i].prev]++] = i;
+			}
+		}
+		/* the fill moved every start to the next one's, shift them back */
+		for (i = g->num_v; i > 0; --i) {
+			child_start[i] = child_start[i - 1];
+		}
+		child_start[0] = 0;
+	}
+
+	/* roots doubles as the work list, everything put on it is affected */
+	for (i = 0; i < num_roots; ++i) {
+		affected[roots[i]] = 1;
+	}
+	for (i = 0; i < num_roots; ++i) {
+		int u = roots[i];
+		for (k = child_start[u]; k < child_start[u + 1]; ++k) {
+			if (!affected[children[k]]) {
+				affected[children[k]] = 1;
+				roots[num_roots++] = children[k];
+			}
+		}
+	}
+	num_affected = num_roots;
+
+	if (num_affected > (g->num_v / 2)) {
+		/* most of the tree is gone, starting over is cheaper */
+		result = -1;
+	} else {
+		for (i = 0; i < num_affected; ++i) {
+			g->v[roots[i]].distance = SPF_INFINITY;
+			g->v[roots[i]].prev = SPF_NONE;
+		}
+
+		/* the best way back into the intact part of the tree */
+		for (i = 0; i < num_affected; ++i) {
+			spf_vertex* w = &(g->v[roots[i]]);
+			for (k = 0; k < w->in_count; ++k) {
+				int u = g->in[w->in_start + k];
+				if (!affected[u] && (g->v[u].distance != SPF_INFINITY) && ((g->v[u].distance + 1) < w->distance)) {
+					w->distance = g->v[u].distance + 1;
+					w->prev = u;
+				}
+			}
+			if (w->distance != SPF_INFINITY) {
+				spf_heap_update(g, roots[i]);
+			}
+		}
 
-		/* update the distances to our neighbors */
-		update_neighbor_distance(r_shortest, pwospf_router_list);
+		/* new links can only shorten paths */
+		for (i = 0; i < num_added; i += 2) {
+			int u = added[i];
+			int w = added[i + 1];
+			if ((g->v[u].distance != SPF_INFINITY) && ((g->v[u].distance + 1) < g->v[w].distance)) {
+				g->v[w].distance = g->v[u].distance + 1;
+				g->v[w].prev = u;
+				spf_heap_update(g, w);
+			}
+		}
+
+		spf_run(g);
+	}
+
+	free(map);
+	free(mapped);
+	free(added);
+	free(roots);
+	free(child_start);
+	free(children);
+	free(affected);
+
+	return result;
+}
+
+/* the router right after the source on the way to vertex i, remembered along the path */
+static int spf_first_hop(spf_graph* g, int i) {
+	int cur = i;
+	while ((g->v[cur].first_hop == SPF_NONE) && (g->v[cur].prev != g->source)) {
+		cur = g->v[cur].prev;
+	}
+	int hop = (g->v[cur].first_hop != SPF_NONE) ? g->v[cur].first_hop : cur;
+
+	while (cur != i) {
+		g->v[i].first_hop = hop;
+		i = g->v[i].prev;
+	}
+	g->v[cur].first_hop = hop;
+
+	return hop;
+}
+
+static inline uint32_t spf_route_hash(uint32_t subnet, uint32_t mask) {
+	return spf_hash(subnet ^ spf_hash(mask));
+}
 
-		/* get the next router with the shortest distance */
-		r_shortest = get_shortest(pwospf_router_list);
+/*
+ * Writes the results back to the routers and turns them into rtable entries. Routes
+ * are deduplicated on subnet and mask through a hash, in the order the router list
+ * first names them, keeping the closest router advertising each.
+ *
+ * NOT THREAD SAFE, lock the pwospf_router_list and the if_list for reads
+ */
+node* spf_build_rtable(spf_graph* g, uint32_t our_router_id, node* if_list) {
+	route_wrapper* wrappers = (route_wrapper*)calloc(g->num_ifaces + 1, sizeof(route_wrapper));
+	int num_wrappers = 0;
+	uint32_t hash_size = 16;
+	int i;
+
+	while (hash_size < (2 * g->num_ifaces)) {
+		hash_size <<= 1;
 	}
+	int* hash = (int*)malloc(hash_size * sizeof(int));
+	memset(hash, 0xFF, hash_size * sizeof(int));
+
+	for (i = 0; i < g->num_v; ++i) {
+		spf_vertex* v = &(g->v[i]);
+		pwospf_router* r = v->router;
+
+		r->distance = v->distance;
+		r->shortest_path_found = (v->distance != SPF_INFINITY);
+		r->prev_router = (v->prev == SPF_NONE) ? NULL : g->v[v->prev].router;
+
+		node* cur;
+		for (cur = r->interface_list; cur; cur = cur->next) {
+			pwospf_interface* iface = (pwospf_interface*)cur->data;
+			uint32_t subnet = iface->subnet.s_addr & iface->mask.s_addr;
+			uint32_t slot = spf_route_hash(subnet, iface->mask.s_addr) & (hash_size - 1);
+			route_wrapper* wrapper = NULL;
+
+			while (hash[slot] != SPF_NONE) {
+				wrapper = &(wrappers[hash[slot]]);
+				if ((wrapper->entry.ip.s_addr == subnet) && (wrapper->entry.mask.s_addr == iface->mask.s_addr)) {
+					break;
+				}
+				wrapper = NULL;
+				slot = (slot + 1) & (hash_size - 1);
+			}
+
+			if (!wrapper) {
+				hash[slot] = num_wrappers;
+				wrapper = &(wrappers[num_wrappers++]);
+				wrapper->entry.ip.s_addr = subnet;
+				wrapper->entry.mask.s_addr = iface->mask.s_addr;
+			} else if (r->distance >= wrapper->distance) {
+				/* someone closer already advertises it */
+				continue;
+			}
 
-	/* now have the shortest path to each router, build the temporary route table */
-	node* route_wrapper_list = build_route_wrapper_list(our_router_id, pwospf_router_list);
-	//print_wrapper_list(route_wrapper_list);
+			wrapper->distance = r->distance;
+			wrapper->next_rid = (v->prev == SPF_NONE) ? iface->router_id : g->v[spf_first_hop(g, i)].router_id;
+			if (our_router_id == r->router_id) {
+				wrapper->directly_connected = 1;
+			}
+		}
+	}
 
-	/* we now have a list of wrapped proper entries, but they need specific interface info,
+	/* we now have the wrapped proper entries, but they need specific interface info,
 	 * and need to lose the wrapping
 	 */
 	node* route_list = NULL;
+	node* tail = NULL;
+
+	for (i = 0; i < num_wrappers; ++i) {
+		route_wrapper* wrapper = &(wrappers[i]);
 
-	cur = route_wrapper_list;
-	while (cur) {
-		route_wrapper* wrapper = (route_wrapper*)cur->data;
-		rtable_entry* new_entry = (rtable_entry*)calloc(1, sizeof(rtable_entry));
-		/* just blast the entry information across */
-		memcpy(new_entry, &(wrapper->entry), sizeof(rtable_entry));
 		/* get the new stuff */
 		iface_entry* iface = get_iface_by_rid(wrapper->next_rid, if_list);
 		if (!iface) {
 			iface = get_iface_by_subnet_mask(&(wrapper->entry.ip), &(wrapper->entry.mask), if_list);
 			if (!iface) {
 				/* most likely the default entry, assume its static, so just continue */
-				free(new_entry);
-				cur = cur->next;
 				continue;
 			}
 		}
-		assert(iface);
 
+		rtable_entry* new_entry = (rtable_entry*)calloc(1, sizeof(rtable_entry));
+		/* just blast the entry information across */
+		memcpy(new_entry, &(wrapper->entry), sizeof(rtable_entry));
 		memcpy(new_entry->iface, iface->name, IF_LEN);
 
 		if (wrapper->directly_connected) {
@@ -119,180 +580,68 @@ node* compute_rtable(uint32_t our_router_id, node* pwospf_router_list, node* if_
 		new_entry->is_active = 1;
 		new_entry->is_static = 0;
 
-		/* grab a new node, add it to the list */
+		/* grab a new node, add it to the end of the list */
 		node* temp = node_create();
 		temp->data = new_entry;
-
-		if (!route_list) {
+		if (!tail) {
 			route_list = temp;
 		} else {
-			node_push_back(route_list, temp);
+			tail->next = temp;
+			temp->prev = tail;
 		}
-
-		cur = cur->next;
+		tail = temp;
 	}
 
-	/* run through and free the wrapper list */
-	cur = route_wrapper_list;
-	while (cur) {
-		node* next = cur->next;
-		node_remove(&route_wrapper_list, cur);
-		cur = next;
-	}
+	free(hash);
+	free(wrappers);
 
 	return route_list;
 }
 
-pwospf_router* get_router_by_rid(uint32_t rid, node* pwospf_router_list) {
-	node* cur = pwospf_router_list;
-	while (cur) {
-		pwospf_router* r = (pwospf_router*)cur->data;
-		if (r->router_id == rid) {
-			return r;
-		}
-		cur = cur->next;
-	}
-
-	return NULL;
-}
-
-pwospf_router* get_shortest(node* pwospf_router_list) {
-	pwospf_router* shortest_router = NULL;
-	uint32_t shortest_distance = 0xFFFFFFFF;
-
-	node* cur = pwospf_router_list;
-	while (cur) {
-		pwospf_router* r = (pwospf_router*)cur->data;
-		if ((!r->shortest_path_found) && (r->distance < shortest_distance)) {
-			shortest_router = r;
-			shortest_distance = r->distance;
-		}
-		cur = cur->next;
-	}
-
-	return shortest_router;
-}
-
 /*
- * Helper function to update distances of routers attached to w's interfaces
+ * NOT thread safe, lock the pwospf_router_list_lock for writes
+ * on the router_state object before passing it in, also the if_list
+ * lock for reads.
+ *
+ * Returns: a linked list representing the dynamic rtable
+ *
  */
-void update_neighbor_distance(pwospf_router* w, node* pwospf_router_list) {
-	node* cur = w->interface_list;
-	/* iterate through each interface of this router */
-	while (cur) {
-		pwospf_interface* i = (pwospf_interface*)cur->data;
-		if ((i->router_id != 0) && i->is_active) {
-			pwospf_router* v = get_router_by_rid(i->router_id, pwospf_router_list);
-
-			/* if the distance to v is shorter through w, update it */
-			/* ADDED: ensure V exists in our router list as well,
-			 * it is possible that someone is reporting a router that is
-			 * a neighbor that we have not received an LSU for yet */
-			if ((v) && (!v->shortest_path_found) && ((w->distance+1) < v->distance)) {
-				v->distance = w->distance + 1;
-				v->prev_router = w;
-			}
-		}
+node* compute_rtable(uint32_t our_router_id, node* pwospf_router_list, node* if_list) {
+	spf_graph* g = spf_graph_create(our_router_id, pwospf_router_list);
+	spf_full(g);
+	node* route_list = spf_build_rtable(g, our_router_id, if_list);
+	spf_graph_destroy(g);
 
-		cur = cur->next;
-	}
+	return route_list;
 }
 
-node* build_route_wrapper_list(uint32_t our_rid, node* pwospf_router_list) {
-	node* head = NULL;
-
-	/* iterate through the routers, adding their interfaces to the route list */
-	node* cur = pwospf_router_list;
-	while (cur) {
-		pwospf_router* r = (pwospf_router*)cur->data;
-		add_route_wrappers(our_rid, &head, r);
-		cur = cur->next;
+/*
+ * Same as compute_rtable, but repairs the tree of the last run in *last where it
+ * can rather than starting over. *last is replaced by this run's graph, the caller
+ * owns it and passes it back in next time.
+ *
+ * NOT thread safe, same locking as compute_rtable
+ */
+node* compute_rtable_incremental(spf_graph** last, uint32_t our_router_id, node* pwospf_router_list, node* if_list) {
+	spf_graph* g = spf_graph_create(our_router_id, pwospf_router_list);
+	if (spf_incremental(*last, g) != 0) {
+		spf_full(g);
 	}
+	node* route_list = spf_build_rtable(g, our_router_id, if_list);
 
-	return head;
-}
-
-void add_route_wrappers(uint32_t our_rid, node** head, pwospf_router* r) {
-	node* cur = r->interface_list;
-	while (cur) {
-		pwospf_interface* i = (pwospf_interface*)cur->data;
-
-		/* check if we have an existing route matching this subnet and mask */
-		node* temp_node = get_route_wrapper(*head, &(i->subnet), &(i->mask));
-		if (temp_node) {
-			/* if our distance is longer, just continue to the next interface */
-			route_wrapper* wrapper = (route_wrapper*)temp_node->data;
-			if (r->distance >= wrapper->distance) {
-				cur = cur->next;
-				continue;
-			} else {
-				/* replace the existing entries data with ours */
-				wrapper->distance = r->distance;
-				/* walk down until the next router is the source */
-				pwospf_router* cur_router = r;
-				if (!cur_router->prev_router) {
-					wrapper->next_rid = i->router_id;
-				} else {
-					while (cur_router->prev_router->distance != 0) {
-						cur_router = cur_router->prev_router;
-					}
-
-					wrapper->next_rid = cur_router->router_id;
-				}
-
-				/* set that this is directly connected to us */
-				if (our_rid == r->router_id) {
-					wrapper->directly_connected = 1;
-				}
-			}
-		} else {
-			node* new_node = node_create();
-
-			/* no existing route wrapper, create a new one for this route */
-			route_wrapper* new_route = (route_wrapper*)calloc(1, sizeof(route_wrapper));
-			new_route->entry.ip.s_addr = i->subnet.s_addr & i->mask.s_addr;
-			new_route->entry.mask.s_addr = i->mask.s_addr;
-			new_route->distance = r->distance;
-
-			/* walk down until the next router is the source */
-			pwospf_router* cur_router = r;
-			if (!cur_router->prev_router) {
-				new_route->next_rid = i->router_id;
-			} else {
-				while (cur_router->prev_router->distance != 0) {
-					cur_router = cur_router->prev_router;
-				}
-				new_route->next_rid = cur_router->router_id;
-			}
-
-			/* set that this is directly connected to us */
-			if (our_rid == r->router_id) {
-				new_route->directly_connected = 1;
-			}
-
-			/* point the node's data at our route wrapper */
-			new_node->data = new_route;
-
-			if (!(*head)) {
-				(*head) = new_node;
-			} else {
-				node_push_back(*head, new_node);
-			}
-		}
+	spf_graph_destroy(*last);
+	*last = g;
 
-		cur = cur->next;
-	}
+	return route_list;
 }
 
-node* get_route_wrapper(node* head, struct in_addr* subnet, struct in_addr* mask) {
-	/* walk the route wrapper list looking for an entry matching this subnet and mask */
-	node* cur = head;
+pwospf_router* get_router_by_rid(uint32_t rid, node* pwospf_router_list) {
+	node* cur = pwospf_router_list;
 	while (cur) {
-		route_wrapper* wrapper = (route_wrapper*)cur->data;
-		if ((wrapper->entry.ip.s_addr == (subnet->s_addr & mask->s_addr)) && (wrapper->entry.mask.s_addr == mask->s_addr)) {
-			return cur;
+		pwospf_router* r = (pwospf_router*)cur->data;
+		if (r->router_id == rid) {
+			return r;
 		}
-
 		cur = cur->next;
 	}
 
@@ -348,108 +697,76 @@ iface_entry* get_iface_by_subnet_mask(struct in_addr* subnet, struct in_addr* ma
 	return NULL;
 }
 
-void print_wrapper_list(node* route_wrapper_list) {
-	node* cur = route_wrapper_list;
-	while (cur) {
-		route_wrapper* wrapper = (route_wrapper*)cur->data;
-		char subnet_str[16];
-		char mask_str[16];
-		inet_ntop(AF_INET, &(wrapper->entry.ip), subnet_str, 16);
-		inet_ntop(AF_INET, &(wrapper->entry.mask), mask_str, 16);
-
-		printf("%u %u %s %s\n", wrapper->distance, wrapper->next_rid, subnet_str, mask_str);
+/*
+ * Timer callback, kicked by dijkstra_trigger when the topology changes. Kicks that
+ * come in while it is pending fold into the one run, one that comes in while it
+ * runs has it run again right after.
+ */
+unsigned int dijkstra_tick(void* arg) {
+	router_state* rs = (router_state*)arg;
 
-		cur = cur->next;
+	/* run dijkstra before touching the rtable, forwarding keeps using the
+	 * published rtable snapshot and never waits on this */
+	lock_if_list_rd(rs);
+	lock_mutex_pwospf_router_list(rs);
+	node* dijkstra_rtable = compute_rtable_incremental(&(rs->spf_graph), rs->router_id, rs->pwospf_router_list, rs->if_list);
+	unlock_mutex_pwospf_router_list(rs);
+	if (rs->spf_graph->is_incremental) {
+		++rs->spf_incremental_runs;
+	} else {
+		++rs->spf_full_runs;
 	}
-}
-
-void* dijkstra_thread(void* arg) {
-	router_state* rs = (router_state*)arg;
 
-	struct timespec wake_up_time;
-	struct timeval now;
-	int result = 0;
+	lock_rtable_wr(rs);
 
-	pthread_mutex_lock(rs->dijkstra_mutex);
-	while (1) {
-		/* Determine the time when to wake up next */
-		gettimeofday(&now, NULL);
-		wake_up_time.tv_sec = now.tv_sec + 1;
-		wake_up_time.tv_nsec = now.tv_usec + 1000;
-
-		result = pthread_cond_timedwait(rs->dijkstra_cond, rs->dijkstra_mutex, &wake_up_time);
-		/* if we timed out, and the data is not dirty, go back to sleep */
-		if (result == ETIMEDOUT) {
-			if (!rs->dijkstra_dirty) {
-				continue;
-			}
-		}
-		rs->dijkstra_dirty = 0;
-
-		lock_if_list_rd(rs);
-		lock_rtable_wr(rs);
-		lock_mutex_pwospf_router_list(rs);
-
-		/* nuke all the non static entries */
-		//printf("---RTABLE BEFORE DIJKSTRA---\n");
-		//char* rtable_printout;
-		//int len;
-		//sprint_rtable(rs, &rtable_printout, &len);
-		//printf("%s\n", rtable_printout);
-		//free(rtable_printout);
-
-		node* cur = rs->rtable;
-		node* next = NULL;
-		while (cur) {
-			next = cur->next;
-			rtable_entry* entry = (rtable_entry*)cur->data;
-			if (!entry->is_static) {
-				node_remove(&(rs->rtable), cur);
-			}
-
-			cur = next;
+	/* nuke all the non static entries */
+	node* cur = rs->rtable;
+	node* next = NULL;
+	while (cur) {
+		next = cur->next;
+		rtable_entry* entry = (rtable_entry*)cur->data;
+		if (!entry->is_static) {
+			node_remove(&(rs->rtable), cur);
 		}
 
-		/* run dijkstra */
-		node* dijkstra_rtable = compute_rtable(rs->router_id, rs->pwospf_router_list, rs->if_list);
+		cur = next;
+	}
 
-		/* patch our list on to the end of the rtable */
-		if (!(rs->rtable)) {
-			rs->rtable = dijkstra_rtable;
-		} else {
-			cur = rs->rtable;
-			/* run to the end of the rtable */
-			while (cur->next) {
-				cur = cur->next;
-			}
-			cur->next = dijkstra_rtable;
-			if (dijkstra_rtable) {
-				dijkstra_rtable->prev = cur;
-			}
+	/* patch our list on to the end of the rtable */
+	if (!(rs->rtable)) {
+		rs->rtable = dijkstra_rtable;
+	} else {
+		cur = rs->rtable;
+		/* run to the end of the rtable */
+		while (cur->next) {
+			cur = cur->next;
+		}
+		cur->next = dijkstra_rtable;
+		if (dijkstra_rtable) {
+			dijkstra_rtable->prev = cur;
 		}
-
-		/* write new rtable out to hardware */
-		trigger_rtable_modified(rs);
-		char* rtable_printout;
-		int len;
-		printf("---RTABLE AFTER DIJKSTRA---\n");
-		sprint_rtable(rs, &rtable_printout, &len);
-		printf("%s\n", rtable_printout);
-		free(rtable_printout);
-
-		/* unlock everything */
-		unlock_mutex_pwospf_router_list(rs);
-		unlock_rtable(rs);
-		unlock_if_list(rs);
-
 	}
-	pthread_mutex_unlock(rs->dijkstra_mutex);
 
-	return NULL;
+	/* write new rtable out to hardware and publish it to the readers */
+	trigger_rtable_modified(rs);
+	char* rtable_printout;
+	int len;
+	printf("---RTABLE AFTER DIJKSTRA (%s, %i of %i routers settled)---\n",
+		rs->spf_graph->is_incremental ? "incremental" : "full", rs->spf_graph->settled, rs->spf_graph->num_v);
+	sprint_rtable(rs, &rtable_printout, &len);
+	printf("%s\n", rtable_printout);
+	free(rtable_printout);
+
+	/* unlock everything */
+	unlock_rtable(rs);
+	unlock_if_list(rs);
+
+	return 0;
 }
 
 void dijkstra_trigger(router_state* rs) {
-	/* no lock on this object, worst case it takes an extra second to run */
-	rs->dijkstra_dirty = 1;
-	pthread_cond_signal(rs->dijkstra_cond);
+	/* runs it as soon as the scheduler thread gets to it, without waiting on the poll */
+	if (rs->dijkstra_timer) {
+		sched_kick(rs->dijkstra_timer, 0);
+	}
 }
@@ -9,9 +9,16 @@
 
 #include "or_data_types.h"
 
+spf_graph* spf_graph_create(uint32_t our_router_id, node* pwospf_router_list);
+void spf_graph_destroy(spf_graph* g);
+int spf_graph_find(spf_graph* g, uint32_t rid);
+void spf_full(spf_graph* g);
+int spf_incremental(spf_graph* old, spf_graph* g);
+node* spf_build_rtable(spf_graph* g, uint32_t our_router_id, node* if_list);
 node* compute_rtable(uint32_t our_router_id, node* pwospf_router_list, node* if_list);
+node* compute_rtable_incremental(spf_graph** last, uint32_t our_router_id, node* pwospf_router_list, node* if_list);
 pwospf_router* get_router_by_rid(uint32_t rid, node* pwospf_router_list);
-void* dijkstra_thread(void* arg);
+unsigned int dijkstra_tick(void* arg);
 void dijkstra_trigger(router_state* rs);
 
 #endif /*OR_DIJKSTRA_H_*/
@@ -0,0 +1,426 @@
+/*
+ * Bulk export of the router tables and hw counters for machines to read, as JSON or
+ * binary. Each table is copied into flat rows in one pass under its lock and
+ * formatted once every lock is released, so a scrape holds up forwarding only as
+ * long as the copies take.
+ *
+ * Every change to an exported table stamps it with the next state_version, under
+ * the lock the change is made under. A snapshot taken since version N leaves out
+ * the rows of tables not stamped after N, and carries the version to ask from next
+ * time. A change racing the snapshot lands after the version it reports, so it is
+ * picked up by the next one.
+ *
+ * The binary form, host byte order except where the rows say otherwise:
+ *	char magic[4] "SCST", uint32_t format, uint64_t version, uint64_t since, uint32_t tables
+ *	then for each table in EXPORT_ order:
+ *	uint32_t table, uint32_t flags, uint64_t changed, uint32_t row_size, uint32_t rows,
+ *	and the rows as the export_*_row structs, none when flags has EXPORT_UNCHANGED
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <assert.h>
+
+#include "or_export.h"
+#include "or_utils.h"
+#include "or_rtable.h"
+#include "or_arp.h"
+#include "or_iface.h"
+#include "or_nat.h"
+#include "or_netfpga.h"
+#include "or_hwstats.h"
+
+static const char* export_table_names[EXPORT_TABLES] = { "ifaces", "rtable", "arp", "nat", "counters" };
+
+static const uint32_t export_row_sizes[EXPORT_TABLES] = {
+	sizeof(export_iface_row), sizeof(export_rtable_row), sizeof(export_arp_row),
+	sizeof(export_nat_row), sizeof(export_counter_row)
+};
+
+/* rows of the last snapshot of each table, the next one is allocated this big before taking the lock */
+static volatile uint32_t export_row_hints[EXPORT_TABLES];
+
+/*
+ * Marks table as changed with the next state version.
+ * NOT THREAD SAFE: hold the lock of the table, for write if it has a read write lock
+ */
+void export_stamp(router_state* rs, int table) {
+	rs->state_changed[table] = __sync_add_and_fetch(&(rs->state_version), 1);
+}
+
+/*
+ * Returns: the next row of t, growing the rows if they are full. Only grows under
+ * the lock when the table grew since the last snapshot.
+ */
+static void* export_next_row(export_table* t) {
+	if (t->num_rows == t->capacity) {
+		t->capacity = (t->capacity * 2) + 16;
+		t->rows = realloc(t->rows, t->capacity * t->row_size);
+		assert(t->rows);
+	}
+	return ((uint8_t*)t->rows) + (t->num_rows++ * t->row_size);
+}
+
+/*
+ * Called under the lock of the table. Returns: 1 if the rows of the table should be
+ * copied, 0 if it has not changed since the version asked about.
+ */
+static int export_begin(router_state* rs, export_snapshot* snap, int table) {
+	export_table* t = &(snap->tables[table]);
+	t->changed = rs->state_changed[table];
+	if ((snap->since != 0) && (t->changed <= snap->since)) {
+		t->flags |= EXPORT_UNCHANGED;
+		return 0;
+	}
+	return 1;
+}
+
+static void export_copy_ifaces(router_state* rs, export_snapshot* snap) {
+	export_table* t = &(snap->tables[EXPORT_IFACES]);
+
+	lock_if_list_rd(rs);
+	if (export_begin(rs, snap, EXPORT_IFACES)) {
+		node* cur = rs->if_list;
+		while (cur) {
+			iface_entry* iface = (iface_entry*)cur->data;
+			export_iface_row* row = (export_iface_row*)export_next_row(t);
+			memcpy(row->name, iface->name, IF_LEN);
+			memcpy(row->addr, iface->addr, ETH_ADDR_LEN);
+			row->is_active = iface->is_active;
+			row->is_wan = iface->is_wan;
+			row->ip = iface->ip;
+			row->mask = iface->mask;
+			row->speed = iface->speed;
+			cur = cur->next;
+		}
+	}
+	unlock_if_list(rs);
+}
+
+static void export_copy_rtable(router_state* rs, export_snapshot* snap) {
+	export_table* t = &(snap->tables[EXPORT_RTABLE]);
+
+	lock_rtable_rd(rs);
+	if (export_begin(rs, snap, EXPORT_RTABLE)) {
+		node* cur = rs->rtable;
+		while (cur) {
+			rtable_entry* re = (rtable_entry*)cur->data;
+			export_rtable_row* row = (export_rtable_row*)export_next_row(t);
+			row->ip = re->ip.s_addr;
+			row->gw = re->gw.s_addr;
+			row->mask = re->mask.s_addr;
+			memcpy(row->iface, re->iface, IF_LEN);
+			row->is_static = re->is_static;
+			row->is_active = re->is_active;
+			cur = cur->next;
+		}
+	}
+	unlock_rtable(rs);
+}
+
+static void export_copy_arp(router_state* rs, export_snapshot* snap) {
+	export_table* t = &(snap->tables[EXPORT_ARP]);
+	time_t now;
+
+	time(&now);
+	lock_arp_cache_rd(rs);
+	if (export_begin(rs, snap, EXPORT_ARP)) {
+		node* cur = rs->arp_cache;
+		while (cur) {
+			arp_cache_entry* ae = (arp_cache_entry*)cur->data;
+			export_arp_row* row = (export_arp_row*)export_next_row(t);
+			row->ip = ae->ip.s_addr;
+			memcpy(row->ha, ae->arp_ha, ETH_ADDR_LEN);
+			row->is_static = ae->is_static ? 1 : 0;
+			row->pad = 0;
+			row->ttl = ae->is_static ? -1 : (int32_t)(rs->arp_ttl - difftime(now, ae->TTL));
+			row->hits = ae->hits;
+			cur = cur->next;
+		}
+	}
+	unlock_arp_cache(rs);
+}
+
+static void export_copy_nat(router_state* rs, export_snapshot* snap) {
+	export_table* t = &(snap->tables[EXPORT_NAT]);
+
+	lock_nat_table(rs);
+	if (export_begin(rs, snap, EXPORT_NAT)) {
+		node* cur = rs->nat_table;
+		while (cur) {
+			nat_entry* ne = (nat_entry*)cur->data;
+			export_nat_row* row = (export_nat_row*)export_next_row(t);
+			row->ext_ip = ne->nat_ext.ip.s_addr;
+			row->int_ip = ne->nat_int.ip.s_addr;
+			row->ext_port = ne->nat_ext.port;
+			row->int_port = ne->nat_int.port;
+			row->hits = ne->hits;
+			row->avg_hits_per_second = ne->avg_hits_per_second;
+			row->hw_row = ne->hw_row;
+			row->is_static = ne->is_static;
+			cur = cur->next;
+		}
+	}
+	unlock_nat_table(rs);
+}
+
+static void export_copy_counters(router_state* rs, export_snapshot* snap) {
+	export_table* t = &(snap->tables[EXPORT_COUNTERS]);
+	hw_stats* hs = rs->hw_stats;
+	int i;
+
+	if (!hs) {
+		return;
+	}
+
+	lock_netfpga_stats(rs);
+	if (export_begin(rs, snap, EXPORT_COUNTERS)) {
+		for (i = 0; i < HWSTATS_COUNTERS; ++i) {
+			export_counter_row* row = (export_counter_row*)export_next_row(t);
+			row->total = hs->total[i];
+			row->rate = hs->rate[i];
+		}
+	}
+	unlock_netfpga_stats(rs);
+}
+
+/*
+ * Copies every exported table, only the ones changed after since unless since is 0.
+ * THREAD SAFE, takes each table lock in turn, never two at once.
+ */
+export_snapshot* export_take(router_state* rs, uint64_t since) {
+	export_snapshot* snap = (export_snapshot*)calloc(1, sizeof(export_snapshot));
+	int i;
+
+	assert(snap);
+	snap->since = since;
+	/* read before any copy, whatever changes after is stamped later and comes next time */
+	snap->version = rs->state_version;
+
+	for (i = 0; i < EXPORT_TABLES; ++i) {
+		export_table* t = &(snap->tables[i]);
+		t->row_size = export_row_sizes[i];
+		t->capacity = export_row_hints[i] + 16;
+		t->rows = malloc(t->capacity * t->row_size);
+		assert(t->rows);
+	}
+
+	export_copy_ifaces(rs, snap);
+	export_copy_rtable(rs, snap);
+	export_copy_arp(rs, snap);
+	export_copy_nat(rs, snap);
+	export_copy_counters(rs, snap);
+
+	for (i = 0; i < EXPORT_TABLES; ++i) {
+		if (!(snap->tables[i].flags & EXPORT_UNCHANGED)) {
+			export_row_hints[i] = snap->tables[i].num_rows;
+		}
+	}
+
+	return snap;
+}
+
+void export_free(export_snapshot* snap) {
+	int i;
+	for (i = 0; i < EXPORT_TABLES; ++i) {
+		free(snap->tables[i].rows);
+	}
+	free(snap);
+}
+
+
+/** JSON **/
+
+static void export_printf(out_buf* ob, const char* fmt, ...) __attribute__ ((format (printf, 2, 3)));
+static void export_printf(out_buf* ob, const char* fmt, ...) {
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(ob->data + ob->len, ob->size - ob->len, fmt, args);
+	va_end(args);
+
+	if (len >= (int)(ob->size - ob->len)) {
+		/* did not fit, grow and format again */
+		while (ob->size - ob->len <= (unsigned int)len) {
+			ob->size *= 2;
+		}
+		ob->data = (char*)realloc(ob->data, ob->size);
+		assert(ob->data);
+
+		va_start(args, fmt);
+		len = vsnprintf(ob->data + ob->len, ob->size - ob->len, fmt, args);
+		va_end(args);
+	}
+	ob->len += len;
+}
+
+/* names come from the config, keep anything odd in them from breaking the document */
+static void export_json_string(out_buf* ob, const char* str, unsigned int max_len) {
+	unsigned int i;
+
+	out_buf_append(ob, "\"", 1);
+	for (i = 0; (i < max_len) && str[i]; ++i) {
+		unsigned char c = str[i];
+		if ((c == '"') || (c == '\\')) {
+			export_printf(ob, "\\%c", c);
+		} else if (c < 0x20) {
+			export_printf(ob, "\\u%04x", c);
+		} else {
+			out_buf_append(ob, (char*)&c, 1);
+		}
+	}
+	out_buf_append(ob, "\"", 1);
+}
+
+static void export_json_ip(out_buf* ob, uint32_t ip) {
+	char str[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &ip, str, INET_ADDRSTRLEN);
+	export_printf(ob, "\"%s\"", str);
+}
+
+static void export_json_mac(out_buf* ob, const uint8_t* mac) {
+	export_printf(ob, "\"%02X:%02X:%02X:%02X:%02X:%02X\"", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static void export_json_row(out_buf* ob, int table, const void* r, unsigned int index) {
+	switch (table) {
+		case EXPORT_IFACES: {
+			const export_iface_row* row = (const export_iface_row*)r;
+			out_buf_append(ob, "{\"name\":", 8);
+			export_json_string(ob, row->name, IF_LEN);
+			out_buf_append(ob, ",\"mac\":", 7);
+			export_json_mac(ob, row->addr);
+			out_buf_append(ob, ",\"ip\":", 6);
+			export_json_ip(ob, row->ip);
+			out_buf_append(ob, ",\"mask\":", 8);
+			export_json_ip(ob, row->mask);
+			export_printf(ob, ",\"speed\":%u,\"active\":%s,\"wan\":%s}", row->speed,
+				row->is_active ? "true" : "false", row->is_wan ? "true" : "false");
+			break;
+		}
+		case EXPORT_RTABLE: {
+			const export_rtable_row* row = (const export_rtable_row*)r;
+			out_buf_append(ob, "{\"dest\":", 8);
+			export_json_ip(ob, row->ip);
+			out_buf_append(ob, ",\"gw\":", 6);
+			export_json_ip(ob, row->gw);
+			out_buf_append(ob, ",\"mask\":", 8);
+			export_json_ip(ob, row->mask);
+			out_buf_append(ob, ",\"iface\":", 9);
+			export_json_string(ob, row->iface, IF_LEN);
+			export_printf(ob, ",\"static\":%s,\"active\":%s}",
+				row->is_static ? "true" : "false", row->is_active ? "true" : "false");
+			break;
+		}
+		case EXPORT_ARP: {
+			const export_arp_row* row = (const export_arp_row*)r;
+			out_buf_append(ob, "{\"ip\":", 6);
+			export_json_ip(ob, row->ip);
+			out_buf_append(ob, ",\"mac\":", 7);
+			export_json_mac(ob, row->ha);
+			export_printf(ob, ",\"static\":%s,\"ttl\":%i,\"hits\":%u}",
+				row->is_static ? "true" : "false", row->ttl, row->hits);
+			break;
+		}
+		case EXPORT_NAT: {
+			const export_nat_row* row = (const export_nat_row*)r;
+			out_buf_append(ob, "{\"ext_ip\":", 10);
+			export_json_ip(ob, row->ext_ip);
+			export_printf(ob, ",\"ext_port\":%u,\"int_ip\":", ntohs(row->ext_port));
+			export_json_ip(ob, row->int_ip);
+			export_printf(ob, ",\"int_port\":%u,\"hits\":%u,\"hits_per_second\":%.2f,\"hw_row\":%i,\"static\":%s}",
+				ntohs(row->int_port), row->hits, row->avg_hits_per_second,
+				(row->hw_row == 0xFF) ? -1 : row->hw_row, row->is_static ? "true" : "false");
+			break;
+		}
+		case EXPORT_COUNTERS: {
+			const export_counter_row* row = (const export_counter_row*)r;
+			char name[32];
+			hwstats_counter_name(index, name, sizeof(name));
+			export_printf(ob, "{\"name\":\"%s\",\"total\":%llu,\"rate\":%.2f}", name,
+				(unsigned long long)row->total, row->rate);
+			break;
+		}
+	}
+}
+
+void export_json(export_snapshot* snap, out_buf* ob) {
+	int i;
+	unsigned int j;
+
+	export_printf(ob, "{\"version\":%llu,\"since\":%llu", (unsigned long long)snap->version,
+		(unsigned long long)snap->since);
+	for (i = 0; i < EXPORT_TABLES; ++i) {
+		export_table* t = &(snap->tables[i]);
+		export_printf(ob, ",\"%s\":{\"changed\":%llu", export_table_names[i], (unsigned long long)t->changed);
+		if (t->flags & EXPORT_UNCHANGED) {
+			out_buf_append(ob, ",\"unchanged\":true}", 18);
+			continue;
+		}
+		out_buf_append(ob, ",\"rows\":[", 9);
+		for (j = 0; j < t->num_rows; ++j) {
+			if (j > 0) {
+				out_buf_append(ob, ",", 1);
+			}
+			export_json_row(ob, i, ((uint8_t*)t->rows) + (j * t->row_size), j);
+		}
+		out_buf_append(ob, "]}", 2);
+	}
+	out_buf_append(ob, "}", 1);
+}
+
+
+/** BINARY **/
+
+static void export_put32(out_buf* ob, uint32_t v) {
+	out_buf_append(ob, (char*)&v, sizeof(v));
+}
+
+static void export_put64(out_buf* ob, uint64_t v) {
+	out_buf_append(ob, (char*)&v, sizeof(v));
+}
+
+void export_binary(export_snapshot* snap, out_buf* ob) {
+	int i;
+
+	out_buf_append(ob, EXPORT_MAGIC, 4);
+	export_put32(ob, EXPORT_FORMAT);
+	export_put64(ob, snap->version);
+	export_put64(ob, snap->since);
+	export_put32(ob, EXPORT_TABLES);
+	for (i = 0; i < EXPORT_TABLES; ++i) {
+		export_table* t = &(snap->tables[i]);
+		unsigned int rows = (t->flags & EXPORT_UNCHANGED) ? 0 : t->num_rows;
+		export_put32(ob, i);
+		export_put32(ob, t->flags);
+		export_put64(ob, t->changed);
+		export_put32(ob, t->row_size);
+		export_put32(ob, rows);
+		out_buf_append(ob, (char*)t->rows, rows * t->row_size);
+	}
+}
+
+
+/** CLI **/
+
+void cli_show_state(router_state* rs, cli_request* req) {
+	unsigned long long since = 0;
+	out_buf ob;
+
+	if (sscanf(req->command, "show state since %llu", &since) != 1) {
+		since = 0;
+	}
+
+	export_snapshot* snap = export_take(rs, since);
+	out_buf_init(&ob, 4096);
+	export_json(snap, &ob);
+	out_buf_append(&ob, "\n", 1);
+	export_free(snap);
+
+	send_to_socket(req->sockfd, ob.data, ob.len);
+	out_buf_free(&ob);
+}
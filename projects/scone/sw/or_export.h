@@ -0,0 +1,15 @@
+#ifndef OR_EXPORT_H_
+#define OR_EXPORT_H_
+
+#include "or_data_types.h"
+
+void export_stamp(router_state* rs, int table);
+
+export_snapshot* export_take(router_state* rs, uint64_t since);
+void export_free(export_snapshot* snap);
+void export_json(export_snapshot* snap, out_buf* ob);
+void export_binary(export_snapshot* snap, out_buf* ob);
+
+void cli_show_state(router_state* rs, cli_request* req);
+
+#endif /*OR_EXPORT_H_*/
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "or_hw_table.h"
+#include "or_utils.h"
+
+static const uint32_t hw_table_zero_row[HW_TABLE_MAX_WIDTH];
+
+static inline uint32_t* shadow_row(hw_table* t, int row) {
+	return t->shadow + (row * t->width);
+}
+
+static inline int row_equals(const uint32_t* a, const uint32_t* b, int width) {
+	return memcmp(a, b, width * sizeof(uint32_t)) == 0;
+}
+
+hw_table* hw_table_create(const char* name, int depth, int width, hw_table_row_writer write_row) {
+	assert(width > 0 && width <= HW_TABLE_MAX_WIDTH);
+	assert(write_row);
+
+	hw_table* t = (hw_table*)calloc(1, sizeof(hw_table));
+	assert(t);
+	strncpy(t->name, name, HW_TABLE_NAME_LEN - 1);
+	t->depth = depth;
+	t->width = width;
+	t->shadow = (uint32_t*)calloc(depth * width, sizeof(uint32_t));
+	assert(t->shadow);
+	t->write_row = write_row;
+
+	return t;
+}
+
+void hw_table_destroy(hw_table* t) {
+	if (!t) {
+		return;
+	}
+	free(t->shadow);
+	free(t);
+}
+
+/*
+ * Forget what the hardware holds, the next sync rewrites every row.
+ * Call after anything that resets the tables behind our back.
+ */
+void hw_table_invalidate(hw_table* t) {
+	t->shadow_valid = 0;
+}
+
+/*
+ * Brings the hardware table in line with rows, num_rows entries of width words each,
+ * writing only the rows whose contents differ from the shadow.
+ *
+ * If ranks is NULL row order does not matter (exact match tables like the arp cache)
+ * and an entry stays in whatever row already holds it. Otherwise ranks must be
+ * non-increasing, e.g. prefix length for the rtable which the hardware searches top
+ * down. Entries of one rank then occupy a contiguous block of rows and only the rows
+ * at the edges of a block that moved get rewritten.
+ *
+ * If placement is not NULL it receives the row each entry was put in.
+ * NOT THREAD SAFE: hold the lock of the software table being synced.
+ * Returns: the number of rows written
+ */
+int hw_table_sync(router_state* rs, hw_table* t, const uint32_t* rows, const int* ranks, int num_rows, int* placement) {
+	int i, j, r, pass;
+	int width = t->width;
+
+	if (num_rows > t->depth) {
+		num_rows = t->depth;
+	}
+
+	/* owner[row] is the entry going into that row, where[entry] is the inverse */
+	int* owner = (int*)malloc(t->depth * sizeof(int));
+	int* where = (int*)malloc((num_rows + 1) * sizeof(int));
+	for (r = 0; r < t->depth; ++r) {
+		owner[r] = -1;
+	}
+	for (i = 0; i < num_rows; ++i) {
+		where[i] = -1;
+	}
+
+	i = 0;
+	while (i < num_rows) {
+		/* entries [first, last) may be placed in rows [row_first, row_last) */
+		int first = i;
+		int last = num_rows;
+		int row_first = 0;
+		int row_last = t->depth;
+		if (ranks) {
+			last = first + 1;
+			while ((last < num_rows) && (ranks[last] == ranks[first])) {
+				++last;
+			}
+			row_first = first;
+			row_last = last;
+		}
+
+		/* keep rows that already hold one of the entries */
+		if (t->shadow_valid) {
+			for (r = row_first; r < row_last; ++r) {
+				for (j = first; j < last; ++j) {
+					if ((where[j] == -1) && row_equals(shadow_row(t, r), rows + (j * width), width)) {
+						owner[r] = j;
+						where[j] = r;
+						break;
+					}
+				}
+			}
+		}
+
+		/* place the rest, first into rows holding stale entries as they need a write anyway */
+		j = first;
+		for (pass = 0; pass < 2; ++pass) {
+			for (r = row_first; (r < row_last) && (j < last); ++r) {
+				if (owner[r] != -1) {
+					continue;
+				}
+				if ((pass == 0) && t->shadow_valid && row_equals(shadow_row(t, r), hw_table_zero_row, width)) {
+					continue;
+				}
+				while ((j < last) && (where[j] != -1)) {
+					++j;
+				}
+				if (j < last) {
+					owner[r] = j;
+					where[j] = r;
+				}
+			}
+		}
+
+		i = last;
+	}
+
+	/* the rows to write and the rows they fill in for */
+	int* dirty = (int*)malloc(t->depth * sizeof(int));
+	int* from = (int*)malloc(t->depth * sizeof(int));
+	int* waits = (int*)malloc(t->depth * sizeof(int));
+	for (r = 0; r < t->depth; ++r) {
+		const uint32_t* want = (owner[r] == -1) ? hw_table_zero_row : rows + (owner[r] * width);
+		dirty[r] = !t->shadow_valid || !row_equals(shadow_row(t, r), want, width);
+		from[r] = -1;
+		waits[r] = 0;
+	}
+
+	/*
+	 * An entry that moves must reach its new row before the row it leaves is
+	 * overwritten, or lookups miss it in between. When a block shifts down that means
+	 * bottom up, when it shifts up top down, so follow the moves rather than a fixed
+	 * direction. Entries only move between rows when ranked.
+	 */
+	if (ranks && t->shadow_valid) {
+		for (r = 0; r < t->depth; ++r) {
+			if (!dirty[r] || (owner[r] == -1)) {
+				continue;
+			}
+			for (j = 0; j < t->depth; ++j) {
+				if ((j != r) && dirty[j] && !waits[j] && row_equals(shadow_row(t, j), rows + (owner[r] * width), width)) {
+					from[r] = j;
+					waits[j] = 1;
+					break;
+				}
+			}
+		}
+	}
+
+	/* each row waits for at most one other, so the writes form chains started by the rows waiting for none */
+	int written = 0;
+	for (pass = 0; pass < 2; ++pass) {
+		for (i = 0; i < t->depth; ++i) {
+			/* rows still waiting after the first pass are in cycles, which sorted ranks never make */
+			if (!dirty[i] || ((pass == 0) && waits[i])) {
+				continue;
+			}
+			for (r = i; (r != -1) && dirty[r]; r = from[r]) {
+				const uint32_t* want = (owner[r] == -1) ? hw_table_zero_row : rows + (owner[r] * width);
+				t->write_row(rs, r, want);
+				memcpy(shadow_row(t, r), want, width * sizeof(uint32_t));
+				dirty[r] = 0;
+				++written;
+			}
+		}
+	}
+	t->shadow_valid = 1;
+
+	++t->syncs;
+	t->rows_written += written;
+	t->regs_written += written * (width + 1);
+	t->regs_saved += (t->depth - written) * (width + 1);
+
+	if (placement) {
+		memcpy(placement, where, num_rows * sizeof(int));
+	}
+
+	free(owner);
+	free(where);
+	free(dirty);
+	free(from);
+	free(waits);
+
+	return written;
+}
+
+/*
+ * Zeroes a single row in hardware and in the shadow.
+ * NOT THREAD SAFE: hold the lock of the software table
+ */
+void hw_table_clear_row(router_state* rs, hw_table* t, int row) {
+	assert(row >= 0 && row < t->depth);
+
+	t->write_row(rs, row, hw_table_zero_row);
+	memcpy(shadow_row(t, row), hw_table_zero_row, t->width * sizeof(uint32_t));
+	++t->rows_written;
+	t->regs_written += t->width + 1;
+}
+
+void sprint_hw_table_stats(hw_table* t, char** buf, unsigned int* len) {
+	*buf = (char*)calloc(256, sizeof(char));
+	*len = snprintf(*buf, 256, "%-8s %-6i %-10llu %-14llu %-14llu %llu\n",
+		t->name, t->depth,
+		(unsigned long long)t->syncs,
+		(unsigned long long)t->rows_written,
+		(unsigned long long)t->regs_written,
+		(unsigned long long)t->regs_saved);
+}
+
+void cli_show_hw_sync(router_state* rs, cli_request* req) {
+	char* info;
+	unsigned int len;
+	hw_table* tables[3];
+	int i;
+
+	tables[0] = rs->rtable_hw;
+	tables[1] = rs->arp_cache_hw;
+	tables[2] = rs->nat_table_hw;
+
+	info = "Table    Rows   Syncs      Rows Written   Regs Written   Regs Saved\n";
+	send_to_socket(req->sockfd, info, strlen(info));
+
+	for (i = 0; i < 3; ++i) {
+		if (tables[i]) {
+			sprint_hw_table_stats(tables[i], &info, &len);
+			send_to_socket(req->sockfd, info, len);
+			free(info);
+		}
+	}
+}
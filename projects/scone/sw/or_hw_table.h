@@ -0,0 +1,16 @@
+#ifndef OR_HW_TABLE_H_
+#define OR_HW_TABLE_H_
+
+#include "or_data_types.h"
+
+hw_table* hw_table_create(const char* name, int depth, int width, hw_table_row_writer write_row);
+void hw_table_destroy(hw_table* t);
+void hw_table_invalidate(hw_table* t);
+
+int hw_table_sync(router_state* rs, hw_table* t, const uint32_t* rows, const int* ranks, int num_rows, int* placement);
+void hw_table_clear_row(router_state* rs, hw_table* t, int row);
+
+void sprint_hw_table_stats(hw_table* t, char** buf, unsigned int* len);
+void cli_show_hw_sync(router_state* rs, cli_request* req);
+
+#endif /*OR_HW_TABLE_H_*/
@@ -0,0 +1,304 @@
+/*
+ * Samples the NetFPGA port and output queue counters. Every interval the stats timer
+ * reads all of them in one readRegs batch, extends the 32 bit registers to 64 bit
+ * totals across wraps, updates exponentially weighted rates and keeps the totals in
+ * a ring of recent sweeps. The CLI and the web server print from what was sampled,
+ * nothing reads a register when stats are asked for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "or_hwstats.h"
+#include "or_netfpga.h"
+#include "or_sched.h"
+#include "or_utils.h"
+#include "or_export.h"
+#include "nf2/nf2.h"
+#include "nf2/nf2util.h"
+#include "reg_defines.h"
+
+static char* hwstats_port_names[HWSTATS_PORTS] = { "eth0", "eth1", "eth2", "eth3" };
+
+/* the mac group counters of each port, in the order of the HWSTATS_ port counters */
+static const uint32_t hwstats_port_regs[HWSTATS_PORTS][HWSTATS_PORT_COUNTERS] = {
+	{ MAC_GRP_0_RX_QUEUE_NUM_PKTS_STORED_REG, MAC_GRP_0_TX_QUEUE_NUM_PKTS_SENT_REG,
+	  MAC_GRP_0_RX_QUEUE_NUM_BYTES_PUSHED_REG, MAC_GRP_0_TX_QUEUE_NUM_BYTES_PUSHED_REG,
+	  MAC_GRP_0_RX_QUEUE_NUM_PKTS_DROPPED_FULL_REG, MAC_GRP_0_RX_QUEUE_NUM_PKTS_DROPPED_BAD_REG },
+	{ MAC_GRP_1_RX_QUEUE_NUM_PKTS_STORED_REG, MAC_GRP_1_TX_QUEUE_NUM_PKTS_SENT_REG,
+	  MAC_GRP_1_RX_QUEUE_NUM_BYTES_PUSHED_REG, MAC_GRP_1_TX_QUEUE_NUM_BYTES_PUSHED_REG,
+	  MAC_GRP_1_RX_QUEUE_NUM_PKTS_DROPPED_FULL_REG, MAC_GRP_1_RX_QUEUE_NUM_PKTS_DROPPED_BAD_REG },
+	{ MAC_GRP_2_RX_QUEUE_NUM_PKTS_STORED_REG, MAC_GRP_2_TX_QUEUE_NUM_PKTS_SENT_REG,
+	  MAC_GRP_2_RX_QUEUE_NUM_BYTES_PUSHED_REG, MAC_GRP_2_TX_QUEUE_NUM_BYTES_PUSHED_REG,
+	  MAC_GRP_2_RX_QUEUE_NUM_PKTS_DROPPED_FULL_REG, MAC_GRP_2_RX_QUEUE_NUM_PKTS_DROPPED_BAD_REG },
+	{ MAC_GRP_3_RX_QUEUE_NUM_PKTS_STORED_REG, MAC_GRP_3_TX_QUEUE_NUM_PKTS_SENT_REG,
+	  MAC_GRP_3_RX_QUEUE_NUM_BYTES_PUSHED_REG, MAC_GRP_3_TX_QUEUE_NUM_BYTES_PUSHED_REG,
+	  MAC_GRP_3_RX_QUEUE_NUM_PKTS_DROPPED_FULL_REG, MAC_GRP_3_RX_QUEUE_NUM_PKTS_DROPPED_BAD_REG }
+};
+
+static const uint32_t hwstats_oq_regs[HWSTATS_QUEUES] = {
+	OQ_QUEUE_0_NUM_PKTS_DROPPED_REG, OQ_QUEUE_1_NUM_PKTS_DROPPED_REG,
+	OQ_QUEUE_2_NUM_PKTS_DROPPED_REG, OQ_QUEUE_3_NUM_PKTS_DROPPED_REG,
+	OQ_QUEUE_4_NUM_PKTS_DROPPED_REG, OQ_QUEUE_5_NUM_PKTS_DROPPED_REG,
+	OQ_QUEUE_6_NUM_PKTS_DROPPED_REG, OQ_QUEUE_7_NUM_PKTS_DROPPED_REG
+};
+
+hw_stats* hwstats_create(void) {
+	hw_stats* hs = (hw_stats*)calloc(1, sizeof(hw_stats));
+	assert(hs);
+	int i, j;
+
+	for (i = 0; i < HWSTATS_PORTS; ++i) {
+		for (j = 0; j < HWSTATS_PORT_COUNTERS; ++j) {
+			hs->reg[HWSTATS_PORT(i, j)] = hwstats_port_regs[i][j];
+		}
+	}
+	for (i = 0; i < HWSTATS_QUEUES; ++i) {
+		hs->reg[HWSTATS_OQ_DROPPED(i)] = hwstats_oq_regs[i];
+	}
+	hs->interval_ms = HWSTATS_DEFAULT_INTERVAL_MS;
+
+	return hs;
+}
+
+void hwstats_destroy(hw_stats* hs) {
+	free(hs);
+}
+
+/*
+ * Folds one sweep of raw register values into the totals and rates. A counter that
+ * went backwards wrapped, which is right as long as no counter wraps twice in an
+ * interval: 2^32 bytes at 1Gb/s take 34 seconds, hence HWSTATS_MAX_INTERVAL_MS.
+ * NOT THREAD SAFE: hold the netfpga stats lock
+ */
+void hwstats_update(hw_stats* hs, const uint32_t* raw, uint64_t now_ns) {
+	int i;
+
+	if (hs->last_ns == 0) {
+		/* the registers count from reset, so does the first total */
+		for (i = 0; i < HWSTATS_COUNTERS; ++i) {
+			hs->total[i] = raw[i];
+		}
+	} else {
+		double dt = (now_ns - hs->last_ns) / 1e9;
+		double alpha = (dt * 1000) / ((dt * 1000) + HWSTATS_EWMA_TAU_MS);
+
+		for (i = 0; i < HWSTATS_COUNTERS; ++i) {
+			uint32_t delta = raw[i] - hs->last_raw[i];
+			if (raw[i] < hs->last_raw[i]) {
+				++hs->wraps;
+			}
+			hs->total[i] += delta;
+
+			double rate = (dt > 0) ? (delta / dt) : 0;
+			hs->rate[i] = (hs->sweeps == 1) ? rate : ((alpha * rate) + ((1 - alpha) * hs->rate[i]));
+		}
+	}
+
+	memcpy(hs->last_raw, raw, sizeof(hs->last_raw));
+	hs->last_ns = now_ns;
+
+	hw_sample* sample = &(hs->ring[hs->ring_next]);
+	sample->ns = now_ns;
+	memcpy(sample->total, hs->total, sizeof(sample->total));
+	hs->ring_next = (hs->ring_next + 1) % HWSTATS_RING_LEN;
+	++hs->sweeps;
+}
+
+/*
+ * Stats timer callback. The batch is read before taking the lock so readers never
+ * wait on the hardware.
+ */
+unsigned int hwstats_tick(void* arg) {
+	router_state* rs = (router_state*)arg;
+	hw_stats* hs = rs->hw_stats;
+	struct nf2reg regs[HWSTATS_COUNTERS];
+	uint32_t raw[HWSTATS_COUNTERS];
+	int i;
+
+	for (i = 0; i < HWSTATS_COUNTERS; ++i) {
+		regs[i].reg = hs->reg[i];
+		regs[i].val = 0;
+	}
+
+	uint64_t start = sched_clock_ns();
+	int result = readRegs(&(rs->netfpga), regs, HWSTATS_COUNTERS);
+	uint64_t now = sched_clock_ns();
+
+	for (i = 0; i < HWSTATS_COUNTERS; ++i) {
+		raw[i] = regs[i].val;
+	}
+
+	lock_netfpga_stats(rs);
+	hs->read_ns_total += now - start;
+	if (result != 0) {
+		/* a partial read would look like a wrap, skip the sweep */
+		++hs->read_errors;
+	} else {
+		hwstats_update(hs, raw, now);
+		export_stamp(rs, EXPORT_COUNTERS);
+	}
+	unsigned int interval = hs->interval_ms;
+	unlock_netfpga_stats(rs);
+
+	return interval;
+}
+
+/* NOT THREAD SAFE: hold the netfpga stats lock */
+double hwstats_rate(hw_stats* hs, int port, int counter) {
+	return hs->rate[HWSTATS_PORT(port, counter)];
+}
+
+/* NOT THREAD SAFE: hold the netfpga stats lock */
+uint64_t hwstats_total(hw_stats* hs, int port, int counter) {
+	return hs->total[HWSTATS_PORT(port, counter)];
+}
+
+static char* hwstats_counter_names[HWSTATS_PORT_COUNTERS] = {
+	"rx_pkts", "tx_pkts", "rx_bytes", "tx_bytes", "rx_dropped_full", "rx_dropped_bad"
+};
+
+/* e.g. eth0_rx_pkts, or oq3_dropped for the output queue counters */
+void hwstats_counter_name(int counter, char* buf, unsigned int len) {
+	if (counter < HWSTATS_PORTS * HWSTATS_PORT_COUNTERS) {
+		snprintf(buf, len, "%s_%s", hwstats_port_names[counter / HWSTATS_PORT_COUNTERS],
+			hwstats_counter_names[counter % HWSTATS_PORT_COUNTERS]);
+	} else {
+		snprintf(buf, len, "oq%i_dropped", counter - (HWSTATS_PORTS * HWSTATS_PORT_COUNTERS));
+	}
+}
+
+#define HWSTATS_COL "Port  RX pps      TX pps      RX kB/s     TX kB/s     RX packets     TX packets     RX bytes         TX bytes         Drops\n"
+#define HWSTATS_LINE_LEN 160
+void sprint_hwstats(router_state* rs, char** buf, unsigned int* len) {
+	hw_stats* hs = rs->hw_stats;
+	unsigned int size = strlen(HWSTATS_COL) + ((HWSTATS_PORTS + 6) * HWSTATS_LINE_LEN);
+	char* buffer = (char*)calloc(size, sizeof(char));
+	unsigned int total_len = 0;
+	int i;
+
+	lock_netfpga_stats(rs);
+	total_len += snprintf(buffer + total_len, size - total_len, "%s", HWSTATS_COL);
+	for (i = 0; i < HWSTATS_PORTS; ++i) {
+		total_len += snprintf(buffer + total_len, size - total_len,
+			"%-5s %-11.1f %-11.1f %-11.2f %-11.2f %-14llu %-14llu %-16llu %-16llu %llu\n",
+			hwstats_port_names[i],
+			hwstats_rate(hs, i, HWSTATS_RX_PKTS), hwstats_rate(hs, i, HWSTATS_TX_PKTS),
+			hwstats_rate(hs, i, HWSTATS_RX_BYTES) / 1000, hwstats_rate(hs, i, HWSTATS_TX_BYTES) / 1000,
+			(unsigned long long)hwstats_total(hs, i, HWSTATS_RX_PKTS), (unsigned long long)hwstats_total(hs, i, HWSTATS_TX_PKTS),
+			(unsigned long long)hwstats_total(hs, i, HWSTATS_RX_BYTES), (unsigned long long)hwstats_total(hs, i, HWSTATS_TX_BYTES),
+			(unsigned long long)(hwstats_total(hs, i, HWSTATS_RX_DROPPED_FULL) + hwstats_total(hs, i, HWSTATS_RX_DROPPED_BAD)));
+	}
+
+	total_len += snprintf(buffer + total_len, size - total_len, "\nOQ drops:");
+	for (i = 0; i < HWSTATS_QUEUES; ++i) {
+		total_len += snprintf(buffer + total_len, size - total_len, " Q%i %llu", i,
+			(unsigned long long)hs->total[HWSTATS_OQ_DROPPED(i)]);
+	}
+
+	total_len += snprintf(buffer + total_len, size - total_len,
+		"\nInterval: %u ms\tSweeps: %llu\tWraps: %llu\tRead errors: %llu\tRead avg: %.1f us for %i registers\n",
+		hs->interval_ms, (unsigned long long)hs->sweeps, (unsigned long long)hs->wraps,
+		(unsigned long long)hs->read_errors,
+		hs->sweeps ? (hs->read_ns_total / 1e3) / hs->sweeps : 0.0, HWSTATS_COUNTERS);
+	unlock_netfpga_stats(rs);
+
+	*buf = buffer;
+	*len = total_len;
+}
+
+/*
+ * The packet and byte rate of every port between consecutive sweeps in the ring,
+ * newest first, at most max_samples of them, 0 for all.
+ */
+#define HWSTATS_HISTORY_COL "Age ms     eth0 pps   eth0 kB/s  eth1 pps   eth1 kB/s  eth2 pps   eth2 kB/s  eth3 pps   eth3 kB/s\n"
+void sprint_hwstats_history(router_state* rs, char** buf, unsigned int* len, unsigned int max_samples) {
+	hw_stats* hs = rs->hw_stats;
+
+	lock_netfpga_stats(rs);
+	unsigned int available = (hs->sweeps < HWSTATS_RING_LEN) ? hs->sweeps : HWSTATS_RING_LEN;
+	unsigned int rows = (available > 0) ? available - 1 : 0;
+	if ((max_samples != 0) && (max_samples < rows)) {
+		rows = max_samples;
+	}
+
+	unsigned int size = strlen(HWSTATS_HISTORY_COL) + ((rows + 1) * HWSTATS_LINE_LEN);
+	char* buffer = (char*)calloc(size, sizeof(char));
+	unsigned int total_len = 0;
+	unsigned int r;
+	int i;
+
+	total_len += snprintf(buffer + total_len, size - total_len, "%s", HWSTATS_HISTORY_COL);
+	for (r = 0; r < rows; ++r) {
+		hw_sample* cur = &(hs->ring[(hs->ring_next + HWSTATS_RING_LEN - 1 - r) % HWSTATS_RING_LEN]);
+		hw_sample* prev = &(hs->ring[(hs->ring_next + HWSTATS_RING_LEN - 2 - r) % HWSTATS_RING_LEN]);
+		double dt = (cur->ns - prev->ns) / 1e9;
+
+		total_len += snprintf(buffer + total_len, size - total_len, "%-10llu",
+			(unsigned long long)((hs->last_ns - cur->ns) / 1000000));
+		for (i = 0; i < HWSTATS_PORTS; ++i) {
+			uint64_t pkts = (cur->total[HWSTATS_PORT(i, HWSTATS_RX_PKTS)] - prev->total[HWSTATS_PORT(i, HWSTATS_RX_PKTS)]) +
+				(cur->total[HWSTATS_PORT(i, HWSTATS_TX_PKTS)] - prev->total[HWSTATS_PORT(i, HWSTATS_TX_PKTS)]);
+			uint64_t bytes = (cur->total[HWSTATS_PORT(i, HWSTATS_RX_BYTES)] - prev->total[HWSTATS_PORT(i, HWSTATS_RX_BYTES)]) +
+				(cur->total[HWSTATS_PORT(i, HWSTATS_TX_BYTES)] - prev->total[HWSTATS_PORT(i, HWSTATS_TX_BYTES)]);
+			total_len += snprintf(buffer + total_len, size - total_len, " %-10.1f %-10.2f",
+				(dt > 0) ? pkts / dt : 0.0, (dt > 0) ? (bytes / dt) / 1000 : 0.0);
+		}
+		total_len += snprintf(buffer + total_len, size - total_len, "\n");
+	}
+	unlock_netfpga_stats(rs);
+
+	*buf = buffer;
+	*len = total_len;
+}
+
+void cli_show_hw_stats(router_state* rs, cli_request* req) {
+	char* info;
+	unsigned int len;
+
+	sprint_hwstats(rs, &info, &len);
+	send_to_socket(req->sockfd, info, len);
+	free(info);
+}
+
+void cli_show_hw_stats_history(router_state* rs, cli_request* req) {
+	char* info;
+	unsigned int len;
+	unsigned int max_samples;
+
+	if (strstr(req->command, "all")) {
+		max_samples = 0;
+	} else if (sscanf(req->command, "show hw stats history %u", &max_samples) != 1) {
+		max_samples = 20;
+	}
+
+	sprint_hwstats_history(rs, &info, &len, max_samples);
+	send_to_socket(req->sockfd, info, len);
+	free(info);
+}
+
+void cli_set_hw_stats_interval(router_state* rs, cli_request* req) {
+	char* msg;
+	unsigned int interval;
+
+	if ((sscanf(req->command, "set hw stats interval %u", &interval) != 1) ||
+		(interval < HWSTATS_MIN_INTERVAL_MS) || (interval > HWSTATS_MAX_INTERVAL_MS)) {
+		msg = "usage: set hw stats interval <ms>, 10 to 30000\n";
+		send_to_socket(req->sockfd, msg, strlen(msg));
+		return;
+	}
+
+	lock_netfpga_stats(rs);
+	rs->hw_stats->interval_ms = interval;
+	unlock_netfpga_stats(rs);
+
+	/* the next sweep comes on the new interval, not after the old one runs out */
+	if (rs->stats_timer) {
+		sched_add(rs->stats_timer, interval);
+	}
+
+	msg = "Hw stats interval set\n";
+	send_to_socket(req->sockfd, msg, strlen(msg));
+}
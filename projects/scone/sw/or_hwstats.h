@@ -0,0 +1,21 @@
+#ifndef OR_HWSTATS_H_
+#define OR_HWSTATS_H_
+
+#include "or_data_types.h"
+
+hw_stats* hwstats_create(void);
+void hwstats_destroy(hw_stats* hs);
+void hwstats_update(hw_stats* hs, const uint32_t* raw, uint64_t now_ns);
+unsigned int hwstats_tick(void* arg);
+
+double hwstats_rate(hw_stats* hs, int port, int counter);
+uint64_t hwstats_total(hw_stats* hs, int port, int counter);
+void hwstats_counter_name(int counter, char* buf, unsigned int len);
+
+void sprint_hwstats(router_state* rs, char** buf, unsigned int* len);
+void sprint_hwstats_history(router_state* rs, char** buf, unsigned int* len, unsigned int max_samples);
+void cli_show_hw_stats(router_state* rs, cli_request* req);
+void cli_show_hw_stats_history(router_state* rs, cli_request* req);
+void cli_set_hw_stats_interval(router_state* rs, cli_request* req);
+
+#endif /*OR_HWSTATS_H_*/
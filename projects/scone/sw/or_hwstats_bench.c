@@ -0,0 +1,132 @@
+/*
+ * Feeds the hw counter sampler synthetic sweeps, the raw 32 bit register values of
+ * counters running at a known rate, and checks what it makes of them: the 64 bit
+ * totals must match the true counts through every wrap, the rates must settle on the
+ * true rate, and after a step in the rate the estimate must cover about 63% of the
+ * step one time constant later. Also reports what a sweep costs to fold in.
+ *
+ * usage: hwstats-bench [sweeps] [interval_ms]
+ */
+
+#include "or_hwstats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+/* true rate per second of each counter, bytes at up to line rate so they wrap */
+void set_rates(double* rate, double scale) {
+	int i, j;
+	for (i = 0; i < HWSTATS_PORTS; ++i) {
+		for (j = 0; j < HWSTATS_PORT_COUNTERS; ++j) {
+			double pps = 81274 * (i + 1) * scale;	/* minimum sized frames, a quarter to all of a gigabit */
+			switch (j) {
+				case HWSTATS_RX_BYTES:
+				case HWSTATS_TX_BYTES:
+					rate[HWSTATS_PORT(i, j)] = pps * 1538;
+					break;
+				case HWSTATS_RX_DROPPED_FULL:
+				case HWSTATS_RX_DROPPED_BAD:
+					rate[HWSTATS_PORT(i, j)] = pps / 1000;
+					break;
+				default:
+					rate[HWSTATS_PORT(i, j)] = pps;
+					break;
+			}
+		}
+	}
+	for (i = 0; i < HWSTATS_QUEUES; ++i) {
+		rate[HWSTATS_OQ_DROPPED(i)] = 10 * scale;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int sweeps = (argc > 1) ? atoi(argv[1]) : 100000;
+	unsigned int interval_ms = (argc > 2) ? atoi(argv[2]) : HWSTATS_DEFAULT_INTERVAL_MS;
+	hw_stats* hs = hwstats_create();
+	double rate[HWSTATS_COUNTERS];
+	double count[HWSTATS_COUNTERS];		/* keeps the fractions the slow counters advance by */
+	uint64_t truth[HWSTATS_COUNTERS];
+	uint32_t raw[HWSTATS_COUNTERS];
+	uint64_t t = 1000000000ULL;
+	unsigned int i, s;
+	int mismatches = 0;
+	double update_ns = 0;
+
+	/* registers start somewhere near the top so the first wraps come early */
+	for (i = 0; i < HWSTATS_COUNTERS; ++i) {
+		count[i] = 0xFFFFF000ULL - (i * 4096);
+		truth[i] = count[i];
+	}
+	set_rates(rate, 1.0);
+
+	for (s = 0; s < sweeps; ++s) {
+		double dt = interval_ms / 1e3;
+		if (s > 0) {
+			for (i = 0; i < HWSTATS_COUNTERS; ++i) {
+				count[i] += rate[i] * dt;
+				truth[i] = (uint64_t)count[i];
+			}
+			t += interval_ms * 1000000ULL;
+		}
+		for (i = 0; i < HWSTATS_COUNTERS; ++i) {
+			raw[i] = (uint32_t)truth[i];
+		}
+
+		double start = now_ns();
+		hwstats_update(hs, raw, t);
+		update_ns += now_ns() - start;
+
+		for (i = 0; i < HWSTATS_COUNTERS; ++i) {
+			if (hs->total[i] != truth[i]) {
+				++mismatches;
+			}
+		}
+	}
+
+	double worst = 0;
+	for (i = 0; i < HWSTATS_COUNTERS; ++i) {
+		double err = (hs->rate[i] - rate[i]) / rate[i];
+		if (err < 0) {
+			err = -err;
+		}
+		if (err > worst) {
+			worst = err;
+		}
+	}
+
+	printf("%u sweeps of %i counters every %ums, %.1f hours of counting\n", sweeps, HWSTATS_COUNTERS, interval_ms,
+		(sweeps * (double)interval_ms) / 3.6e6);
+	printf("wraps %llu, total mismatches %i, worst rate error %.4f%%, %.1f ns per sweep\n",
+		(unsigned long long)hs->wraps, mismatches, worst * 100, update_ns / sweeps);
+
+	/* halve every rate and watch eth0 rx packets follow */
+	double before = hs->rate[HWSTATS_PORT(0, HWSTATS_RX_PKTS)];
+	set_rates(rate, 0.5);
+	double after = rate[HWSTATS_PORT(0, HWSTATS_RX_PKTS)];
+	unsigned int steps = HWSTATS_EWMA_TAU_MS / interval_ms;
+	for (s = 0; s < steps; ++s) {
+		for (i = 0; i < HWSTATS_COUNTERS; ++i) {
+			count[i] += rate[i] * (interval_ms / 1e3);
+			truth[i] = (uint64_t)count[i];
+			raw[i] = (uint32_t)truth[i];
+		}
+		t += interval_ms * 1000000ULL;
+		hwstats_update(hs, raw, t);
+	}
+	double covered = (before - hs->rate[HWSTATS_PORT(0, HWSTATS_RX_PKTS)]) / (before - after);
+	printf("step to half rate: %.1f%% of the step covered after %ums\n", covered * 100, steps * interval_ms);
+
+	int ok = (mismatches == 0) && (hs->wraps > 0) && (worst < 0.01) && (covered > 0.55) && (covered < 0.72);
+	printf("%s\n", ok ? "ok" : "MISMATCH");
+
+	hwstats_destroy(hs);
+	return ok ? 0 : 1;
+}
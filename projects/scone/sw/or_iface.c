@@ -20,6 +20,7 @@
 #include "or_pwospf.h"
 #include "reg_defines.h"
 #include "or_netfpga.h"
+#include "or_export.h"
 
 int iface_match_ip(router_state* rs, uint32_t ip) {
 
@@ -73,6 +74,7 @@ int iface_update(router_state* rs, char* interface, struct in_addr* ip, struct i
 
 	iface->ip = ip->s_addr;
 	iface->mask = mask->s_addr;
+	export_stamp(rs, EXPORT_IFACES);
 	return 1;
 }
 
@@ -272,6 +274,7 @@ int iface_up(router_state* rs, char* interface) {
 		}
 
 		iface->is_active = 1;
+		export_stamp(rs, EXPORT_IFACES);
 
 		/* activate any static routes pertaining to this interface */
 		activate_routes(rs, interface);
@@ -347,6 +350,7 @@ int iface_down(router_state* rs, char* interface) {
 
 
 		iface->is_active = 0;
+		export_stamp(rs, EXPORT_IFACES);
 
 		/* deactivate and or delete routes pertaining to this interface */
 		deactivate_routes(rs, interface);
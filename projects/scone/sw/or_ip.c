@@ -17,6 +17,7 @@
 #include "or_rtable.h"
 #include "or_output.h"
 #include "or_utils.h"
+#include "or_pktbuf.h"
 #include "or_rtable.h"
 #include "or_ip.h"
 #include "or_pwospf.h"
@@ -34,10 +35,10 @@ void process_ip_packet(struct sr_instance* sr, const uint8_t * packet, unsigned
 		return;
 	}
 
+	/* no rtable lock, get_next_hop reads the published rtable snapshot */
 	lock_arp_cache_rd(rs);
 	lock_arp_queue_wr(rs);
 	lock_if_list_rd(rs);
-	lock_rtable_rd(rs);
 
 	/* check for incoming wan interface */
 	iface_entry* iface = get_iface(rs, interface);
@@ -60,7 +61,10 @@ void process_ip_packet(struct sr_instance* sr, const uint8_t * packet, unsigned
 				process_icmp_packet(sr, packet, len, interface);
 				break;
 			case IP_PROTO_PWOSPF:
+				/* pwospf walks and upgrades the rtable lock itself, so it expects it held for reads */
+				lock_rtable_rd(rs);
 				process_pwospf_packet(sr, packet, len, interface);
+				unlock_rtable(rs);
 				break;
 			case IP_PROTO_UDP:
 				/* We don't accept UDP so ICMP reply port unreachable*/
@@ -78,7 +82,9 @@ void process_ip_packet(struct sr_instance* sr, const uint8_t * packet, unsigned
 		}
 	} else if ((get_ip_hdr(packet, len))->ip_dst.s_addr == htonl(PWOSPF_HELLO_TIP)) {
 		/* if the packet is destined to the PWOSPF address then process it */
+		lock_rtable_rd(rs);
 		process_pwospf_packet(sr, packet, len, interface);
+		unlock_rtable(rs);
 	} else {
 		/* Need to forward this packet to another host */
 		struct in_addr next_hop;
@@ -141,12 +147,11 @@ void process_ip_packet(struct sr_instance* sr, const uint8_t * packet, unsigned
 					/* update the eth header */
 					populate_eth_hdr(eth, NULL, sr_if->addr, ETH_TYPE_IP);
 
-					/* duplicate this packet here because the memory will be freed
-				 	 * by send_ip, and our copy of the packet is only on loan
-				 	 */
-
-				 	uint8_t* packet_copy = (uint8_t*)malloc(len);
-				 	memcpy(packet_copy, packet, len);
+					/* our copy of the packet is only on loan and send_ip releases what
+					 * it is given, so take a reference (or a pooled copy if it was not
+					 * received into a packet buffer)
+					 */
+					uint8_t* packet_copy = pktbuf_hold(packet, len);
 
 					/* forward packet out the next hop interface */
 					send_ip(sr, packet_copy, len, &(next_hop), next_hop_iface);
@@ -155,7 +160,6 @@ void process_ip_packet(struct sr_instance* sr, const uint8_t * packet, unsigned
 		} /* end of if(get_next_hop) */
 	}
 
-	unlock_rtable(rs);
 	unlock_if_list(rs);
 	unlock_arp_queue(rs);
 	unlock_arp_cache(rs);
@@ -264,7 +268,6 @@ uint32_t send_ip_packet(struct sr_instance *sr, uint8_t proto, uint32_t src, uin
 	lock_arp_cache_rd(rs);
 	lock_arp_queue_wr(rs);
 	lock_if_list_rd(rs);
-	lock_rtable_rd(rs);
 
 
 	eth_hdr* new_eth = (eth_hdr *)new_packet;
@@ -294,7 +297,6 @@ uint32_t send_ip_packet(struct sr_instance *sr, uint8_t proto, uint32_t src, uin
 	/* ship the packet */
 	int ret = send_ip(sr, new_packet, new_packet_len, &(next_hop), iface_struct->name);
 
-	unlock_rtable(rs);
 	unlock_if_list(rs);
 	unlock_arp_queue(rs);
 	unlock_arp_cache(rs);
@@ -0,0 +1,238 @@
+/*
+ * Measures what logging costs the I/O threads. Each row has a number of threads
+ * log packets at a fixed rate each, once the way netfpga_input and netfpga_output
+ * used to (take log_dumper_mutex, read the clock, write and flush the file) and
+ * once into the per thread rings, as pcap and as pcapng. Threads log in batches of
+ * 32 with a timestamp per batch like the pktio threads, only the time spent in the
+ * logging calls is counted. The files are read back and the packets in them
+ * checked against the drops.
+ *
+ * usage: log-bench [max_threads] [packets_per_thread] [packets_per_sec_per_thread]
+ */
+
+#include "sr_dumper.h"
+#include "sr_base_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+
+#define BATCH 32
+
+/* a locally built ack, a small packet, a default mtu datagram and a full frame */
+unsigned int packet_sizes[] = { 54, 64, 576, 1514 };
+char* iface_names[] = { "eth0", "eth1", "eth2", "eth3" };
+
+struct bench_arg {
+	struct sr_instance* sr;
+	pthread_mutex_t* lock;
+	FILE* fp;
+	int num_packets;
+	int rate;
+	int thread;
+	double log_ns;		/* time spent logging */
+};
+typedef struct bench_arg bench_arg;
+
+double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+/* sleeps until the next batch is due, leaving the cpu to the writer */
+void pace(bench_arg* arg, double begin, int sent) {
+	double due = begin + (sent * 1e9 / arg->rate);
+	struct timespec ts;
+	ts.tv_sec = (time_t)(due / 1e9);
+	ts.tv_nsec = (long)(due - (ts.tv_sec * 1e9));
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/* the old sr_log_packet under the old lock */
+void* sync_thread(void* v) {
+	bench_arg* arg = (bench_arg*)v;
+	uint8_t packet[SR_PACKET_DUMP_SIZE];
+	struct pcap_pkthdr h;
+	int i;
+
+	memset(packet, arg->thread, sizeof(packet));
+	double begin = now_ns();
+	for (i = 0; i < arg->num_packets; i += BATCH) {
+		int j;
+		pace(arg, begin, i);
+		double start = now_ns();
+		for (j = i; (j < i + BATCH) && (j < arg->num_packets); ++j) {
+			pthread_mutex_lock(arg->lock);
+			gettimeofday(&h.ts, 0);
+			h.caplen = packet_sizes[j & 3];
+			h.len = h.caplen;
+			sr_dump(arg->fp, &h, packet);
+			fflush(arg->fp);
+			pthread_mutex_unlock(arg->lock);
+		}
+		arg->log_ns += now_ns() - start;
+	}
+	return NULL;
+}
+
+void* ring_thread(void* v) {
+	bench_arg* arg = (bench_arg*)v;
+	uint8_t packet[SR_PACKET_DUMP_SIZE];
+	int i;
+
+	memset(packet, arg->thread, sizeof(packet));
+	double begin = now_ns();
+	for (i = 0; i < arg->num_packets; i += BATCH) {
+		int j;
+		pace(arg, begin, i);
+		double start = now_ns();
+		sr_log_batch_begin();
+		for (j = i; (j < i + BATCH) && (j < arg->num_packets); ++j) {
+			sr_log_packet_iface(arg->sr, packet, packet_sizes[j & 3], iface_names[arg->thread & 3],
+				(j & 1) ? SR_LOG_DIR_OUT : SR_LOG_DIR_IN);
+		}
+		sr_log_batch_end();
+		arg->log_ns += now_ns() - start;
+	}
+	return NULL;
+}
+
+/*
+ * Walks the file a record or block at a time, every block has to end with its
+ * own length.
+ * Returns: the packets in it, -1 if it is malformed
+ */
+long count_packets(const char* fname, int format, uint64_t* isb_drops) {
+	FILE* fp = fopen(fname, "r");
+	long packets = 0;
+	uint32_t hdr[2];
+
+	*isb_drops = 0;
+	if (!fp) {
+		return -1;
+	}
+
+	if (format == SR_LOG_PCAP) {
+		struct pcap_file_header fh;
+		struct pcap_sf_pkthdr ph;
+		if (fread(&fh, sizeof(fh), 1, fp) != 1) {
+			packets = -1;
+		}
+		while ((packets >= 0) && (fread(&ph, sizeof(ph), 1, fp) == 1)) {
+			if ((ph.caplen > SR_PACKET_DUMP_SIZE) || (fseek(fp, ph.caplen, SEEK_CUR) != 0)) {
+				packets = -1;
+				break;
+			}
+			++packets;
+		}
+	} else {
+		while (fread(hdr, sizeof(hdr), 1, fp) == 1) {
+			uint8_t* body = (uint8_t*)malloc(hdr[1]);
+			uint32_t trailer;
+			if ((hdr[1] < 12) || (fread(body, hdr[1] - 8, 1, fp) != 1)) {
+				free(body);
+				packets = -1;
+				break;
+			}
+			memcpy(&trailer, body + hdr[1] - 12, 4);
+			if (trailer != hdr[1]) {
+				free(body);
+				packets = -1;
+				break;
+			}
+			if (hdr[0] == PCAPNG_EPB) {
+				++packets;
+			} else if (hdr[0] == PCAPNG_ISB) {
+				uint64_t drops;
+				memcpy(&drops, body + 12 + 4, sizeof(drops));	/* id, timestamp, then the option */
+				*isb_drops += drops;
+			}
+			free(body);
+		}
+	}
+
+	fclose(fp);
+	return packets;
+}
+
+void run(int mode, int num_threads, int num_packets, int rate) {
+	char* fname = "/tmp/log-bench.out";
+	struct sr_instance sr;
+	pthread_mutex_t lock;
+	pthread_t threads[64];
+	bench_arg args[64];
+	double log_ns = 0;
+	int i;
+
+	memset(&sr, 0, sizeof(sr));
+	pthread_mutex_init(&lock, NULL);
+
+	FILE* fp = NULL;
+	if (mode == 0) {
+		fp = sr_dump_open(fname, 0, SR_PACKET_DUMP_SIZE);
+	} else {
+		sr.log = sr_log_open(fname, (mode == 1) ? SR_LOG_PCAP : SR_LOG_PCAPNG);
+	}
+
+	for (i = 0; i < num_threads; ++i) {
+		args[i].sr = &sr;
+		args[i].lock = &lock;
+		args[i].fp = fp;
+		args[i].num_packets = num_packets;
+		args[i].rate = rate;
+		args[i].thread = i;
+		args[i].log_ns = 0;
+		pthread_create(&threads[i], NULL, (mode == 0) ? sync_thread : ring_thread, &args[i]);
+	}
+	for (i = 0; i < num_threads; ++i) {
+		pthread_join(threads[i], NULL);
+		log_ns += args[i].log_ns;
+	}
+
+	uint64_t drops = 0;
+	uint64_t writes = num_threads * (uint64_t)num_packets;
+	if (mode == 0) {
+		sr_dump_close(fp);
+	} else {
+		drops = sr_log_drops(sr.log);
+		writes = sr.log->writes;
+		sr_log_close(sr.log);
+	}
+
+	uint64_t isb_drops;
+	long packets = count_packets(fname, (mode == 2) ? SR_LOG_PCAPNG : SR_LOG_PCAP, &isb_drops);
+	long expected = (num_threads * (long)num_packets) - drops;
+
+	printf("%-8s %-8i %-10.1f %-10llu %-10llu %-10li %s\n",
+		(mode == 0) ? "sync" : (mode == 1) ? "pcap" : "pcapng", num_threads,
+		log_ns / (num_threads * (double)num_packets), (unsigned long long)drops, (unsigned long long)writes,
+		packets, ((packets == expected) && ((mode != 2) || (isb_drops == drops))) ? "ok" : "MISMATCH");
+
+	pthread_mutex_destroy(&lock);
+	remove(fname);
+}
+
+int main(int argc, char** argv)
+{
+	int max_threads = (argc > 1) ? atoi(argv[1]) : 8;
+	int num_packets = (argc > 2) ? atoi(argv[2]) : 200000;
+	int rate = (argc > 3) ? atoi(argv[3]) : 200000;
+	int num_threads;
+
+	if (max_threads > 64) {
+		max_threads = 64;
+	}
+
+	printf("%-8s %-8s %-10s %-10s %-10s %-10s %s\n", "Mode", "Threads", "ns/pkt", "Drops", "Writes",
+		"In file", "Check");
+	for (num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+		run(0, num_threads, num_packets, rate);
+		run(1, num_threads, num_packets, rate);
+		run(2, num_threads, num_packets, rate);
+	}
+
+	return 0;
+}
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "or_lpm.h"
+
+static inline uint32_t lpm_len_to_mask(uint8_t len) {
+	return (len == 0) ? 0 : (0xFFFFFFFF << (32 - len));
+}
+
+/* returns bit i of x, counting from the most significant bit */
+static inline int lpm_bit(uint32_t x, uint8_t i) {
+	return (x >> (31 - i)) & 0x1;
+}
+
+/* number of leading bits that a and b have in common */
+static inline uint8_t lpm_common_len(uint32_t a, uint32_t b) {
+	uint32_t diff = a ^ b;
+	return (diff == 0) ? 32 : __builtin_clz(diff);
+}
+
+static lpm_node* lpm_node_create(lpm_trie* t, uint32_t prefix, uint8_t len, void* data) {
+	lpm_node* n = (lpm_node*)calloc(1, sizeof(lpm_node));
+	assert(n);
+	n->prefix = prefix & lpm_len_to_mask(len);
+	n->len = len;
+	n->data = data;
+	++t->num_nodes;
+	return n;
+}
+
+static void lpm_node_free(lpm_trie* t, lpm_node* n) {
+	if (!n) {
+		return;
+	}
+	lpm_node_free(t, n->child[0]);
+	lpm_node_free(t, n->child[1]);
+	free(n);
+	--t->num_nodes;
+}
+
+/*
+ * Returns the prefix length of a netmask, i.e. the number of leading one bits.
+ * Mask is in host byte order.
+ */
+uint8_t lpm_mask_len(uint32_t mask) {
+	return (~mask == 0) ? 32 : __builtin_clz(~mask);
+}
+
+lpm_trie* lpm_create(void) {
+	lpm_trie* t = (lpm_trie*)calloc(1, sizeof(lpm_trie));
+	assert(t);
+	return t;
+}
+
+void lpm_clear(lpm_trie* t) {
+	assert(t);
+	lpm_node_free(t, t->root);
+	t->root = NULL;
+	t->num_prefixes = 0;
+}
+
+void lpm_destroy(lpm_trie* t) {
+	if (!t) {
+		return;
+	}
+	lpm_clear(t);
+	free(t);
+}
+
+/*
+ * Prefix and mask are in host byte order, data must not be NULL.
+ * Returns: 0 if inserted, 1 if the prefix/mask pair already exists (the existing data is kept)
+ */
+int lpm_insert(lpm_trie* t, uint32_t prefix, uint32_t mask, void* data) {
+	assert(t);
+	assert(data);
+
+	uint8_t len = lpm_mask_len(mask);
+	prefix &= lpm_len_to_mask(len);
+
+	lpm_node** p = &(t->root);
+	while (*p) {
+		lpm_node* n = *p;
+		uint8_t common = lpm_common_len(prefix, n->prefix);
+		if (common > len) { common = len; }
+		if (common > n->len) { common = n->len; }
+
+		if (common < n->len) {
+			/* the paths diverge inside n, split it with a node at the divergence point */
+			lpm_node* split = lpm_node_create(t, prefix, common, NULL);
+			split->child[lpm_bit(n->prefix, common)] = n;
+			if (common == len) {
+				split->data = data;
+			} else {
+				split->child[lpm_bit(prefix, common)] = lpm_node_create(t, prefix, len, data);
+			}
+			*p = split;
+			++t->num_prefixes;
+			return 0;
+		}
+
+		if (n->len == len) {
+			/* exact match, may be an internal node waiting for data */
+			if (n->data) {
+				return 1;
+			}
+			n->data = data;
+			++t->num_prefixes;
+			return 0;
+		}
+
+		p = &(n->child[lpm_bit(prefix, n->len)]);
+	}
+
+	*p = lpm_node_create(t, prefix, len, data);
+	++t->num_prefixes;
+	return 0;
+}
+
+/*
+ * Address is in host byte order.
+ * Returns: the data of the longest matching prefix, NULL if none match
+ */
+void* lpm_lookup(lpm_trie* t, uint32_t addr) {
+	assert(t);
+
+	void* best = NULL;
+	lpm_node* n = t->root;
+	while (n) {
+		if (((addr ^ n->prefix) & lpm_len_to_mask(n->len)) != 0) {
+			break;
+		}
+		if (n->data) {
+			best = n->data;
+		}
+		if (n->len == 32) {
+			break;
+		}
+		n = n->child[lpm_bit(addr, n->len)];
+	}
+
+	return best;
+}
@@ -0,0 +1,15 @@
+#ifndef OR_LPM_H_
+#define OR_LPM_H_
+
+#include "or_data_types.h"
+
+lpm_trie* lpm_create(void);
+void lpm_destroy(lpm_trie* t);
+void lpm_clear(lpm_trie* t);
+
+int lpm_insert(lpm_trie* t, uint32_t prefix, uint32_t mask, void* data);
+void* lpm_lookup(lpm_trie* t, uint32_t addr);
+
+uint8_t lpm_mask_len(uint32_t mask);
+
+#endif /*OR_LPM_H_*/
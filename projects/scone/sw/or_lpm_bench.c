@@ -0,0 +1,188 @@
+/*
+ * Compares longest prefix match lookups through the lpm trie against the
+ * original walk of the rtable linked list.
+ *
+ * usage: lpm-bench [num_prefixes ...]
+ */
+
+#include "or_lpm.h"
+#include "or_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#define LOOKUPS_TRIE 2000000
+#define LIST_WORK_BUDGET 200000000ULL /* entries visited by the list walk per run */
+
+/* the lookup get_next_hop used to do, kept here as the baseline */
+rtable_entry* list_lookup(node* rtable, struct in_addr* destination) {
+	int i;
+
+	node* n = rtable;
+	rtable_entry* lpm = NULL;
+	int most_bits_matched = -1;
+	while (n) {
+		rtable_entry* re = (rtable_entry*)n->data;
+
+		if (re->is_active) {
+			uint32_t mask = ntohl(re->mask.s_addr);
+			uint32_t ip = ntohl(re->ip.s_addr) & mask;
+			uint32_t dest_ip = ntohl(destination->s_addr) & mask;
+
+			if (ip == dest_ip) {
+				/* count the number of bits in the mask */
+				int bits_matched = 0;
+				for (i = 0; i < 32; ++i) {
+					if ((mask >> i) & 0x1) {
+						++bits_matched;
+					}
+				}
+
+				if (bits_matched > most_bits_matched) {
+					lpm = re;
+					most_bits_matched = bits_matched;
+				}
+			}
+		}
+		n = n->next;
+	}
+
+	return lpm;
+}
+
+double elapsed_ns(struct timeval* start, struct timeval* end) {
+	return ((end->tv_sec - start->tv_sec) * 1e9) + ((end->tv_usec - start->tv_usec) * 1e3);
+}
+
+/* mostly /16 - /24 routes with a few short and host routes, like a real table */
+uint32_t random_mask(void) {
+	int r = rand() % 100;
+	int len;
+	if (r < 5) {
+		len = 8 + (rand() % 8);
+	} else if (r < 95) {
+		len = 16 + (rand() % 9);
+	} else {
+		len = 25 + (rand() % 8);
+	}
+	return 0xFFFFFFFF << (32 - len);
+}
+
+uint32_t random_ip(void) {
+	return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+void run(int num_prefixes) {
+	int i;
+	node* rtable = NULL;
+	node* tail = NULL;
+	lpm_trie* trie = lpm_create();
+
+	/* build the list and the trie from the same entries */
+	for (i = 0; i < num_prefixes; ++i) {
+		rtable_entry* entry = (rtable_entry*)calloc(1, sizeof(rtable_entry));
+		uint32_t mask = random_mask();
+		entry->ip.s_addr = htonl(random_ip() & mask);
+		entry->mask.s_addr = htonl(mask);
+		entry->gw.s_addr = htonl(random_ip());
+		snprintf(entry->iface, IF_LEN, "eth%i", i % 4);
+		entry->is_active = 1;
+		entry->is_static = 1;
+
+		node* n = node_create();
+		n->data = entry;
+		if (!rtable) {
+			rtable = n;
+		} else {
+			/* push onto the tail directly, node_push_back would make the build quadratic */
+			tail->next = n;
+			n->prev = tail;
+		}
+		tail = n;
+
+		lpm_insert(trie, ntohl(entry->ip.s_addr), mask, entry);
+	}
+
+	/* destinations are drawn from the table so that most lookups hit */
+	int num_dests = 4096;
+	struct in_addr* dests = (struct in_addr*)malloc(num_dests * sizeof(struct in_addr));
+	node* cur = rtable;
+	for (i = 0; i < num_dests; ++i) {
+		rtable_entry* entry = (rtable_entry*)cur->data;
+		uint32_t mask = ntohl(entry->mask.s_addr);
+		dests[i].s_addr = htonl(ntohl(entry->ip.s_addr) | (random_ip() & ~mask));
+		if (i % 8 == 7) {
+			dests[i].s_addr = htonl(random_ip());
+		}
+		cur = cur->next ? cur->next : rtable;
+	}
+
+	/* verify both methods agree on the matched prefix */
+	int mismatches = 0;
+	int verify = (num_prefixes <= 10000) ? num_dests : 64;
+	for (i = 0; i < verify; ++i) {
+		rtable_entry* a = list_lookup(rtable, &dests[i]);
+		rtable_entry* b = (rtable_entry*)lpm_lookup(trie, ntohl(dests[i].s_addr));
+		if ((a == NULL) != (b == NULL) || (a && ((a->ip.s_addr != b->ip.s_addr) || (a->mask.s_addr != b->mask.s_addr)))) {
+			++mismatches;
+		}
+	}
+
+	struct timeval start, end;
+	volatile void* sink = NULL;
+
+	int list_lookups = (int)(LIST_WORK_BUDGET / num_prefixes);
+	if (list_lookups < 16) {
+		list_lookups = 16;
+	}
+	gettimeofday(&start, NULL);
+	for (i = 0; i < list_lookups; ++i) {
+		sink = list_lookup(rtable, &dests[i % num_dests]);
+	}
+	gettimeofday(&end, NULL);
+	double list_ns = elapsed_ns(&start, &end) / list_lookups;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < LOOKUPS_TRIE; ++i) {
+		sink = lpm_lookup(trie, ntohl(dests[i % num_dests].s_addr));
+	}
+	gettimeofday(&end, NULL);
+	double trie_ns = elapsed_ns(&start, &end) / LOOKUPS_TRIE;
+	(void)sink;
+
+	printf("%-10i %-10u %-14.1f %-14.1f %-10.1f %i\n", num_prefixes, trie->num_nodes,
+		list_ns, trie_ns, list_ns / trie_ns, mismatches);
+
+	lpm_destroy(trie);
+	cur = rtable;
+	while (cur) {
+		node* next = cur->next;
+		free(cur->data);
+		free(cur);
+		cur = next;
+	}
+	free(dests);
+}
+
+int main(int argc, char** argv)
+{
+	int default_sizes[] = { 100, 10000, 500000 };
+	int i;
+
+	srand(1);
+	printf("%-10s %-10s %-14s %-14s %-10s %s\n", "Prefixes", "Nodes", "List ns/op", "Trie ns/op", "Speedup", "Mismatches");
+
+	if (argc > 1) {
+		for (i = 1; i < argc; ++i) {
+			run(atoi(argv[i]));
+		}
+	} else {
+		for (i = 0; i < 3; ++i) {
+			run(default_sizes[i]);
+		}
+	}
+
+	return 0;
+}
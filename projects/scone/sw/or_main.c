@@ -34,6 +34,14 @@
 #include "or_dijkstra.h"
 #include "or_netfpga.h"
 #include "or_nat.h"
+#include "or_hw_table.h"
+#include "or_pktio.h"
+#include "or_pktbuf.h"
+#include "or_twheel.h"
+#include "or_sched.h"
+#include "or_hwstats.h"
+#include "or_trace.h"
+#include "or_export.h"
 #include "nf2/nf2util.h"
 #include "nf2/nf2.h"
 #include "reg_defines.h"
@@ -71,12 +79,14 @@ void init(struct sr_instance* sr)
     	perror("Lock init error");
     	exit(1);
     }
+    rs->arp_cache_wheel = twheel_create(time(NULL));
 
     rs->arp_queue_lock = (pthread_rwlock_t*)malloc(sizeof(pthread_rwlock_t));
     if (pthread_rwlock_init(rs->arp_queue_lock, NULL) != 0) {
     	perror("Lock init error");
     	exit(1);
     }
+    rs->arp_queue_wheel = twheel_create(arp_queue_now());
 
     rs->if_list_lock = (pthread_rwlock_t*)malloc(sizeof(pthread_rwlock_t));
     if (pthread_rwlock_init(rs->if_list_lock, NULL) != 0) {
@@ -90,6 +100,12 @@ void init(struct sr_instance* sr)
     	exit(1);
     }
 
+    rtable_snapshot_init(rs);
+
+    rs->rtable_hw = hw_table_create("rtable", ROUTER_OP_LUT_ROUTE_TABLE_DEPTH, RTABLE_HW_WIDTH, write_rtable_row_to_hw);
+    rs->arp_cache_hw = hw_table_create("arp", ROUTER_OP_LUT_ARP_TABLE_DEPTH, ARP_CACHE_HW_WIDTH, write_arp_cache_row_to_hw);
+    rs->nat_table_hw = hw_table_create("nat", NAT_HW_TABLE_DEPTH, NAT_HW_WIDTH, write_nat_table_row_to_hw);
+
     rs->cli_commands_lock = (pthread_rwlock_t*)malloc(sizeof(pthread_rwlock_t));
     if (pthread_rwlock_init(rs->cli_commands_lock, NULL) != 0) {
     	perror("Lock init error");
@@ -107,6 +123,7 @@ void init(struct sr_instance* sr)
 			perror("Nat Table cond init error");
 			exit(1);
     }
+    init_nat_table(rs);
 
     rs->local_ip_filter_list_mutex = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
     if (pthread_mutex_init(rs->local_ip_filter_list_mutex, NULL) != 0) {
@@ -114,32 +131,18 @@ void init(struct sr_instance* sr)
 			exit(1);
     }
 
-    rs->log_dumper_mutex = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
-    if (pthread_mutex_init(rs->log_dumper_mutex, NULL) != 0) {
-			perror("Log dumper mutex init error");
-			exit(1);
-    }
-
     rs->sr = sr;
 		rs->area_id = PWOSPF_AREA_ID;
 		rs->pwospf_hello_interval = PWOSPF_NEIGHBOR_TIMEOUT;
 		rs->pwospf_lsu_interval = PWOSPF_LSUINT;
 		rs->pwospf_lsu_broadcast = 1;
 		rs->arp_ttl = INITIAL_ARP_TIMEOUT;
+		rs->arp_queue_dest_limit = INITIAL_ARP_QUEUE_DEST_LIMIT;
+		rs->arp_queue_limit = INITIAL_ARP_QUEUE_LIMIT;
 		rs->nat_timeout = 120;
 
-		/* clear stats */
-		int i, j;
-		for (i = 0; i < 8; ++i) {
-			for (j = 0; j < 4; ++j) {
-				rs->stats_last[i][j] = 0;
-			}
-			for (j = 0; j < 2; ++j) {
-				rs->stats_avg[i][j] = 0.0;
-			}
-		}
-		rs->stats_last_time.tv_sec = 0;
-		rs->stats_last_time.tv_usec = 0;
+		/* nothing sampled yet, the stats timer fills it on the NETFPGA */
+		rs->hw_stats = hwstats_create();
 
 		#ifdef _CPUMODE_
 			rs->is_netfpga = 1;
@@ -213,19 +216,6 @@ void init(struct sr_instance* sr)
     }
 
 
-    /* Initialize PWOSPF Dijkstra Thread Mutex/Cond Var */
-    rs->dijkstra_mutex = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
-    if (pthread_mutex_init(rs->dijkstra_mutex, NULL) != 0) {
-			perror("Dijkstra mutex init error");
-    	exit(1);
-    }
-
-    rs->dijkstra_cond = (pthread_cond_t*)malloc(sizeof(pthread_cond_t));
-    if (pthread_cond_init(rs->dijkstra_cond, NULL) != 0) {
-			perror("Dijkstra cond init error");
-			exit(1);
-    }
-
     /* Initialize WWW Mutex/Cond Var */
     rs->www_mutex = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
     if (pthread_mutex_init(rs->www_mutex, NULL) != 0) {
@@ -249,39 +239,35 @@ void init(struct sr_instance* sr)
 
     sr_set_subsystem(sr, (void*)rs);
 
-    /** SPAWN THE ARP QUEUE THREAD **/
-    rs->arp_thread = (pthread_t*)malloc(sizeof(pthread_t));
-
-    if(pthread_create(rs->arp_thread, NULL, arp_thread, (void *)sr) != 0) {
-	    perror("Thread create error");
-    }
-
-
-    /** SPAWN THE PWOSPF HELLO BROADCAST THREAD **/
-    rs->pwospf_hello_thread = (pthread_t*)malloc(sizeof(pthread_t));
-    if(pthread_create(rs->pwospf_hello_thread, NULL, pwospf_hello_thread, (void *)sr) != 0) {
-		perror("Thread create error");
-    }
-
-
-    /** SPAWN THE PWOSPF LSU BROADCAST THREAD **/
-    rs->pwospf_lsu_thread = (pthread_t*)malloc(sizeof(pthread_t));
-    if(pthread_create(rs->pwospf_lsu_thread, NULL, pwospf_lsu_thread, (void *)sr) != 0) {
-	    perror("Thread create error");
-    }
-
+    /** CREATE THE TIMERS, ONE THREAD RUNS THEM ALL **/
+    rs->sched = sched_create();
+    rs->arp_cache_timer = sched_timer_create(rs->sched, "arp cache", arp_cache_tick, (void*)sr);
+    rs->arp_queue_timer = sched_timer_create(rs->sched, "arp queue", arp_queue_tick, (void*)sr);
+    rs->pwospf_hello_timer = sched_timer_create(rs->sched, "pwospf hello", pwospf_hello_tick, (void*)sr);
+    rs->pwospf_lsu_timer = sched_timer_create(rs->sched, "pwospf lsu", pwospf_lsu_tick, (void*)sr);
+    rs->pwospf_lsu_timeout_timer = sched_timer_create(rs->sched, "pwospf lsu timeout", pwospf_lsu_timeout_tick, (void*)sr);
+    rs->dijkstra_timer = sched_timer_create(rs->sched, "dijkstra", dijkstra_tick, (void*)rs);
+    rs->sping_timer = sched_timer_create(rs->sched, "sping cleanup", sping_queue_cleanup_tick, (void*)rs);
+
+    sched_add(rs->arp_cache_timer, 1000);
+    sched_add(rs->pwospf_hello_timer, 0);
+    sched_add(rs->pwospf_lsu_timer, 5000);
+    sched_add(rs->pwospf_lsu_timeout_timer, 1000);
+    sched_add(rs->sping_timer, 30000);
+
+    /** NAT Maintenance Timer **/
+    /*
+    rs->nat_maintenance_timer = sched_timer_create(rs->sched, "nat maintenance", nat_maintenance_tick, (void*)rs);
+    sched_add(rs->nat_maintenance_timer, 1000);
+    */
 
-    /** SPAWN THE PWOSPF LSU BCAST TIMEOUT THREAD **/
-    rs->pwospf_lsu_timeout_thread = (pthread_t*)malloc(sizeof(pthread_t));
-    if(pthread_create(rs->pwospf_lsu_timeout_thread, NULL, pwospf_lsu_timeout_thread, (void*)sr) != 0) {
-	    perror("Thread create error");
-    }
+    /* if we are on the NETFPGA add the hw counter sampler */
+		if (rs->is_netfpga) {
+	    rs->stats_timer = sched_timer_create(rs->sched, "hw stats", hwstats_tick, (void*)rs);
+	    sched_add(rs->stats_timer, 0);
+		}
 
-    /** SPAWN THE DIJKSTRA THREAD **/
-    rs->pwospf_dijkstra_thread = (pthread_t*)malloc(sizeof(pthread_t));
-    if(pthread_create(rs->pwospf_dijkstra_thread, NULL, dijkstra_thread, (void*)get_router_state(sr)) != 0) {
-	    perror("Thread create error");
-    }
+    sched_start(rs->sched);
 
 
     /** SPAWN THE PWOSPF LSU BCAST THREAD **/
@@ -289,22 +275,6 @@ void init(struct sr_instance* sr)
     if(pthread_create(rs->pwospf_lsu_bcast_thread, NULL, pwospf_lsu_bcast_thread, (void*)sr) != 0) {
 	    perror("Thread create error");
     }
-
-    /** Spawn the NAT Maintenance Thread **/
-    /*
-    rs->nat_maintenance_thread = (pthread_t*)malloc(sizeof(pthread_t));
-    if(pthread_create(rs->nat_maintenance_thread, NULL, nat_maintenance_thread, (void*)rs) != 0) {
-	    perror("Thread create error");
-    }
-    */
-
-    /* if we are on the NETFPGA spawn the stats thread */
-		if (rs->is_netfpga) {
-	    rs->stats_thread = (pthread_t*)malloc(sizeof(pthread_t));
-	    if(pthread_create(rs->stats_thread, NULL, netfpga_stats, (void*)rs) != 0) {
-		    perror("Thread create error");
-	    }
-		}
 }
 
 void init_add_interface(struct sr_instance* sr, struct sr_vns_if* vns_if) {
@@ -535,6 +505,9 @@ void init_rtable(struct sr_instance* sr) {
 		perror("Failure closing file");
 	}
 
+	/* publish the static routes for lookups until dijkstra runs */
+	publish_rtable_snapshot(rs);
+
 	/* check if we have a default route entry, if so we need to add it to our pwospf router */
 	pwospf_interface* default_route = default_route_present(rs);
 
@@ -568,6 +541,11 @@ void init_hardware(router_state* rs) {
 	/* enable DMA */
 	//writeReg(&rs->netfpga, DMA_ENABLE_REG, 0x1);
 
+	/* the reset cleared the tables, rewrite every row */
+	hw_table_invalidate(rs->rtable_hw);
+	hw_table_invalidate(rs->arp_cache_hw);
+	hw_table_invalidate(rs->nat_table_hw);
+
 	/* write 0's out to the rtable and arp table */
 	write_arp_cache_to_hw(rs);
 	write_rtable_to_hw(rs);
@@ -602,6 +580,8 @@ void init_cli(struct sr_instance* sr) {
 	register_cli_command(&(rs->cli_commands), "show vns server ?", &cli_show_vns_server_help);
 	register_cli_command(&(rs->cli_commands), "show vns topology", &cli_show_vns_topology);
 	register_cli_command(&(rs->cli_commands), "show vns topology ?", &cli_show_vns_topology_help);
+	register_cli_command(&(rs->cli_commands), "show vns log", &cli_show_vns_log);
+	register_cli_command(&(rs->cli_commands), "show vns log ?", &cli_show_vns_log_help);
 
 
 	/* CLI: show ip ... */
@@ -609,6 +589,7 @@ void init_cli(struct sr_instance* sr) {
 	register_cli_command(&(rs->cli_commands), "show ip ?", &cli_show_ip_help);
 	register_cli_command(&(rs->cli_commands), "show ip arp", &cli_show_ip_arp);
 	register_cli_command(&(rs->cli_commands), "show ip arp ?", &cli_show_ip_arp_help);
+	register_cli_command(&(rs->cli_commands), "show ip arp queue", &cli_show_ip_arp_queue);
 	register_cli_command(&(rs->cli_commands), "show ip interface", &cli_show_ip_iface);
 	register_cli_command(&(rs->cli_commands), "show ip interface ?", &cli_show_ip_iface_help);
 	register_cli_command(&(rs->cli_commands), "show ip route", &cli_show_ip_rtable);
@@ -638,6 +619,7 @@ void init_cli(struct sr_instance* sr) {
 	register_cli_command(&(rs->cli_commands), "ip arp del", &cli_ip_arp_del);
 	register_cli_command(&(rs->cli_commands), "ip arp del ?", &cli_ip_arp_del_help);
 	register_cli_command(&(rs->cli_commands), "ip arp set ttl", &cli_ip_arp_set_ttl);
+	register_cli_command(&(rs->cli_commands), "ip arp set queue", &cli_ip_arp_set_queue);
 
 
 	/* CLI: sping ... */
@@ -660,11 +642,32 @@ void init_cli(struct sr_instance* sr) {
 	register_cli_command(&(rs->cli_commands), "send lsu", &cli_pwospf_send_lsu);
 
 
+	/* CLI: show sched */
+	register_cli_command(&(rs->cli_commands), "show sched", &cli_show_sched);
+
+
+	/* CLI: show state */
+	register_cli_command(&(rs->cli_commands), "show state", &cli_show_state);
+
+
+	/* CLI: trace ... */
+	register_cli_command(&(rs->cli_commands), "show trace", &cli_show_trace);
+	register_cli_command(&(rs->cli_commands), "show trace ?", &cli_show_trace_help);
+	register_cli_command(&(rs->cli_commands), "trace level", &cli_trace_level);
+
+
 	/* CLI: hw ... */
 	register_cli_command(&(rs->cli_commands), "hw info", &cli_hw_info);
 	register_cli_command(&(rs->cli_commands), "hw ?", &cli_hw_help);
 	register_cli_command(&(rs->cli_commands), "show hw rtable", &cli_show_hw_rtable);
 	register_cli_command(&(rs->cli_commands), "show hw arp", &cli_show_hw_arp_cache);
+	register_cli_command(&(rs->cli_commands), "show hw sync", &cli_show_hw_sync);
+	register_cli_command(&(rs->cli_commands), "show hw pktio", &cli_show_pktio);
+	register_cli_command(&(rs->cli_commands), "show hw stats", &cli_show_hw_stats);
+	register_cli_command(&(rs->cli_commands), "show hw stats history", &cli_show_hw_stats_history);
+	register_cli_command(&(rs->cli_commands), "set hw stats interval", &cli_set_hw_stats_interval);
+	register_cli_command(&(rs->cli_commands), "show pktbuf", &cli_show_pktbuf);
+	register_cli_command(&(rs->cli_commands), "show tcp stats", &cli_show_tcp_stats);
 	register_cli_command(&(rs->cli_commands), "nuke arp", &cli_nuke_arp_cache);
 	register_cli_command(&(rs->cli_commands), "nuke hw arp", &cli_nuke_hw_arp_cache_entry);
 	register_cli_command(&(rs->cli_commands), "show hw iface", &cli_show_hw_interface);
@@ -714,11 +717,10 @@ void init_cli(struct sr_instance* sr) {
 
 void process_packet(struct sr_instance* sr, const uint8_t * packet, unsigned int len, const char* interface) {
 
-	/*
-	printf("\n--- Received Packet on iface: %s ---\n", interface);
-	print_packet((uint8_t*)packet, len);
-	printf("&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&\n");
-	*/
+	if (trace_enabled(TRACE_PACKET)) {
+		TRACE(TRACE_PACKET, "--- Received Packet on iface: %s ---", interface);
+		print_packet((uint8_t*)packet, len);
+	}
 
 	if (iface_is_active(get_router_state(sr), (char*)interface) == 0) {
 		/* drop the packet */
@@ -734,12 +736,12 @@ void process_packet(struct sr_instance* sr, const uint8_t * packet, unsigned int
 	switch(ntohs(ether_hdr->eth_type)) {
 
 		case ETH_TYPE_IP:
-			printf(" ** -> Received IP packet of length %d\n", len);
+			TRACE(TRACE_DEBUG, " ** -> Received IP packet of length %d", len);
 			process_ip_packet(sr, packet, len, interface);
 			break;
 
 		case ETH_TYPE_ARP:
-			printf(" ** -> Received ARP packet of length %d\n", len);
+			TRACE(TRACE_DEBUG, " ** -> Received ARP packet of length %d", len);
 			process_arp_packet(sr, packet, len, interface);
 			break;
 
@@ -749,7 +751,8 @@ void process_packet(struct sr_instance* sr, const uint8_t * packet, unsigned int
 }
 
 /*
- * This function takes responsibility for finding the target MAC address, and freeing packet.
+ * This function takes responsibility for finding the target MAC address, and freeing packet
+ * with pkt_free, so it may be malloced or pooled.
  */
 int send_ip(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct in_addr* next_hop, const char* out_iface) {
 
@@ -761,12 +764,12 @@ int send_ip(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct in
 		memcpy(eth->eth_dhost, ace->arp_ha, ETH_ADDR_LEN);
 
 		if (send_packet(sr, packet, len, out_iface) != 0) {
-			printf("Failure sending IP packet\n");
-			free(packet);
+			TRACE(TRACE_WARN, "Failure sending IP packet out %s", out_iface);
+			pkt_free(packet);
 			return 1;
 		}
 
-		free(packet);
+		pkt_free(packet);
 	} else {
 		/* arp queue add adds the packet to the queue, will free later */
 		arp_queue_add(sr, packet, len, out_iface, next_hop);
@@ -777,14 +780,20 @@ int send_ip(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct in
 
 int send_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len, const char* iface) {
 	router_state* rs = get_router_state(sr);
-	if (pthread_mutex_lock(rs->write_lock) != 0) {
+
+	/* the netfpga ports serialize their own writes per port */
+	if (!rs->is_netfpga && (pthread_mutex_lock(rs->write_lock) != 0)) {
 		perror("Failure locking write lock\n");
 		exit(1);
 	}
 
 	int result;
 
-	if (len < 60) {
+	if ((len < 60) && (pktbuf_pad(packet, len, 60) == 0)) {
+		/* pooled packets have the tailroom to pad in place */
+		TRACE(TRACE_DEBUG, " ** <- Sending packet of size %u out iface: %s", 60, iface);
+		result = sr_integ_low_level_output(sr, packet, 60, iface);
+	} else if (len < 60) {
 		int pad_len = 60 - len;
 		uint8_t* pad_packet = (uint8_t*)malloc (len + pad_len);
 		if (!pad_packet) {
@@ -795,21 +804,19 @@ int send_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len, const
 		bzero(pad_packet, len+pad_len);
 		memmove(pad_packet, packet, len);
 
-		printf(" ** <- Sending packet of size %u out iface: %s\n", len+pad_len, iface);
+		TRACE(TRACE_DEBUG, " ** <- Sending packet of size %u out iface: %s", len+pad_len, iface);
 
 		result=sr_integ_low_level_output(sr, pad_packet, len+pad_len, iface);
 
 		free(pad_packet);
 	} else {
-		printf(" ** <- Sending packet of size %u out iface: %s\n", len, iface);
+		TRACE(TRACE_DEBUG, " ** <- Sending packet of size %u out iface: %s", len, iface);
 		result = sr_integ_low_level_output(sr, packet, len, iface);
 	}
 
-	/*
 	print_packet(packet, len);
-	*/
 
-	if (pthread_mutex_unlock(rs->write_lock) != 0) {
+	if (!rs->is_netfpga && (pthread_mutex_unlock(rs->write_lock) != 0)) {
 		perror("Failure unlocking write lock\n");
 		exit(1);
 	}
@@ -821,6 +828,9 @@ int send_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len, const
 void destroy(struct sr_instance* sr) {
     router_state* rs = sr->interface_subsystem;
 
+    /* stop the timers before the state they work on goes away */
+    sched_destroy(rs->sched);
+
     /** DESTROY LOCKS **/
     if (pthread_mutex_destroy(rs->write_lock) != 0) {
     	perror("Lock destroy error");
@@ -847,6 +857,17 @@ void destroy(struct sr_instance* sr) {
     }
     free(rs->rtable_lock);
 
+    hw_table_destroy(rs->rtable_hw);
+    hw_table_destroy(rs->arp_cache_hw);
+    hw_table_destroy(rs->nat_table_hw);
+
+    destroy_nat_table(rs);
+    twheel_destroy(rs->arp_cache_wheel);
+    twheel_destroy(rs->arp_queue_wheel);
+    free(rs->arp_cache_hash);
+
+    pktio_destroy(rs->pktio);
+
     if (pthread_rwlock_destroy(rs->cli_commands_lock) != 0) {
     	perror("Lock destroy error");
     }
@@ -863,15 +884,9 @@ void destroy(struct sr_instance* sr) {
     free(rs->nat_table_cond);
 
     /* destroy dijkstra stuff */
-    if (pthread_mutex_destroy(rs->dijkstra_mutex) != 0) {
-    	perror("Mutex destroy error");
-    }
-    free(rs->dijkstra_mutex);
+    spf_graph_destroy(rs->spf_graph);
 
-    if (pthread_cond_destroy(rs->dijkstra_cond) != 0) {
-    	perror("Cond destroy error");
-    }
-    free(rs->dijkstra_cond);
+    hwstats_destroy(rs->hw_stats);
 
     /* destroy www stuff */
     if (pthread_mutex_destroy(rs->www_mutex) != 0) {
@@ -917,7 +932,6 @@ uint32_t find_srcip(uint32_t dest) {
 
 
         lock_if_list_rd(rs);
-        lock_rtable_rd(rs);
 
         if(get_next_hop(&src, iface, 32, rs, &dst)) {
                 srcip = 0;
@@ -928,7 +942,6 @@ uint32_t find_srcip(uint32_t dest) {
 		srcip = iface_struct->ip;
 	}
 
-        unlock_rtable(rs);
         unlock_if_list(rs);
 
 	return srcip;
@@ -940,6 +953,11 @@ void init_rawsockets(router_state* rs) {
 
 	char iface_name[32] = "nf2c";
 	int i;
+
+	if (!rs->pktio) {
+		rs->pktio = pktio_create(netfpga_input_handler, sr);
+	}
+
 	for (i = 0; i < 4; ++i) {
 		sprintf(&(iface_name[4]), "%i", base+i);
 		int s = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
@@ -964,6 +982,7 @@ void init_rawsockets(router_state* rs) {
 		}
 
 		rs->raw_sockets[i] = s;
+		pktio_add_socket(rs->pktio, s);
 	}
 }
 
@@ -985,6 +1004,10 @@ void init_pcap(router_state* rs) {
 	char* iface_names[4] = {"nf2c0", "nf2c1", "nf2c2", "nf2c3"};
 	struct bpf_program fp;
 
+	if (!rs->pktio) {
+		rs->pktio = pktio_create(netfpga_input_handler, rs->sr);
+	}
+
 	lock_if_list_rd(rs);
 
 	int i = 0;
@@ -1014,6 +1037,11 @@ void init_pcap(router_state* rs) {
 				exit(1);
 			}
 
+			if (pktio_add_pcap(rs->pktio, rs->pcap_context[i]) < 0) {
+				printf("error adding %s to the packet I/O engine\n", iface_names[i]);
+				exit(1);
+			}
+
 			++i;
 		}
 
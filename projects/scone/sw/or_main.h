@@ -12,6 +12,8 @@
 
 /* Default setting for ARP */
 #define INITIAL_ARP_TIMEOUT 300
+#define INITIAL_ARP_QUEUE_DEST_LIMIT (64 * 1024)	/* bytes waiting on one next hop */
+#define INITIAL_ARP_QUEUE_LIMIT (1024 * 1024)		/* bytes waiting on all of them */
 
 void init(struct sr_instance* sr);
 void init_add_interface(struct sr_instance* sr, struct sr_vns_if* vns_if);
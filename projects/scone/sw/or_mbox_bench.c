@@ -0,0 +1,259 @@
+/*
+ * Measures the lwtcp mailboxes the way the router uses them. In the stream test
+ * several threads post to one mailbox that a single thread drains, as the cli and
+ * www threads and the packet input path all post to the transport thread; posters
+ * keep at most a window of messages outstanding so the old ring never overflows.
+ * In the call test two threads pass a message back and forth through a pair of
+ * mailboxes, as an api call and its reply do. The mailboxes as they were, a ring
+ * guarded by two semaphores, are rebuilt here on the sys_sem calls to compare
+ * against, and the new ones are run fetching one message at a time and in batches.
+ *
+ * usage: mbox-bench [messages] [posters]
+ */
+
+#include "lwip/sys.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define LEGACY_MBOX_SIZE 100
+#define WINDOW 64
+#define BATCH 32
+#define MAX_POSTERS 16
+
+/* the mailbox as it was */
+struct legacy_mbox {
+	uint16_t first, last;
+	void* msgs[LEGACY_MBOX_SIZE];
+	sys_sem_t mail;
+	sys_sem_t mutex;
+};
+typedef struct legacy_mbox legacy_mbox;
+
+legacy_mbox* legacy_mbox_new(void) {
+	legacy_mbox* mbox = malloc(sizeof(legacy_mbox));
+	mbox->first = mbox->last = 0;
+	mbox->mail = sys_sem_new(0);
+	mbox->mutex = sys_sem_new(1);
+	return mbox;
+}
+
+void legacy_mbox_post(legacy_mbox* mbox, void* msg) {
+	int first;
+	sys_arch_sem_wait(mbox->mutex, 0);
+	mbox->msgs[mbox->last] = msg;
+	first = (mbox->last == mbox->first);
+	if (++mbox->last == LEGACY_MBOX_SIZE) {
+		mbox->last = 0;
+	}
+	if (first) {
+		sys_sem_signal(mbox->mail);
+	}
+	sys_sem_signal(mbox->mutex);
+}
+
+void* legacy_mbox_fetch(legacy_mbox* mbox) {
+	void* msg;
+	sys_arch_sem_wait(mbox->mutex, 0);
+	while (mbox->first == mbox->last) {
+		sys_sem_signal(mbox->mutex);
+		sys_arch_sem_wait(mbox->mail, 0);
+		sys_arch_sem_wait(mbox->mutex, 0);
+	}
+	msg = mbox->msgs[mbox->first];
+	if (++mbox->first == LEGACY_MBOX_SIZE) {
+		mbox->first = 0;
+	}
+	sys_sem_signal(mbox->mutex);
+	return msg;
+}
+
+enum { MODE_LEGACY, MODE_SINGLE, MODE_BATCH };
+char* mode_names[] = { "legacy", "lockfree", "batched" };
+
+struct bench {
+	int mode;
+	unsigned int messages;		/* per poster */
+	unsigned int posters;
+	legacy_mbox* legacy[2];
+	sys_mbox_t mbox[2];
+	volatile int in_flight;
+	unsigned int out_of_order;
+};
+typedef struct bench bench;
+
+void post(bench* b, int i, void* msg) {
+	if (b->mode == MODE_LEGACY) {
+		legacy_mbox_post(b->legacy[i], msg);
+	} else {
+		sys_mbox_post(b->mbox[i], msg);
+	}
+}
+
+/* fetches one message, or with MODE_BATCH all that are waiting, returns how many */
+unsigned int fetch(bench* b, int i, void** msgs) {
+	if (b->mode == MODE_LEGACY) {
+		msgs[0] = legacy_mbox_fetch(b->legacy[i]);
+		return 1;
+	}
+	sys_arch_mbox_fetch(b->mbox[i], &msgs[0], 0);
+	if (b->mode == MODE_BATCH) {
+		return 1 + sys_arch_mbox_tryfetch(b->mbox[i], &msgs[1], BATCH - 1);
+	}
+	return 1;
+}
+
+struct poster_arg {
+	bench* b;
+	unsigned int id;
+};
+
+void* stream_poster(void* arg) {
+	struct poster_arg* pa = (struct poster_arg*)arg;
+	bench* b = pa->b;
+	unsigned int i;
+
+	for (i = 1; i <= b->messages; ++i) {
+		while (b->in_flight >= WINDOW) {
+			sched_yield();
+		}
+		__sync_fetch_and_add(&(b->in_flight), 1);
+		post(b, 0, (void*)(((unsigned long)pa->id << 32) | i));
+	}
+	return NULL;
+}
+
+void* call_server(void* arg) {
+	bench* b = (bench*)arg;
+	void* msgs[BATCH];
+	unsigned int i;
+
+	for (i = 0; i < b->messages; ++i) {
+		fetch(b, 0, msgs);
+		post(b, 1, msgs[0]);
+	}
+	return NULL;
+}
+
+double now_s(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1e6);
+}
+
+long switches(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+void setup(bench* b) {
+	int i;
+	for (i = 0; i < 2; ++i) {
+		if (b->mode == MODE_LEGACY) {
+			b->legacy[i] = legacy_mbox_new();
+		} else {
+			b->mbox[i] = sys_mbox_new();
+		}
+	}
+}
+
+void run_stream(bench* b) {
+	pthread_t threads[MAX_POSTERS];
+	struct poster_arg args[MAX_POSTERS];
+	unsigned long last[MAX_POSTERS + 1];
+	void* msgs[BATCH];
+	unsigned int i, n, total = b->messages * b->posters, got = 0;
+
+	setup(b);
+	b->in_flight = 0;
+	b->out_of_order = 0;
+	memset(last, 0, sizeof(last));
+
+	long sw = switches();
+	double start = now_s();
+	for (i = 0; i < b->posters; ++i) {
+		args[i].b = b;
+		args[i].id = i + 1;
+		pthread_create(&threads[i], NULL, stream_poster, &args[i]);
+	}
+	while (got < total) {
+		n = fetch(b, 0, msgs);
+		for (i = 0; i < n; ++i) {
+			unsigned long v = (unsigned long)msgs[i];
+			unsigned int id = v >> 32;
+			if ((id > b->posters) || ((v & 0xffffffff) != last[id] + 1)) {
+				++b->out_of_order;
+			} else {
+				last[id] = v & 0xffffffff;
+			}
+		}
+		__sync_fetch_and_sub(&(b->in_flight), n);
+		got += n;
+	}
+	double elapsed = now_s() - start;
+	sw = switches() - sw;
+	for (i = 0; i < b->posters; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	printf("%-8s %-7s %-12.0f %-14.2f %u\n", mode_names[b->mode], "stream", total / elapsed,
+		(sw * 1000.0) / total, b->out_of_order);
+}
+
+void run_call(bench* b) {
+	pthread_t server;
+	void* msgs[BATCH];
+	unsigned int i;
+
+	setup(b);
+	b->out_of_order = 0;
+
+	long sw = switches();
+	double start = now_s();
+	pthread_create(&server, NULL, call_server, b);
+	for (i = 1; i <= b->messages; ++i) {
+		post(b, 0, (void*)(unsigned long)i);
+		fetch(b, 1, msgs);
+		if ((unsigned long)msgs[0] != i) {
+			++b->out_of_order;
+		}
+	}
+	double elapsed = now_s() - start;
+	sw = switches() - sw;
+	pthread_join(server, NULL);
+
+	printf("%-8s %-7s %-12.0f %-14.2f %u   %.2f us per call\n", mode_names[b->mode], "call", b->messages / elapsed,
+		(sw * 1000.0) / b->messages, b->out_of_order, (elapsed * 1e6) / b->messages);
+}
+
+int main(int argc, char** argv)
+{
+	bench b;
+	int mode;
+
+	memset(&b, 0, sizeof(b));
+	b.messages = (argc > 1) ? atoi(argv[1]) : 200000;
+	b.posters = (argc > 2) ? atoi(argv[2]) : 3;
+	if (b.posters < 1 || b.posters > MAX_POSTERS) {
+		b.posters = 3;
+	}
+	sys_init();
+
+	printf("%u messages from each of %u posters, window %i\n", b.messages, b.posters, WINDOW);
+	printf("%-8s %-7s %-12s %-14s %s\n", "Mode", "Test", "Msgs/s", "Switches/1k", "Out of order");
+	for (mode = MODE_LEGACY; mode <= MODE_BATCH; ++mode) {
+		b.mode = mode;
+		run_stream(&b);
+	}
+	for (mode = MODE_LEGACY; mode <= MODE_SINGLE; ++mode) {
+		b.mode = mode;
+		run_call(&b);
+	}
+	return 0;
+}
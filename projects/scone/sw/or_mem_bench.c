@@ -0,0 +1,327 @@
+/*
+ * Churns the lwtcp heap the way long lived sessions do: every thread keeps a working
+ * set of live allocations and keeps replacing a random one with a new allocation of
+ * a random size, mostly small control blocks and pbuf sized buffers with the odd
+ * large one. The heap as it was, a first fit list over one array under one
+ * semaphore, is rebuilt here to compare against, and libc malloc is run as a
+ * reference. Reports the rate, the cost per operation early and late in the run to
+ * show it growing as the heap fragments, failed allocations, and how fragmented
+ * each heap is at the end.
+ *
+ * usage: mem-bench [operations per thread] [threads] [live allocations per thread]
+ */
+
+#include "lwip/sys.h"
+#include "lwip/mem.h"
+#include "lwip/stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MAX_THREADS 16
+#define PHASES 10
+
+/* the heap as it was */
+struct legacy_mem {
+	uint32_t next, prev;
+	uint8_t used;
+};
+
+#define LEGACY_SIZE MEM_SIZE
+#define LEGACY_HDR MEM_ALIGN_SIZE(sizeof(struct legacy_mem))
+#define LEGACY_AT(off) ((struct legacy_mem*)&legacy_ram[off])
+#define LEGACY_OFF(m) ((uint8_t*)(m) - legacy_ram)
+
+static uint8_t* legacy_ram;
+static struct legacy_mem* legacy_lfree;
+static sys_sem_t legacy_sem;
+
+void legacy_init(void) {
+	legacy_ram = calloc(1, LEGACY_SIZE + LEGACY_HDR);
+	LEGACY_AT(0)->next = LEGACY_SIZE;
+	LEGACY_AT(0)->prev = 0;
+	LEGACY_AT(LEGACY_SIZE)->used = 1;
+	LEGACY_AT(LEGACY_SIZE)->next = LEGACY_AT(LEGACY_SIZE)->prev = LEGACY_SIZE;
+	legacy_lfree = LEGACY_AT(0);
+	legacy_sem = sys_sem_new(1);
+}
+
+void legacy_plug_holes(struct legacy_mem* mem) {
+	struct legacy_mem* nmem = LEGACY_AT(mem->next);
+	if (mem != nmem && !nmem->used && mem->next != LEGACY_SIZE) {
+		if (legacy_lfree == nmem) {
+			legacy_lfree = mem;
+		}
+		mem->next = nmem->next;
+		LEGACY_AT(nmem->next)->prev = LEGACY_OFF(mem);
+	}
+	struct legacy_mem* pmem = LEGACY_AT(mem->prev);
+	if (pmem != mem && !pmem->used) {
+		if (legacy_lfree == mem) {
+			legacy_lfree = pmem;
+		}
+		pmem->next = mem->next;
+		LEGACY_AT(mem->next)->prev = LEGACY_OFF(pmem);
+	}
+}
+
+void* legacy_malloc(uint32_t size) {
+	uint32_t ptr, ptr2;
+	size = MEM_ALIGN_SIZE(size);
+
+	sys_arch_sem_wait(legacy_sem, 0);
+	for (ptr = LEGACY_OFF(legacy_lfree); ptr < LEGACY_SIZE; ptr = LEGACY_AT(ptr)->next) {
+		struct legacy_mem* mem = LEGACY_AT(ptr);
+		if (!mem->used && (mem->next - (ptr + LEGACY_HDR) >= size + LEGACY_HDR)) {
+			ptr2 = ptr + LEGACY_HDR + size;
+			struct legacy_mem* mem2 = LEGACY_AT(ptr2);
+			mem2->prev = ptr;
+			mem2->next = mem->next;
+			mem->next = ptr2;
+			if (mem2->next != LEGACY_SIZE) {
+				LEGACY_AT(mem2->next)->prev = ptr2;
+			}
+			mem2->used = 0;
+			mem->used = 1;
+			if (mem == legacy_lfree) {
+				while (legacy_lfree->used && LEGACY_OFF(legacy_lfree) != LEGACY_SIZE) {
+					legacy_lfree = LEGACY_AT(legacy_lfree->next);
+				}
+			}
+			sys_sem_signal(legacy_sem);
+			return (uint8_t*)mem + LEGACY_HDR;
+		}
+	}
+	sys_sem_signal(legacy_sem);
+	return NULL;
+}
+
+void legacy_free(void* rmem) {
+	struct legacy_mem* mem = (struct legacy_mem*)((uint8_t*)rmem - LEGACY_HDR);
+	sys_arch_sem_wait(legacy_sem, 0);
+	mem->used = 0;
+	if (mem < legacy_lfree) {
+		legacy_lfree = mem;
+	}
+	legacy_plug_holes(mem);
+	sys_sem_signal(legacy_sem);
+}
+
+/* free bytes, free blocks and the largest of them */
+void legacy_fragmentation(uint64_t* free_bytes, unsigned int* blocks, uint32_t* largest) {
+	uint32_t ptr;
+	*free_bytes = 0;
+	*blocks = 0;
+	*largest = 0;
+	for (ptr = 0; ptr < LEGACY_SIZE; ptr = LEGACY_AT(ptr)->next) {
+		struct legacy_mem* mem = LEGACY_AT(ptr);
+		if (!mem->used) {
+			uint32_t len = mem->next - ptr - LEGACY_HDR;
+			*free_bytes += len;
+			++*blocks;
+			if (len > *largest) {
+				*largest = len;
+			}
+		}
+	}
+}
+
+enum { MODE_LEGACY, MODE_SLAB, MODE_MALLOC };
+char* mode_names[] = { "legacy", "slab", "malloc" };
+
+struct bench {
+	int mode;
+	unsigned int ops;		/* per thread */
+	unsigned int threads;
+	unsigned int live;		/* per thread */
+	double phase_ns[MAX_THREADS][PHASES];
+	unsigned int failures[MAX_THREADS];
+	pthread_barrier_t churned;	/* everyone done churning, the heap is at its most fragmented */
+	pthread_barrier_t measured;
+};
+typedef struct bench bench;
+
+struct worker_arg {
+	bench* b;
+	unsigned int id;
+};
+
+void* bench_malloc(int mode, uint32_t size) {
+	switch (mode) {
+		case MODE_LEGACY:
+			return legacy_malloc(size);
+		case MODE_SLAB:
+			return mem_malloc(size);
+		default:
+			return malloc(size);
+	}
+}
+
+void bench_free(int mode, void* p) {
+	switch (mode) {
+		case MODE_LEGACY:
+			legacy_free(p);
+			break;
+		case MODE_SLAB:
+			mem_free(p);
+			break;
+		default:
+			free(p);
+			break;
+	}
+}
+
+uint32_t next_rand(uint32_t* state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/* mostly control blocks and pbufs for full sized segments, some large writes */
+uint32_t pick_size(uint32_t* state) {
+	uint32_t r = next_rand(state) % 100;
+	if (r < 60) {
+		return 16 + next_rand(state) % 240;
+	} else if (r < 90) {
+		return 1480 + next_rand(state) % 60;
+	} else if (r < 98) {
+		return 2048 + next_rand(state) % 2048;
+	}
+	return 8192 + next_rand(state) % 12288;
+}
+
+double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+void* worker(void* arg) {
+	struct worker_arg* wa = (struct worker_arg*)arg;
+	bench* b = wa->b;
+	void** slots = calloc(b->live, sizeof(void*));
+	uint32_t state = 2463534242U + wa->id * 7919;
+	unsigned int i, phase;
+
+	for (i = 0; i < b->live; ++i) {
+		slots[i] = bench_malloc(b->mode, pick_size(&state));
+	}
+
+	for (phase = 0; phase < PHASES; ++phase) {
+		double start = now_ns();
+		for (i = 0; i < b->ops / PHASES; ++i) {
+			unsigned int slot = next_rand(&state) % b->live;
+			if (slots[slot]) {
+				bench_free(b->mode, slots[slot]);
+			}
+			uint32_t size = pick_size(&state);
+			slots[slot] = bench_malloc(b->mode, size);
+			if (slots[slot]) {
+				memset(slots[slot], 0, (size < 64) ? size : 64);
+			} else {
+				++b->failures[wa->id];
+			}
+		}
+		b->phase_ns[wa->id][phase] = now_ns() - start;
+	}
+
+	pthread_barrier_wait(&b->churned);
+	pthread_barrier_wait(&b->measured);
+
+	for (i = 0; i < b->live; ++i) {
+		if (slots[i]) {
+			bench_free(b->mode, slots[i]);
+		}
+	}
+	free(slots);
+	return NULL;
+}
+
+void run(bench* b) {
+	pthread_t threads[MAX_THREADS];
+	struct worker_arg args[MAX_THREADS];
+	unsigned int i, failures = 0;
+	double first = 0, last = 0, total = 0;
+
+	memset(b->phase_ns, 0, sizeof(b->phase_ns));
+	memset(b->failures, 0, sizeof(b->failures));
+	pthread_barrier_init(&b->churned, NULL, b->threads + 1);
+	pthread_barrier_init(&b->measured, NULL, b->threads + 1);
+
+	for (i = 0; i < b->threads; ++i) {
+		args[i].b = b;
+		args[i].id = i;
+		pthread_create(&threads[i], NULL, worker, &args[i]);
+	}
+	pthread_barrier_wait(&b->churned);
+
+	for (i = 0; i < b->threads; ++i) {
+		int phase;
+		for (phase = 0; phase < PHASES; ++phase) {
+			total += b->phase_ns[i][phase];
+		}
+		first += b->phase_ns[i][0];
+		last += b->phase_ns[i][PHASES - 1];
+		failures += b->failures[i];
+	}
+	double per_phase = (double)b->threads * (b->ops / PHASES);
+	/* threads run side by side, so the rate is over the mean thread time */
+	printf("%-8s %-12.0f %-12.1f %-12.1f %u\n", mode_names[b->mode],
+		(b->threads * (double)(b->ops / PHASES) * PHASES) / (total / b->threads / 1e9),
+		first / per_phase, last / per_phase, failures);
+
+	if (b->mode == MODE_LEGACY) {
+		uint64_t free_bytes;
+		unsigned int blocks;
+		uint32_t largest;
+		legacy_fragmentation(&free_bytes, &blocks, &largest);
+		printf("         %llu bytes free in %u blocks, largest %u, %.1f%% of the free space unusable for a %u byte request\n",
+			(unsigned long long)free_bytes, blocks, largest,
+			free_bytes ? 100.0 * (free_bytes - largest) / free_bytes : 0.0, largest + 1);
+	} else if (b->mode == MODE_SLAB) {
+		char buf[4096];
+		mem_sprint(buf, sizeof(buf));
+		printf("%s", buf);
+	}
+
+	pthread_barrier_wait(&b->measured);
+	for (i = 0; i < b->threads; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_barrier_destroy(&b->churned);
+	pthread_barrier_destroy(&b->measured);
+}
+
+int main(int argc, char** argv)
+{
+	bench b;
+	int mode;
+
+	memset(&b, 0, sizeof(b));
+	b.ops = (argc > 1) ? atoi(argv[1]) : 200000;
+	b.threads = (argc > 2) ? atoi(argv[2]) : 3;
+	b.live = (argc > 3) ? atoi(argv[3]) : 1500;
+	if (b.threads < 1 || b.threads > MAX_THREADS) {
+		b.threads = 3;
+	}
+	if (b.live < 1) {
+		b.live = 1500;
+	}
+	b.ops -= b.ops % PHASES;
+
+	sys_init();
+	mem_init();
+	legacy_init();
+
+	printf("%u threads each replacing one of %u live allocations %u times, heap %u bytes\n",
+		b.threads, b.live, b.ops, (unsigned int)MEM_SIZE);
+	printf("%-8s %-12s %-12s %-12s %s\n", "Heap", "Ops/s", "ns/op first", "ns/op last", "Failed");
+	for (mode = MODE_LEGACY; mode <= MODE_MALLOC; ++mode) {
+		b.mode = mode;
+		run(&b);
+	}
+	return 0;
+}
@@ -20,6 +20,229 @@
 #include "or_ip.h"
 #include "or_icmp.h"
 #include "or_output.h"
+#include "or_hw_table.h"
+#include "or_trace.h"
+#include "or_export.h"
+
+#include <errno.h>
+
+/* internal side buckets, mixes the ip and port so flows from one host spread out */
+static inline uint32_t nat_int_bucket(uint32_t ip, uint16_t port) {
+	uint32_t h = ip ^ ((uint32_t)port << 16) ^ port;
+	h ^= h >> 16;
+	h *= 0x45D9F3B;
+	h ^= h >> 16;
+	h *= 0x45D9F3B;
+	h ^= h >> 16;
+	return h & (NAT_HASH_SIZE - 1);
+}
+
+/* external ports are handed out in runs, so the port itself spreads them out */
+static inline uint32_t nat_ext_bucket(uint16_t port) {
+	return ntohs(port) & (NAT_HASH_SIZE - 1);
+}
+
+static inline void nat_port_set(router_state *rs, uint16_t port) {
+	rs->nat_port_map[port >> 5] |= (1U << (port & 31));
+}
+
+static inline void nat_port_clear(router_state *rs, uint16_t port) {
+	rs->nat_port_map[port >> 5] &= ~(1U << (port & 31));
+}
+
+/*
+ * Sets up the nat table indices, the ports below NAT_PORT_MIN start out taken
+ * so they are never handed to a flow.
+ */
+void init_nat_table(router_state *rs) {
+	int port;
+
+	rs->nat_int_hash = (nat_entry **)calloc(NAT_HASH_SIZE, sizeof(nat_entry *));
+	rs->nat_ext_hash = (nat_entry **)calloc(NAT_HASH_SIZE, sizeof(nat_entry *));
+	assert(rs->nat_int_hash && rs->nat_ext_hash);
+
+	bzero(rs->nat_port_map, sizeof(rs->nat_port_map));
+	for (port = 0; port < NAT_PORT_MIN; ++port) {
+		nat_port_set(rs, port);
+	}
+}
+
+void destroy_nat_table(router_state *rs) {
+	while (rs->nat_table) {
+		nat_table_remove(rs, (nat_entry *)rs->nat_table->data);
+	}
+	free(rs->nat_int_hash);
+	free(rs->nat_ext_hash);
+}
+
+/*
+ * Takes the first free external port at or after a random one, a word of the map
+ * at a time.
+ * NOT THREAD SAFE - acquire the NAT TABLE LOCK
+ * Returns: the port in network byte order, 0 if every port is taken
+ */
+uint16_t nat_alloc_ext_port(router_state *rs) {
+	uint32_t start = NAT_PORT_MIN + (rand() % (65536 - NAT_PORT_MIN));
+	uint32_t i;
+
+	/* one extra word to come back round to the bits below start */
+	for (i = 0; i <= NAT_PORT_MAP_WORDS; ++i) {
+		uint32_t word = ((start >> 5) + i) % NAT_PORT_MAP_WORDS;
+		uint32_t free_bits = ~rs->nat_port_map[word];
+
+		if (i == 0) {
+			free_bits &= ~0U << (start & 31);
+		}
+
+		if (free_bits) {
+			uint16_t port = (word << 5) + __builtin_ctz(free_bits);
+			nat_port_set(rs, port);
+			return htons(port);
+		}
+	}
+
+	return 0;
+}
+
+/* NOT THREAD SAFE - acquire the NAT TABLE LOCK */
+nat_entry *nat_table_find_int(router_state *rs, struct in_addr ip, uint16_t port) {
+	nat_entry *ne = rs->nat_int_hash[nat_int_bucket(ip.s_addr, port)];
+	while (ne) {
+		if ((ne->nat_int.ip.s_addr == ip.s_addr) && (ne->nat_int.port == port)) {
+			return ne;
+		}
+		ne = ne->int_next;
+	}
+	return NULL;
+}
+
+/* NOT THREAD SAFE - acquire the NAT TABLE LOCK */
+nat_entry *nat_table_find_ext(router_state *rs, struct in_addr ip, uint16_t port) {
+	nat_entry *ne = rs->nat_ext_hash[nat_ext_bucket(port)];
+	while (ne) {
+		if ((ne->nat_ext.ip.s_addr == ip.s_addr) && (ne->nat_ext.port == port)) {
+			return ne;
+		}
+		ne = ne->ext_next;
+	}
+	return NULL;
+}
+
+/*
+ * Adds ne to the table and both indices, and marks its external port taken.
+ * NOT THREAD SAFE - acquire the NAT TABLE LOCK
+ */
+void nat_table_insert(router_state *rs, nat_entry *ne) {
+	uint32_t int_bucket = nat_int_bucket(ne->nat_int.ip.s_addr, ne->nat_int.port);
+	uint32_t ext_bucket = nat_ext_bucket(ne->nat_ext.port);
+
+	node *n = node_create();
+	n->data = (void *)ne;
+	if(rs->nat_table == NULL) {
+		rs->nat_table = n;
+	}
+	else {
+		node_push_back(rs->nat_table, n);
+	}
+	ne->list_node = n;
+
+	ne->int_next = rs->nat_int_hash[int_bucket];
+	rs->nat_int_hash[int_bucket] = ne;
+	ne->ext_next = rs->nat_ext_hash[ext_bucket];
+	rs->nat_ext_hash[ext_bucket] = ne;
+
+	nat_port_set(rs, ntohs(ne->nat_ext.port));
+	++rs->nat_entries;
+	export_stamp(rs, EXPORT_NAT);
+}
+
+/*
+ * Unlinks ne from the table and both indices and frees it. Its external port goes
+ * back to the map unless another entry still uses it.
+ * NOT THREAD SAFE - acquire the NAT TABLE LOCK
+ */
+void nat_table_remove(router_state *rs, nat_entry *ne) {
+	nat_entry **walker = &(rs->nat_int_hash[nat_int_bucket(ne->nat_int.ip.s_addr, ne->nat_int.port)]);
+	while (*walker != ne) {
+		walker = &((*walker)->int_next);
+	}
+	*walker = ne->int_next;
+
+	walker = &(rs->nat_ext_hash[nat_ext_bucket(ne->nat_ext.port)]);
+	while (*walker != ne) {
+		walker = &((*walker)->ext_next);
+	}
+	*walker = ne->ext_next;
+
+	/* static entries may share a port across external ips */
+	uint16_t port = ne->nat_ext.port;
+	int in_use = 0;
+	nat_entry *other;
+	for (other = rs->nat_ext_hash[nat_ext_bucket(port)]; other; other = other->ext_next) {
+		if (other->nat_ext.port == port) {
+			in_use = 1;
+			break;
+		}
+	}
+	if (!in_use && (ntohs(port) >= NAT_PORT_MIN)) {
+		nat_port_clear(rs, ntohs(port));
+	}
+
+	--rs->nat_entries;
+	node_remove(&rs->nat_table, ne->list_node);
+	export_stamp(rs, EXPORT_NAT);
+}
+
+/*
+ * Picks the k entries with the highest avg_hits_per_second in one pass, keeping
+ * the best k seen so far in a min heap, then sorts them busiest first.
+ * NOT THREAD SAFE - acquire the NAT TABLE LOCK
+ * Returns: the number of entries in top, at most k
+ */
+int nat_top_entries(router_state *rs, nat_entry **top, int k) {
+	int num = 0;
+	int i, j;
+	node *cur;
+
+	for (cur = rs->nat_table; cur; cur = cur->next) {
+		nat_entry *ne = (nat_entry *)cur->data;
+
+		if (num < k) {
+			/* sift up */
+			i = num++;
+			while ((i > 0) && (top[(i - 1) / 2]->avg_hits_per_second > ne->avg_hits_per_second)) {
+				top[i] = top[(i - 1) / 2];
+				i = (i - 1) / 2;
+			}
+			top[i] = ne;
+		} else if ((k > 0) && (ne->avg_hits_per_second > top[0]->avg_hits_per_second)) {
+			/* replace the least busy of the top k and sift down */
+			i = 0;
+			while ((j = (2 * i) + 1) < num) {
+				if (((j + 1) < num) && (top[j + 1]->avg_hits_per_second < top[j]->avg_hits_per_second)) {
+					++j;
+				}
+				if (top[j]->avg_hits_per_second >= ne->avg_hits_per_second) {
+					break;
+				}
+				top[i] = top[j];
+				i = j;
+			}
+			top[i] = ne;
+		}
+	}
+
+	/* k is the size of the hw table, an insertion sort is plenty */
+	for (i = 1; i < num; ++i) {
+		nat_entry *ne = top[i];
+		for (j = i; (j > 0) && (top[j - 1]->avg_hits_per_second < ne->avg_hits_per_second); --j) {
+			top[j] = top[j - 1];
+		}
+		top[j] = ne;
+	}
+
+	return num;
+}
 
 /* NOT THREAD SAFE - acquire the NAT TABLE LOCK */
 void process_nat_ext_packet(router_state *rs, const uint8_t *packet, unsigned int len) {
@@ -82,7 +305,7 @@ void process_nat_ext_packet(router_state *rs, const uint8_t *packet, unsigned in
 				break;
 
 			default:
-				printf("Invalid IP Protocol found int the ip header  while processing nat\n");
+				TRACE(TRACE_WARN, "Invalid IP Protocol found int the ip header  while processing nat");
 
 		}
 
@@ -112,9 +335,17 @@ void process_nat_int_packet(router_state *rs, const uint8_t *packet, unsigned in
 			ne = create_nat_table_entry(rs, packet, len, ext_ip);
 		}
 
+		/* every external port is taken, the packet leaves untranslated */
+		if(ne == NULL) {
+			return;
+		}
+
 		/* rewrite src ip and src port */
 		populate_nat_packet(ip, packet, len, ne, NAT_EXTERNAL);
 	}
+	else {
+		return;
+	}
 
 	/* Increment Hits */
 	ne->hits++;
@@ -171,14 +402,10 @@ void process_nat_int_packet(router_state *rs, const uint8_t *packet, unsigned in
 nat_entry *create_nat_table_entry(router_state *rs, const uint8_t *packet, unsigned int len, uint32_t ext_ip) {
 	ip_hdr *ip = get_ip_hdr(packet, len);
 
-	/* Generate a pseudo-random port # for the ext entry */
-	unsigned short port = (unsigned short) rand();
-
-	while(1) {
-		if(port > 1024 && (is_unique_nat_ext_port(rs, port) == 1)) {
-			break;
-		}
-		port = (unsigned short) rand();
+	/* Take a free port for the ext entry */
+	uint16_t port = nat_alloc_ext_port(rs);
+	if(port == 0) {
+		return NULL;
 	}
 
 	nat_entry *ne = (nat_entry *)calloc(1, sizeof(nat_entry));
@@ -191,21 +418,14 @@ nat_entry *create_nat_table_entry(router_state *rs, const uint8_t *packet, unsig
 
 
 	ne->nat_ext.ip.s_addr = ext_ip;
-	ne->nat_ext.port = htons(port);
+	ne->nat_ext.port = port;
 	compute_nat_checksums(&(ne->nat_ext));
 
 	ne->nat_int.ip.s_addr = ip->ip_src.s_addr;
 	ne->nat_int.port = get_src_port_number(packet, len, ip->ip_p);
 	compute_nat_checksums(&(ne->nat_int));
 
-	node *n = (node *)calloc(1, sizeof(node));
-	n->data = (void *)ne;
-	if(rs->nat_table == NULL) {
-		rs->nat_table = n;
-	}
-	else {
-		node_push_back(rs->nat_table, n);
-	}
+	nat_table_insert(rs, ne);
 
 
 	/* signal the thread that we have a new entry
@@ -224,27 +444,16 @@ nat_entry *get_nat_table_entry(router_state *rs, const uint8_t *packet, unsigned
 	assert(packet);
 
 	nat_ip_port_pair pair;
-	node *n = rs->nat_table;
-	nat_entry *ne = NULL;
-	int match_found = 0;
 
-	bzero(&pair, sizeof(nat_ip_port_pair));
 	get_nat_ip_port_pair(&pair, packet, len, nat_type);
-	while(n) {
-		ne = (nat_entry *)n->data;
-		if(found_nat_table_match(ne, &pair, nat_type) == 1) {
-			match_found = 1;
-			break;
-		}
-		n = n->next;
-	}
-
-	if(match_found == 1) {
-		return ne;
+	if(nat_type == NAT_EXTERNAL) {
+		return nat_table_find_ext(rs, pair.ip, pair.port);
 	}
-	else {
-		return NULL;
+	else if(nat_type == NAT_INTERNAL) {
+		return nat_table_find_int(rs, pair.ip, pair.port);
 	}
+
+	return NULL;
 }
 
 
@@ -347,7 +556,7 @@ uint16_t get_src_port_number(const uint8_t *packet, unsigned int len, uint8_t ip
 			return get_src_port_number_from_icmp(packet, len);
 
 		default:
-			printf("Invalid IP PROTOCOL passed as argument\n");
+			TRACE(TRACE_ERROR, "Invalid IP PROTOCOL passed as argument");
 			return 0;
 	}
 }
@@ -389,24 +598,17 @@ int found_nat_table_match(nat_entry *ne, nat_ip_port_pair *nipp, int nat_type) {
 			}
 			break;
 		default:
-			printf("Invalid NAT type argument cannot match the pair (ip, port) into the nat table\n");
+			TRACE(TRACE_ERROR, "Invalid NAT type argument cannot match the pair (ip, port) into the nat table");
 			return 0;
 			break;
 	}
 }
 
 
+/* port in network byte order, NOT THREAD SAFE - acquire the NAT TABLE LOCK */
 int is_unique_nat_ext_port(router_state *rs, uint16_t port) {
-
-	node *n = rs->nat_table;
-	while(n) {
-		nat_entry *ne = (nat_entry *)n->data;
-		if(ne->nat_ext.port == port) {
-			return 0;
-		}
-		n = n->next;
-	}
-	return 1;
+	port = ntohs(port);
+	return (rs->nat_port_map[port >> 5] & (1U << (port & 31))) ? 0 : 1;
 }
 
 
@@ -561,6 +763,7 @@ void cli_nat_set(router_state *rs, cli_request *req) {
 		lock_if_list_wr(rs);
 		iface_entry *ie = get_iface(rs, iface);
 		ie->is_wan = 1;
+		export_stamp(rs, EXPORT_IFACES);
 
 		if (rs->is_netfpga) {
 			/*
@@ -584,6 +787,7 @@ void cli_nat_set(router_state *rs, cli_request *req) {
 			iface->is_wan = 0;
 			cur = cur->next;
 		}
+		export_stamp(rs, EXPORT_IFACES);
 
 		if (rs->is_netfpga) {
 			//writeReg(&rs->netfpga, ROUTER_OP_LUT_NAT_WAN_INTERFACE, 0);
@@ -606,18 +810,13 @@ void cli_nat_reset(router_state *rs, cli_request *req) {
 
 	lock_nat_table(rs);
 	/* blast out the software nat table */
-	node* cur = rs->nat_table;
-	node* next;
-	while(cur) {
-		next = cur->next;
-		node_remove(&rs->nat_table, cur);
-		cur = next;
+	while(rs->nat_table) {
+		nat_table_remove(rs, (nat_entry *)rs->nat_table->data);
 	}
 
 	/* blast out the hw nat table */
-	int i;
-	for (i = 0; i < 16; ++i) {
-		write_nat_table_zero_to_hw(rs, i);
+	if (rs->is_netfpga) {
+		write_nat_table_to_hw(rs);
 	}
 
 	unlock_nat_table(rs);
@@ -675,34 +874,12 @@ void cli_nat_add(router_state *rs, cli_request *req) {
 	/* check if an existing NAT entry matches this external ip/port */
 	lock_nat_table(rs);
 
-	node* cur = rs->nat_table;
-	node* result = NULL;
-	while (cur) {
-		nat_entry* ne_existing = (nat_entry*)cur->data;
-		if ((ne_existing->nat_ext.ip.s_addr == ne->nat_ext.ip.s_addr) &&
-				(ne_existing->nat_ext.port == ne->nat_ext.port)) {
-
-			result = cur;
-			break;
-		}
-		cur = cur->next;
-	}
-
-	/* if there is an existing entry, swap data */
-	if (result) {
-		free(result->data);
-		result->data = ne;
-	} else {
-		/* else append */
-		node *n = (node *)calloc(1, sizeof(node));
-		n->data = (void *)ne;
-
-		if (rs->nat_table == NULL) {
-			rs->nat_table = n;
-		}	else {
-			node_push_back(rs->nat_table, n);
-		}
+	/* if there is an existing entry, replace it */
+	nat_entry* ne_existing = nat_table_find_ext(rs, ne->nat_ext.ip, ne->nat_ext.port);
+	if (ne_existing) {
+		nat_table_remove(rs, ne_existing);
 	}
+	nat_table_insert(rs, ne);
 
 	unlock_nat_table(rs);
 
@@ -739,22 +916,10 @@ void cli_nat_del(router_state *rs, cli_request *req) {
 	/* check if an existing NAT entry matches this external ip/port */
 	lock_nat_table(rs);
 
-	node* cur = rs->nat_table;
-	node* result = NULL;
-	while (cur) {
-		nat_entry* ne_existing = (nat_entry*)cur->data;
-		if ((ne_existing->nat_ext.ip.s_addr == ip.s_addr) &&
-				(ne_existing->nat_ext.port == port)) {
-
-			result = cur;
-			break;
-		}
-		cur = cur->next;
-	}
-
 	/* if there is an existing entry delete */
+	nat_entry* result = nat_table_find_ext(rs, ip, port);
 	if (result) {
-		node_remove(&rs->nat_table, result);
+		nat_table_remove(rs, result);
 	}
 
 	unlock_nat_table(rs);
@@ -771,94 +936,68 @@ void cli_nat_del(router_state *rs, cli_request *req) {
 	}
 }
 
-void* nat_maintenance_thread(void* arg) {
+/*
+ * Timer callback, once a second updates the rolling averages, expires idle entries
+ * and pushes the busiest entries down to hardware. Holds the nat table lock for
+ * the pass.
+ */
+unsigned int nat_maintenance_tick(void* arg) {
 	router_state* rs = (router_state*)arg;
-	struct timespec wake_up_time;
-	struct timeval cur_timeval;
 	time_t now;
+	int hits_moved = 0;
 
-	while (1) {
-		/* Determine the time when to wake up next */
-		gettimeofday(&cur_timeval, NULL);
-		wake_up_time.tv_sec = cur_timeval.tv_sec + 1;
-		wake_up_time.tv_nsec = cur_timeval.tv_usec;
-
-		/* sleep */
-		pthread_cond_timedwait(rs->dijkstra_cond, rs->dijkstra_mutex, &wake_up_time);
-
-		/* update our current time */
-		time(&now);
+	lock_nat_table(rs);
 
-		/* update the rolling average, get hits from hw if exist */
-		node* cur = rs->nat_table;
-		node* next;
-		while (cur) {
-			next = cur->next;
-			nat_entry* ne = (nat_entry*)cur->data;
+	/* update our current time */
+	time(&now);
 
-			/*
-			if (rs->is_netfpga && (ne->hw_row != 0xFF)) {
-				ne->hits += (get_hw_hits(rs, ne->hw_row) - ne->last_hits);
-			}
-			*/
+	/* update the rolling average, get hits from hw if exist */
+	node* cur = rs->nat_table;
+	node* next;
+	while (cur) {
+		next = cur->next;
+		nat_entry* ne = (nat_entry*)cur->data;
 
-			/* update our moving average */
-			double cur_avg = ((double)(ne->hits - ne->last_hits)) / difftime(now, ne->last_hits_time);
-			ne->avg_hits_per_second = (0.75 * cur_avg) + (0.25 * ne->avg_hits_per_second);
+		/*
+		if (rs->is_netfpga && (ne->hw_row != 0xFF)) {
+			ne->hits += (get_hw_hits(rs, ne->hw_row) - ne->last_hits);
+		}
+		*/
 
-			/* update last hits */
-			if (ne->last_hits != ne->hits) {
-				ne->last_hits_time = now;
-				ne->last_hits = ne->hits;
-			}
+		/* update our moving average */
+		double cur_avg = ((double)(ne->hits - ne->last_hits)) / difftime(now, ne->last_hits_time);
+		ne->avg_hits_per_second = (0.75 * cur_avg) + (0.25 * ne->avg_hits_per_second);
 
-			/* expire if not hits for a long time */
-			if (!ne->is_static && (difftime(now, ne->last_hits_time) > rs->nat_timeout)) {
-				node_remove(&rs->nat_table, cur);
-			}
+		/* update last hits */
+		if (ne->last_hits != ne->hits) {
+			ne->last_hits_time = now;
+			ne->last_hits = ne->hits;
+			hits_moved = 1;
+		}
 
-			/* reset the hw row because we will be pushing back down to hw shortly */
-			ne->hw_row = 0xFF;
+		/* reset the hw row because we will be pushing back down to hw shortly */
+		ne->hw_row = 0xFF;
 
-			cur = next;
+		/* expire if not hits for a long time */
+		if (!ne->is_static && (difftime(now, ne->last_hits_time) > rs->nat_timeout)) {
+			nat_table_remove(rs, ne);
 		}
 
-		/* bubble sort by avg hits per second */
-		int swapped = 0;
-		do {
-			swapped = 0;
-			node* cur = rs->nat_table;
-			while (cur && cur->next) {
-				nat_entry* a = (nat_entry*)cur->data;
-				nat_entry* b = (nat_entry*)cur->next->data;
-				if (a->avg_hits_per_second < b->avg_hits_per_second) {
-					cur->data = b;
-					cur->next->data = a;
-					swapped = 1;
-				}
+		cur = next;
+	}
 
-				cur = cur->next;
-			}
-		} while (swapped);
+	/* the hit counts and rates of the export are as of the last stamp */
+	if (hits_moved) {
+		export_stamp(rs, EXPORT_NAT);
+	}
 
-		/* write to hw if we are running hw */
-		if (rs->is_netfpga) {
-			int i = 0;
-			node* cur = rs->nat_table;
-
-  		for(i=0; i<16; ++i) {
-	  		if(cur) {
-	    		nat_entry *nat = (nat_entry *)cur->data;
-	    		nat->hw_row = i;
-					write_nat_table_entry_to_hw(rs, nat, i);
-					cur = cur->next;
-				} else {
-					write_nat_table_zero_to_hw(rs, i);
-				}
-			}
-		}
+	/* write to hw if we are running hw */
+	if (rs->is_netfpga) {
+		write_nat_table_to_hw(rs);
 	}
-	return NULL;
+
+	unlock_nat_table(rs);
+	return 1000;
 }
 
 uint32_t get_hw_hits(router_state *rs, uint8_t row) {
@@ -872,42 +1011,63 @@ uint32_t get_hw_hits(router_state *rs, uint8_t row) {
 }
 
 
-void write_nat_table_entry_to_hw(router_state *rs, nat_entry *nat, uint8_t row) {
+/*
+ * Pushes the busiest NAT_HW_TABLE_DEPTH entries by avg_hits_per_second down to
+ * hardware. An entry that stays in the top set keeps its row, so only entries
+ * entering or leaving it cost register writes.
+ */
+void write_nat_table_to_hw(router_state *rs) {
+	uint32_t rows[NAT_HW_TABLE_DEPTH * NAT_HW_WIDTH];
+	nat_entry *entries[NAT_HW_TABLE_DEPTH];
+	int placement[NAT_HW_TABLE_DEPTH];
+	int i, num_rows;
+
+	bzero(rows, sizeof(rows));
+	num_rows = nat_top_entries(rs, entries, NAT_HW_TABLE_DEPTH);
+	for (i = 0; i < num_rows; ++i) {
+		nat_entry *nat = entries[i];
+		uint32_t *row = rows + (i * NAT_HW_WIDTH);
+		row[0] = ntohl(nat->nat_int.ip.s_addr);
+		row[1] = ntohs(nat->nat_int.port);
+		row[2] = ntohs(nat->nat_int.checksum);
+		row[3] = ntohl(nat->nat_ext.ip.s_addr);
+		row[4] = ntohs(nat->nat_ext.port);
+		row[5] = ntohs(nat->nat_ext.checksum);
+	}
+
+	hw_table_sync(rs, rs->nat_table_hw, rows, NULL, num_rows, placement);
+
+	for (i = 0; i < num_rows; ++i) {
+		entries[i]->hw_row = placement[i];
+	}
+}
+
+
+/*
+ * Row writer for rs->nat_table_hw
+ */
+void write_nat_table_row_to_hw(router_state *rs, int row, const uint32_t *words) {
 
 	/* write int ip */
-	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_INT_IP_REG, ntohl(nat->nat_int.ip.s_addr));
+	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_INT_IP_REG, words[0]);
 	/* write int port */
-	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_INT_PORT_REG, ntohs(nat->nat_int.port));
+	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_INT_PORT_REG, words[1]);
 	/* write int checksum */
-	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_INT_CHKSUM_REG, ntohs(nat->nat_int.checksum));
+	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_INT_CHKSUM_REG, words[2]);
 	/* write ext ip */
-	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_EXT_IP_REG, ntohl(nat->nat_ext.ip.s_addr));
+	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_EXT_IP_REG, words[3]);
 	/* write ext port */
-	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_EXT_PORT_REG, ntohs(nat->nat_ext.port));
+	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_EXT_PORT_REG, words[4]);
 	/* write ext checksum */
-	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_EXT_CHKSUM_REG, ntohs(nat->nat_ext.checksum));
-	/* write the numbe of hits */
-	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_HIT_REG, ntohl(nat->hits));
+	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_EXT_CHKSUM_REG, words[5]);
+	/* a rewritten row starts counting hits from zero */
+	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_HIT_REG, 0);
 	/* write the row number */
 	//writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_WR_ADDR_REG, row);
 
 }
 
 
-void write_nat_table_zero_to_hw(router_state *rs, uint8_t row) {
-	/*
-	writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_INT_IP_REG, 0);
-	writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_INT_PORT_REG, 0);
-	writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_INT_CHKSUM_REG, 0);
-	writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_EXT_IP_REG, 0);
-	writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_EXT_PORT_REG, 0);
-	writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_EXT_CHKSUM_REG, 0);
-	writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_HIT_REG, 0);
-	writeReg(&(rs->netfpga), ROUTER_OP_LUT_NAT_WR_ADDR_REG, row);
-	*/
-}
-
-
 void lock_nat_table(router_state *rs) {
 	assert(rs);
 	if(pthread_mutex_lock(rs->nat_table_mutex) != 0) {
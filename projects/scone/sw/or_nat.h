@@ -9,6 +9,19 @@
 
 #include "or_data_types.h"
 
+#define NAT_HW_TABLE_DEPTH 16
+/* int ip, int port, int checksum, ext ip, ext port, ext checksum */
+#define NAT_HW_WIDTH 6
+
+void init_nat_table(router_state *rs);
+void destroy_nat_table(router_state *rs);
+void nat_table_insert(router_state *rs, nat_entry *ne);
+void nat_table_remove(router_state *rs, nat_entry *ne);
+nat_entry *nat_table_find_int(router_state *rs, struct in_addr ip, uint16_t port);
+nat_entry *nat_table_find_ext(router_state *rs, struct in_addr ip, uint16_t port);
+uint16_t nat_alloc_ext_port(router_state *rs);
+int nat_top_entries(router_state *rs, nat_entry **top, int k);
+
 void process_nat_ext_packet(router_state *rs, const uint8_t *packet, unsigned int len);
 void process_nat_int_packet(router_state *rs, const uint8_t *packet, unsigned int len, uint32_t ext_ip);
 
@@ -38,9 +51,9 @@ uint16_t get_nat_echo_id_from_icmp_data(const uint8_t *packet, unsigned int len)
 void compute_nat_checksums(nat_ip_port_pair *pair);
 uint16_t nat_checksum(uint16_t old, uint16_t pos, uint16_t neg);
 
-void* nat_maintenance_thread(void* arg);
-void write_nat_table_entry_to_hw(router_state *rs, nat_entry *ne, uint8_t row);
-void write_nat_table_zero_to_hw(router_state *rs, uint8_t row);
+unsigned int nat_maintenance_tick(void* arg);
+void write_nat_table_to_hw(router_state *rs);
+void write_nat_table_row_to_hw(router_state *rs, int row, const uint32_t *words);
 uint32_t get_hw_hits(router_state *rs, uint8_t row);
 
 
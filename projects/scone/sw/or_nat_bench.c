@@ -0,0 +1,206 @@
+/*
+ * Measures the nat table as the number of flows grows. Each row fills a table
+ * with tcp flows from a /16 of internal hosts and times, against the old way:
+ * an outbound lookup (list scan versus the internal index), handing out an
+ * external port (random probing checked against every entry versus the free
+ * port bitmap) and choosing the hardware rows (bubble sort of the whole table
+ * versus the top k selection).
+ *
+ * usage: nat-bench [max_flows] [lookups]
+ */
+
+#include "or_nat.h"
+#include "or_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#define EXT_IP 0xC0A80001	/* 192.168.0.1 */
+
+volatile unsigned int sink = 0;
+
+double elapsed_ns(struct timeval* start, struct timeval* end) {
+	return ((end->tv_sec - start->tv_sec) * 1e9) + ((end->tv_usec - start->tv_usec) * 1e3);
+}
+
+/* an outbound tcp segment of flow i */
+void build_packet(uint8_t* packet, int i) {
+	bzero(packet, ETH_HDR_LEN + sizeof(ip_hdr) + sizeof(nat_tcp_hdr));
+	ip_hdr* ip = (ip_hdr*)(packet + ETH_HDR_LEN);
+	ip->ip_v = 4;
+	ip->ip_hl = 5;
+	ip->ip_p = IP_PROTO_TCP;
+	ip->ip_src.s_addr = htonl((10 << 24) | (i & 0xFFFF));
+	ip->ip_dst.s_addr = htonl(0x08080808);
+
+	nat_tcp_hdr* tcp = (nat_tcp_hdr*)(packet + ETH_HDR_LEN + sizeof(ip_hdr));
+	tcp->tcp_sport = htons(1024 + (i >> 16));
+	tcp->tcp_dport = htons(80);
+}
+
+/* the old get_nat_table_entry */
+nat_entry* list_lookup(router_state* rs, const uint8_t* packet, unsigned int len) {
+	nat_ip_port_pair pair;
+	node* n;
+
+	get_nat_ip_port_pair(&pair, packet, len, NAT_INTERNAL);
+	for (n = rs->nat_table; n; n = n->next) {
+		if (found_nat_table_match((nat_entry*)n->data, &pair, NAT_INTERNAL) == 1) {
+			return (nat_entry*)n->data;
+		}
+	}
+	return NULL;
+}
+
+/* the old port choice in create_nat_table_entry with the old is_unique_nat_ext_port */
+uint16_t probe_port(router_state* rs) {
+	while (1) {
+		unsigned short port = (unsigned short)rand();
+		if (port > 1024) {
+			node* n;
+			for (n = rs->nat_table; n; n = n->next) {
+				if (((nat_entry*)n->data)->nat_ext.port == htons(port)) {
+					break;
+				}
+			}
+			if (!n) {
+				return htons(port);
+			}
+		}
+	}
+}
+
+/* the old bubble sort in nat_maintenance_thread, on a copy of the list */
+void bubble_sort(node* list) {
+	int swapped;
+	do {
+		swapped = 0;
+		node* cur = list;
+		while (cur && cur->next) {
+			nat_entry* a = (nat_entry*)cur->data;
+			nat_entry* b = (nat_entry*)cur->next->data;
+			if (a->avg_hits_per_second < b->avg_hits_per_second) {
+				cur->data = b;
+				cur->next->data = a;
+				swapped = 1;
+			}
+			cur = cur->next;
+		}
+	} while (swapped);
+}
+
+void run(int num_flows, int num_lookups) {
+	router_state* rs = (router_state*)calloc(1, sizeof(router_state));
+	rs->nat_table_cond = (pthread_cond_t*)malloc(sizeof(pthread_cond_t));
+	pthread_cond_init(rs->nat_table_cond, NULL);
+	init_nat_table(rs);
+
+	unsigned int len = ETH_HDR_LEN + sizeof(ip_hdr) + sizeof(nat_tcp_hdr);
+	uint8_t packet[ETH_HDR_LEN + sizeof(ip_hdr) + sizeof(nat_tcp_hdr)];
+	struct timeval start, end;
+	unsigned int seed = 1;
+	int i;
+
+	srand(1);
+	for (i = 0; i < num_flows; ++i) {
+		build_packet(packet, i);
+		nat_entry* ne = create_nat_table_entry(rs, packet, len, htonl(EXT_IP));
+		ne->avg_hits_per_second = rand_r(&seed) % 10000;
+	}
+
+	/* lookups */
+	int list_lookups = (num_flows > 4096) ? (num_lookups / 16) : num_lookups;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < list_lookups; ++i) {
+		build_packet(packet, rand_r(&seed) % num_flows);
+		sink += list_lookup(rs, packet, len)->hits;
+	}
+	gettimeofday(&end, NULL);
+	double list_ns = elapsed_ns(&start, &end) / list_lookups;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_lookups; ++i) {
+		build_packet(packet, rand_r(&seed) % num_flows);
+		sink += get_nat_table_entry(rs, packet, len, NAT_INTERNAL)->hits;
+	}
+	gettimeofday(&end, NULL);
+	double hash_ns = elapsed_ns(&start, &end) / num_lookups;
+
+	/* external ports, each one handed back so the fill stays the same */
+	int num_ports = 1000;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_ports; ++i) {
+		sink += probe_port(rs);
+	}
+	gettimeofday(&end, NULL);
+	double probe_ns = elapsed_ns(&start, &end) / num_ports;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_ports; ++i) {
+		uint16_t port = ntohs(nat_alloc_ext_port(rs));
+		rs->nat_port_map[port >> 5] &= ~(1U << (port & 31));
+		sink += port;
+	}
+	gettimeofday(&end, NULL);
+	double bitmap_ns = elapsed_ns(&start, &end) / num_ports;
+
+	/* hardware row choice, the sort runs on a copy so both see the same order */
+	node* copy = NULL;
+	node* n;
+	for (n = rs->nat_table; n; n = n->next) {
+		node* c = node_create();
+		c->data = n->data;
+		c->next = copy;
+		copy = c;
+	}
+
+	gettimeofday(&start, NULL);
+	bubble_sort(copy);
+	gettimeofday(&end, NULL);
+	double sort_ms = elapsed_ns(&start, &end) / 1e6;
+
+	nat_entry* top[NAT_HW_TABLE_DEPTH];
+	gettimeofday(&start, NULL);
+	int num_top = nat_top_entries(rs, top, NAT_HW_TABLE_DEPTH);
+	gettimeofday(&end, NULL);
+	double topk_ms = elapsed_ns(&start, &end) / 1e6;
+
+	/* both have to agree on the busiest entries */
+	for (i = 0, n = copy; i < num_top; ++i, n = n->next) {
+		if (((nat_entry*)n->data)->avg_hits_per_second != top[i]->avg_hits_per_second) {
+			printf("top k mismatch at %i\n", i);
+			break;
+		}
+	}
+
+	printf("%-8i %-12.1f %-12.1f %-12.1f %-12.1f %-12.3f %.3f\n", num_flows, list_ns, hash_ns,
+		probe_ns, bitmap_ns, sort_ms, topk_ms);
+
+	while (copy) {
+		n = copy->next;
+		free(copy);
+		copy = n;
+	}
+	destroy_nat_table(rs);
+	pthread_cond_destroy(rs->nat_table_cond);
+	free(rs->nat_table_cond);
+	free(rs);
+}
+
+int main(int argc, char** argv)
+{
+	int max_flows = (argc > 1) ? atoi(argv[1]) : 16384;
+	int num_lookups = (argc > 2) ? atoi(argv[2]) : 200000;
+	int num_flows;
+
+	printf("%-8s %-12s %-12s %-12s %-12s %-12s %s\n", "Flows", "List ns/op", "Hash ns/op",
+		"Probe ns/op", "Bitmap ns/op", "Sort ms", "Top k ms");
+	for (num_flows = 256; num_flows <= max_flows; num_flows *= 4) {
+		run(num_flows, num_lookups);
+	}
+
+	return 0;
+}
@@ -19,6 +19,7 @@
 #include "reg_defines.h"
 #include "sr_dumper.h"
 #include "or_utils.h"
+#include "or_pktio.h"
 
 unsigned char getPortNumber(char* name) {
 	if (strcmp(ETH0, name) == 0) {
@@ -82,64 +83,35 @@ void getIfaceFromOneHotPortNumber(char *name, unsigned int len, unsigned int por
 	}
 }
 
-void netfpga_input(struct sr_instance* sr) {
-	router_state* rs = get_router_state(sr);
-	int i;
+/*
+ * Handler for the packet I/O engine, arg is the sr_instance
+ */
+void netfpga_input_handler(void* arg, int port, uint8_t* packet, unsigned int len) {
+	struct sr_instance* sr = (struct sr_instance*)arg;
 	char* internal_names[4] = {"eth0", "eth1", "eth2", "eth3"};
 
-	/* setup select */
-	fd_set read_set;
-	FD_ZERO(&read_set);
-	int READ_BUF_SIZE = 16384;
-	unsigned char readBuf[READ_BUF_SIZE];
+	/* log packet */
+	sr_log_packet_iface(sr, packet, len, internal_names[port], SR_LOG_DIR_IN);
 
-	while (1) {
-		for (i = 0; i < 4; ++i) {
-			FD_SET(rs->raw_sockets[i], &read_set);
-		}
+	/* send packet */
+	sr_integ_input(sr, packet, len, internal_names[port]);
+}
 
-		struct timeval t;
-		t.tv_usec = 500; // timeout every half a millisecond
+void netfpga_input(struct sr_instance* sr) {
+	router_state* rs = get_router_state(sr);
 
-		if (select(getMax(rs->raw_sockets, 4)+1, &read_set, NULL, NULL, NULL) < 0) {
-			perror("select");
+	while (1) {
+		if (pktio_poll(rs->pktio, -1) < 0) {
+			perror("epoll_wait");
 			exit(1);
 		}
-
-		for (i = 0; i < 4; ++i) {
-			if (FD_ISSET(rs->raw_sockets[i], &read_set)) {
-				// assume each read is a full packet
-				int read_bytes = read(rs->raw_sockets[i], readBuf, READ_BUF_SIZE);
-
-				/* log packet */
-				pthread_mutex_lock(rs->log_dumper_mutex);
-				sr_log_packet(sr, (unsigned char*)readBuf, read_bytes);
-				pthread_mutex_unlock(rs->log_dumper_mutex);
-
-				/* send packet */
-				sr_integ_input(sr, readBuf, read_bytes, internal_names[i]);
-			}
-		}
-
 	}
-
 }
 
 void netfpga_input_callback(unsigned char* arg, const struct pcap_pkthdr * pkt_hdr, unsigned char const* packet) {
 	netfpga_input_arg* input_arg = (netfpga_input_arg*)arg;
-	router_state* rs = input_arg->rs;
-	struct sr_instance* sr = rs->sr;
-
-
-	char* internal_names[4] = {"eth0", "eth1", "eth2", "eth3"};
 
-	/* log packet */
-	pthread_mutex_lock(rs->log_dumper_mutex);
-	sr_log_packet(sr, (unsigned char*)packet, pkt_hdr->caplen);
-	pthread_mutex_unlock(rs->log_dumper_mutex);
-
-	/* send packet */
-	sr_integ_input(sr, packet, pkt_hdr->caplen, internal_names[input_arg->interface_num]);
+	netfpga_input_handler(input_arg->rs->sr, input_arg->interface_num, (uint8_t*)packet, pkt_hdr->caplen);
 }
 
 
@@ -164,14 +136,10 @@ void* netfpga_input_threaded(void* arg) {
 
 int netfpga_output(struct sr_instance* sr, uint8_t* packet, unsigned int len, const char* iface) {
 	router_state* rs = get_router_state(sr);
-	int written_length = 0;
 	int i = 0;
 
 	/* log the packet */
-	pthread_mutex_lock(rs->log_dumper_mutex);
-	sr_log_packet(sr, packet, len);
-	pthread_mutex_unlock(rs->log_dumper_mutex);
-
+	sr_log_packet_iface(sr, packet, len, iface, SR_LOG_DIR_OUT);
 
 	char* internal_names[4] = {"eth0", "eth1", "eth2", "eth3"};
 	for (i = 0; i < 4; ++i) {
@@ -180,35 +148,11 @@ int netfpga_output(struct sr_instance* sr, uint8_t* packet, unsigned int len, co
 		}
 	}
 
-	/* setup select */
-	fd_set write_set;
-	FD_ZERO(&write_set);
-
-	while (written_length < len) {
-		FD_SET(rs->raw_sockets[i], &write_set);
-
-		struct timeval t;
-		t.tv_sec = 0;
-		t.tv_usec = 500; // timeout every half a millisecond
-
-		if (select(rs->raw_sockets[i]+1, NULL, &write_set, NULL, NULL) < 0) {
-			perror("select");
-			exit(1);
-		}
-
-		if (FD_ISSET(rs->raw_sockets[i], &write_set)) {
-			int w = 0;
-			if ((w = write(rs->raw_sockets[i], packet+written_length, len-written_length)) == -1) {
-				perror("write");
-				exit(1);
-			}
-			written_length += w;
-		}
-
+	/* queued behind the current batch if called from the input thread, written now otherwise */
+	if (pktio_send(rs->pktio, i, packet, len)) {
+		return -1;
 	}
 
-
-
 	/*
 	if ((written_length = libnet_adv_write_link((libnet_t*)rs->libnet_context[i], packet, len)) != len) {
 		printf("Error writing packet using libnet, expected length: %i returned length: %i\n", len, written_length);
@@ -377,61 +321,6 @@ unsigned int set_wr_ctrl_word(nf2device* nf2, unsigned char port, unsigned int v
 	return retval;
 }
 
-/*
- * Stats thread for the NETFPGA Ports
- */
-void* netfpga_stats(void* arg) {
-	router_state* rs = (router_state*)arg;
-	struct timeval now;
-	uint32_t rx_packets, tx_packets, rx_bytes, tx_bytes;
-	uint32_t packets_diff, bytes_diff;
-	long double timeDiff;
-	int i;
-
-	while (1) {
-    gettimeofday(&now, NULL);
-		if (now.tv_sec == rs->stats_last_time.tv_sec) {
-			/* must be a later usec time */
-			timeDiff = (((long double)(now.tv_usec - rs->stats_last_time.tv_usec)) / (long double)1000000);
-		} else {
-			timeDiff = (now.tv_sec - rs->stats_last_time.tv_sec - 1) + ((long double)((1000000 - rs->stats_last_time.tv_usec) + now.tv_usec) / (long double)1000000);
-		}
-
-		lock_netfpga_stats(rs);
-
-		for (i = 0; i < 8; ++i) {
-			/* read all the values */
-			rx_packets = get_rx_queue_num_pkts_received(&rs->netfpga, i);
-			tx_packets = get_tx_queue_num_pkts_sent(&rs->netfpga, i);
-			rx_bytes = get_rx_queue_num_bytes_received(&rs->netfpga, i);
-			tx_bytes = get_tx_queue_num_bytes_sent(&rs->netfpga, i);
-
-			/* compute differences */
-			packets_diff = (rx_packets - rs->stats_last[i][0]) + (tx_packets - rs->stats_last[i][1]);
-			bytes_diff = (rx_bytes - rs->stats_last[i][2]) + (tx_bytes - rs->stats_last[i][3]);
-
-			/* bytes_diff will be in kB */
-			bytes_diff /= 1000;
-
-			/* update averages */
-			rs->stats_avg[i][0] = ((double)packets_diff) / timeDiff;
-			rs->stats_avg[i][1] = ((double)bytes_diff) / timeDiff;
-
-			/* store data back */
-			rs->stats_last[i][0] = rx_packets;
-			rs->stats_last[i][1] = tx_packets;
-			rs->stats_last[i][2] = rx_bytes;
-			rs->stats_last[i][3] = tx_bytes;
-			rs->stats_last_time = now;
-		}
-
-		unlock_netfpga_stats(rs);
-		usleep(500000);
-	}
-
-	return NULL;
-}
-
 /* IS THREADSAFE */
 void trigger_local_ip_filters_change(router_state* rs) {
 	/* Bubble sort by name*/
@@ -566,202 +455,6 @@ void unlock_netfpga_stats(router_state* rs) {
 }
 
 
-unsigned int get_rx_queue_num_pkts_received(nf2device* nf2, unsigned char port) {
-	unsigned int retval = 0;
-	switch(port) {
-		case 0:
-			readReg(nf2, MAC_GRP_0_RX_QUEUE_NUM_PKTS_STORED_REG, &retval);
-			break;
-		case 1:
-			readReg(nf2, MAC_GRP_1_RX_QUEUE_NUM_PKTS_STORED_REG, &retval);
-			break;
-		case 2:
-			readReg(nf2, MAC_GRP_2_RX_QUEUE_NUM_PKTS_STORED_REG, &retval);
-			break;
-		case 3:
-			readReg(nf2, MAC_GRP_3_RX_QUEUE_NUM_PKTS_STORED_REG, &retval);
-			break;
-/*		case 4:
-			readReg(nf2, CPU_REG_Q_0_RX_NUM_PKTS_RCVD_REG, &retval);
-			break;
-		case 5:
-			readReg(nf2, CPU_REG_Q_1_RX_NUM_PKTS_RCVD_REG, &retval);
-			break;
-		case 6:
-			readReg(nf2, CPU_REG_Q_2_RX_NUM_PKTS_RCVD_REG, &retval);
-			break;
-		case 7:
-			readReg(nf2, CPU_REG_Q_3_RX_NUM_PKTS_RCVD_REG, &retval);
-			break;
-*/
-	}
-	return retval;
-}
-
-unsigned int get_tx_queue_num_pkts_sent(nf2device* nf2, unsigned char port) {
-	unsigned int retval = 0;
-	switch(port) {
-		case 0:
-			readReg(nf2, MAC_GRP_0_TX_QUEUE_NUM_PKTS_SENT_REG, &retval);
-			break;
-		case 1:
-			readReg(nf2, MAC_GRP_1_TX_QUEUE_NUM_PKTS_SENT_REG, &retval);
-			break;
-		case 2:
-			readReg(nf2, MAC_GRP_2_TX_QUEUE_NUM_PKTS_SENT_REG, &retval);
-			break;
-		case 3:
-			readReg(nf2, MAC_GRP_3_TX_QUEUE_NUM_PKTS_SENT_REG, &retval);
-			break;
-/*		case 4:
-			readReg(nf2, CPU_REG_Q_0_TX_NUM_PKTS_SENT_REG, &retval);
-			break;
-		case 5:
-			readReg(nf2, CPU_REG_Q_1_TX_NUM_PKTS_SENT_REG, &retval);
-			break;
-		case 6:
-			readReg(nf2, CPU_REG_Q_2_TX_NUM_PKTS_SENT_REG, &retval);
-			break;
-		case 7:
-			readReg(nf2, CPU_REG_Q_3_TX_NUM_PKTS_SENT_REG, &retval);
-			break;
-*/
-	}
-	return retval;
-}
-unsigned int get_rx_queue_num_bytes_received(nf2device* nf2, unsigned char port) {
-	unsigned int retval = 0;
-	switch(port) {
-		case 0:
-			readReg(nf2, MAC_GRP_0_RX_QUEUE_NUM_BYTES_PUSHED_REG, &retval);
-			break;
-		case 1:
-			readReg(nf2, MAC_GRP_1_RX_QUEUE_NUM_BYTES_PUSHED_REG, &retval);
-			break;
-		case 2:
-			readReg(nf2, MAC_GRP_2_RX_QUEUE_NUM_BYTES_PUSHED_REG, &retval);
-			break;
-		case 3:
-			readReg(nf2, MAC_GRP_3_RX_QUEUE_NUM_BYTES_PUSHED_REG, &retval);
-			break;
-/*		case 4:
-			readReg(nf2, CPU_REG_Q_0_RX_NUM_BYTES_RCVD_REG, &retval);
-			break;
-		case 5:
-			readReg(nf2, CPU_REG_Q_1_RX_NUM_BYTES_RCVD_REG, &retval);
-			break;
-		case 6:
-			readReg(nf2, CPU_REG_Q_2_RX_NUM_BYTES_RCVD_REG, &retval);
-			break;
-		case 7:
-			readReg(nf2, CPU_REG_Q_3_RX_NUM_BYTES_RCVD_REG, &retval);
-			break;
-*/
-	}
-	return retval;
-}
-
-unsigned int get_tx_queue_num_bytes_sent(nf2device* nf2, unsigned char port) {
-	unsigned int retval = 0;
-	switch(port) {
-		case 0:
-			readReg(nf2, MAC_GRP_0_TX_QUEUE_NUM_BYTES_PUSHED_REG, &retval);
-			break;
-		case 1:
-			readReg(nf2, MAC_GRP_1_TX_QUEUE_NUM_BYTES_PUSHED_REG, &retval);
-			break;
-		case 2:
-			readReg(nf2, MAC_GRP_2_TX_QUEUE_NUM_BYTES_PUSHED_REG, &retval);
-			break;
-		case 3:
-			readReg(nf2, MAC_GRP_3_TX_QUEUE_NUM_BYTES_PUSHED_REG, &retval);
-			break;
-/*		case 4:
-			readReg(nf2, CPU_REG_Q_0_TX_NUM_BYTES_SENT_REG, &retval);
-			break;
-		case 5:
-			readReg(nf2, CPU_REG_Q_1_TX_NUM_BYTES_SENT_REG, &retval);
-			break;
-		case 6:
-			readReg(nf2, CPU_REG_Q_2_TX_NUM_BYTES_SENT_REG, &retval);
-			break;
-		case 7:
-			readReg(nf2, CPU_REG_Q_3_TX_NUM_BYTES_SENT_REG, &retval);
-			break;
-*/
-	}
-	return retval;
-}
-
-unsigned int get_rx_queue_num_pkts_dropped_full(nf2device* nf2, unsigned char port) {
-	unsigned int retval = 0;
-	switch(port) {
-		case 0:
-			readReg(nf2, MAC_GRP_0_RX_QUEUE_NUM_PKTS_DROPPED_FULL_REG, &retval);
-			break;
-		case 1:
-			readReg(nf2, MAC_GRP_1_RX_QUEUE_NUM_PKTS_DROPPED_FULL_REG, &retval);
-			break;
-		case 2:
-			readReg(nf2, MAC_GRP_2_RX_QUEUE_NUM_PKTS_DROPPED_FULL_REG, &retval);
-			break;
-		case 3:
-			readReg(nf2, MAC_GRP_3_RX_QUEUE_NUM_PKTS_DROPPED_FULL_REG, &retval);
-			break;
-	}
-	return retval;
-}
-
-unsigned int get_rx_queue_num_pkts_dropped_bad(nf2device* nf2, unsigned char port) {
-	unsigned int retval = 0;
-	switch(port) {
-		case 0:
-			readReg(nf2, MAC_GRP_0_RX_QUEUE_NUM_PKTS_DROPPED_BAD_REG, &retval);
-			break;
-		case 1:
-			readReg(nf2, MAC_GRP_1_RX_QUEUE_NUM_PKTS_DROPPED_BAD_REG, &retval);
-			break;
-		case 2:
-			readReg(nf2, MAC_GRP_2_RX_QUEUE_NUM_PKTS_DROPPED_BAD_REG, &retval);
-			break;
-		case 3:
-			readReg(nf2, MAC_GRP_3_RX_QUEUE_NUM_PKTS_DROPPED_BAD_REG, &retval);
-			break;
-	}
-	return retval;
-}
-
-unsigned int get_oq_num_pkts_dropped(nf2device* nf2, unsigned char port) {
-	unsigned int retval = 0;
-	switch(port) {
-		case 0:
-			readReg(nf2, OQ_QUEUE_0_NUM_PKTS_DROPPED_REG, &retval);
-			break;
-		case 1:
-			readReg(nf2, OQ_QUEUE_1_NUM_PKTS_DROPPED_REG, &retval);
-			break;
-		case 2:
-			readReg(nf2, OQ_QUEUE_2_NUM_PKTS_DROPPED_REG, &retval);
-			break;
-		case 3:
-			readReg(nf2, OQ_QUEUE_3_NUM_PKTS_DROPPED_REG, &retval);
-			break;
-		case 4:
-			readReg(nf2, OQ_QUEUE_4_NUM_PKTS_DROPPED_REG, &retval);
-			break;
-		case 5:
-			readReg(nf2, OQ_QUEUE_5_NUM_PKTS_DROPPED_REG, &retval);
-			break;
-		case 6:
-			readReg(nf2, OQ_QUEUE_6_NUM_PKTS_DROPPED_REG, &retval);
-			break;
-		case 7:
-			readReg(nf2, OQ_QUEUE_7_NUM_PKTS_DROPPED_REG, &retval);
-			break;
-	}
-	return retval;
-}
-
 void cli_hw_info(router_state *rs, cli_request *req) {
 
 	if(rs->is_netfpga) {
@@ -24,6 +24,7 @@ unsigned char getPortNumber(char* name);
 unsigned int getOneHotPortNumber(char* name);
 void getIfaceFromOneHotPortNumber(char *name, unsigned int len, unsigned int port);
 
+void netfpga_input_handler(void* arg, int port, uint8_t* packet, unsigned int len);
 void netfpga_input(struct sr_instance* sr);
 void* netfpga_input_threaded(void* arg);
 void netfpga_input_threaded_np(void* arg);
@@ -40,7 +41,6 @@ void get_incoming_interface(char *iface, unsigned int len, unsigned int queue);
 
 void lock_netfpga_stats(router_state* rs);
 void unlock_netfpga_stats(router_state* rs);
-void* netfpga_stats(void* arg);
 
 /* ip filter functions */
 void trigger_local_ip_filters_change(router_state* rs);
@@ -56,15 +56,6 @@ unsigned int get_wr_num_words_left(nf2device* nf2, unsigned char port);
 unsigned int set_wr_data_word(nf2device* nf2, unsigned char port, unsigned int val);
 unsigned int set_wr_ctrl_word(nf2device* nf2, unsigned char port, unsigned int val);
 
-/* Stats Functions 0-3 eth 4-7 cpu */
-unsigned int get_rx_queue_num_pkts_received(nf2device* nf2, unsigned char port);
-unsigned int get_tx_queue_num_pkts_sent(nf2device* nf2, unsigned char port);
-unsigned int get_rx_queue_num_bytes_received(nf2device* nf2, unsigned char port);
-unsigned int get_tx_queue_num_bytes_sent(nf2device* nf2, unsigned char port);
-unsigned int get_rx_queue_num_pkts_dropped_full(nf2device* nf2, unsigned char port);
-unsigned int get_rx_queue_num_pkts_dropped_bad(nf2device* nf2, unsigned char port);
-unsigned int get_oq_num_pkts_dropped(nf2device* nf2, unsigned char port);
-
 void cli_hw_info(router_state *rs, cli_request *req);
 
 #endif
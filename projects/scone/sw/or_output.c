@@ -19,13 +19,15 @@
 #include "or_pwospf.h"
 #include "or_iface.h"
 #include "or_netfpga.h"
+#include "or_hwstats.h"
 #include "reg_defines.h"
 #include "or_nat.h"
+#include "or_trace.h"
 
 /* GENERAL PRETTY PRINT HELPER FUNCTIONS */
 inline void indent(unsigned int tab) {
 	int i;
-	for(i=0; i<tab; i++) {printf("\t");}
+	for(i=0; i<tab; i++) {trace_text(TRACE_PACKET, "\t");}
 }
 
 #define COPY_STRING(buf, len, str)	\
@@ -33,8 +35,8 @@ inline void indent(unsigned int tab) {
 	len += strlen(str);
 
 
-#define ARP_CACHE_COL "IP Address      MAC               TTL\n"
-#define ARP_CACHE_ENTRY_TO_STRING_LEN 82
+#define ARP_CACHE_COL "IP Address      MAC               Hits       TTL\n"
+#define ARP_CACHE_ENTRY_TO_STRING_LEN 96
 
 /* NOT THREAD SAFE */
 void sprint_arp_cache(router_state *rs, char **buf, int *len)
@@ -72,10 +74,10 @@ void sprint_arp_cache(router_state *rs, char **buf, int *len)
 		}
 
 		char line[ARP_CACHE_ENTRY_TO_STRING_LEN];
-		snprintf(line, ARP_CACHE_ENTRY_TO_STRING_LEN, "%-15s %02X:%02X:%02X:%02X:%02X:%02X %-46s\n",
+		snprintf(line, ARP_CACHE_ENTRY_TO_STRING_LEN, "%-15s %02X:%02X:%02X:%02X:%02X:%02X %-10u %-46s\n",
 			addr, (unsigned char)arp_entry->arp_ha[0], (unsigned char)arp_entry->arp_ha[1], (unsigned char)arp_entry->arp_ha[2],
 			(unsigned char)arp_entry->arp_ha[3], (unsigned char)arp_entry->arp_ha[4], (unsigned char)arp_entry->arp_ha[5],
-			ttl);
+			arp_entry->hits, ttl);
 
 		COPY_STRING(buffer, total_len, line);
 
@@ -89,6 +91,53 @@ void sprint_arp_cache(router_state *rs, char **buf, int *len)
 
 
 
+#define ARP_QUEUE_COL "Next Hop        Interface  Requests Packets  Bytes\n"
+#define ARP_QUEUE_ENTRY_TO_STRING_LEN 80
+#define ARP_QUEUE_SUMMARY_LEN 320
+
+/* NOT THREAD SAFE */
+void sprint_arp_queue(router_state *rs, char **buf, int *len)
+{
+	assert(rs);
+	assert(buf);
+	assert(len);
+
+	int size = ARP_QUEUE_SUMMARY_LEN + strlen(ARP_QUEUE_COL) + (ARP_QUEUE_ENTRY_TO_STRING_LEN * rs->arp_queue_entries);
+	char *buffer = calloc(size, sizeof(char));
+	int total_len = 0;
+	int i;
+
+	total_len += snprintf(buffer + total_len, size - total_len,
+		"Queued: %u bytes behind %u next hops, limits %u bytes per next hop, %u total\n"
+		"Dropped: %llu over next hop limit, %llu over total limit, %llu unresolved\n\n",
+		rs->arp_queue_bytes, rs->arp_queue_entries, rs->arp_queue_dest_limit, rs->arp_queue_limit,
+		(unsigned long long)rs->arp_queue_dest_drops,
+		(unsigned long long)rs->arp_queue_limit_drops,
+		(unsigned long long)rs->arp_queue_timeout_drops);
+	COPY_STRING(buffer, total_len, ARP_QUEUE_COL);
+
+	for (i = 0; i < ARP_QUEUE_HASH_SIZE; ++i) {
+		arp_queue_entry *aqe = rs->arp_queue[i];
+		while (aqe) {
+			char addr[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &(aqe->next_hop), addr, INET_ADDRSTRLEN);
+
+			char line[ARP_QUEUE_ENTRY_TO_STRING_LEN];
+			snprintf(line, ARP_QUEUE_ENTRY_TO_STRING_LEN, "%-15s %-10s %-8i %-8u %u\n",
+				addr, aqe->out_iface_name, aqe->requests, aqe->packets, aqe->bytes);
+			COPY_STRING(buffer, total_len, line);
+
+			aqe = aqe->hash_next;
+		}
+	}
+
+	*buf = buffer;
+	*len = total_len;
+}
+
+
+
+
 #define IFACE_COL "Name                  MAC               IP              Mask            Speed Up WAN\n"
 #define IFACE_ENTRY_TO_STRING_LEN 100
 #define IFACE_MAX_IFACE_LEN 21
@@ -419,29 +468,13 @@ void print_arp_queue(struct sr_instance *sr)
 {
 	assert(sr);
 
-	printf("ARP QUEUE CONTENTS\n");
-	printf("INTERFACE\tIP\t\tREQ_LEF\tHEAD\n");
-
-	router_state *rs = get_router_state(sr);
-	node *arp_walker = 0;
-	arp_queue_entry *arp_entry = 0;
-
-	arp_walker = rs->arp_queue;
-	while(arp_walker)
-	{
-
-		arp_entry = (arp_queue_entry *)arp_walker->data;
-
-		printf("%s\t\t", arp_entry->out_iface_name);
-		char addr[INET_ADDRSTRLEN];
-		printf("%-15s\t", inet_ntop(AF_INET, &(arp_entry->next_hop), addr, INET_ADDRSTRLEN));
-
-		printf("%d\t%X\n", arp_entry->requests, (unsigned int)arp_walker->next);
-
-		arp_walker = arp_walker->next;
-	}
-	printf("\n");
+	char *info;
+	int len;
 
+	printf("ARP QUEUE CONTENTS\n");
+	sprint_arp_queue(get_router_state(sr), &info, &len);
+	printf("%s\n", info);
+	free(info);
 }
 
 
@@ -525,21 +558,24 @@ void sprint_nat_table(router_state *rs, char **buf, unsigned int *len) {
 
 void print_packet(const uint8_t *packet, unsigned int len)
 {
+	if (!trace_enabled(TRACE_PACKET)) {
+		return;
+	}
 
 	assert(packet);
 
-	printf("\n");
+	trace_text(TRACE_PACKET, "\n");
 	print_eth_hdr(packet, len);
-	printf("\n");
+	trace_text(TRACE_PACKET, "\n");
 
 	eth_hdr *eth = (eth_hdr *)packet;
 	if (ntohs(eth->eth_type) == ETH_TYPE_ARP) {
 		print_arp_hdr(packet, len);
-		printf("\n");
+		trace_text(TRACE_PACKET, "\n");
 	} else if (ntohs(eth->eth_type) == ETH_TYPE_IP) {
 		ip_hdr *ip = get_ip_hdr(packet, len);
 		indent(1);
-		printf("IPv4 Packet (%d bytes)\n", len - sizeof(eth_hdr));
+		trace_text(TRACE_PACKET, "IPv4 Packet (%d bytes)\n", len - sizeof(eth_hdr));
 		print_ip_hdr(packet, len);
 		switch(ip->ip_p) {
 			case 1:
@@ -549,7 +585,7 @@ void print_packet(const uint8_t *packet, unsigned int len)
 			case 89:
 			{ print_pwospf_load(packet, len); break; }
 			default:
-			{ printf("UNRECOGNIZABLE PROTOCOL\n"); break;}
+			{ trace_text(TRACE_PACKET, "UNRECOGNIZABLE PROTOCOL\n"); break;}
 		}
 	}
 }
@@ -562,29 +598,33 @@ inline void print_mac_address(char *host, unsigned char *mac_addr) {
 	assert(host);
 	assert(mac_addr);
 
-	printf("%s = ", host);
+	trace_text(TRACE_PACKET, "%s = ", host);
 	int i;
-	for(i=0; i<ETH_ADDR_LEN-1; i++) {printf("%X.", mac_addr[i]);}
-	printf("%X\n", mac_addr[i]);
+	for(i=0; i<ETH_ADDR_LEN-1; i++) {trace_text(TRACE_PACKET, "%X.", mac_addr[i]);}
+	trace_text(TRACE_PACKET, "%X\n", mac_addr[i]);
 }
 
 void print_eth_hdr(const uint8_t *packet, unsigned int len)
 {
+	if (!trace_enabled(TRACE_PACKET)) {
+		return;
+	}
+
 	assert(packet);
 
 	eth_hdr *eth = (eth_hdr *)packet;
 
-	printf("Ethernet Packet Header (%d bytes)\n", sizeof(eth_hdr));
+	trace_text(TRACE_PACKET, "Ethernet Packet Header (%d bytes)\n", sizeof(eth_hdr));
 	indent(1);
 	print_mac_address("Src MAC Address", eth->eth_shost);
 	indent(1);
 	print_mac_address("Dst MAC Address", eth->eth_dhost);
 	indent(1);
 	if(ntohs(eth->eth_type) == ETH_TYPE_IP) {
-		printf("Type = Internet Protocol, Version 4 (IPv4)\n");
+		trace_text(TRACE_PACKET, "Type = Internet Protocol, Version 4 (IPv4)\n");
 	}
 	if(ntohs(eth->eth_type) == ETH_TYPE_ARP) {
-		printf("Type = Address Resolution Protocol (ARP)\n");
+		trace_text(TRACE_PACKET, "Type = Address Resolution Protocol (ARP)\n");
 	}
 }
 
@@ -594,36 +634,40 @@ void print_eth_hdr(const uint8_t *packet, unsigned int len)
 void print_ip_address(char *host, struct in_addr ip_addr) {
 	assert(host);
 	char addr[INET_ADDRSTRLEN];
-	printf("%s = %s\n", host, inet_ntop(AF_INET, &(ip_addr), addr, INET_ADDRSTRLEN));
+	trace_text(TRACE_PACKET, "%s = %s\n", host, inet_ntop(AF_INET, &(ip_addr), addr, INET_ADDRSTRLEN));
 }
 
 
 void print_arp_hdr(const uint8_t *packet, unsigned int len)
 {
+	if (!trace_enabled(TRACE_PACKET)) {
+		return;
+	}
+
 	assert(packet);
 
 	arp_hdr *arp = get_arp_hdr(packet, len);
 
 	indent(1);
-	printf("ARP Packet (%d bytes)\n", sizeof(arp_hdr));
+	trace_text(TRACE_PACKET, "ARP Packet (%d bytes)\n", sizeof(arp_hdr));
 	indent(2);
-	printf("Hardware Type: ");
+	trace_text(TRACE_PACKET, "Hardware Type: ");
 	switch(ntohs(arp->arp_hrd)) {
-		case 1: { printf("Ethernet\n"); break; }
-		default: { printf("%X\n", ntohs(arp->arp_hrd)); break; }
+		case 1: { trace_text(TRACE_PACKET, "Ethernet\n"); break; }
+		default: { trace_text(TRACE_PACKET, "%X\n", ntohs(arp->arp_hrd)); break; }
 	}
 	indent(2);
-	printf("Protocol Type = %X (IP)\n", ntohs(arp->arp_pro));
+	trace_text(TRACE_PACKET, "Protocol Type = %X (IP)\n", ntohs(arp->arp_pro));
 	indent(2);
-	printf("Hardware Address Length = %d\n", arp->arp_hln);
+	trace_text(TRACE_PACKET, "Hardware Address Length = %d\n", arp->arp_hln);
 	indent(2);
-	printf("Protocol Address Length = %d\n", arp->arp_pln);
+	trace_text(TRACE_PACKET, "Protocol Address Length = %d\n", arp->arp_pln);
 	indent(2);
-	printf("Opcode = ");
+	trace_text(TRACE_PACKET, "Opcode = ");
 	switch(ntohs(arp->arp_op)) {
-		case 1: { printf("Request\n"); break; }
-		case 2: { printf("Reply\n"); break; }
-		default: { printf("%X\n", arp->arp_op); break; }
+		case 1: { trace_text(TRACE_PACKET, "Request\n"); break; }
+		case 2: { trace_text(TRACE_PACKET, "Reply\n"); break; }
+		default: { trace_text(TRACE_PACKET, "%X\n", arp->arp_op); break; }
 	}
 	indent(2);
 	print_mac_address("Src Hardware Address", arp->arp_sha);
@@ -640,35 +684,39 @@ void print_arp_hdr(const uint8_t *packet, unsigned int len)
 
 void print_ip_hdr(const uint8_t *packet, unsigned int len)
 {
+	if (!trace_enabled(TRACE_PACKET)) {
+		return;
+	}
+
 	assert(packet);
 
 	ip_hdr *ip = get_ip_hdr(packet, len);
 
 	indent(1);
-	printf("IPv4 Packet Header (%d bytes)\n", 4*ip->ip_hl);
+	trace_text(TRACE_PACKET, "IPv4 Packet Header (%d bytes)\n", 4*ip->ip_hl);
 	indent(2);
-	printf("Version = %d\n", ip->ip_v);
+	trace_text(TRACE_PACKET, "Version = %d\n", ip->ip_v);
 	indent(2);
-	printf("Header Length = %d\n", 4*ip->ip_hl);
+	trace_text(TRACE_PACKET, "Header Length = %d\n", 4*ip->ip_hl);
 	indent(2);
-	printf("Terms of Service = 0x%X\n", ip->ip_tos);
+	trace_text(TRACE_PACKET, "Terms of Service = 0x%X\n", ip->ip_tos);
 	indent(2);
-	printf("Total Length = %d\n", ntohs(ip->ip_len));
+	trace_text(TRACE_PACKET, "Total Length = %d\n", ntohs(ip->ip_len));
 	indent(2);
-	printf("Identification = 0x%X\n", ntohs(ip->ip_id));
+	trace_text(TRACE_PACKET, "Identification = 0x%X\n", ntohs(ip->ip_id));
 	indent(2);
-	printf("Fragment Offset Field = 0x%X\n", ntohs(ip->ip_off));
+	trace_text(TRACE_PACKET, "Fragment Offset Field = 0x%X\n", ntohs(ip->ip_off));
 	indent(2);
-	printf("TTL (Time to Live) = %d\n", ip->ip_ttl);
+	trace_text(TRACE_PACKET, "TTL (Time to Live) = %d\n", ip->ip_ttl);
 	indent(2);
-	printf("Protocol = ");
+	trace_text(TRACE_PACKET, "Protocol = ");
 	switch(ip->ip_p) {
-		case 1: { printf("ICMP\n"); break; }
-		case 6: { printf("TCP\n"); break; }
-		default: { printf("%d\n", ip->ip_p); break; }
+		case 1: { trace_text(TRACE_PACKET, "ICMP\n"); break; }
+		case 6: { trace_text(TRACE_PACKET, "TCP\n"); break; }
+		default: { trace_text(TRACE_PACKET, "%d\n", ip->ip_p); break; }
 	}
 	indent(2);
-	printf("Header Checksum = 0x%X\n", ntohs(ip->ip_sum));
+	trace_text(TRACE_PACKET, "Header Checksum = 0x%X\n", ntohs(ip->ip_sum));
 	indent(2);
 	print_ip_address("Src IP Address", ip->ip_src);
 	indent(2);
@@ -679,58 +727,62 @@ void print_ip_hdr(const uint8_t *packet, unsigned int len)
 /* PRETTY PRINT ICMP PACKET HEADER */
 void print_icmp_load(const uint8_t *packet, unsigned int len)
 {
+	if (!trace_enabled(TRACE_PACKET)) {
+		return;
+	}
+
 	assert(packet);
 
 	icmp_hdr *icmp = get_icmp_hdr(packet, len);
 
 	indent(1);
-	printf("ICMP Packet Header (%d bytes)\n", sizeof(icmp_hdr));
+	trace_text(TRACE_PACKET, "ICMP Packet Header (%d bytes)\n", sizeof(icmp_hdr));
 	indent(2);
 	switch(icmp->icmp_type) {
 		case ICMP_TYPE_ECHO_REPLY:
 		{
-			printf("Type = Echo reply\n");
+			trace_text(TRACE_PACKET, "Type = Echo reply\n");
 			indent(2);
-			printf("Code = %d\n", icmp->icmp_code);
+			trace_text(TRACE_PACKET, "Code = %d\n", icmp->icmp_code);
 			break;
 		}
 		case ICMP_TYPE_ECHO_REQUEST:
 		{
-			printf("Type = Echo request\n");
+			trace_text(TRACE_PACKET, "Type = Echo request\n");
 			indent(2);
-			printf("Code = %d\n", icmp->icmp_code);
+			trace_text(TRACE_PACKET, "Code = %d\n", icmp->icmp_code);
 			break;
 		}
 		case ICMP_TYPE_TIME_EXCEEDED:
 		{
-			printf("Type = Time exceeded\n");
+			trace_text(TRACE_PACKET, "Type = Time exceeded\n");
 			indent(2);
-			printf("Code = %d\n", icmp->icmp_code);
+			trace_text(TRACE_PACKET, "Code = %d\n", icmp->icmp_code);
 			break;
 		}
 		case ICMP_TYPE_DESTINATION_UNREACHABLE:
 		{
-			printf("Type = Destination unreachable\n");
+			trace_text(TRACE_PACKET, "Type = Destination unreachable\n");
 			indent(2);
 			switch(icmp->icmp_code) {
 				case 0:
 				{
-					printf("Code = Network unreachable\n error\n");
+					trace_text(TRACE_PACKET, "Code = Network unreachable\n error\n");
 					break;
 				}
 				case 1:
 				{
-					printf("Code = Host unreachable error\n");
+					trace_text(TRACE_PACKET, "Code = Host unreachable error\n");
 					break;
 				}
 				case 2:
 				{
-					printf("Code = Protocol unreachable error\n");
+					trace_text(TRACE_PACKET, "Code = Protocol unreachable error\n");
 					break;
 				}
 				case 3:
 				{
-					printf("Code = Port unreachable error\n");
+					trace_text(TRACE_PACKET, "Code = Port unreachable error\n");
 					break;
 				}
 			} /* end of switch(icmp->icmp_code)) */
@@ -738,23 +790,23 @@ void print_icmp_load(const uint8_t *packet, unsigned int len)
 		}
 		default:
 		{
-			printf("Type = %d\n", icmp->icmp_type);
+			trace_text(TRACE_PACKET, "Type = %d\n", icmp->icmp_type);
 			indent(2);
-       			printf("Code = %d\n", icmp->icmp_code);
+       			trace_text(TRACE_PACKET, "Code = %d\n", icmp->icmp_code);
 			break;
 		}
 	}/* end of switch(icmp->icmp_type)) */
 	indent(2);
-	printf("Checksum = 0x%X\n", htons(icmp->icmp_sum));
+	trace_text(TRACE_PACKET, "Checksum = 0x%X\n", htons(icmp->icmp_sum));
 
 	indent(2);
  	uint8_t* data = (uint8_t *) icmp;
 	data += sizeof(icmp_hdr);
 	int data_len = len - (sizeof(eth_hdr)+sizeof(ip_hdr)+sizeof(icmp_hdr));
-	printf("\nPayload 1(%d bytes)\n", data_len);
+	trace_text(TRACE_PACKET, "\nPayload 1(%d bytes)\n", data_len);
 	int i; for(i=0; i<data_len; i++)
-	{ printf("%X ", data[i]); }
-	printf("\n\n");
+	{ trace_text(TRACE_PACKET, "%X ", data[i]); }
+	trace_text(TRACE_PACKET, "\n\n");
 }
 
 
@@ -763,31 +815,35 @@ void print_icmp_load(const uint8_t *packet, unsigned int len)
 /* PRETTY PRINT TCP PACKET HEADER */
 void print_tcp_load(const uint8_t *packet, unsigned int len) {
 
+	if (!trace_enabled(TRACE_PACKET)) {
+		return;
+	}
+
 	unsigned int data_offset = sizeof(eth_hdr) + sizeof(ip_hdr);
 	unsigned int data_len = len - data_offset;
 	const uint8_t *data = packet + data_offset;
 
 	indent(2);
-	printf("\nTCP PACKET in HEX (%d bytes)\n", data_len);
+	trace_text(TRACE_PACKET, "\nTCP PACKET in HEX (%d bytes)\n", data_len);
 	nat_tcp_hdr *tcp = get_nat_tcp_hdr(packet, len);
 	indent(3);
-	printf("Src Port = %d\n", ntohs(tcp->tcp_sport));
+	trace_text(TRACE_PACKET, "Src Port = %d\n", ntohs(tcp->tcp_sport));
 	indent(3);
-	printf("Dst Port = %d\n", ntohs(tcp->tcp_dport));
+	trace_text(TRACE_PACKET, "Dst Port = %d\n", ntohs(tcp->tcp_dport));
 	indent(3);
-	printf("Seq # = %X\n", ntohl(tcp->tcp_seq));
+	trace_text(TRACE_PACKET, "Seq # = %X\n", ntohl(tcp->tcp_seq));
 	indent(3);
-	printf("Acq # = %X\n", ntohl(tcp->tcp_ack));
+	trace_text(TRACE_PACKET, "Acq # = %X\n", ntohl(tcp->tcp_ack));
 	indent(3);
-	printf("Unused = %X %X %X %X\n", tcp->unused1[0], tcp->unused1[1], tcp->unused1[2], tcp->unused1[3]);
+	trace_text(TRACE_PACKET, "Unused = %X %X %X %X\n", tcp->unused1[0], tcp->unused1[1], tcp->unused1[2], tcp->unused1[3]);
 	indent(3);
-	printf("Sum = %X\n", tcp->tcp_sum);
+	trace_text(TRACE_PACKET, "Sum = %X\n", tcp->tcp_sum);
 	indent(3);
-	printf("Unused = %X %X\n", tcp->unused2[0], tcp->unused2[1]);
+	trace_text(TRACE_PACKET, "Unused = %X %X\n", tcp->unused2[0], tcp->unused2[1]);
 
-	printf("\n");
-	int i; for(i=0; i<data_len; i++){ printf("%X ", data[i]); }
-	printf("\n\n");
+	trace_text(TRACE_PACKET, "\n");
+	int i; for(i=0; i<data_len; i++){ trace_text(TRACE_PACKET, "%X ", data[i]); }
+	trace_text(TRACE_PACKET, "\n\n");
 }
 
 
@@ -795,30 +851,34 @@ void print_tcp_load(const uint8_t *packet, unsigned int len) {
 /* PRETTY PRINT PWOSPF PACKET */
 void print_pwospf_load(const uint8_t *packet, unsigned int len) {
 
+	if (!trace_enabled(TRACE_PACKET)) {
+		return;
+	}
+
 	pwospf_hdr *pwospf = get_pwospf_hdr(packet, len);
 	struct in_addr ip_addr;
 
 	indent(1);
-	printf("PWOSPFv2 Packet Header (%d bytes)\n", ntohs(pwospf->pwospf_len));
+	trace_text(TRACE_PACKET, "PWOSPFv2 Packet Header (%d bytes)\n", ntohs(pwospf->pwospf_len));
 	indent(2);
- 	printf("Version = %d\n", pwospf->pwospf_ver);
+ 	trace_text(TRACE_PACKET, "Version = %d\n", pwospf->pwospf_ver);
 	indent(2);
-	printf("Type = %d\n", pwospf->pwospf_type);
+	trace_text(TRACE_PACKET, "Type = %d\n", pwospf->pwospf_type);
 	indent(2);
-	printf("Length = %d\n", ntohs(pwospf->pwospf_len));
+	trace_text(TRACE_PACKET, "Length = %d\n", ntohs(pwospf->pwospf_len));
 	indent(2);
 	ip_addr.s_addr = pwospf->pwospf_rid;
 	print_ip_address("Router ID", ip_addr);
 	indent(2);
-	printf("Area ID = %X\n", ntohl(pwospf->pwospf_aid));
+	trace_text(TRACE_PACKET, "Area ID = %X\n", ntohl(pwospf->pwospf_aid));
 	indent(2);
-	printf("Checksum = %X\n", ntohs(pwospf->pwospf_sum));
+	trace_text(TRACE_PACKET, "Checksum = %X\n", ntohs(pwospf->pwospf_sum));
 	indent(2);
-	printf("Autype = %d\n", ntohs(pwospf->pwospf_atype));
+	trace_text(TRACE_PACKET, "Autype = %d\n", ntohs(pwospf->pwospf_atype));
 	indent(2);
-	printf("Authentication = %X\n", ntohl(pwospf->pwospf_auth1));
+	trace_text(TRACE_PACKET, "Authentication = %X\n", ntohl(pwospf->pwospf_auth1));
 	indent(2);
-	printf("Authentication = %X\n", ntohl(pwospf->pwospf_auth2));
+	trace_text(TRACE_PACKET, "Authentication = %X\n", ntohl(pwospf->pwospf_auth2));
 
 
 	switch(pwospf->pwospf_type) {
@@ -830,9 +890,9 @@ void print_pwospf_load(const uint8_t *packet, unsigned int len) {
 			indent(2);
 			print_ip_address("Net Mask", hello->pwospf_mask);
 			indent(2);
-			printf("HelloInt = %d\n", ntohs(hello->pwospf_hint));
+			trace_text(TRACE_PACKET, "HelloInt = %d\n", ntohs(hello->pwospf_hint));
 			indent(2);
-			printf("Padding = %X\n", hello->pwospf_pad);
+			trace_text(TRACE_PACKET, "Padding = %X\n", hello->pwospf_pad);
 
 			break;
 		}
@@ -843,16 +903,16 @@ void print_pwospf_load(const uint8_t *packet, unsigned int len) {
 			pwospf_lsu_adv *iface_adv = (pwospf_lsu_adv *)get_pwospf_lsu_data(packet, len);
 
 			indent(2);
-			printf("Sequence = %d\n", ntohs(lsu->pwospf_seq));
+			trace_text(TRACE_PACKET, "Sequence = %d\n", ntohs(lsu->pwospf_seq));
 			indent(2);
-			printf("TTL = %d\n", ntohs(lsu->pwospf_ttl));
+			trace_text(TRACE_PACKET, "TTL = %d\n", ntohs(lsu->pwospf_ttl));
 			indent(2);
-			printf("No. of Adverisements = %d\n", ntohl(lsu->pwospf_num));
+			trace_text(TRACE_PACKET, "No. of Adverisements = %d\n", ntohl(lsu->pwospf_num));
 
 			int i;
 			for(i=0; i < ntohl(lsu->pwospf_num); i++) {
 				indent(2);
-				printf("Advertisement #%d\n", i);
+				trace_text(TRACE_PACKET, "Advertisement #%d\n", i);
 				indent(3);
 				print_ip_address("Subnet", iface_adv->pwospf_sub);
 				indent(3);
@@ -870,7 +930,7 @@ void print_pwospf_load(const uint8_t *packet, unsigned int len) {
 
 		default:
 			indent(2);
-			printf("Invalid PWOSPF Type\n");
+			trace_text(TRACE_PACKET, "Invalid PWOSPF Type\n");
 	}
 
 }
@@ -879,30 +939,34 @@ void print_pwospf_load(const uint8_t *packet, unsigned int len) {
 
 
 void print_pwospf(pwospf_hdr *pwospf) {
+	if (!trace_enabled(TRACE_PACKET)) {
+		return;
+	}
+
 
 	struct in_addr ip_addr;
 
 	indent(1);
-	printf("PWOSPFv2 Packet Header (%d bytes)\n", ntohs(pwospf->pwospf_len));
+	trace_text(TRACE_PACKET, "PWOSPFv2 Packet Header (%d bytes)\n", ntohs(pwospf->pwospf_len));
 	indent(2);
- 	printf("Version = %d\n", pwospf->pwospf_ver);
+ 	trace_text(TRACE_PACKET, "Version = %d\n", pwospf->pwospf_ver);
 	indent(2);
-	printf("Type = %d\n", pwospf->pwospf_type);
+	trace_text(TRACE_PACKET, "Type = %d\n", pwospf->pwospf_type);
 	indent(2);
-	printf("Length = %d\n", ntohs(pwospf->pwospf_len));
+	trace_text(TRACE_PACKET, "Length = %d\n", ntohs(pwospf->pwospf_len));
 	indent(2);
 	ip_addr.s_addr = pwospf->pwospf_rid;
 	print_ip_address("Router ID", ip_addr);
 	indent(2);
-	printf("Area ID = %X\n", ntohl(pwospf->pwospf_aid));
+	trace_text(TRACE_PACKET, "Area ID = %X\n", ntohl(pwospf->pwospf_aid));
 	indent(2);
-	printf("Checksum = %X\n", ntohs(pwospf->pwospf_sum));
+	trace_text(TRACE_PACKET, "Checksum = %X\n", ntohs(pwospf->pwospf_sum));
 	indent(2);
-	printf("Autype = %d\n", ntohs(pwospf->pwospf_atype));
+	trace_text(TRACE_PACKET, "Autype = %d\n", ntohs(pwospf->pwospf_atype));
 	indent(2);
-	printf("Authentication = %X\n", ntohl(pwospf->pwospf_auth1));
+	trace_text(TRACE_PACKET, "Authentication = %X\n", ntohl(pwospf->pwospf_auth1));
 	indent(2);
-	printf("Authentication = %X\n", ntohl(pwospf->pwospf_auth2));
+	trace_text(TRACE_PACKET, "Authentication = %X\n", ntohl(pwospf->pwospf_auth2));
 
 
 	switch(pwospf->pwospf_type) {
@@ -914,9 +978,9 @@ void print_pwospf(pwospf_hdr *pwospf) {
 			indent(2);
 			print_ip_address("Net Mask", hello->pwospf_mask);
 			indent(2);
-			printf("HelloInt = %d\n", ntohs(hello->pwospf_hint));
+			trace_text(TRACE_PACKET, "HelloInt = %d\n", ntohs(hello->pwospf_hint));
 			indent(2);
-			printf("Padding = %X\n", hello->pwospf_pad);
+			trace_text(TRACE_PACKET, "Padding = %X\n", hello->pwospf_pad);
 
 			break;
 		}
@@ -928,16 +992,16 @@ void print_pwospf(pwospf_hdr *pwospf) {
 			pwospf_lsu_adv *iface_adv = (pwospf_lsu_adv *) ( ((uint8_t *)lsu) + sizeof(pwospf_lsu_hdr) );
 
 			indent(2);
-			printf("Sequence = %d\n", ntohs(lsu->pwospf_seq));
+			trace_text(TRACE_PACKET, "Sequence = %d\n", ntohs(lsu->pwospf_seq));
 			indent(2);
-			printf("TTL = %d\n", ntohs(lsu->pwospf_ttl));
+			trace_text(TRACE_PACKET, "TTL = %d\n", ntohs(lsu->pwospf_ttl));
 			indent(2);
-			printf("No. of Adverisements = %d\n", ntohl(lsu->pwospf_num));
+			trace_text(TRACE_PACKET, "No. of Adverisements = %d\n", ntohl(lsu->pwospf_num));
 
 			int i;
 			for(i=0; i < ntohl(lsu->pwospf_num); i++) {
 				indent(2);
-				printf("Advertisement #%d\n", i);
+				trace_text(TRACE_PACKET, "Advertisement #%d\n", i);
 				indent(3);
 				print_ip_address("Subnet", iface_adv->pwospf_sub);
 				indent(3);
@@ -955,7 +1019,7 @@ void print_pwospf(pwospf_hdr *pwospf) {
 
 		default:
 			indent(2);
-			printf("Invalid PWOSPF Type\n");
+			trace_text(TRACE_PACKET, "Invalid PWOSPF Type\n");
 	}
 
 }
@@ -1179,31 +1243,35 @@ void sprint_hw_nat_table(router_state *rs, char **buf, unsigned int *len) {
 }
 
 void print_ip(ip_hdr *ip) {
+	if (!trace_enabled(TRACE_PACKET)) {
+		return;
+	}
+
 	indent(1);
-	printf("IPv4 Packet Header (%d bytes)\n", 4*ip->ip_hl);
+	trace_text(TRACE_PACKET, "IPv4 Packet Header (%d bytes)\n", 4*ip->ip_hl);
 	indent(2);
-	printf("Version = %d\n", ip->ip_v);
+	trace_text(TRACE_PACKET, "Version = %d\n", ip->ip_v);
 	indent(2);
-	printf("Header Length = %d\n", 4*ip->ip_hl);
+	trace_text(TRACE_PACKET, "Header Length = %d\n", 4*ip->ip_hl);
 	indent(2);
-	printf("Terms of Service = 0x%X\n", ip->ip_tos);
+	trace_text(TRACE_PACKET, "Terms of Service = 0x%X\n", ip->ip_tos);
 	indent(2);
-	printf("Total Length = %d\n", ntohs(ip->ip_len));
+	trace_text(TRACE_PACKET, "Total Length = %d\n", ntohs(ip->ip_len));
 	indent(2);
-	printf("Identification = 0x%X\n", ntohs(ip->ip_id));
+	trace_text(TRACE_PACKET, "Identification = 0x%X\n", ntohs(ip->ip_id));
 	indent(2);
-	printf("Fragment Offset Field = 0x%X\n", ntohs(ip->ip_off));
+	trace_text(TRACE_PACKET, "Fragment Offset Field = 0x%X\n", ntohs(ip->ip_off));
 	indent(2);
-	printf("TTL (Time to Live) = %d\n", ip->ip_ttl);
+	trace_text(TRACE_PACKET, "TTL (Time to Live) = %d\n", ip->ip_ttl);
 	indent(2);
-	printf("Protocol = ");
+	trace_text(TRACE_PACKET, "Protocol = ");
 	switch(ip->ip_p) {
-		case 1: { printf("ICMP\n"); break; }
-		case 6: { printf("TCP\n"); break; }
-		default: { printf("%d\n", ip->ip_p); break; }
+		case 1: { trace_text(TRACE_PACKET, "ICMP\n"); break; }
+		case 6: { trace_text(TRACE_PACKET, "TCP\n"); break; }
+		default: { trace_text(TRACE_PACKET, "%d\n", ip->ip_p); break; }
 	}
 	indent(2);
-	printf("Header Checksum = 0x%X\n", ntohs(ip->ip_sum));
+	trace_text(TRACE_PACKET, "Header Checksum = 0x%X\n", ntohs(ip->ip_sum));
 	indent(2);
 	print_ip_address("Src IP Address", ip->ip_src);
 	indent(2);
@@ -1214,16 +1282,17 @@ void print_ip(ip_hdr *ip) {
 void sprint_hw_stats(router_state *rs, char **buf, unsigned int *len) {
 	char *buffer = calloc(4*HW_STATS_LEN + 1, sizeof(char));
 	unsigned int total_len = 0;
-	char* port_names[8] = {"eth0", "eth1", "eth2", "eth3", "cpu0", "cpu1", "cpu2", "cpu3"};
+	char* port_names[4] = {"eth0", "eth1", "eth2", "eth3"};
 
+	/* rates as of the last sweep of the sampler, no registers are read here */
 	lock_netfpga_stats(rs);
 	int i;
 	char line[HW_STATS_LEN];
 	bzero(line, HW_STATS_LEN);
 	for (i = 0; i < 4; ++i) {
-		snprintf(line, HW_STATS_LEN, "%-4s %12.2f PPS %12.2f kB/s %-4s %12.2f PPS %12.2f kB/s\n",
-			port_names[i], rs->stats_avg[i][0], rs->stats_avg[i][1],
-			port_names[i+4], rs->stats_avg[i+4][0], rs->stats_avg[i+4][1]);
+		snprintf(line, HW_STATS_LEN, "%-4s %12.2f PPS %12.2f kB/s\n", port_names[i],
+			hwstats_rate(rs->hw_stats, i, HWSTATS_RX_PKTS) + hwstats_rate(rs->hw_stats, i, HWSTATS_TX_PKTS),
+			(hwstats_rate(rs->hw_stats, i, HWSTATS_RX_BYTES) + hwstats_rate(rs->hw_stats, i, HWSTATS_TX_BYTES)) / 1000);
 		COPY_STRING(buffer, total_len, line);
 	}
 
@@ -1241,12 +1310,18 @@ void sprint_hw_drops(router_state *rs, char **buf, unsigned int *len) {
 	if (rs->is_netfpga) {
 		char* port_names[4] = {"eth0", "eth1", "eth2", "eth3"};
 		char line[HW_DROPS_LEN];
+		unsigned long long drops[4];
+		int i;
+
+		lock_netfpga_stats(rs);
+		for (i = 0; i < 4; ++i) {
+			drops[i] = hwstats_total(rs->hw_stats, i, HWSTATS_RX_DROPPED_FULL) + hwstats_total(rs->hw_stats, i, HWSTATS_RX_DROPPED_BAD);
+		}
+		unlock_netfpga_stats(rs);
+
 		bzero(line, HW_DROPS_LEN);
-		snprintf(line, HW_DROPS_LEN, "%4s %10u %4s %10u %4s %10u %4s %10u\n",
-			port_names[0], get_rx_queue_num_pkts_dropped_full(&rs->netfpga, 0) + get_rx_queue_num_pkts_dropped_bad(&rs->netfpga, 0),
-			port_names[1], get_rx_queue_num_pkts_dropped_full(&rs->netfpga, 1) + get_rx_queue_num_pkts_dropped_bad(&rs->netfpga, 1),
-			port_names[2], get_rx_queue_num_pkts_dropped_full(&rs->netfpga, 2) + get_rx_queue_num_pkts_dropped_bad(&rs->netfpga, 2),
-			port_names[3], get_rx_queue_num_pkts_dropped_full(&rs->netfpga, 3) + get_rx_queue_num_pkts_dropped_bad(&rs->netfpga, 3));
+		snprintf(line, HW_DROPS_LEN, "%4s %10llu %4s %10llu %4s %10llu %4s %10llu\n",
+			port_names[0], drops[0], port_names[1], drops[1], port_names[2], drops[2], port_names[3], drops[3]);
 
 		COPY_STRING(buffer, total_len, line);
 	}
@@ -1263,20 +1338,22 @@ void sprint_hw_oq_drops(router_state *rs, char **buf, unsigned int *len) {
 	if (rs->is_netfpga) {
 		char* port_names[8] = {"Q0", "Q1", "Q2", "Q3", "Q4", "Q5", "Q6", "Q7"};
 		char line[HW_OQ_DROPS_LEN];
-		bzero(line, HW_OQ_DROPS_LEN);
+		unsigned long long drops[8];
+		int i;
 
-		snprintf(line, HW_OQ_DROPS_LEN, "%4s %10u %4s %10u %4s %10u %4s %10u\n",
-			port_names[0], get_oq_num_pkts_dropped(&rs->netfpga, 0),
-			port_names[1], get_oq_num_pkts_dropped(&rs->netfpga, 1),
-			port_names[2], get_oq_num_pkts_dropped(&rs->netfpga, 2),
-			port_names[3], get_oq_num_pkts_dropped(&rs->netfpga, 3));
+		lock_netfpga_stats(rs);
+		for (i = 0; i < 8; ++i) {
+			drops[i] = rs->hw_stats->total[HWSTATS_OQ_DROPPED(i)];
+		}
+		unlock_netfpga_stats(rs);
+
+		bzero(line, HW_OQ_DROPS_LEN);
+		snprintf(line, HW_OQ_DROPS_LEN, "%4s %10llu %4s %10llu %4s %10llu %4s %10llu\n",
+			port_names[0], drops[0], port_names[1], drops[1], port_names[2], drops[2], port_names[3], drops[3]);
 		COPY_STRING(buffer, total_len, line);
 
-		snprintf(line, HW_OQ_DROPS_LEN, "%4s %10u %4s %10u %4s %10u %4s %10u\n",
-			port_names[4], get_oq_num_pkts_dropped(&rs->netfpga, 4),
-			port_names[5], get_oq_num_pkts_dropped(&rs->netfpga, 5),
-			port_names[6], get_oq_num_pkts_dropped(&rs->netfpga, 6),
-			port_names[7], get_oq_num_pkts_dropped(&rs->netfpga, 7));
+		snprintf(line, HW_OQ_DROPS_LEN, "%4s %10llu %4s %10llu %4s %10llu %4s %10llu\n",
+			port_names[4], drops[4], port_names[5], drops[5], port_names[6], drops[6], port_names[7], drops[7]);
 		COPY_STRING(buffer, total_len, line);
 	}
 
@@ -11,6 +11,7 @@
 #include "or_data_types.h"
 
 void sprint_arp_cache(router_state *rs, char **buf, int *len);
+void sprint_arp_queue(router_state *rs, char **buf, int *len);
 void sprint_if_list(router_state *rs, char **buf, int *len);
 void sprint_pwospf_if_list(router_state *rs, char **buf, int *len);
 void sprint_pwospf_router_list(router_state *rs, char **buf, int *len);
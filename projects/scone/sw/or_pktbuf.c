@@ -0,0 +1,243 @@
+/*
+ * Packet buffers for the forwarding path. Every thread allocates from its own pool
+ * so gets and local puts take no lock, a buffer released by another thread is pushed
+ * onto the remote list of its owner and reclaimed in one swap when the owner runs
+ * dry. Buffers are reference counted so a received packet can be queued for arp or
+ * transmit without copying, and are found from any pointer into their data which
+ * lets them travel through the existing uint8_t* packet interfaces.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "or_pktbuf.h"
+#include "or_utils.h"
+
+static __thread pktbuf_pool* local_pool = NULL;
+
+/* every pool ever created, pools and slabs are never freed so readers walk it lock free */
+static pktbuf_pool* volatile pktbuf_pools = NULL;
+
+static void pool_grow(pktbuf_pool* pool) {
+	int i;
+
+	pktbuf_slab* slab = (pktbuf_slab*)calloc(1, sizeof(pktbuf_slab));
+	slab->bufs = (pktbuf*)malloc(PKTBUF_SLAB_SIZE * sizeof(pktbuf));
+	assert(slab && slab->bufs);
+	slab->count = PKTBUF_SLAB_SIZE;
+
+	for (i = 0; i < PKTBUF_SLAB_SIZE; ++i) {
+		slab->bufs[i].pool = pool;
+		slab->bufs[i].refcnt = 0;
+		slab->bufs[i].next = pool->free;
+		pool->free = &(slab->bufs[i]);
+	}
+
+	/* publish the slab only once its buffers are set up */
+	slab->next = pool->slabs;
+	__sync_synchronize();
+	pool->slabs = slab;
+	++pool->grows;
+}
+
+static pktbuf_pool* get_local_pool(void) {
+	if (!local_pool) {
+		pktbuf_pool* pool = (pktbuf_pool*)calloc(1, sizeof(pktbuf_pool));
+		assert(pool);
+
+		do {
+			pool->next = pktbuf_pools;
+		} while (!__sync_bool_compare_and_swap(&pktbuf_pools, pool->next, pool));
+
+		local_pool = pool;
+	}
+
+	return local_pool;
+}
+
+/*
+ * Returns: a buffer from the pool of the calling thread holding one reference,
+ * the pool gets its first slab on the first call
+ */
+pktbuf* pktbuf_get(void) {
+	pktbuf_pool* pool = get_local_pool();
+
+	if (!pool->free) {
+		pool->free = (pktbuf*)__sync_lock_test_and_set(&(pool->remote_free), NULL);
+		if (!pool->free) {
+			pool_grow(pool);
+		}
+	}
+
+	pktbuf* pb = pool->free;
+	pool->free = pb->next;
+	pb->next = NULL;
+	pb->refcnt = 1;
+	++pool->gets;
+
+	return pb;
+}
+
+void pktbuf_ref(pktbuf* pb) {
+	__sync_fetch_and_add(&(pb->refcnt), 1);
+}
+
+void pktbuf_put(pktbuf* pb) {
+	assert(pb->refcnt > 0);
+	if (__sync_sub_and_fetch(&(pb->refcnt), 1) != 0) {
+		return;
+	}
+
+	pktbuf_pool* pool = pb->pool;
+	if (pool == local_pool) {
+		pb->next = pool->free;
+		pool->free = pb;
+		++pool->puts;
+	} else {
+		do {
+			pb->next = pool->remote_free;
+		} while (!__sync_bool_compare_and_swap(&(pool->remote_free), pb->next, pb));
+		__sync_fetch_and_add(&(pool->remote_puts), 1);
+	}
+}
+
+/*
+ * Returns: the pooled buffer packet points into, NULL if it came from malloc
+ */
+pktbuf* pktbuf_lookup(const uint8_t* packet) {
+	pktbuf_pool* pool;
+	pktbuf_slab* slab;
+
+	for (pool = pktbuf_pools; pool; pool = pool->next) {
+		for (slab = pool->slabs; slab; slab = slab->next) {
+			const uint8_t* start = (const uint8_t*)slab->bufs;
+			const uint8_t* end = (const uint8_t*)(slab->bufs + slab->count);
+			if ((packet >= start) && (packet < end)) {
+				return &(slab->bufs[(packet - start) / sizeof(pktbuf)]);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* where a packet starts in a fresh buffer, leaving the headroom in front */
+uint8_t* pktbuf_data(pktbuf* pb) {
+	return pb->buf + PKTBUF_HEADROOM;
+}
+
+/*
+ * Like malloc for a packet of len bytes, release it with pkt_free.
+ */
+uint8_t* pktbuf_alloc(unsigned int len) {
+	assert(len <= PKTBUF_DATA_LEN);
+	return pktbuf_data(pktbuf_get());
+}
+
+/*
+ * Keeps a packet that is only on loan, e.g. the one being handled by the input
+ * thread. Takes another reference if it is pooled and copies it into a pooled
+ * buffer otherwise.
+ * Returns: the packet to use from now on, release it with pkt_free
+ */
+uint8_t* pktbuf_hold(const uint8_t* packet, unsigned int len) {
+	pktbuf* pb = pktbuf_lookup(packet);
+	if (pb) {
+		pktbuf_ref(pb);
+		++get_local_pool()->holds;
+		return (uint8_t*)packet;
+	}
+
+	uint8_t* copy = pktbuf_alloc(len);
+	memcpy(copy, packet, len);
+	++get_local_pool()->copies;
+	return copy;
+}
+
+/*
+ * Grows a pooled packet by n bytes at the front for a new header.
+ * Returns: the new start of the packet, NULL if the headroom is used up
+ */
+uint8_t* pktbuf_push(uint8_t* packet, unsigned int n) {
+	pktbuf* pb = pktbuf_lookup(packet);
+	if (!pb || ((packet - pb->buf) < n)) {
+		return NULL;
+	}
+	return packet - n;
+}
+
+/*
+ * Zero fills a pooled packet out to min_len bytes in its tailroom.
+ * Returns: 0 on success, 1 if packet is not pooled and has to be copied to pad it
+ */
+int pktbuf_pad(uint8_t* packet, unsigned int len, unsigned int min_len) {
+	pktbuf* pb = pktbuf_lookup(packet);
+	if (!pb || ((packet + min_len) > (pb->buf + sizeof(pb->buf)))) {
+		++get_local_pool()->pad_misses;
+		return 1;
+	}
+
+	if (len < min_len) {
+		bzero(packet + len, min_len - len);
+	}
+	++get_local_pool()->pads;
+	return 0;
+}
+
+/*
+ * Releases a packet from pktbuf_alloc or pktbuf_hold, anything else is handed to free
+ * so callers that still malloc their packets can share the same paths.
+ */
+void pkt_free(uint8_t* packet) {
+	pktbuf* pb = pktbuf_lookup(packet);
+	if (pb) {
+		pktbuf_put(pb);
+	} else {
+		free(packet);
+	}
+}
+
+void sprint_pktbuf_stats(char** buf, unsigned int* len) {
+	pktbuf_pool* pool;
+	pktbuf_slab* slab;
+	int num_pools = 0;
+
+	for (pool = pktbuf_pools; pool; pool = pool->next) {
+		++num_pools;
+	}
+
+	int size = 160 * (num_pools + 1);
+	*buf = (char*)calloc(size, sizeof(char));
+	*len = 0;
+
+	for (pool = pktbuf_pools; pool; pool = pool->next, --num_pools) {
+		int bufs = 0;
+		for (slab = pool->slabs; slab; slab = slab->next) {
+			bufs += slab->count;
+		}
+		*len += snprintf(*buf + *len, size - *len, "%-6i %-6i %-10llu %-10llu %-10llu %-10llu %-8llu %-10llu %-8llu %llu\n",
+			num_pools, bufs,
+			(unsigned long long)pool->gets,
+			(unsigned long long)pool->puts,
+			(unsigned long long)pool->remote_puts,
+			(unsigned long long)pool->holds,
+			(unsigned long long)pool->copies,
+			(unsigned long long)pool->pads,
+			(unsigned long long)pool->pad_misses,
+			(unsigned long long)pool->grows);
+	}
+}
+
+void cli_show_pktbuf(router_state* rs, cli_request* req) {
+	char* info;
+	unsigned int len;
+
+	info = "Pool   Bufs   Gets       Puts       Remote     Holds      Copies   Pads       Pad Miss Slabs\n";
+	send_to_socket(req->sockfd, info, strlen(info));
+
+	sprint_pktbuf_stats(&info, &len);
+	send_to_socket(req->sockfd, info, len);
+	free(info);
+}
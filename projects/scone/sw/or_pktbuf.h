@@ -0,0 +1,21 @@
+#ifndef OR_PKTBUF_H_
+#define OR_PKTBUF_H_
+
+#include "or_data_types.h"
+
+pktbuf* pktbuf_get(void);
+void pktbuf_ref(pktbuf* pb);
+void pktbuf_put(pktbuf* pb);
+pktbuf* pktbuf_lookup(const uint8_t* packet);
+
+uint8_t* pktbuf_data(pktbuf* pb);
+uint8_t* pktbuf_alloc(unsigned int len);
+uint8_t* pktbuf_hold(const uint8_t* packet, unsigned int len);
+uint8_t* pktbuf_push(uint8_t* packet, unsigned int n);
+int pktbuf_pad(uint8_t* packet, unsigned int len, unsigned int min_len);
+void pkt_free(uint8_t* packet);
+
+void sprint_pktbuf_stats(char** buf, unsigned int* len);
+void cli_show_pktbuf(router_state* rs, cli_request* req);
+
+#endif /*OR_PKTBUF_H_*/
@@ -0,0 +1,150 @@
+/*
+ * Walks packets through the buffer handling of the forwarding path, once the way
+ * process_ip_packet, send_packet and send_ip used to (copy into a malloc, pad runts
+ * into another, free) and once with pooled buffers (hold a reference, pad in place,
+ * release). Every 16th packet waits in an arp queue for a while first. malloc and
+ * calloc are wrapped so the allocation count is the real one for the whole process.
+ *
+ * usage: pktbuf-bench [num_packets]
+ */
+
+#include "or_pktbuf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define ARP_QUEUE_DEPTH 8
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+
+static volatile unsigned long long num_allocs = 0;
+
+void* malloc(size_t size) {
+	__sync_fetch_and_add(&num_allocs, 1);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+	__sync_fetch_and_add(&num_allocs, 1);
+	return __libc_calloc(nmemb, size);
+}
+
+/* a locally built ack, a small packet, a default mtu datagram and a full frame */
+unsigned int packet_sizes[] = { 54, 64, 576, 1514 };
+
+volatile unsigned int sink = 0;
+
+/* stands in for the write to the wire */
+void wire(uint8_t* packet, unsigned int len) {
+	sink += packet[len - 1];
+}
+
+double elapsed_ns(struct timeval* start, struct timeval* end) {
+	return ((end->tv_sec - start->tv_sec) * 1e9) + ((end->tv_usec - start->tv_usec) * 1e3);
+}
+
+/* the old send_packet and send_ip */
+void malloc_send(uint8_t* packet, unsigned int len) {
+	if (len < 60) {
+		uint8_t* pad_packet = (uint8_t*)malloc(60);
+		bzero(pad_packet, 60);
+		memmove(pad_packet, packet, len);
+		wire(pad_packet, 60);
+		free(pad_packet);
+	} else {
+		wire(packet, len);
+	}
+	free(packet);
+}
+
+void pool_send(uint8_t* packet, unsigned int len) {
+	if ((len < 60) && (pktbuf_pad(packet, len, 60) == 0)) {
+		len = 60;
+	}
+	wire(packet, len);
+	pkt_free(packet);
+}
+
+void run(int use_pool, int num_packets) {
+	uint8_t* arp_queue[ARP_QUEUE_DEPTH];
+	unsigned int arp_queue_len[ARP_QUEUE_DEPTH];
+	int queued = 0;
+	int i;
+
+	/* what the input thread receives into, the first get also gives the pool its slab */
+	uint8_t* rx_static = (uint8_t*)malloc(PKTBUF_DATA_LEN);
+	pktbuf* rx_pb = use_pool ? pktbuf_get() : NULL;
+
+	unsigned long long allocs_before = num_allocs;
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < num_packets; ++i) {
+		unsigned int len = packet_sizes[i & 3];
+		uint8_t* rx = use_pool ? pktbuf_data(rx_pb) : rx_static;
+		memset(rx, i, 14);
+
+		/* process_ip_packet keeps the packet for send_ip */
+		uint8_t* packet;
+		if (use_pool) {
+			packet = pktbuf_hold(rx, len);
+		} else {
+			packet = (uint8_t*)malloc(len);
+			memcpy(packet, rx, len);
+		}
+
+		if ((i & 15) == 15) {
+			/* no arp entry yet, it waits with the others for the same next hop */
+			arp_queue[queued] = packet;
+			arp_queue_len[queued] = len;
+			if (++queued == ARP_QUEUE_DEPTH) {
+				while (queued > 0) {
+					--queued;
+					if (use_pool) {
+						pool_send(arp_queue[queued], arp_queue_len[queued]);
+					} else {
+						malloc_send(arp_queue[queued], arp_queue_len[queued]);
+					}
+				}
+			}
+		} else if (use_pool) {
+			pool_send(packet, len);
+		} else {
+			malloc_send(packet, len);
+		}
+
+		/* the rx slot is handed a fresh buffer if the old one was kept */
+		if (use_pool && (rx_pb->refcnt > 1)) {
+			pktbuf_put(rx_pb);
+			rx_pb = pktbuf_get();
+		}
+	}
+
+	gettimeofday(&end, NULL);
+	unsigned long long allocs = num_allocs - allocs_before;
+
+	printf("%-8s %-10i %-10.1f %-12llu %.3f\n", use_pool ? "pool" : "malloc", num_packets,
+		elapsed_ns(&start, &end) / num_packets, allocs, allocs / (double)num_packets);
+
+	while (queued > 0) {
+		--queued;
+		pkt_free(arp_queue[queued]);
+	}
+	if (rx_pb) {
+		pktbuf_put(rx_pb);
+	}
+	free(rx_static);
+}
+
+int main(int argc, char** argv)
+{
+	int num_packets = (argc > 1) ? atoi(argv[1]) : 4000000;
+
+	printf("%-8s %-10s %-10s %-12s %s\n", "Mode", "Packets", "ns/pkt", "Allocs", "Allocs/pkt");
+	run(0, num_packets);
+	run(1, num_packets);
+
+	return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * Packet I/O for the raw socket and pcap back ends. One epoll set covers every
+ * port, a ready raw socket is drained a batch at a time with recvmmsg and packets
+ * sent while a batch is being handled are queued per port and pushed out with a
+ * single sendmmsg once the batch is done. Raw sockets receive straight into pooled
+ * packet buffers so the handler can keep a packet by taking a reference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <pcap.h>
+
+#include "or_pktio.h"
+#include "or_pktbuf.h"
+#include "or_utils.h"
+#include "sr_dumper.h"
+
+/* > 0 while the calling thread is inside a batch, its sends are held until the end */
+static __thread int pktio_batch_depth = 0;
+
+struct pktio_pcap_arg {
+	pktio* io;
+	int port;
+};
+
+pktio* pktio_create(pktio_rx_handler handler, void* handler_arg) {
+	pktio* io = (pktio*)calloc(1, sizeof(pktio));
+	assert(io);
+
+	if ((io->epoll_fd = epoll_create(PKTIO_MAX_PORTS)) < 0) {
+		perror("epoll_create");
+		exit(1);
+	}
+	io->handler = handler;
+	io->handler_arg = handler_arg;
+
+	return io;
+}
+
+void pktio_destroy(pktio* io) {
+	int i, j;
+
+	if (!io) {
+		return;
+	}
+
+	pktio_flush_all(io);
+	for (i = 0; i < io->num_ports; ++i) {
+		pktio_port* p = &(io->ports[i]);
+		for (j = 0; j < PKTIO_BATCH; ++j) {
+			pktbuf_put(p->rx_pbs[j]);
+		}
+		pthread_mutex_destroy(&(p->tx_lock));
+		free(p->tx_bufs);
+	}
+	close(io->epoll_fd);
+	free(io);
+}
+
+/* puts a fresh buffer under rx slot i */
+static void pktio_rx_refill(pktio_port* p, int i) {
+	p->rx_pbs[i] = pktbuf_get();
+	p->rx_iov[i].iov_base = pktbuf_data(p->rx_pbs[i]);
+	p->rx_iov[i].iov_len = PKTBUF_DATA_LEN;
+}
+
+static int pktio_add_port(pktio* io, int fd, void* pcap) {
+	int i;
+
+	if (io->num_ports == PKTIO_MAX_PORTS) {
+		return -1;
+	}
+
+	int port = io->num_ports;
+	pktio_port* p = &(io->ports[port]);
+	bzero(p, sizeof(pktio_port));
+	p->fd = fd;
+	p->pcap = pcap;
+
+	p->tx_bufs = (uint8_t*)malloc(PKTIO_BATCH * PKTIO_TX_FRAME_LEN);
+	assert(p->tx_bufs);
+
+	/* the headers are built once, only the iov bases change as buffers are swapped */
+	for (i = 0; i < PKTIO_BATCH; ++i) {
+		pktio_rx_refill(p, i);
+		p->rx_msgs[i].msg_hdr.msg_iov = &(p->rx_iov[i]);
+		p->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+
+		p->tx_msgs[i].msg_hdr.msg_iov = &(p->tx_iov[i]);
+		p->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	if (pthread_mutex_init(&(p->tx_lock), NULL) != 0) {
+		perror("Lock init error");
+		exit(1);
+	}
+
+	struct epoll_event ev;
+	bzero(&ev, sizeof(struct epoll_event));
+	ev.events = EPOLLIN;
+	ev.data.u32 = port;
+	if (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		perror("epoll_ctl");
+		exit(1);
+	}
+
+	++io->num_ports;
+	return port;
+}
+
+/*
+ * Adds a bound PF_PACKET socket as the next port.
+ * Returns: the port number or -1 if all ports are taken
+ */
+int pktio_add_socket(pktio* io, int fd) {
+	return pktio_add_port(io, fd, NULL);
+}
+
+/*
+ * Adds a live pcap handle as the next port, it is switched to non blocking mode.
+ * Returns: the port number or -1 on failure
+ */
+int pktio_add_pcap(pktio* io, void* pcap) {
+	char errbuf[PCAP_ERRBUF_SIZE];
+
+	if (pcap_setnonblock((pcap_t*)pcap, 1, errbuf) < 0) {
+		fprintf(stderr, "pcap_setnonblock(): %s\n", errbuf);
+		return -1;
+	}
+
+	int fd = pcap_get_selectable_fd((pcap_t*)pcap);
+	if (fd < 0) {
+		return -1;
+	}
+
+	return pktio_add_port(io, fd, pcap);
+}
+
+static void pktio_pcap_callback(unsigned char* arg, const struct pcap_pkthdr* pkt_hdr, const unsigned char* packet) {
+	struct pktio_pcap_arg* pcap_arg = (struct pktio_pcap_arg*)arg;
+	pktio* io = pcap_arg->io;
+
+	++io->ports[pcap_arg->port].rx_packets;
+	io->handler(io->handler_arg, pcap_arg->port, (uint8_t*)packet, pkt_hdr->caplen);
+}
+
+/*
+ * Hands up to PKTIO_RX_BUDGET batches from one port to the handler, the epoll set
+ * is level triggered so whatever is left is picked up on the next poll.
+ * Returns: the number of packets received
+ */
+static int pktio_drain(pktio* io, int port) {
+	pktio_port* p = &(io->ports[port]);
+	int total = 0;
+	int round, i, n;
+
+	for (round = 0; round < PKTIO_RX_BUDGET; ++round) {
+		/* every packet of this batch, and whatever the handler sends, gets one timestamp */
+		sr_log_batch_begin();
+
+		if (p->pcap) {
+			struct pktio_pcap_arg pcap_arg;
+			pcap_arg.io = io;
+			pcap_arg.port = port;
+			n = pcap_dispatch((pcap_t*)p->pcap, PKTIO_BATCH, pktio_pcap_callback, (unsigned char*)&pcap_arg);
+			if (n < 0) {
+				pcap_perror((pcap_t*)p->pcap, "pcap_dispatch");
+				break;
+			}
+		} else {
+			n = recvmmsg(p->fd, p->rx_msgs, PKTIO_BATCH, MSG_DONTWAIT, NULL);
+			if (n < 0) {
+				if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+					perror("recvmmsg");
+				}
+				break;
+			}
+
+			for (i = 0; i < n; ++i) {
+				if (p->rx_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+					++p->rx_truncated;
+				}
+				io->handler(io->handler_arg, port, (uint8_t*)p->rx_iov[i].iov_base, p->rx_msgs[i].msg_len);
+
+				/* the handler kept the packet, it is not ours to receive into any more */
+				if (p->rx_pbs[i]->refcnt > 1) {
+					pktbuf_put(p->rx_pbs[i]);
+					pktio_rx_refill(p, i);
+					++p->rx_refills;
+				}
+			}
+			p->rx_packets += n;
+		}
+
+		if (n == 0) {
+			break;
+		}
+
+		++p->rx_batches;
+		total += n;
+		if (n < PKTIO_BATCH) {
+			break;
+		}
+	}
+
+	return total;
+}
+
+/*
+ * Waits up to timeout_ms (-1 forever) for any port to become readable, passes
+ * everything waiting to the handler and then flushes what the handler sent.
+ * Returns: the number of packets received, -1 if epoll_wait failed
+ */
+int pktio_poll(pktio* io, int timeout_ms) {
+	struct epoll_event events[PKTIO_MAX_PORTS];
+	int i, n;
+	int total = 0;
+
+	n = epoll_wait(io->epoll_fd, events, PKTIO_MAX_PORTS, timeout_ms);
+	if (n < 0) {
+		return (errno == EINTR) ? 0 : -1;
+	}
+
+	++io->polls;
+	pktio_begin_batch();
+	for (i = 0; i < n; ++i) {
+		total += pktio_drain(io, events[i].data.u32);
+	}
+	sr_log_batch_end();
+	pktio_end_batch(io);
+
+	return total;
+}
+
+/*
+ * Packets sent by this thread until the matching pktio_end_batch are queued rather
+ * than written, batches nest.
+ */
+void pktio_begin_batch(void) {
+	++pktio_batch_depth;
+}
+
+void pktio_end_batch(pktio* io) {
+	assert(pktio_batch_depth > 0);
+	if (--pktio_batch_depth == 0) {
+		pktio_flush_all(io);
+	}
+}
+
+/* NOT THREAD SAFE: hold the tx_lock of the port */
+static void pktio_flush_locked(pktio_port* p) {
+	int sent = 0;
+	int n;
+
+	while (sent < p->tx_count) {
+		if (p->pcap) {
+			if (pcap_inject((pcap_t*)p->pcap, p->tx_iov[sent].iov_base, p->tx_iov[sent].iov_len) < 0) {
+				pcap_perror((pcap_t*)p->pcap, "pcap_inject");
+				++p->tx_errors;
+			} else {
+				++p->tx_packets;
+			}
+			++sent;
+			continue;
+		}
+
+		n = sendmmsg(p->fd, p->tx_msgs + sent, p->tx_count - sent, 0);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			/* the packet at the head of the batch is the one that failed, drop it */
+			perror("sendmmsg");
+			++p->tx_errors;
+			++sent;
+			continue;
+		}
+		++p->tx_batches;
+		p->tx_packets += n;
+		sent += n;
+	}
+
+	if (p->pcap && (p->tx_count > 0)) {
+		++p->tx_batches;
+	}
+	for (sent = 0; sent < p->tx_count; ++sent) {
+		if (p->tx_pbs[sent]) {
+			pktbuf_put(p->tx_pbs[sent]);
+			p->tx_pbs[sent] = NULL;
+		}
+	}
+	p->tx_count = 0;
+}
+
+/*
+ * Queues packet on port, taking a reference if it is pooled and a copy otherwise.
+ * The queue goes out when it fills, when the batch of the calling thread ends, or
+ * straight away if it is not in one.
+ * Returns: 0 on success, 1 if the port does not exist
+ */
+int pktio_send(pktio* io, int port, const uint8_t* packet, unsigned int len) {
+	if ((port < 0) || (port >= io->num_ports)) {
+		return 1;
+	}
+
+	pktio_port* p = &(io->ports[port]);
+	pktbuf* pb = pktbuf_lookup(packet);
+	pthread_mutex_lock(&(p->tx_lock));
+
+	if (!pb && (len > PKTIO_TX_FRAME_LEN)) {
+		/* too big for a slot, send it on its own behind whatever is queued */
+		pktio_flush_locked(p);
+		if (p->pcap) {
+			if (pcap_inject((pcap_t*)p->pcap, packet, len) < 0) {
+				++p->tx_errors;
+			} else {
+				++p->tx_packets;
+			}
+		} else if (send(p->fd, packet, len, 0) < 0) {
+			perror("send");
+			++p->tx_errors;
+		} else {
+			++p->tx_packets;
+		}
+		pthread_mutex_unlock(&(p->tx_lock));
+		return 0;
+	}
+
+	if (pb) {
+		pktbuf_ref(pb);
+		p->tx_pbs[p->tx_count] = pb;
+		p->tx_iov[p->tx_count].iov_base = (uint8_t*)packet;
+	} else {
+		p->tx_iov[p->tx_count].iov_base = p->tx_bufs + (p->tx_count * PKTIO_TX_FRAME_LEN);
+		memcpy(p->tx_iov[p->tx_count].iov_base, packet, len);
+	}
+	p->tx_iov[p->tx_count].iov_len = len;
+	++p->tx_count;
+
+	if ((p->tx_count == PKTIO_BATCH) || (pktio_batch_depth == 0)) {
+		pktio_flush_locked(p);
+	}
+
+	pthread_mutex_unlock(&(p->tx_lock));
+	return 0;
+}
+
+void pktio_flush(pktio* io, int port) {
+	pktio_port* p = &(io->ports[port]);
+
+	pthread_mutex_lock(&(p->tx_lock));
+	if (p->tx_count > 0) {
+		pktio_flush_locked(p);
+	}
+	pthread_mutex_unlock(&(p->tx_lock));
+}
+
+void pktio_flush_all(pktio* io) {
+	int i;
+	for (i = 0; i < io->num_ports; ++i) {
+		pktio_flush(io, i);
+	}
+}
+
+void sprint_pktio_stats(pktio* io, char** buf, unsigned int* len) {
+	int i;
+	int size = 128 * (io->num_ports + 2);
+	*buf = (char*)calloc(size, sizeof(char));
+	*len = 0;
+
+	for (i = 0; i < io->num_ports; ++i) {
+		pktio_port* p = &(io->ports[i]);
+		double rx_per_batch = p->rx_batches ? (p->rx_packets / (double)p->rx_batches) : 0.0;
+		double tx_per_batch = p->tx_batches ? (p->tx_packets / (double)p->tx_batches) : 0.0;
+		*len += snprintf(*buf + *len, size - *len, "%-6i %-6s %-12llu %-9.1f %-12llu %-9.1f %-8llu %llu\n",
+			i, p->pcap ? "pcap" : "raw",
+			(unsigned long long)p->rx_packets, rx_per_batch,
+			(unsigned long long)p->tx_packets, tx_per_batch,
+			(unsigned long long)p->rx_truncated,
+			(unsigned long long)p->tx_errors);
+	}
+	*len += snprintf(*buf + *len, size - *len, "Polls: %llu\n", (unsigned long long)io->polls);
+}
+
+void cli_show_pktio(router_state* rs, cli_request* req) {
+	char* info;
+	unsigned int len;
+
+	if (!rs->pktio) {
+		info = "No packet I/O ports\n";
+		send_to_socket(req->sockfd, info, strlen(info));
+		return;
+	}
+
+	info = "Port   Type   RX Packets   RX/Batch  TX Packets   TX/Batch  RX Trunc TX Errors\n";
+	send_to_socket(req->sockfd, info, strlen(info));
+
+	sprint_pktio_stats(rs->pktio, &info, &len);
+	send_to_socket(req->sockfd, info, len);
+	free(info);
+}
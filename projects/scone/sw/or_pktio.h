@@ -0,0 +1,22 @@
+#ifndef OR_PKTIO_H_
+#define OR_PKTIO_H_
+
+#include "or_data_types.h"
+
+pktio* pktio_create(pktio_rx_handler handler, void* handler_arg);
+void pktio_destroy(pktio* io);
+int pktio_add_socket(pktio* io, int fd);
+int pktio_add_pcap(pktio* io, void* pcap);
+
+int pktio_poll(pktio* io, int timeout_ms);
+
+void pktio_begin_batch(void);
+void pktio_end_batch(pktio* io);
+int pktio_send(pktio* io, int port, const uint8_t* packet, unsigned int len);
+void pktio_flush(pktio* io, int port);
+void pktio_flush_all(pktio* io);
+
+void sprint_pktio_stats(pktio* io, char** buf, unsigned int* len);
+void cli_show_pktio(router_state* rs, cli_request* req);
+
+#endif /*OR_PKTIO_H_*/
@@ -0,0 +1,199 @@
+/*
+ * Measures packets per second across a veth pair, once with a read or write per
+ * packet like netfpga_input and netfpga_output used to do and once through the
+ * pktio engine with recvmmsg and sendmmsg. Needs root and a pair that is up:
+ *
+ *   ip link add veth0 type veth peer name veth1
+ *   ip link set veth0 up; ip link set veth1 up
+ *
+ * usage: pktio-bench tx_iface rx_iface [seconds] [frame_len]
+ */
+
+#include "or_pktio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#define BENCH_ETH_TYPE 0x88B5	/* local experimental, nothing else on the pair uses it */
+
+struct bench_state {
+	int use_pktio;
+	int tx_fd;
+	int rx_fd;
+	pktio* tx_io;
+	pktio* rx_io;
+	uint8_t frame[PKTIO_TX_FRAME_LEN];
+	unsigned int frame_len;
+	volatile int sending;
+	volatile int receiving;
+	unsigned long long sent;
+	unsigned long long received;
+};
+typedef struct bench_state bench_state;
+
+int open_packet_socket(const char* name, int protocol) {
+	int s = socket(PF_PACKET, SOCK_RAW, protocol);
+	if (s < 0) {
+		perror("socket");
+		exit(1);
+	}
+
+	struct ifreq ifr;
+	bzero(&ifr, sizeof(struct ifreq));
+	strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+	if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+		perror("ioctl SIOCGIFINDEX");
+		exit(1);
+	}
+
+	struct sockaddr_ll saddr;
+	bzero(&saddr, sizeof(struct sockaddr_ll));
+	saddr.sll_family = AF_PACKET;
+	saddr.sll_protocol = protocol;
+	saddr.sll_ifindex = ifr.ifr_ifindex;
+	if (bind(s, (struct sockaddr*)&saddr, sizeof(saddr)) < 0) {
+		perror("bind");
+		exit(1);
+	}
+
+	int rcvbuf = 4 * 1024 * 1024;
+	setsockopt(s, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	return s;
+}
+
+int is_bench_frame(const uint8_t* packet, unsigned int len) {
+	return (len >= ETH_HLEN) && (((packet[12] << 8) | packet[13]) == BENCH_ETH_TYPE);
+}
+
+void count_frame(void* arg, int port, uint8_t* packet, unsigned int len) {
+	bench_state* bs = (bench_state*)arg;
+	if (is_bench_frame(packet, len)) {
+		++bs->received;
+	}
+}
+
+void* sender_thread(void* arg) {
+	bench_state* bs = (bench_state*)arg;
+	int i;
+
+	while (bs->sending) {
+		if (bs->use_pktio) {
+			pktio_begin_batch();
+			for (i = 0; i < PKTIO_BATCH; ++i) {
+				pktio_send(bs->tx_io, 0, bs->frame, bs->frame_len);
+			}
+			pktio_end_batch(bs->tx_io);
+		} else if (write(bs->tx_fd, bs->frame, bs->frame_len) == bs->frame_len) {
+			++bs->sent;
+		}
+	}
+
+	return NULL;
+}
+
+void* receiver_thread(void* arg) {
+	bench_state* bs = (bench_state*)arg;
+	uint8_t buf[PKTBUF_DATA_LEN];
+	struct pollfd pfd;
+	pfd.fd = bs->rx_fd;
+	pfd.events = POLLIN;
+
+	while (bs->receiving) {
+		if (bs->use_pktio) {
+			pktio_poll(bs->rx_io, 100);
+		} else if (poll(&pfd, 1, 100) > 0) {
+			int n = read(bs->rx_fd, buf, sizeof(buf));
+			if ((n > 0) && is_bench_frame(buf, n)) {
+				++bs->received;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+void run(int use_pktio, const char* tx_iface, const char* rx_iface, int seconds, unsigned int frame_len) {
+	bench_state* bs = (bench_state*)calloc(1, sizeof(bench_state));
+	bs->use_pktio = use_pktio;
+	bs->frame_len = frame_len;
+
+	/* broadcast from a locally administered address */
+	memset(bs->frame, 0xFF, ETH_ALEN);
+	bs->frame[6] = 0x02;
+	bs->frame[11] = 0x01;
+	bs->frame[12] = BENCH_ETH_TYPE >> 8;
+	bs->frame[13] = BENCH_ETH_TYPE & 0xFF;
+
+	/* protocol 0 keeps the tx socket from queueing anything it would never read */
+	bs->tx_fd = open_packet_socket(tx_iface, 0);
+	bs->rx_fd = open_packet_socket(rx_iface, htons(ETH_P_ALL));
+	if (use_pktio) {
+		bs->tx_io = pktio_create(count_frame, bs);
+		bs->rx_io = pktio_create(count_frame, bs);
+		pktio_add_socket(bs->tx_io, bs->tx_fd);
+		pktio_add_socket(bs->rx_io, bs->rx_fd);
+	}
+
+	bs->sending = 1;
+	bs->receiving = 1;
+	pthread_t sender, receiver;
+	pthread_create(&receiver, NULL, receiver_thread, bs);
+	pthread_create(&sender, NULL, sender_thread, bs);
+
+	sleep(seconds);
+	bs->sending = 0;
+	pthread_join(sender, NULL);
+	if (use_pktio) {
+		bs->sent = bs->tx_io->ports[0].tx_packets;
+	}
+
+	/* let the receiver catch up with what is still queued */
+	usleep(200000);
+	bs->receiving = 0;
+	pthread_join(receiver, NULL);
+
+	double lost = bs->sent ? (100.0 * (bs->sent - bs->received) / bs->sent) : 0.0;
+	printf("%-8s %-8u %-14.0f %-14.0f %.2f\n", use_pktio ? "mmsg" : "rw", frame_len,
+		bs->sent / (double)seconds, bs->received / (double)seconds, lost);
+
+	if (use_pktio) {
+		pktio_destroy(bs->tx_io);
+		pktio_destroy(bs->rx_io);
+	}
+	close(bs->tx_fd);
+	close(bs->rx_fd);
+	free(bs);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s tx_iface rx_iface [seconds] [frame_len]\n", argv[0]);
+		return 1;
+	}
+
+	int seconds = (argc > 3) ? atoi(argv[3]) : 3;
+	unsigned int frame_len = (argc > 4) ? atoi(argv[4]) : 60;
+	if (frame_len < ETH_ZLEN) {
+		frame_len = ETH_ZLEN;
+	} else if (frame_len > PKTIO_TX_FRAME_LEN) {
+		frame_len = PKTIO_TX_FRAME_LEN;
+	}
+
+	printf("%-8s %-8s %-14s %-14s %s\n", "Mode", "Bytes", "Sent pps", "Received pps", "Lost %");
+	run(0, argv[1], argv[2], seconds, frame_len);
+	run(1, argv[1], argv[2], seconds, frame_len);
+
+	return 0;
+}
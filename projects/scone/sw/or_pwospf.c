@@ -162,6 +162,10 @@ void process_pwospf_hello_packet(struct sr_instance* sr, const uint8_t * packet,
 
 }
 
+/*
+ * Sends our hello out every active interface.
+ * NOT THREAD SAFE: lock the iface list for reads
+ */
 void broadcast_pwospf_hello_packet(struct sr_instance* sr) {
 
 	assert(sr);
@@ -175,7 +179,6 @@ void broadcast_pwospf_hello_packet(struct sr_instance* sr) {
 	pwospf_hdr *pwospf = get_pwospf_hdr(packet, len);
 	pwospf_hello_hdr *hello = get_pwospf_hello_hdr(packet, len);
 	uint8_t default_addr[ETH_ADDR_LEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
-	int interface_has_timedout = 0;
 
 	/* send one hello packet per interface */
 	node *iface_walker = rs->if_list;
@@ -193,28 +196,76 @@ void broadcast_pwospf_hello_packet(struct sr_instance* sr) {
 			ip->ip_sum = htons(compute_ip_checksum(ip));
 			populate_eth_hdr(eth, default_addr, ie->addr, ETH_TYPE_IP);
 
-			/* send hello packet and update the time sent */
+			/* send hello packet and update the time sent, only the hello senders write it */
 			send_packet(sr, packet, len, ie->name);
 			time((time_t *)(&ie->last_sent_hello));
+		}
+
+		iface_walker = iface_walker->next;
+	}
+
+	free(packet);
+
+}
+
+
+
+/*
+ * Returns: 1 if a neighbor on an active interface has missed its hellos
+ * NOT THREAD SAFE: lock the iface list for reads
+ */
+int pwospf_neighbor_timedout(router_state *rs) {
+	time_t now;
+	time(&now);
+
+	node *iface_walker = rs->if_list;
+	while (iface_walker) {
+		iface_entry *ie = (iface_entry *)iface_walker->data;
+		if (ie->is_active & 0x1) {
+			node *cur = ie->nbr_routers;
+			while (cur) {
+				nbr_router *nbr = (nbr_router *)cur->data;
+				if ((int)difftime(now, (time_t)nbr->last_rcvd_hello) > (3 * rs->pwospf_hello_interval)) {
+					return 1;
+				}
+				cur = cur->next;
+			}
+		}
+		iface_walker = iface_walker->next;
+	}
 
+	return 0;
+}
+
+
+/*
+ * Drops the neighbors that missed their hellos and floods the change.
+ * NOT THREAD SAFE: lock the iface list for writes
+ */
+void expire_pwospf_neighbors(struct sr_instance *sr) {
+	router_state *rs = get_router_state(sr);
+	int interface_has_timedout = 0;
 
+	node *iface_walker = rs->if_list;
+	while (iface_walker) {
+		iface_entry *ie = (iface_entry *)iface_walker->data;
+
+		if (ie->is_active & 0x1) {
 			/* disable timed out interface */
 			/* have to lock the router list because we update our pwospf router from inside */
 			lock_mutex_pwospf_router_list(rs);
-			if(determine_timedout_interface(rs, ie) == 1) {
+			if (determine_timedout_interface(rs, ie) == 1) {
 				/* the outer loop checks all interfaces, so we need this if statement */
 				interface_has_timedout = 1;
 			}
 			unlock_mutex_pwospf_router_list(rs);
-
 		}
 
 		iface_walker = iface_walker->next;
 	}
 
-
 	/* One of neighbor interfaces has timed out */
-	if(interface_has_timedout == 1) {
+	if (interface_has_timedout == 1) {
 
 		/* flood with lsu updates */
 		lock_mutex_pwospf_router_list(rs);
@@ -224,11 +275,28 @@ void broadcast_pwospf_hello_packet(struct sr_instance* sr) {
 		/*send it to every neighbor */
 		pthread_cond_signal(rs->pwospf_lsu_bcast_cond);
 	}
+}
 
-	free(packet);
 
-}
+/*
+ * Broadcasts our hello under the iface list read lock, the list is only locked for
+ * writing when a neighbor has gone quiet and has to be dropped.
+ */
+void send_pwospf_hello(struct sr_instance *sr) {
+	router_state *rs = get_router_state(sr);
+	int timedout;
 
+	lock_if_list_rd(rs);
+	broadcast_pwospf_hello_packet(sr);
+	timedout = pwospf_neighbor_timedout(rs);
+	unlock_if_list(rs);
+
+	if (timedout) {
+		lock_if_list_wr(rs);
+		expire_pwospf_neighbors(sr);
+		unlock_if_list(rs);
+	}
+}
 
 
 int determine_timedout_interface(router_state *rs, iface_entry *iface) {
@@ -1094,8 +1162,9 @@ void cli_show_pwospf_info(router_state *rs, cli_request *req) {
 	char buf[512];
 	bzero(buf, 512);
 
-	sprintf(buf, "Area ID: %u\nHello Interval: %u\nLSU Interval: %u\n\n",
-		rs->area_id, rs->pwospf_hello_interval, rs->pwospf_lsu_interval);
+	sprintf(buf, "Area ID: %u\nHello Interval: %u\nLSU Interval: %u\nSPF Runs: %llu full, %llu incremental\n\n",
+		rs->area_id, rs->pwospf_hello_interval, rs->pwospf_lsu_interval,
+		(unsigned long long)rs->spf_full_runs, (unsigned long long)rs->spf_incremental_runs);
 	send_to_socket(req->sockfd, buf, strlen(buf));
 
 	lock_mutex_pwospf_router_list(rs);
@@ -1119,133 +1188,155 @@ void cli_show_pwospf_info(router_state *rs, cli_request *req) {
 }
 
 
-void *pwospf_hello_thread(void *param) {
+/*
+ * Timer callback, broadcasts our hello a second ahead of the interval so the
+ * neighbors never see it lapse.
+ */
+unsigned int pwospf_hello_tick(void *arg) {
 
-	assert(param);
-	struct sr_instance *sr = (struct sr_instance *)param;
+	assert(arg);
+	struct sr_instance *sr = (struct sr_instance *)arg;
 	router_state *rs = get_router_state(sr);
 
-	while(1) {
+	send_pwospf_hello(sr);
+
+	return ((rs->pwospf_hello_interval > 1) ? (rs->pwospf_hello_interval - 1) : 1) * 1000;
+}
 
-		lock_if_list_wr(rs);
-		broadcast_pwospf_hello_packet(sr);
-		unlock_if_list(rs);
 
-		sleep(rs->pwospf_hello_interval-1);
+/* milliseconds from now until time() passes second */
+static unsigned int pwospf_delay(time_t second) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	if (second < now.tv_sec) {
+		return 1;
 	}
+	return ((second - now.tv_sec + 1) * 1000) - (now.tv_usec / 1000);
 }
 
 
-void *pwospf_lsu_thread(void *param) {
+/*
+ * Timer callback, floods our lsu once lsu_interval has gone by since we last did.
+ * Wakes again when the next one is due rather than looking every second.
+ */
+unsigned int pwospf_lsu_tick(void *arg) {
 
-	assert(param);
-	struct sr_instance *sr = (struct sr_instance *)param;
+	assert(arg);
+	struct sr_instance *sr = (struct sr_instance *)arg;
 	router_state *rs = get_router_state(sr);
 
 	time_t now;
 	int diff;
+	unsigned int delay = 1000;
 
-	sleep(5);
-	while(1) {
-
-		lock_mutex_pwospf_router_list(rs);
-		pwospf_router *our_router = get_router_by_rid(rs->router_id, rs->pwospf_router_list);
-		unlock_mutex_pwospf_router_list(rs);
-		time(&now);
-		if (our_router) {
-			diff = (int)difftime(now, our_router->last_update);
+	lock_mutex_pwospf_router_list(rs);
+	pwospf_router *our_router = get_router_by_rid(rs->router_id, rs->pwospf_router_list);
+	unlock_mutex_pwospf_router_list(rs);
+	time(&now);
+	if (our_router) {
+		diff = (int)difftime(now, our_router->last_update);
 
-			/* send an lsu update if we haven't done so */
-			if(diff > (rs->pwospf_lsu_interval)) {
+		/* send an lsu update if we haven't done so */
+		if(diff > (rs->pwospf_lsu_interval)) {
 
-				lock_mutex_pwospf_router_list(rs);
-				start_lsu_bcast_flood(rs, NULL);
-				unlock_mutex_pwospf_router_list(rs);
+			lock_mutex_pwospf_router_list(rs);
+			start_lsu_bcast_flood(rs, NULL);
+			unlock_mutex_pwospf_router_list(rs);
 
-				/* signal the lsu bcast thread to send the packets */
-				pthread_cond_signal(rs->pwospf_lsu_bcast_cond);
-			}
+			/* signal the lsu bcast thread to send the packets */
+			pthread_cond_signal(rs->pwospf_lsu_bcast_cond);
 		}
 
-		/* poll every 1 second */
-		sleep(1);
+		/* the first second the check above passes again */
+		delay = pwospf_delay(our_router->last_update + rs->pwospf_lsu_interval);
 	}
 
+	return delay;
 }
 
-void *pwospf_lsu_timeout_thread(void *param) {
+/*
+ * Timer callback, drops the routers we have not heard an lsu from in three
+ * intervals. Wakes again when the next one would time out, or after an interval
+ * so a shorter interval set from the cli is picked up.
+ */
+unsigned int pwospf_lsu_timeout_tick(void *arg) {
 
-	assert(param);
-	struct sr_instance *sr = (struct sr_instance *)param;
+	assert(arg);
+	struct sr_instance *sr = (struct sr_instance *)arg;
 	router_state *rs = get_router_state(sr);
 	time_t now;
 	int diff;
 	int timeout_occured = 0;
+	time_t next_timeout = 0;
 
-	while(1) {
-		timeout_occured = 0;
-		lock_mutex_pwospf_router_list(rs);
-
-		node *rl_cur = rs->pwospf_router_list;
-		node *rl_next = NULL;
-
-		/* eliminate lsu timedout entries */
-		while(rl_cur) {
-			rl_next = rl_cur->next;
-
-			pwospf_router *rl_entry = (pwospf_router *)rl_cur->data;
-			/* don't time out ourself */
-			if (rl_entry->router_id == rs->router_id) {
-				rl_cur = rl_next;
-				continue;
-			}
+	lock_mutex_pwospf_router_list(rs);
 
-			time(&now);
-			diff = (int)difftime(now, rl_entry->last_update);
-
-			/* if(diff > 3 * LSUINT) */
-			if (diff > (rs->pwospf_lsu_interval * 3)) {
-				char addr[16];
-				inet_ntop(AF_INET, &(rl_entry->router_id), addr, 16);
-				//printf("PWOSPF ROUTER LENGTH: %u\n", node_length(rs->pwospf_router_list));
-				//printf("Timing out router with id: %s\n", addr);
-				node *il_cur = rl_entry->interface_list;
-				node *il_next = NULL;
-
-				while(il_cur) {
-					il_next = il_cur->next;
-					node_remove(&rl_entry->interface_list, il_cur);
-					il_cur = il_next;
-				}
+	node *rl_cur = rs->pwospf_router_list;
+	node *rl_next = NULL;
 
-				node_remove(&rs->pwospf_router_list, rl_cur);
-				timeout_occured = 1;
-			}
+	/* eliminate lsu timedout entries */
+	while(rl_cur) {
+		rl_next = rl_cur->next;
 
+		pwospf_router *rl_entry = (pwospf_router *)rl_cur->data;
+		/* don't time out ourself */
+		if (rl_entry->router_id == rs->router_id) {
 			rl_cur = rl_next;
+			continue;
 		}
 
+		time(&now);
+		diff = (int)difftime(now, rl_entry->last_update);
 
-		/* build lsu flood information for all our neighbors */
-		if(timeout_occured == 1) {
+		/* if(diff > 3 * LSUINT) */
+		if (diff > (rs->pwospf_lsu_interval * 3)) {
+			char addr[16];
+			inet_ntop(AF_INET, &(rl_entry->router_id), addr, 16);
 			//printf("PWOSPF ROUTER LENGTH: %u\n", node_length(rs->pwospf_router_list));
-			propagate_pwospf_changes(rs, NULL);
+			//printf("Timing out router with id: %s\n", addr);
+			node *il_cur = rl_entry->interface_list;
+			node *il_next = NULL;
+
+			while(il_cur) {
+				il_next = il_cur->next;
+				node_remove(&rl_entry->interface_list, il_cur);
+				il_cur = il_next;
+			}
+
+			node_remove(&rs->pwospf_router_list, rl_cur);
+			timeout_occured = 1;
+		} else if ((next_timeout == 0) || ((rl_entry->last_update + (rs->pwospf_lsu_interval * 3)) < next_timeout)) {
+			next_timeout = rl_entry->last_update + (rs->pwospf_lsu_interval * 3);
 		}
 
+		rl_cur = rl_next;
+	}
 
-		unlock_mutex_pwospf_router_list(rs);
 
+	/* build lsu flood information for all our neighbors */
+	if(timeout_occured == 1) {
+		//printf("PWOSPF ROUTER LENGTH: %u\n", node_length(rs->pwospf_router_list));
+		propagate_pwospf_changes(rs, NULL);
+	}
 
-		/* signal thread to send the lsu flood */
-		if(timeout_occured == 1) {
-			pthread_cond_signal(rs->pwospf_lsu_bcast_cond);
+	unsigned int delay = ((rs->pwospf_lsu_interval > 0) ? rs->pwospf_lsu_interval : 1) * 1000;
+	if (next_timeout != 0) {
+		unsigned int timeout_delay = pwospf_delay(next_timeout);
+		if (timeout_delay < delay) {
+			delay = timeout_delay;
 		}
+	}
 
+	unlock_mutex_pwospf_router_list(rs);
 
-		sleep(1);
-	}
 
+	/* signal thread to send the lsu flood */
+	if(timeout_occured == 1) {
+		pthread_cond_signal(rs->pwospf_lsu_bcast_cond);
+	}
 
+	return delay;
 }
 
 
@@ -1270,7 +1361,6 @@ void *pwospf_lsu_bcast_thread(void *param) {
 		lock_arp_cache_rd(rs);
 		lock_arp_queue_wr(rs);
 		lock_if_list_rd(rs);
-		lock_rtable_rd(rs);
 
 		/* iterate over the queue and send each packet */
 		node *cur = lsu_queue;
@@ -1300,7 +1390,6 @@ void *pwospf_lsu_bcast_thread(void *param) {
 			cur = next;
 		}
 
-		unlock_rtable(rs);
 		unlock_if_list(rs);
 		unlock_arp_queue(rs);
 		unlock_arp_cache(rs);
@@ -1315,9 +1404,7 @@ void *pwospf_lsu_bcast_thread(void *param) {
 
 void cli_pwospf_send_hello(router_state *rs, cli_request *req) {
 
-	lock_if_list_wr(rs);
-	broadcast_pwospf_hello_packet(rs->sr);
-	unlock_if_list(rs);
+	send_pwospf_hello(rs->sr);
 
 	char *usage = "Hello packet sent on each interface\n";
 	send_to_socket(req->sockfd, usage, strlen(usage));
@@ -15,6 +15,7 @@ void process_pwospf_packet(struct sr_instance* sr, const uint8_t * packet, unsig
 void process_pwospf_hello_packet(struct sr_instance* sr, const uint8_t * packet, unsigned int len, const char* interface);
 void process_pwospf_lsu_packet(struct sr_instance* sr, const uint8_t * packet, unsigned int len, const char* interface);
 void broadcast_pwospf_hello_packet(struct sr_instance *sr);
+void send_pwospf_hello(struct sr_instance *sr);
 void broadcast_pwospf_lsu_packet(struct sr_instance *sr, pwospf_hdr *pwospf, struct in_addr* src_ip);
 
 int is_pwospf_packet_valid(router_state *rs, const uint8_t *packet, unsigned int len);
@@ -33,6 +34,8 @@ int populate_pwospf_router_interface_list(pwospf_router *router, uint8_t *packet
 void propagate_pwospf_changes(router_state *rs, char *except_this_interface);
 void determine_active_interfaces(router_state *rs, pwospf_router *router);
 int determine_timedout_interface(router_state *rs, iface_entry *iface);
+int pwospf_neighbor_timedout(router_state *rs);
+void expire_pwospf_neighbors(struct sr_instance *sr);
 void start_lsu_bcast_flood(router_state *rs, char *exclude_this_interface);
 
 pwospf_interface *default_route_present(router_state *rs);
@@ -53,9 +56,9 @@ void cli_pwospf_set_lsu_interval(router_state *rs, cli_request *req);
 void cli_pwospf_send_hello(router_state *rs, cli_request *req);
 void cli_pwospf_send_lsu(router_state *rs, cli_request *req);
 
-void *pwospf_hello_thread(void *param);
-void *pwospf_lsu_thread(void *param);
-void *pwospf_lsu_timeout_thread(void *param);
+unsigned int pwospf_hello_tick(void *arg);
+unsigned int pwospf_lsu_tick(void *arg);
+unsigned int pwospf_lsu_timeout_tick(void *arg);
 void *pwospf_lsu_bcast_thread(void *param);
 
 void lock_mutex_pwospf_router_list(router_state* rs);
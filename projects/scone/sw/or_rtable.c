@@ -9,6 +9,7 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <assert.h>
+#include <sched.h>
 
 #include "or_rtable.h"
 #include "or_main.h"
@@ -16,7 +17,11 @@
 #include "or_output.h"
 #include "or_utils.h"
 #include "or_netfpga.h"
+#include "or_lpm.h"
+#include "or_hw_table.h"
+#include "or_export.h"
 #include "nf2/nf2util.h"
+#include "nf2/nf2.h"
 #include "reg_defines.h"
 
 void write_rtable_to_hw(router_state* rs);
@@ -24,40 +29,12 @@ void write_rtable_to_hw(router_state* rs);
 /*
  * next_hop, next_hop_iface are parameters returned by the function
  * len is the max length that can be copied into next_hop_iface
- * THIS METHOD IS NOT THREAD SAFE! AQUIRE THE rtable lock first!
+ * THREAD SAFE, looks up the latest published rtable snapshot without taking the rtable lock.
  * Returns: 1 if no match, 0 if there is a match
  */
 int get_next_hop(struct in_addr* next_hop, char* next_hop_iface, int len, router_state* rs, struct in_addr* destination) {
-	int i;
-
-	node* n = rs->rtable;
-	rtable_entry* lpm = NULL;
-	int most_bits_matched = -1;
-	while (n) {
-		rtable_entry* re = (rtable_entry*)n->data;
-
-		if (re->is_active) {
-			uint32_t mask = ntohl(re->mask.s_addr);
-			uint32_t ip = ntohl(re->ip.s_addr) & mask;
-			uint32_t dest_ip = ntohl(destination->s_addr) & mask;
-
-			if (ip == dest_ip) {
-				/* count the number of bits in the mask */
-				int bits_matched = 0;
-				for (i = 0; i < 32; ++i) {
-					if ((mask >> i) & 0x1) {
-						++bits_matched;
-					}
-				}
-
-				if (bits_matched > most_bits_matched) {
-					lpm = re;
-					most_bits_matched = bits_matched;
-				}
-			}
-		}
-		n = n->next;
-	}
+	rtable_snapshot* snap = rtable_snapshot_acquire(rs);
+	rtable_entry* lpm = (rtable_entry*)lpm_lookup(snap->lpm, ntohl(destination->s_addr));
 
 	int retval = 1;
 	if (lpm) {
@@ -72,9 +49,221 @@ int get_next_hop(struct in_addr* next_hop, char* next_hop_iface, int len, router
 		retval = 0;
 	}
 
+	rtable_snapshot_release(rs, snap);
+
 	return retval;
 }
 
+/* the reader record of the calling thread, taken on its first lookup */
+static __thread rtable_reader* local_reader = NULL;
+static __thread router_state* local_reader_rs = NULL;
+static pthread_key_t rtable_reader_key;
+static pthread_once_t rtable_reader_key_once = PTHREAD_ONCE_INIT;
+
+static void rtable_snapshot_free(rtable_snapshot* snap) {
+	lpm_destroy(snap->lpm);
+	free(snap->entries);
+	snap->lpm = NULL;
+	snap->entries = NULL;
+	snap->num_entries = 0;
+	snap->retired = 0;
+	snap->in_use = 0;
+}
+
+/* hands the record of an exiting thread back for the next new thread to take over */
+static void rtable_reader_exit(void* arg) {
+	rtable_reader* r = (rtable_reader*)arg;
+
+	r->pinned = 0;
+	__sync_synchronize();
+	r->owned = 0;
+}
+
+static void rtable_reader_key_create(void) {
+	pthread_key_create(&rtable_reader_key, rtable_reader_exit);
+}
+
+/*
+ * Returns the reader record of the calling thread, taking over the record of a
+ * thread that has exited or adding a new one on the first call.
+ */
+static rtable_reader* get_local_reader(router_state* rs) {
+	if (local_reader_rs != rs) {
+		rtable_reader* r;
+
+		if (local_reader) {
+			rtable_reader_exit(local_reader);
+		}
+
+		for (r = rs->rtable_readers; r; r = r->next) {
+			if (!r->owned && __sync_bool_compare_and_swap(&(r->owned), 0, 1)) {
+				break;
+			}
+		}
+		if (!r) {
+			if (posix_memalign((void**)&r, sizeof(rtable_reader), sizeof(rtable_reader)) != 0) {
+				perror("Failure allocating an rtable reader");
+				exit(1);
+			}
+			bzero(r, sizeof(rtable_reader));
+			r->owned = 1;
+
+			do {
+				r->next = rs->rtable_readers;
+			} while (!__sync_bool_compare_and_swap(&(rs->rtable_readers), r->next, r));
+		}
+
+		local_reader = r;
+		local_reader_rs = rs;
+		pthread_setspecific(rtable_reader_key, r);
+	}
+
+	return local_reader;
+}
+
+/*
+ * Frees every retired snapshot no reader has pinned.
+ * NOT Threadsafe, ensure rtable locked for write
+ */
+static void rtable_snapshot_reclaim(router_state* rs) {
+	uint64_t pinned = 0;
+	rtable_reader* r;
+	int i;
+
+	/* pairs with the barrier in rtable_snapshot_acquire */
+	__sync_synchronize();
+	for (r = rs->rtable_readers; r; r = r->next) {
+		uint32_t p = r->pinned;
+		if (p) {
+			pinned |= ((uint64_t)1) << (p - 1);
+		}
+	}
+
+	for (i = 0; i < RTABLE_SNAPSHOT_SLOTS; ++i) {
+		if (rs->rtable_snapshots[i].retired && !(pinned & (((uint64_t)1) << i))) {
+			rtable_snapshot_free(&(rs->rtable_snapshots[i]));
+		}
+	}
+}
+
+/*
+ * Allocates the snapshot slots and publishes an empty rtable. Call once before any
+ * thread looks up a route.
+ */
+void rtable_snapshot_init(router_state* rs) {
+	rs->rtable_snapshots = (rtable_snapshot*)calloc(RTABLE_SNAPSHOT_SLOTS, sizeof(rtable_snapshot));
+	assert(rs->rtable_snapshots);
+
+	rtable_snapshot* snap = &(rs->rtable_snapshots[0]);
+	snap->lpm = lpm_create();
+	snap->in_use = 1;
+
+	pthread_once(&rtable_reader_key_once, rtable_reader_key_create);
+	rs->rtable_readers = NULL;
+	rs->rtable_version = 0;
+	rs->rtable_current = 0;
+	__sync_synchronize();
+}
+
+/*
+ * THREAD SAFE, lock free. Pins the current snapshot in the reader record of the
+ * calling thread, so a lookup only writes to memory of its own thread. A thread holds
+ * one snapshot at a time, every acquire must be paired with a release.
+ */
+rtable_snapshot* rtable_snapshot_acquire(router_state* rs) {
+	rtable_reader* r = get_local_reader(rs);
+	uint32_t cur = rs->rtable_current;
+	uint32_t seen;
+
+	/* a writer that retired cur before it saw the pin has published a newer one */
+	for (;;) {
+		r->pinned = cur + 1;
+		__sync_synchronize();
+		seen = rs->rtable_current;
+		if (seen == cur) {
+			break;
+		}
+		cur = seen;
+	}
+
+	return &(rs->rtable_snapshots[cur]);
+}
+
+/*
+ * THREAD SAFE, lock free. Unpins snap, which must be the snapshot the calling thread
+ * acquired from rs. The snapshot is freed by a later writer.
+ */
+void rtable_snapshot_release(router_state* rs, rtable_snapshot* snap) {
+	rtable_reader* r = get_local_reader(rs);
+	assert(r->pinned == (uint32_t)(snap - rs->rtable_snapshots) + 1);
+
+	/* the release orders the reads of the snapshot before the unpin */
+	__atomic_store_n(&(r->pinned), 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies the active entries of the rtable into a new snapshot, indexes them in a new
+ * trie and swaps it in for the readers, so every change costs a pass over the whole
+ * rtable. The rtable must be sorted already, the first entry for a given destination
+ * and mask wins, which keeps static routes ahead of dynamic ones.
+ * NOT Threadsafe, ensure rtable locked for write
+ */
+void publish_rtable_snapshot(router_state* rs) {
+	int slot = -1;
+	int i;
+
+	/* grab a free slot, only waits if 63 old snapshots are still pinned by readers */
+	while (slot < 0) {
+		for (i = 0; i < RTABLE_SNAPSHOT_SLOTS; ++i) {
+			if (!rs->rtable_snapshots[i].in_use) {
+				slot = i;
+				break;
+			}
+		}
+		if (slot < 0) {
+			sched_yield();
+			rtable_snapshot_reclaim(rs);
+		}
+	}
+
+	rtable_snapshot* snap = &(rs->rtable_snapshots[slot]);
+	snap->num_entries = 0;
+	node* cur = rs->rtable;
+	while (cur) {
+		if (((rtable_entry*)cur->data)->is_active) {
+			++snap->num_entries;
+		}
+		cur = cur->next;
+	}
+
+	snap->entries = (rtable_entry*)calloc(snap->num_entries ? snap->num_entries : 1, sizeof(rtable_entry));
+	snap->lpm = lpm_create();
+
+	i = 0;
+	cur = rs->rtable;
+	while (cur) {
+		rtable_entry* entry = (rtable_entry*)cur->data;
+		if (entry->is_active) {
+			memcpy(&(snap->entries[i]), entry, sizeof(rtable_entry));
+			lpm_insert(snap->lpm, ntohl(entry->ip.s_addr), ntohl(entry->mask.s_addr), &(snap->entries[i]));
+			++i;
+		}
+		cur = cur->next;
+	}
+
+	snap->version = ++rs->rtable_version;
+	export_stamp(rs, EXPORT_RTABLE);
+	snap->in_use = 1;
+
+	/* publish once the snapshot is filled in, then retire the old one */
+	uint32_t old = rs->rtable_current;
+	__sync_synchronize();
+	rs->rtable_current = slot;
+	rs->rtable_snapshots[old].retired = 1;
+
+	rtable_snapshot_reclaim(rs);
+}
+
 /*
  * NOT thread safe, lock the rtable before calling.
  * All parameters are copied out.
@@ -195,80 +384,106 @@ int activate_routes(router_state* rs, char* interface) {
 	return 0;
 }
 
+/* an rtable entry and its place in the list before sorting */
+struct rtable_sort_item {
+	rtable_entry* entry;
+	int index;
+};
+
+/* longest mask first, then by ip, static before dynamic, then in list order */
+static int rtable_entry_cmp(const void* a, const void* b) {
+	const struct rtable_sort_item* p = (const struct rtable_sort_item*)a;
+	const struct rtable_sort_item* q = (const struct rtable_sort_item*)b;
+	rtable_entry* x = p->entry;
+	rtable_entry* y = q->entry;
+
+	if (x->mask.s_addr != y->mask.s_addr) {
+		return (ntohl(x->mask.s_addr) < ntohl(y->mask.s_addr)) ? 1 : -1;
+	}
+	if (x->ip.s_addr != y->ip.s_addr) {
+		return (ntohl(x->ip.s_addr) < ntohl(y->ip.s_addr)) ? 1 : -1;
+	}
+	if (x->is_static != y->is_static) {
+		return y->is_static - x->is_static;
+	}
+	/* qsort is not stable, keep equal entries where they were like the old bubble sort did */
+	return p->index - q->index;
+}
+
 /*
  * NOT Threadsafe, ensure rtable locked for write
  */
 void trigger_rtable_modified(router_state* rs) {
-	/* bubble sort by netmask */
-
-	int swapped = 0;
-	do {
-		swapped = 0;
-		node* cur = rs->rtable;
-		while (cur && cur->next) {
-			rtable_entry* a = (rtable_entry*)cur->data;
-			rtable_entry* b = (rtable_entry*)cur->next->data;
-			if ((ntohl(a->mask.s_addr) < ntohl(b->mask.s_addr)) ||
-				((a->mask.s_addr == b->mask.s_addr) && (ntohl(a->ip.s_addr) < ntohl(b->ip.s_addr))) ||
-				((a->mask.s_addr == b->mask.s_addr) && (a->ip.s_addr == b->ip.s_addr) && !a->is_static && b->is_static)) {
-				cur->data = b;
-				cur->next->data = a;
-				swapped = 1;
-			}
+	/* sort by netmask, the nodes keep their place and only the data pointers move */
+	int i, count = 0;
+	node* cur = rs->rtable;
+	while (cur) {
+		++count;
+		cur = cur->next;
+	}
 
-			cur = cur->next;
+	if (count > 1) {
+		struct rtable_sort_item* items = (struct rtable_sort_item*)malloc(count * sizeof(struct rtable_sort_item));
+		for (i = 0, cur = rs->rtable; cur; ++i, cur = cur->next) {
+			items[i].entry = (rtable_entry*)cur->data;
+			items[i].index = i;
 		}
-	} while (swapped);
+		qsort(items, count, sizeof(struct rtable_sort_item), rtable_entry_cmp);
+		for (i = 0, cur = rs->rtable; cur; ++i, cur = cur->next) {
+			cur->data = items[i].entry;
+		}
+		free(items);
+	}
+
+	publish_rtable_snapshot(rs);
 
 	if (rs->is_netfpga) {
 		write_rtable_to_hw(rs);
 	}
 }
 
+/*
+ * Row writer for rs->rtable_hw, words are ip, mask, next hop, one hot port.
+ */
+void write_rtable_row_to_hw(router_state* rs, int row, const uint32_t* words) {
+	/* ip, mask, next hop and port, then the row number latches them, in one batch */
+	struct nf2reg regs[] = {
+		{ ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_IP_REG, words[0] },
+		{ ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_MASK_REG, words[1] },
+		{ ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_NEXT_HOP_IP_REG, words[2] },
+		{ ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_OUTPUT_PORT_REG, words[3] },
+		{ ROUTER_OP_LUT_ROUTE_TABLE_WR_ADDR_REG, row }
+	};
+
+	writeRegs(&(rs->netfpga), regs, sizeof(regs) / sizeof(regs[0]));
+}
+
+/*
+ * Pushes the first ROUTER_OP_LUT_ROUTE_TABLE_DEPTH active entries down to hardware,
+ * only rows that differ from what is already there get written.
+ * NOT THREAD SAFE: lock rtable at least for read, the rtable must be sorted
+ */
 void write_rtable_to_hw(router_state* rs) {
-	/* naively iterate through the 32 slots in hardware updating all entries */
-	int i = 0;
-	node* cur = rs->rtable;
+	uint32_t rows[ROUTER_OP_LUT_ROUTE_TABLE_DEPTH * RTABLE_HW_WIDTH];
+	int ranks[ROUTER_OP_LUT_ROUTE_TABLE_DEPTH];
+	int num_rows = 0;
 
-	/* find first active entry before entering the loop */
-	while (cur && !(((rtable_entry*)cur->data)->is_active)) {
+	node* cur = rs->rtable;
+	while (cur && (num_rows < ROUTER_OP_LUT_ROUTE_TABLE_DEPTH)) {
+		rtable_entry* entry = (rtable_entry*)cur->data;
+		if (entry->is_active) {
+			uint32_t* row = rows + (num_rows * RTABLE_HW_WIDTH);
+			row[0] = ntohl(entry->ip.s_addr);
+			row[1] = ntohl(entry->mask.s_addr);
+			row[2] = ntohl(entry->gw.s_addr);
+			row[3] = getOneHotPortNumber(entry->iface);
+			ranks[num_rows] = lpm_mask_len(row[1]);
+			++num_rows;
+		}
 		cur = cur->next;
 	}
 
-	for (i = 0; i < ROUTER_OP_LUT_ROUTE_TABLE_DEPTH; ++i) {
-
-		if (cur) {
-			rtable_entry* entry = (rtable_entry*)cur->data;
-			/* write the ip */
-			writeReg(&(rs->netfpga), ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_IP_REG, ntohl(entry->ip.s_addr));
-			/* write the mask */
-			writeReg(&(rs->netfpga), ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_MASK_REG, ntohl(entry->mask.s_addr));
-			/* write the next hop */
-			writeReg(&(rs->netfpga), ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_NEXT_HOP_IP_REG, ntohl(entry->gw.s_addr));
-			/* write the port */
-			writeReg(&(rs->netfpga), ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_OUTPUT_PORT_REG, getOneHotPortNumber(entry->iface));
-			/* write the row number */
-			writeReg(&(rs->netfpga), ROUTER_OP_LUT_ROUTE_TABLE_WR_ADDR_REG, i);
-
-			/* advance at least once */
-			cur = cur->next;
-			/* find the next active entry */
-			while (cur && !(((rtable_entry*)cur->data)->is_active)) {
-				cur = cur->next;
-			}
-		} else {
-			/* write the ip */
-			writeReg(&(rs->netfpga), ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_IP_REG, 0);
-			/* write the mask */
-			writeReg(&(rs->netfpga), ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_MASK_REG, 0);
-			/* write the next hop */
-			writeReg(&(rs->netfpga), ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_NEXT_HOP_IP_REG, 0);
-			/* write the port */
-			writeReg(&(rs->netfpga), ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_OUTPUT_PORT_REG, 0);
-			/* set the row */
-			writeReg(&(rs->netfpga), ROUTER_OP_LUT_ROUTE_TABLE_WR_ADDR_REG, i);
-		}
-	}
+	hw_table_sync(rs, rs->rtable_hw, rows, ranks, num_rows, NULL);
 }
 
 
@@ -10,6 +10,9 @@
 #include "or_data_types.h"
 #include "sr_base_internal.h"
 
+/* ip, mask, next hop, port */
+#define RTABLE_HW_WIDTH 4
+
 int get_next_hop(struct in_addr* next_hop, char* next_hop_iface, int len, router_state* rs, struct in_addr* destination);
 int add_route(router_state* rs, struct in_addr* dest, struct in_addr* gateway, struct in_addr* mask, char* interface);
 int del_route(router_state* rs, struct in_addr* dest, struct in_addr* mask);
@@ -18,7 +21,13 @@ int deactivate_routes(router_state* rs, char* interface);
 int activate_routes(router_state* rs, char* interface);
 
 void trigger_rtable_modified(router_state* rs);
+
+void rtable_snapshot_init(router_state* rs);
+rtable_snapshot* rtable_snapshot_acquire(router_state* rs);
+void rtable_snapshot_release(router_state* rs, rtable_snapshot* snap);
+void publish_rtable_snapshot(router_state* rs);
 void write_rtable_to_hw(router_state* rs);
+void write_rtable_row_to_hw(router_state* rs, int row, const uint32_t* words);
 
 void lock_rtable_rd(router_state *rs);
 void lock_rtable_wr(router_state *rs);
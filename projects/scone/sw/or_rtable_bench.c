@@ -0,0 +1,173 @@
+/*
+ * Measures forwarding lookups per second while a writer churns routes at a fixed
+ * rate. Runs once with readers taking the rtable read lock around get_next_hop (the
+ * old forwarding path) and once reading the published rtable snapshot lock free. The
+ * lock prefers writers so the churn is the same in both runs, a default rwlock lets
+ * the readers starve the writer and the locked run would measure no churn at all.
+ *
+ * usage: rtable-bench [num_readers] [num_routes] [seconds] [churn_per_sec]
+ */
+
+#include "or_rtable.h"
+#include "or_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+struct bench_state {
+	router_state* rs;
+	int use_lock;
+	int num_routes;
+	int churn_rate;
+	volatile int running;
+	volatile unsigned long long lookups;
+	volatile unsigned long long churns;
+};
+typedef struct bench_state bench_state;
+
+void* reader_thread(void* arg) {
+	bench_state* bs = (bench_state*)arg;
+	unsigned long long count = 0;
+	unsigned int seed = (unsigned int)pthread_self();
+	struct in_addr dest, next_hop;
+	char iface[IF_LEN];
+
+	while (bs->running) {
+		dest.s_addr = htonl((10 << 24) | ((rand_r(&seed) % bs->num_routes) << 8) | 1);
+		if (bs->use_lock) {
+			lock_rtable_rd(bs->rs);
+		}
+		get_next_hop(&next_hop, iface, IF_LEN, bs->rs, &dest);
+		if (bs->use_lock) {
+			unlock_rtable(bs->rs);
+		}
+		++count;
+	}
+
+	__sync_fetch_and_add(&(bs->lookups), count);
+	return NULL;
+}
+
+/* deletes and re-adds one /24 at a time, like a flapping link, churn_rate times a second */
+void* writer_thread(void* arg) {
+	bench_state* bs = (bench_state*)arg;
+	unsigned int seed = 1;
+	struct in_addr dest, gw, mask;
+	struct timespec next;
+	long interval_ns = 1000000000L / bs->churn_rate;
+	inet_pton(AF_INET, "255.255.255.0", &mask);
+	inet_pton(AF_INET, "192.168.0.1", &gw);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (bs->running) {
+		next.tv_nsec += interval_ns;
+		while (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			++next.tv_sec;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		dest.s_addr = htonl((10 << 24) | ((rand_r(&seed) % bs->num_routes) << 8));
+
+		lock_rtable_wr(bs->rs);
+		del_route(bs->rs, &dest, &mask);
+		add_route(bs->rs, &dest, &gw, &mask, "eth1");
+		unlock_rtable(bs->rs);
+
+		++bs->churns;
+	}
+
+	return NULL;
+}
+
+void run(int use_lock, int num_readers, int num_routes, int seconds, int churn_rate) {
+	int i;
+	router_state* rs = (router_state*)calloc(1, sizeof(router_state));
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	rs->rtable_lock = (pthread_rwlock_t*)malloc(sizeof(pthread_rwlock_t));
+	pthread_rwlock_init(rs->rtable_lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	rtable_snapshot_init(rs);
+
+	struct in_addr gw, mask;
+	inet_pton(AF_INET, "255.255.255.0", &mask);
+	inet_pton(AF_INET, "192.168.0.1", &gw);
+
+	/* build the table directly, add_route would re-sort on every insert */
+	node* tail = NULL;
+	for (i = 0; i < num_routes; ++i) {
+		rtable_entry* entry = (rtable_entry*)calloc(1, sizeof(rtable_entry));
+		entry->ip.s_addr = htonl((10 << 24) | (i << 8));
+		entry->mask.s_addr = mask.s_addr;
+		entry->gw.s_addr = gw.s_addr;
+		strncpy(entry->iface, "eth0", IF_LEN);
+		entry->is_active = 1;
+		entry->is_static = 1;
+
+		node* n = node_create();
+		n->data = entry;
+		if (!rs->rtable) {
+			rs->rtable = n;
+		} else {
+			tail->next = n;
+			n->prev = tail;
+		}
+		tail = n;
+	}
+	lock_rtable_wr(rs);
+	trigger_rtable_modified(rs);
+	unlock_rtable(rs);
+
+	bench_state bs;
+	bzero(&bs, sizeof(bench_state));
+	bs.rs = rs;
+	bs.use_lock = use_lock;
+	bs.num_routes = num_routes;
+	bs.churn_rate = churn_rate;
+	bs.running = 1;
+
+	pthread_t* readers = (pthread_t*)malloc(num_readers * sizeof(pthread_t));
+	pthread_t writer;
+	for (i = 0; i < num_readers; ++i) {
+		pthread_create(&readers[i], NULL, reader_thread, &bs);
+	}
+	pthread_create(&writer, NULL, writer_thread, &bs);
+
+	sleep(seconds);
+	bs.running = 0;
+
+	for (i = 0; i < num_readers; ++i) {
+		pthread_join(readers[i], NULL);
+	}
+	pthread_join(writer, NULL);
+
+	printf("%-10s %-8i %-8i %-16.0f %-12.0f %u\n", use_lock ? "rwlock" : "snapshot",
+		num_readers, num_routes, bs.lookups / (double)seconds, bs.churns / (double)seconds,
+		rs->rtable_version);
+
+	free(readers);
+}
+
+int main(int argc, char** argv)
+{
+	int num_readers = (argc > 1) ? atoi(argv[1]) : 4;
+	int num_routes = (argc > 2) ? atoi(argv[2]) : 1000;
+	int seconds = (argc > 3) ? atoi(argv[3]) : 3;
+	int churn_rate = (argc > 4) ? atoi(argv[4]) : 100;
+	if (churn_rate <= 0) {
+		churn_rate = 1;
+	}
+
+	printf("%-10s %-8s %-8s %-16s %-12s %s\n", "Mode", "Readers", "Routes", "Lookups/s", "Churn/s", "Versions");
+	run(1, num_readers, num_routes, seconds, churn_rate);
+	run(0, num_readers, num_routes, seconds, churn_rate);
+
+	return 0;
+}
@@ -0,0 +1,342 @@
+/*
+ * Timer service for the periodic work of the router. One thread sleeps on a timerfd
+ * armed for the earliest pending timer, timers sit in a timer wheel with millisecond
+ * ticks, so the thread only wakes when something is due and nothing is polled.
+ * Callbacks run without the scheduler lock and return the milliseconds until they
+ * want to run again. Other threads kick a timer to have it run sooner, a kick never
+ * pushes a timer back. How late each timer ran and how often the thread woke up
+ * are kept for "show sched".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/timerfd.h>
+
+#include "or_sched.h"
+#include "or_twheel.h"
+#include "or_utils.h"
+
+#define SCHED_NS_PER_MS 1000000ULL
+#define SCHED_NS_PER_SEC 1000000000ULL
+
+static char* sched_state_names[] = { "idle", "pending", "running" };
+
+uint64_t sched_clock_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * SCHED_NS_PER_SEC) + ts.tv_nsec;
+}
+
+/* the current tick */
+static uint64_t sched_now(scheduler* s) {
+	return (sched_clock_ns() - s->start_ns) / SCHED_NS_PER_MS;
+}
+
+/*
+ * Sets the timerfd for the earliest pending timer, a timer added from another thread
+ * that comes before it moves the wakeup forward.
+ * NOT THREAD SAFE: hold s->lock
+ */
+static void sched_arm(scheduler* s) {
+	struct itimerspec its;
+	uint64_t next = twheel_next(s->wheel);
+
+	if (next == s->armed) {
+		return;
+	}
+
+	bzero(&its, sizeof(its));
+	if (next != 0) {
+		uint64_t ns = s->start_ns + (next * SCHED_NS_PER_MS);
+		its.it_value.tv_sec = ns / SCHED_NS_PER_SEC;
+		its.it_value.tv_nsec = ns % SCHED_NS_PER_SEC;
+	}
+	if (timerfd_settime(s->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+		perror("Failure arming the scheduler timerfd");
+	}
+	s->armed = next;
+}
+
+/* NOT THREAD SAFE: hold s->lock */
+static void sched_place(sched_timer* t, uint64_t tick) {
+	twheel_add(t->sched->wheel, &(t->wheel), tick);
+	t->state = SCHED_TIMER_PENDING;
+	sched_arm(t->sched);
+}
+
+/* queues a due timer to be run once the lock is dropped */
+static void sched_collect(twheel_timer* w, void* arg) {
+	sched_timer*** tail = (sched_timer***)arg;
+	sched_timer* t = (sched_timer*)w->data;
+
+	t->state = SCHED_TIMER_RUNNING;
+	t->fire_next = NULL;
+	**tail = t;
+	*tail = &(t->fire_next);
+}
+
+static void sched_account(scheduler* s, sched_timer* t, uint64_t late_ns, uint64_t run_ns) {
+	uint64_t bound = 100000;
+	int i;
+
+	++t->runs;
+	++s->runs;
+	t->late_ns_total += late_ns;
+	if (late_ns > t->late_ns_max) {
+		t->late_ns_max = late_ns;
+	}
+	t->run_ns_total += run_ns;
+
+	for (i = 0; (i < SCHED_LATE_BUCKETS - 1) && (late_ns >= bound); ++i) {
+		bound *= 10;
+	}
+	++s->late[i];
+}
+
+/* runs everything due, in the order it was due */
+static void sched_run(scheduler* s) {
+	sched_timer* fired = NULL;
+	sched_timer** tail = &fired;
+
+	pthread_mutex_lock(&(s->lock));
+	++s->wakeups;
+	s->armed = 0;
+	twheel_advance(s->wheel, sched_now(s), sched_collect, &tail);
+	if (!fired) {
+		++s->idle_wakeups;
+	}
+	pthread_mutex_unlock(&(s->lock));
+
+	while (fired) {
+		sched_timer* t = fired;
+		fired = t->fire_next;
+
+		uint64_t due = s->start_ns + (t->wheel.expires * SCHED_NS_PER_MS);
+		uint64_t start = sched_clock_ns();
+		unsigned int delay = t->callback(t->arg);
+		uint64_t end = sched_clock_ns();
+
+		pthread_mutex_lock(&(s->lock));
+		sched_account(s, t, (start > due) ? (start - due) : 0, end - start);
+
+		/* the sooner of what the callback wants and what a kick asked for meanwhile */
+		uint64_t next = (delay > 0) ? (sched_now(s) + delay) : 0;
+		if (t->requested && (!next || (t->requested < next))) {
+			next = t->requested;
+		}
+		t->requested = 0;
+		t->state = SCHED_TIMER_IDLE;
+		if (next && !t->cancelled) {
+			twheel_add(s->wheel, &(t->wheel), next);
+			t->state = SCHED_TIMER_PENDING;
+		}
+		t->cancelled = 0;
+		pthread_mutex_unlock(&(s->lock));
+	}
+
+	pthread_mutex_lock(&(s->lock));
+	sched_arm(s);
+	pthread_mutex_unlock(&(s->lock));
+}
+
+static void* sched_thread(void* arg) {
+	scheduler* s = (scheduler*)arg;
+	uint64_t expirations;
+
+	while (s->running) {
+		if (read(s->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("Failure reading the scheduler timerfd");
+			break;
+		}
+		sched_run(s);
+	}
+
+	return NULL;
+}
+
+scheduler* sched_create(void) {
+	scheduler* s = (scheduler*)calloc(1, sizeof(scheduler));
+	assert(s);
+
+	s->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (s->timer_fd < 0) {
+		perror("Failure creating the scheduler timerfd");
+		exit(1);
+	}
+	if (pthread_mutex_init(&(s->lock), NULL) != 0) {
+		perror("Scheduler mutex init error");
+		exit(1);
+	}
+
+	s->start_ns = sched_clock_ns();
+	s->wheel = twheel_create(0);
+	return s;
+}
+
+/* timers may be added before the thread is started, they fire once it is */
+void sched_start(scheduler* s) {
+	s->running = 1;
+	if (pthread_create(&(s->thread), NULL, sched_thread, s) != 0) {
+		perror("Thread create error");
+		s->running = 0;
+	}
+}
+
+/* stops the thread, waiting for a callback that is running, and frees every timer */
+void sched_destroy(scheduler* s) {
+	if (s->running) {
+		pthread_mutex_lock(&(s->lock));
+		s->running = 0;
+		s->armed = 0;
+
+		/* wake the thread right away */
+		struct itimerspec its;
+		bzero(&its, sizeof(its));
+		its.it_value.tv_nsec = 1;
+		timerfd_settime(s->timer_fd, 0, &its, NULL);
+		pthread_mutex_unlock(&(s->lock));
+
+		pthread_join(s->thread, NULL);
+	}
+
+	while (s->timers) {
+		sched_timer* next = s->timers->next;
+		free(s->timers);
+		s->timers = next;
+	}
+	twheel_destroy(s->wheel);
+	pthread_mutex_destroy(&(s->lock));
+	close(s->timer_fd);
+	free(s);
+}
+
+/* the timer stays idle until it is added or kicked, it belongs to the scheduler */
+sched_timer* sched_timer_create(scheduler* s, const char* name, sched_callback callback, void* arg) {
+	sched_timer* t = (sched_timer*)calloc(1, sizeof(sched_timer));
+	assert(t);
+
+	t->wheel.data = t;
+	t->sched = s;
+	snprintf(t->name, SCHED_NAME_LEN, "%s", name);
+	t->callback = callback;
+	t->arg = arg;
+
+	pthread_mutex_lock(&(s->lock));
+	t->next = s->timers;
+	s->timers = t;
+	pthread_mutex_unlock(&(s->lock));
+	return t;
+}
+
+/*
+ * Runs t delay_ms from now, moving it if it is pending. A timer that is running is
+ * put back for then once it returns.
+ */
+void sched_add(sched_timer* t, unsigned int delay_ms) {
+	scheduler* s = t->sched;
+
+	pthread_mutex_lock(&(s->lock));
+	uint64_t tick = sched_now(s) + delay_ms;
+	if (t->state == SCHED_TIMER_RUNNING) {
+		t->requested = tick;
+		t->cancelled = 0;
+	} else {
+		sched_place(t, tick);
+	}
+	pthread_mutex_unlock(&(s->lock));
+}
+
+/*
+ * Runs t within delay_ms, unless it is already due sooner. Kicks that come in while
+ * it is pending fold into the one run.
+ */
+void sched_kick(sched_timer* t, unsigned int delay_ms) {
+	scheduler* s = t->sched;
+
+	pthread_mutex_lock(&(s->lock));
+	uint64_t tick = sched_now(s) + delay_ms;
+	++t->kicks;
+	if (t->state == SCHED_TIMER_RUNNING) {
+		if (!t->requested || (tick < t->requested)) {
+			t->requested = tick;
+		}
+		t->cancelled = 0;
+	} else if ((t->state == SCHED_TIMER_IDLE) || (tick < t->wheel.expires)) {
+		sched_place(t, tick);
+	}
+	pthread_mutex_unlock(&(s->lock));
+}
+
+/* a running timer finishes its run but is not put back */
+void sched_del(sched_timer* t) {
+	scheduler* s = t->sched;
+
+	pthread_mutex_lock(&(s->lock));
+	if (t->state == SCHED_TIMER_PENDING) {
+		twheel_del(s->wheel, &(t->wheel));
+		t->state = SCHED_TIMER_IDLE;
+	} else if (t->state == SCHED_TIMER_RUNNING) {
+		t->requested = 0;
+		t->cancelled = 1;
+	}
+	pthread_mutex_unlock(&(s->lock));
+}
+
+#define SCHED_TIMER_COL "Timer                State    Next ms    Runs       Kicks      Late avg us  Late max us  Run avg us\n"
+#define SCHED_LINE_LEN 128
+void sprint_sched(scheduler* s, char** buf, unsigned int* len) {
+	unsigned int size = strlen(SCHED_TIMER_COL) + (4 * SCHED_LINE_LEN);
+	unsigned int total_len = 0;
+	sched_timer* t;
+
+	pthread_mutex_lock(&(s->lock));
+	for (t = s->timers; t; t = t->next) {
+		size += SCHED_LINE_LEN;
+	}
+
+	char* buffer = (char*)calloc(size, sizeof(char));
+	total_len += snprintf(buffer + total_len, size - total_len, "%s", SCHED_TIMER_COL);
+
+	uint64_t now = sched_now(s);
+	for (t = s->timers; t; t = t->next) {
+		char next[24];
+		if (t->state == SCHED_TIMER_PENDING) {
+			snprintf(next, 24, "%llu", (unsigned long long)((t->wheel.expires > now) ? (t->wheel.expires - now) : 0));
+		} else {
+			snprintf(next, 24, "-");
+		}
+		total_len += snprintf(buffer + total_len, size - total_len, "%-20s %-8s %-10s %-10llu %-10llu %-12.1f %-12.1f %.1f\n",
+			t->name, sched_state_names[t->state], next, (unsigned long long)t->runs, (unsigned long long)t->kicks,
+			t->runs ? (t->late_ns_total / 1e3) / t->runs : 0.0, t->late_ns_max / 1e3,
+			t->runs ? (t->run_ns_total / 1e3) / t->runs : 0.0);
+	}
+
+	double uptime = (sched_clock_ns() - s->start_ns) / 1e9;
+	total_len += snprintf(buffer + total_len, size - total_len, "\nWakeups: %llu (%.2f/s)\tIdle wakeups: %llu\tRuns: %llu\n",
+		(unsigned long long)s->wakeups, (uptime > 0) ? s->wakeups / uptime : 0.0, (unsigned long long)s->idle_wakeups,
+		(unsigned long long)s->runs);
+
+	total_len += snprintf(buffer + total_len, size - total_len, "Late by: <100us %llu  <1ms %llu  <10ms %llu  <100ms %llu  <1s %llu  more %llu\n",
+		(unsigned long long)s->late[0], (unsigned long long)s->late[1], (unsigned long long)s->late[2],
+		(unsigned long long)s->late[3], (unsigned long long)s->late[4], (unsigned long long)s->late[5]);
+	pthread_mutex_unlock(&(s->lock));
+
+	*buf = buffer;
+	*len = total_len;
+}
+
+void cli_show_sched(router_state* rs, cli_request* req) {
+	char* info;
+	unsigned int len;
+
+	sprint_sched(rs->sched, &info, &len);
+	send_to_socket(req->sockfd, info, len);
+	free(info);
+}
@@ -0,0 +1,19 @@
+#ifndef OR_SCHED_H_
+#define OR_SCHED_H_
+
+#include "or_data_types.h"
+
+scheduler* sched_create(void);
+void sched_start(scheduler* s);
+void sched_destroy(scheduler* s);
+uint64_t sched_clock_ns(void);
+
+sched_timer* sched_timer_create(scheduler* s, const char* name, sched_callback callback, void* arg);
+void sched_add(sched_timer* t, unsigned int delay_ms);
+void sched_kick(sched_timer* t, unsigned int delay_ms);
+void sched_del(sched_timer* t);
+
+void sprint_sched(scheduler* s, char** buf, unsigned int* len);
+void cli_show_sched(router_state* rs, cli_request* req);
+
+#endif /*OR_SCHED_H_*/
@@ -0,0 +1,282 @@
+/*
+ * Compares the periodic work of the router run the way it used to be, a thread per
+ * job polling with sleep(1), usleep and a one second cond timedwait, against the
+ * same jobs as timers on the scheduler. Besides the jobs the router has, a retry
+ * job wants to run every 250ms the way an arp request retry does. Each mode reports
+ * the wakeups per second of all its threads, the cpu it used, and how late the retry
+ * ran past when it wanted to, the old threads only notice a deadline on their next
+ * poll so they can not do better than a second. The scheduler's own "show sched"
+ * output follows. Last, a timer on the second level of the wheel must run before a
+ * later one added to the first level is due, and timers of periods spread over every
+ * level running side by side must run within LATE_LIMIT_MS of their tick. The exit
+ * status says whether they did.
+ *
+ * usage: sched-bench [seconds] [retry_ms]
+ */
+
+#include "or_sched.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define MAX_SAMPLES 100000
+#define LATE_LIMIT_MS 20
+
+struct bench_job {
+	char* name;
+	unsigned int period_ms;
+};
+typedef struct bench_job bench_job;
+
+/* the periodic work of the router: arp, hello, lsu, lsu timeout, dijkstra, sping, stats */
+bench_job jobs[] = {
+	{ "arp", 1000 }, { "pwospf hello", 1000 }, { "pwospf lsu", 1000 }, { "pwospf lsu timeout", 1000 },
+	{ "dijkstra", 1000 }, { "sping cleanup", 30000 }, { "netfpga stats", 500 }
+};
+#define NUM_JOBS (sizeof(jobs) / sizeof(bench_job))
+
+volatile int running = 0;
+volatile uint64_t wakeups = 0;
+unsigned int retry_ms = 250;
+
+uint64_t samples[MAX_SAMPLES];
+unsigned int num_samples = 0;
+uint64_t retry_due = 0;
+
+pthread_mutex_t cond_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+void record_retry(uint64_t now) {
+	/* the wheel ticks in whole ms, so a timer may come up to a tick early */
+	if (num_samples < MAX_SAMPLES) {
+		samples[num_samples++] = (now > retry_due) ? (now - retry_due) : 0;
+	}
+	retry_due = now + (retry_ms * 1000000ULL);
+}
+
+/* the old threads, polling on their period */
+void* legacy_thread(void* arg) {
+	bench_job* job = (bench_job*)arg;
+
+	while (running) {
+		if (job->period_ms < 1000) {
+			usleep(job->period_ms * 1000);
+		} else if (!strcmp(job->name, "dijkstra")) {
+			struct timespec wake_up_time;
+			struct timeval now;
+			gettimeofday(&now, NULL);
+			wake_up_time.tv_sec = now.tv_sec + 1;
+			wake_up_time.tv_nsec = now.tv_usec * 1000;
+			pthread_mutex_lock(&cond_mutex);
+			pthread_cond_timedwait(&cond, &cond_mutex, &wake_up_time);
+			pthread_mutex_unlock(&cond_mutex);
+		} else {
+			sleep(job->period_ms / 1000);
+		}
+		__sync_fetch_and_add(&wakeups, 1);
+
+		/* the arp thread looks at its retries when it comes around */
+		if (!strcmp(job->name, "arp")) {
+			uint64_t now = sched_clock_ns();
+			if (now >= retry_due) {
+				record_retry(now);
+			}
+		}
+	}
+	return NULL;
+}
+
+unsigned int job_tick(void* arg) {
+	bench_job* job = (bench_job*)arg;
+	return job->period_ms;
+}
+
+unsigned int retry_tick(void* arg) {
+	record_retry(sched_clock_ns());
+	return retry_ms;
+}
+
+int compare_samples(const void* a, const void* b) {
+	uint64_t x = *(uint64_t*)a;
+	uint64_t y = *(uint64_t*)b;
+	return (x < y) ? -1 : (x > y);
+}
+
+double cpu_ms(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+void report(char* mode, double seconds, double cpu) {
+	qsort(samples, num_samples, sizeof(uint64_t), compare_samples);
+	double p50 = num_samples ? samples[num_samples / 2] / 1e6 : 0;
+	double p99 = num_samples ? samples[(num_samples * 99) / 100] / 1e6 : 0;
+	double max = num_samples ? samples[num_samples - 1] / 1e6 : 0;
+
+	printf("%-8s %-10.2f %-8.2f %-8u %-10.3f %-10.3f %.3f\n", mode, wakeups / seconds, cpu, num_samples, p50, p99, max);
+}
+
+void run_legacy(unsigned int seconds) {
+	pthread_t threads[NUM_JOBS];
+	unsigned int i;
+
+	wakeups = 0;
+	num_samples = 0;
+	retry_due = sched_clock_ns() + (retry_ms * 1000000ULL);
+	running = 1;
+
+	double cpu = cpu_ms();
+	uint64_t start = sched_clock_ns();
+	for (i = 0; i < NUM_JOBS; ++i) {
+		pthread_create(&threads[i], NULL, legacy_thread, &jobs[i]);
+	}
+	sleep(seconds);
+	running = 0;
+	double elapsed = (sched_clock_ns() - start) / 1e9;
+	cpu = cpu_ms() - cpu;
+
+	/* the sping thread would take 30s to notice, don't wait for it */
+	for (i = 0; i < NUM_JOBS; ++i) {
+		if (jobs[i].period_ms <= 1000) {
+			pthread_join(threads[i], NULL);
+		} else {
+			pthread_detach(threads[i]);
+		}
+	}
+	report("legacy", elapsed, cpu);
+}
+
+void run_sched(unsigned int seconds) {
+	scheduler* s = sched_create();
+	unsigned int i;
+
+	num_samples = 0;
+	for (i = 0; i < NUM_JOBS; ++i) {
+		sched_add(sched_timer_create(s, jobs[i].name, job_tick, &jobs[i]), jobs[i].period_ms);
+	}
+	retry_due = sched_clock_ns() + (retry_ms * 1000000ULL);
+	sched_add(sched_timer_create(s, "retry", retry_tick, NULL), retry_ms);
+
+	double cpu = cpu_ms();
+	uint64_t start = sched_clock_ns();
+	sched_start(s);
+	sleep(seconds);
+	double elapsed = (sched_clock_ns() - start) / 1e9;
+	cpu = cpu_ms() - cpu;
+
+	wakeups = s->wakeups;
+	report("sched", elapsed, cpu);
+
+	/* what "show sched" would have said */
+	char* buf;
+	unsigned int len;
+	sprint_sched(s, &buf, &len);
+	printf("\n%s", buf);
+	free(buf);
+	sched_destroy(s);
+}
+
+/* timers from a few ticks to past a level 1 turn, each restarted on its period */
+unsigned int probe_periods[] = { 3, 17, 45, 80, 130, 250, 700, 1100, 4500 };
+#define NUM_PROBES (sizeof(probe_periods) / sizeof(unsigned int))
+
+unsigned int probe_tick(void* arg) {
+	return *(unsigned int*)arg;
+}
+
+unsigned int once_tick(void* arg) {
+	return 0;
+}
+
+/*
+ * A wakes at tick 20 to move the wheel on, B is then due at 64 on the second level
+ * and C, added after it at 83, lands on the first level. The wakeup has to come from
+ * B, nothing else runs that would wake the scheduler in between.
+ * Returns: 1 if B ran before C was due
+ */
+int run_wheel_levels(void) {
+	scheduler* s = sched_create();
+	sched_timer* a = sched_timer_create(s, "tick 20", once_tick, NULL);
+	sched_timer* b = sched_timer_create(s, "tick 64", once_tick, NULL);
+	sched_timer* c = sched_timer_create(s, "tick 83", once_tick, NULL);
+
+	sched_add(a, 20);
+	sched_add(b, 64);
+	sched_start(s);
+	usleep(30000);
+
+	unsigned int now = (sched_clock_ns() - s->start_ns) / 1000000;
+	if (now >= 83 - 1) {
+		printf("\nwheel levels: woke too late to place the timer, skipped\n");
+		sched_destroy(s);
+		return 1;
+	}
+	sched_add(c, 83 - now);
+	usleep(150000);
+
+	pthread_mutex_lock(&(s->lock));
+	uint64_t late = b->late_ns_max;
+	uint64_t runs = b->runs;
+	pthread_mutex_unlock(&(s->lock));
+	sched_destroy(s);
+
+	int ok = (runs == 1) && (late < (83 - 64) * 1000000ULL);
+	printf("\nsecond level timer due before a later first level one, %.3f ms past due: %s\n", late / 1e6, ok ? "ok" : "LATE");
+	return ok;
+}
+
+/* Returns: 1 if no timer ran later than LATE_LIMIT_MS past the tick it was due */
+int run_lateness(unsigned int seconds) {
+	scheduler* s = sched_create();
+	sched_timer* probes[NUM_PROBES];
+	uint64_t late_max = 0;
+	uint64_t runs = 0;
+	unsigned int i;
+	char name[SCHED_NAME_LEN];
+
+	for (i = 0; i < NUM_PROBES; ++i) {
+		snprintf(name, SCHED_NAME_LEN, "probe %ums", probe_periods[i]);
+		probes[i] = sched_timer_create(s, name, probe_tick, &probe_periods[i]);
+		sched_add(probes[i], probe_periods[i]);
+	}
+	sched_start(s);
+	sleep(seconds);
+
+	pthread_mutex_lock(&(s->lock));
+	for (i = 0; i < NUM_PROBES; ++i) {
+		if (probes[i]->late_ns_max > late_max) {
+			late_max = probes[i]->late_ns_max;
+		}
+		runs += probes[i]->runs;
+	}
+	pthread_mutex_unlock(&(s->lock));
+	sched_destroy(s);
+
+	int ok = (late_max < LATE_LIMIT_MS * 1000000ULL);
+	printf("%u timers from %ums to %ums, %llu runs, latest %.3f ms past due: %s\n", (unsigned int)NUM_PROBES,
+		probe_periods[0], probe_periods[NUM_PROBES - 1], (unsigned long long)runs, late_max / 1e6, ok ? "ok" : "LATE");
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int seconds = (argc > 1) ? atoi(argv[1]) : 5;
+	if (argc > 2) {
+		retry_ms = atoi(argv[2]);
+	}
+
+	printf("retry every %ums for %us\n", retry_ms, seconds);
+	printf("%-8s %-10s %-8s %-8s %-10s %-10s %s\n", "Mode", "Wakeups/s", "CPU ms", "Retries", "Late p50", "Late p99", "Late max ms");
+	run_legacy(seconds);
+	run_sched(seconds);
+
+	int ok = run_wheel_levels();
+	ok = run_lateness(seconds) && ok;
+	return ok ? 0 : 1;
+}
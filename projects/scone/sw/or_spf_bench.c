@@ -0,0 +1,314 @@
+/*
+ * Measures route computation as the pwospf area grows. Each row generates a
+ * topology of routers on a ring with random extra links, every link its own /30
+ * and every router a stub /24, then times the old computation (linear scan for
+ * the next router, linear router lookups along every link, linear route wrapper
+ * lookups) against compute_rtable with the heap, checking both find the same
+ * distances. Then a random link goes down and comes back up again, a few times,
+ * and the shortest path part of a full heap run is timed against repairing the
+ * last tree, whose result is checked against the full run.
+ *
+ * usage: spf-bench [max_routers] [flaps]
+ */
+
+#include "or_dijkstra.h"
+#include "or_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#define EXTRA_LINKS_PER_ROUTER 1	/* on top of the ring, about four links per router */
+
+struct bench_link {
+	pwospf_interface* a;	/* the two ends, flapped together */
+	pwospf_interface* b;
+};
+typedef struct bench_link bench_link;
+
+double elapsed_ms(struct timeval* start, struct timeval* end) {
+	return ((end->tv_sec - start->tv_sec) * 1e3) + ((end->tv_usec - start->tv_usec) / 1e3);
+}
+
+void add_interface(pwospf_router* r, uint32_t subnet, uint32_t mask, uint32_t rid, pwospf_interface** out) {
+	pwospf_interface* iface = (pwospf_interface*)calloc(1, sizeof(pwospf_interface));
+	iface->subnet.s_addr = htonl(subnet);
+	iface->mask.s_addr = htonl(mask);
+	iface->router_id = rid;
+	iface->is_active = 1;
+
+	node* n = node_create();
+	n->data = iface;
+	if (!r->interface_list) {
+		r->interface_list = n;
+	} else {
+		node_push_back(r->interface_list, n);
+	}
+	if (out) {
+		*out = iface;
+	}
+}
+
+/* router 0 is us, its links become the if_list with the neighbor on each */
+void add_link(pwospf_router** routers, node** if_list, bench_link* link, int a, int b, uint32_t subnet) {
+	add_interface(routers[a], subnet, 0xFFFFFFFC, routers[b]->router_id, &(link->a));
+	add_interface(routers[b], subnet, 0xFFFFFFFC, routers[a]->router_id, &(link->b));
+
+	if ((a == 0) || (b == 0)) {
+		iface_entry* iface = (iface_entry*)calloc(1, sizeof(iface_entry));
+		snprintf(iface->name, IF_LEN, "eth%i", node_length(*if_list));
+		iface->ip = htonl(subnet + 1);
+		iface->mask = htonl(0xFFFFFFFC);
+		iface->is_active = 1;
+
+		nbr_router* nbr = (nbr_router*)calloc(1, sizeof(nbr_router));
+		nbr->router_id = routers[(a == 0) ? b : a]->router_id;
+		nbr->ip.s_addr = htonl(subnet + 2);
+		iface->nbr_routers = node_create();
+		iface->nbr_routers->data = nbr;
+
+		node* n = node_create();
+		n->data = iface;
+		n->next = *if_list;
+		if (*if_list) {
+			(*if_list)->prev = n;
+		}
+		*if_list = n;
+	}
+}
+
+/* the old get_shortest and update_neighbor_distance loop of compute_rtable */
+void legacy_spf(uint32_t our_rid, node* list) {
+	node* cur;
+	for (cur = list; cur; cur = cur->next) {
+		pwospf_router* r = (pwospf_router*)cur->data;
+		r->distance = (r->router_id == our_rid) ? 0 : 0xFFFFFFFF;
+		r->shortest_path_found = (r->router_id == our_rid);
+	}
+
+	pwospf_router* w = get_router_by_rid(our_rid, list);
+	while (w) {
+		w->shortest_path_found = 1;
+		for (cur = w->interface_list; cur; cur = cur->next) {
+			pwospf_interface* i = (pwospf_interface*)cur->data;
+			if ((i->router_id != 0) && i->is_active) {
+				pwospf_router* v = get_router_by_rid(i->router_id, list);
+				if (v && !v->shortest_path_found && ((w->distance + 1) < v->distance)) {
+					v->distance = w->distance + 1;
+					v->prev_router = w;
+				}
+			}
+		}
+
+		w = NULL;
+		uint32_t shortest = 0xFFFFFFFF;
+		for (cur = list; cur; cur = cur->next) {
+			pwospf_router* r = (pwospf_router*)cur->data;
+			if (!r->shortest_path_found && (r->distance < shortest)) {
+				w = r;
+				shortest = r->distance;
+			}
+		}
+	}
+}
+
+/* the old build_route_wrapper_list, a list searched for every interface */
+int legacy_routes(node* list) {
+	node* head = NULL;
+	node* cur;
+	int num_routes = 0;
+
+	for (cur = list; cur; cur = cur->next) {
+		pwospf_router* r = (pwospf_router*)cur->data;
+		node* in;
+		for (in = r->interface_list; in; in = in->next) {
+			pwospf_interface* i = (pwospf_interface*)in->data;
+			rtable_entry* e = NULL;
+			node* w;
+			for (w = head; w; w = w->next) {
+				e = (rtable_entry*)w->data;
+				if ((e->ip.s_addr == (i->subnet.s_addr & i->mask.s_addr)) && (e->mask.s_addr == i->mask.s_addr)) {
+					break;
+				}
+			}
+			if (!w) {
+				e = (rtable_entry*)calloc(1, sizeof(rtable_entry));
+				e->ip.s_addr = i->subnet.s_addr & i->mask.s_addr;
+				e->mask.s_addr = i->mask.s_addr;
+				node* n = node_create();
+				n->data = e;
+				if (!head) {
+					head = n;
+				} else {
+					node_push_back(head, n);
+				}
+				++num_routes;
+			}
+		}
+	}
+
+	while (head) {
+		node_remove(&head, head);
+	}
+	return num_routes;
+}
+
+void free_rtable(node* rtable) {
+	while (rtable) {
+		node_remove(&rtable, rtable);
+	}
+}
+
+void run(int num_routers, int num_flaps) {
+	pwospf_router** routers = (pwospf_router**)calloc(num_routers, sizeof(pwospf_router*));
+	int num_links = num_routers * (1 + EXTRA_LINKS_PER_ROUTER);
+	bench_link* links = (bench_link*)calloc(num_links, sizeof(bench_link));
+	node* list = NULL;
+	node* if_list = NULL;
+	unsigned int seed = num_routers;
+	int i;
+
+	for (i = num_routers - 1; i >= 0; --i) {
+		routers[i] = (pwospf_router*)calloc(1, sizeof(pwospf_router));
+		routers[i]->router_id = htonl(0x0A000001 + i);
+		node* n = node_create();
+		n->data = routers[i];
+		n->next = list;
+		if (list) {
+			list->prev = n;
+		}
+		list = n;
+	}
+
+	/* links out of 172.16/12, stubs out of 10/8 */
+	for (i = 0; i < num_routers; ++i) {
+		add_link(routers, &if_list, &(links[i]), i, (i + 1) % num_routers, 0xAC100000 + (i * 4));
+		add_interface(routers[i], 0x0A000000 + (i << 8), 0xFFFFFF00, 0, NULL);
+	}
+	for (i = num_routers; i < num_links; ++i) {
+		int a = rand_r(&seed) % num_routers;
+		int b = rand_r(&seed) % num_routers;
+		if (a == b) {
+			b = (a + (num_routers / 2)) % num_routers;
+		}
+		add_link(routers, &if_list, &(links[i]), a, b, 0xAC100000 + (i * 4));
+	}
+
+	uint32_t our_rid = routers[0]->router_id;
+	struct timeval start, end;
+
+	gettimeofday(&start, NULL);
+	legacy_spf(our_rid, list);
+	int legacy_num_routes = legacy_routes(list);
+	gettimeofday(&end, NULL);
+	double legacy_ms = elapsed_ms(&start, &end);
+
+	uint32_t* legacy_distance = (uint32_t*)malloc(num_routers * sizeof(uint32_t));
+	for (i = 0; i < num_routers; ++i) {
+		legacy_distance[i] = routers[i]->distance;
+	}
+
+	gettimeofday(&start, NULL);
+	node* rtable = compute_rtable(our_rid, list, if_list);
+	gettimeofday(&end, NULL);
+	double heap_ms = elapsed_ms(&start, &end);
+
+	int mismatches = 0;
+	for (i = 0; i < num_routers; ++i) {
+		if (routers[i]->distance != legacy_distance[i]) {
+			++mismatches;
+		}
+	}
+	int num_routes = node_length(rtable);
+	free_rtable(rtable);
+
+	/* the tree the incremental runs start from, only the shortest path part is timed */
+	spf_graph* last = spf_graph_create(our_rid, list);
+	spf_full(last);
+
+	double incr_us = 0;
+	double full_us = 0;
+	long settled = 0;
+	int num_runs = 0;
+	int num_incremental = 0;
+
+	for (i = 0; i < num_flaps; ++i) {
+		bench_link* link = &(links[rand_r(&seed) % num_links]);
+		int up;
+		for (up = 0; up <= 1; ++up) {
+			link->a->is_active = up;
+			link->b->is_active = up;
+
+			spf_graph* g = spf_graph_create(our_rid, list);
+			gettimeofday(&start, NULL);
+			if (spf_incremental(last, g) != 0) {
+				spf_full(g);
+			}
+			gettimeofday(&end, NULL);
+			incr_us += elapsed_ms(&start, &end) * 1e3;
+			settled += g->settled;
+			num_incremental += g->is_incremental;
+			++num_runs;
+
+			spf_graph* ref = spf_graph_create(our_rid, list);
+			gettimeofday(&start, NULL);
+			spf_full(ref);
+			gettimeofday(&end, NULL);
+			full_us += elapsed_ms(&start, &end) * 1e3;
+
+			int v;
+			for (v = 0; v < g->num_v; ++v) {
+				if (g->v[v].distance != ref->v[v].distance) {
+					++mismatches;
+				}
+			}
+
+			spf_graph_destroy(ref);
+			spf_graph_destroy(last);
+			last = g;
+		}
+	}
+
+	printf("%-8i %-8i %-8i %-12.3f %-12.3f %-12.1f %-12.1f %-10.1f %-6i %i\n", num_routers, num_links,
+		num_routes, legacy_ms, heap_ms, full_us / num_runs, incr_us / num_runs, (double)settled / num_runs,
+		num_incremental, mismatches);
+	if (legacy_num_routes != (num_routers + num_links)) {
+		printf("legacy found %i routes\n", legacy_num_routes);
+	}
+
+	spf_graph_destroy(last);
+	free(legacy_distance);
+	while (list) {
+		pwospf_router* r = (pwospf_router*)list->data;
+		while (r->interface_list) {
+			node_remove(&(r->interface_list), r->interface_list);
+		}
+		node_remove(&list, list);
+	}
+	while (if_list) {
+		iface_entry* iface = (iface_entry*)if_list->data;
+		while (iface->nbr_routers) {
+			node_remove(&(iface->nbr_routers), iface->nbr_routers);
+		}
+		node_remove(&if_list, if_list);
+	}
+	free(links);
+	free(routers);
+}
+
+int main(int argc, char** argv)
+{
+	int max_routers = (argc > 1) ? atoi(argv[1]) : 5000;
+	int num_flaps = (argc > 2) ? atoi(argv[2]) : 20;
+	int sizes[] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 20000 };
+	int i;
+
+	printf("%-8s %-8s %-8s %-12s %-12s %-12s %-12s %-10s %-6s %s\n", "Routers", "Links", "Routes",
+		"Legacy ms", "Heap ms", "Full us", "Incr us", "Settled", "Incr", "Mismatch");
+	for (i = 0; (i < (int)(sizeof(sizes) / sizeof(sizes[0]))) && (sizes[i] <= max_routers); ++i) {
+		run(sizes[i], num_flaps);
+	}
+
+	return 0;
+}
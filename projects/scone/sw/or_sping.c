@@ -154,11 +154,8 @@ void unlock_mutex_sping_queue(router_state* rs) {
 }
 
 
-void sping_queue_cleanup_thread_np(void *arg) {
-	sping_queue_cleanup_thread(arg);
-}
-
-void* sping_queue_cleanup_thread(void *arg) {
+/* Timer callback, every 30 seconds drops the sping replies nobody waited for */
+unsigned int sping_queue_cleanup_tick(void *arg) {
 
 	router_state *rs = (router_state *)arg;
 	time_t now;
@@ -166,37 +163,30 @@ void* sping_queue_cleanup_thread(void *arg) {
 	node *sping_walker = 0;
 	sping_queue_entry *sqe = 0;
 
-	while(1) {
-		sleep(30);
-
-		lock_mutex_sping_queue(rs);
-
-		sping_walker = rs->sping_queue;
-		while(sping_walker) {
+	lock_mutex_sping_queue(rs);
 
-			node *sping_current = NULL;
-			sqe = (sping_queue_entry *)sping_walker->data;
+	sping_walker = rs->sping_queue;
+	while(sping_walker) {
 
-			time(&now);
-			diff = difftime(now, sqe->arrival_time);
+		node *sping_current = NULL;
+		sqe = (sping_queue_entry *)sping_walker->data;
 
-			/* mark this entry for removal if it's been on the queue for too long */
-			if(diff > 30) {
-				sping_current = sping_walker;
-			}
+		time(&now);
+		diff = difftime(now, sqe->arrival_time);
 
-			sping_walker = sping_walker->next;
-			if(sping_current) {
-				free(sqe->packet);
-				node_remove(&rs->sping_queue, sping_current);
-			}
+		/* mark this entry for removal if it's been on the queue for too long */
+		if(diff > 30) {
+			sping_current = sping_walker;
 		}
 
-		unlock_mutex_sping_queue(rs);
+		sping_walker = sping_walker->next;
+		if(sping_current) {
+			free(sqe->packet);
+			node_remove(&rs->sping_queue, sping_current);
+		}
 	}
-}
-
-
-
 
+	unlock_mutex_sping_queue(rs);
 
+	return 30000;
+}
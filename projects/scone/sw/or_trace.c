@@ -0,0 +1,215 @@
+/*
+ * Leveled tracing into an in memory ring instead of stdout. Any thread claims the
+ * next slot with one atomic add and formats its line straight into it, nothing is
+ * locked and nothing is written out, the ring is read back from the cli. A slot is
+ * marked busy while its line is formatted so a reader skips lines it would
+ * otherwise see half written or already overwritten.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <sys/time.h>
+
+#include "or_trace.h"
+#include "or_utils.h"
+
+#define TRACE_RING_MASK (TRACE_RING_SLOTS - 1)
+#define TRACE_SEQ_BUSY (~0ULL)
+
+volatile int trace_level = TRACE_DEFAULT_LEVEL;
+
+static trace_entry trace_ring[TRACE_RING_SLOTS];
+static volatile uint64_t trace_head = 0;
+static volatile uint64_t trace_lost = 0;
+
+/* the line trace_text is building, per thread so print_packet calls do not interleave */
+static __thread char trace_line[TRACE_MSG_LEN];
+static __thread int trace_line_len = 0;
+
+static char* trace_level_names[] = { "off", "error", "warn", "info", "debug", "packet" };
+
+/*
+ * Adds one line to the ring, the caller checks trace_enabled first, usually
+ * through TRACE. A writer that laps one still formatting into the same slot, a
+ * whole ring later, drops its line rather than wait.
+ */
+void trace_write(int level, const char* fmt, ...) {
+	va_list ap;
+	uint64_t pos = __sync_fetch_and_add(&trace_head, 1);
+	trace_entry* e = &(trace_ring[pos & TRACE_RING_MASK]);
+	uint64_t seq = e->seq;
+
+	if ((seq == TRACE_SEQ_BUSY) || !__sync_bool_compare_and_swap(&(e->seq), seq, TRACE_SEQ_BUSY)) {
+		__sync_fetch_and_add(&trace_lost, 1);
+		return;
+	}
+
+	gettimeofday(&(e->ts), NULL);
+	e->level = level;
+	va_start(ap, fmt);
+	vsnprintf(e->msg, TRACE_MSG_LEN, fmt, ap);
+	va_end(ap);
+
+	__sync_synchronize();
+	e->seq = pos + 1;
+}
+
+/*
+ * Collects text the way a run of printf calls would, each complete line goes into
+ * the ring as its own entry and blank lines are dropped. Used by the pretty
+ * printers in or_output.c, the caller checks trace_enabled first.
+ */
+void trace_text(int level, const char* fmt, ...) {
+	char text[256];
+	va_list ap;
+	int i;
+
+	va_start(ap, fmt);
+	vsnprintf(text, 256, fmt, ap);
+	va_end(ap);
+
+	for (i = 0; text[i] != '\0'; ++i) {
+		if (text[i] == '\n') {
+			if (trace_line_len > 0) {
+				trace_line[trace_line_len] = '\0';
+				trace_write(level, "%s", trace_line);
+				trace_line_len = 0;
+			}
+		} else if (trace_line_len < TRACE_MSG_LEN - 1) {
+			trace_line[trace_line_len++] = text[i];
+		}
+	}
+}
+
+void trace_set_level(int level) {
+	if (level < TRACE_OFF) {
+		level = TRACE_OFF;
+	}
+	if (level > TRACE_PACKET) {
+		level = TRACE_PACKET;
+	}
+	trace_level = level;
+}
+
+uint64_t trace_lost_lines(void) {
+	return trace_lost;
+}
+
+const char* trace_level_name(int level) {
+	if ((level < TRACE_OFF) || (level > TRACE_PACKET)) {
+		return "?";
+	}
+	return trace_level_names[level];
+}
+
+/*
+ * Returns: the level by name or number, -1 if it is neither
+ */
+int trace_level_parse(const char* name) {
+	int i;
+
+	for (i = TRACE_OFF; i <= TRACE_PACKET; ++i) {
+		if (strcasecmp(name, trace_level_names[i]) == 0) {
+			return i;
+		}
+	}
+	if ((sscanf(name, "%i", &i) == 1) && (i >= TRACE_OFF) && (i <= TRACE_PACKET)) {
+		return i;
+	}
+	return -1;
+}
+
+/*
+ * Prints the last max_entries lines in the ring oldest first, or the whole ring if
+ * max_entries is 0. Writers are not held up, lines they are in the middle of are
+ * left out.
+ */
+#define TRACE_LINE_LEN (TRACE_MSG_LEN + 32)
+void sprint_trace(char** buf, unsigned int* len, unsigned int max_entries) {
+	uint64_t head = trace_head;
+	uint64_t start = (head > TRACE_RING_SLOTS) ? (head - TRACE_RING_SLOTS) : 0;
+	uint64_t pos;
+
+	if ((max_entries > 0) && ((head - start) > max_entries)) {
+		start = head - max_entries;
+	}
+
+	unsigned int size = ((head - start) * TRACE_LINE_LEN) + 1;
+	char* buffer = (char*)calloc(size, sizeof(char));
+	unsigned int total_len = 0;
+
+	for (pos = start; pos < head; ++pos) {
+		trace_entry* e = &(trace_ring[pos & TRACE_RING_MASK]);
+		trace_entry copy;
+
+		if (e->seq != (pos + 1)) {
+			continue;
+		}
+		__sync_synchronize();
+		memcpy(&copy, e, sizeof(trace_entry));
+		__sync_synchronize();
+		if (e->seq != (pos + 1)) {
+			continue;
+		}
+
+		struct tm tm;
+		time_t sec = copy.ts.tv_sec;
+		localtime_r(&sec, &tm);
+		total_len += snprintf(buffer + total_len, size - total_len, "%02d:%02d:%02d.%06ld %-6s %s\n",
+			tm.tm_hour, tm.tm_min, tm.tm_sec, (long)copy.ts.tv_usec, trace_level_name(copy.level), copy.msg);
+	}
+
+	*buf = buffer;
+	*len = total_len;
+}
+
+#define TRACE_DEFAULT_DUMP 100
+void cli_show_trace(router_state* rs, cli_request* req) {
+	char line[128];
+	char* info;
+	unsigned int len;
+	unsigned int count = TRACE_DEFAULT_DUMP;
+
+	if (strstr(req->command, "all")) {
+		count = 0;
+	} else if (sscanf(req->command, "show trace %u", &count) != 1) {
+		count = TRACE_DEFAULT_DUMP;
+	}
+
+	snprintf(line, 128, "Level: %s (compiled up to %s)\tLines: %llu\tLost: %llu\n", trace_level_name(trace_level),
+		trace_level_name(TRACE_COMPILE_LEVEL), (unsigned long long)trace_head, (unsigned long long)trace_lost);
+	send_to_socket(req->sockfd, line, strlen(line));
+
+	sprint_trace(&info, &len, count);
+	send_to_socket(req->sockfd, info, len);
+	free(info);
+}
+
+void cli_show_trace_help(router_state* rs, cli_request* req) {
+	char* usage = "Usage: show trace [<lines>|all], the last 100 lines by default\n";
+	send_to_socket(req->sockfd, usage, strlen(usage));
+}
+
+void cli_trace_level(router_state* rs, cli_request* req) {
+	char name[32];
+	char line[128];
+	int level;
+
+	if ((sscanf(req->command, "trace level %31s", name) != 1) || ((level = trace_level_parse(name)) < 0)) {
+		char* usage = "Usage: trace level <off|error|warn|info|debug|packet>\n";
+		send_to_socket(req->sockfd, usage, strlen(usage));
+		return;
+	}
+
+	trace_set_level(level);
+	if (level > TRACE_COMPILE_LEVEL) {
+		snprintf(line, 128, "Trace level set to: %s, only up to %s is compiled in\n", trace_level_name(level),
+			trace_level_name(TRACE_COMPILE_LEVEL));
+	} else {
+		snprintf(line, 128, "Trace level set to: %s\n", trace_level_name(level));
+	}
+	send_to_socket(req->sockfd, line, strlen(line));
+}
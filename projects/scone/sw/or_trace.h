@@ -0,0 +1,40 @@
+#ifndef OR_TRACE_H_
+#define OR_TRACE_H_
+
+#include "or_data_types.h"
+
+#define TRACE_OFF 0
+#define TRACE_ERROR 1
+#define TRACE_WARN 2
+#define TRACE_INFO 3
+#define TRACE_DEBUG 4
+#define TRACE_PACKET 5		/* every packet sent and received, and their decoded headers */
+
+/* levels above this are compiled out, build with -DTRACE_COMPILE_LEVEL=n to lower it */
+#ifndef TRACE_COMPILE_LEVEL
+#define TRACE_COMPILE_LEVEL TRACE_PACKET
+#endif
+
+#define TRACE_DEFAULT_LEVEL TRACE_WARN
+
+extern volatile int trace_level;
+
+/* a disabled trace costs one compare, its arguments are not evaluated */
+#define trace_enabled(level) (((level) <= TRACE_COMPILE_LEVEL) && ((level) <= trace_level))
+
+#define TRACE(level, fmt, args...) \
+	do { if (trace_enabled(level)) { trace_write(level, fmt, ## args); } } while (0)
+
+void trace_write(int level, const char* fmt, ...) __attribute__ ((format (printf, 2, 3)));
+void trace_text(int level, const char* fmt, ...) __attribute__ ((format (printf, 2, 3)));
+void trace_set_level(int level);
+uint64_t trace_lost_lines(void);
+const char* trace_level_name(int level);
+int trace_level_parse(const char* name);
+
+void sprint_trace(char** buf, unsigned int* len, unsigned int max_entries);
+void cli_show_trace(router_state* rs, cli_request* req);
+void cli_show_trace_help(router_state* rs, cli_request* req);
+void cli_trace_level(router_state* rs, cli_request* req);
+
+#endif /*OR_TRACE_H_*/
@@ -0,0 +1,166 @@
+/*
+ * Measures what the per packet debug output costs the forwarding path. Each row
+ * has a number of threads each "receive" packets and report them, once the way
+ * process_packet and send_packet used to (a printf per packet, here into a line
+ * buffered /dev/null to leave the terminal out of it), then through TRACE with the
+ * level below it, with it enabled, and with the full print_packet decode at the
+ * packet level. The ring is read back after the enabled runs to check the lines in
+ * it are whole and that only lines counted as lost are missing, a writer lapping
+ * a preempted one drops its own line and leaves the other stale.
+ *
+ * usage: trace-bench [max_threads] [packets_per_thread]
+ */
+
+#include "or_trace.h"
+#include "or_output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define MODE_PRINTF 0
+#define MODE_DISABLED 1
+#define MODE_ENABLED 2
+#define MODE_DECODE 3
+
+char* mode_names[] = { "printf", "disabled", "enabled", "decode" };
+
+struct bench_arg {
+	FILE* fp;
+	int mode;
+	int num_packets;
+	double ns;
+};
+typedef struct bench_arg bench_arg;
+
+volatile unsigned int sink = 0;
+
+double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+/* an icmp echo request, what a ping through the router looks like */
+void build_packet(uint8_t* packet, unsigned int len) {
+	bzero(packet, len);
+	eth_hdr* eth = (eth_hdr*)packet;
+	eth->eth_type = htons(ETH_TYPE_IP);
+	ip_hdr* ip = (ip_hdr*)(packet + sizeof(eth_hdr));
+	ip->ip_v = 4;
+	ip->ip_hl = 5;
+	ip->ip_len = htons(len - sizeof(eth_hdr));
+	ip->ip_ttl = 64;
+	ip->ip_p = IP_PROTO_ICMP;
+	ip->ip_src.s_addr = htonl(0x0A000001);
+	ip->ip_dst.s_addr = htonl(0x0A000102);
+	icmp_hdr* icmp = (icmp_hdr*)(packet + sizeof(eth_hdr) + sizeof(ip_hdr));
+	icmp->icmp_type = 8;
+}
+
+void* bench_thread(void* v) {
+	bench_arg* arg = (bench_arg*)v;
+	uint8_t packet[98];
+	unsigned int len = sizeof(packet);
+	int i;
+
+	build_packet(packet, len);
+	double start = now_ns();
+	for (i = 0; i < arg->num_packets; ++i) {
+		switch (arg->mode) {
+			case MODE_PRINTF:
+				fprintf(arg->fp, " ** -> Received IP packet of length %d\n", len);
+				break;
+			case MODE_DECODE:
+				print_packet(packet, len);
+				/* fall through, the packet level includes the debug lines */
+			default:
+				TRACE(TRACE_DEBUG, " ** -> Received IP packet of length %d", len);
+				break;
+		}
+		sink += packet[i & 63];
+	}
+	arg->ns = now_ns() - start;
+	return NULL;
+}
+
+/* lines in the ring, -1 if one of them is not the line traced */
+int count_lines(void) {
+	char* buf;
+	unsigned int len;
+	int lines = 0;
+
+	sprint_trace(&buf, &len, 0);
+	char* line = strtok(buf, "\n");
+	while (line) {
+		if (!strstr(line, "Received IP packet of length 98")) {
+			lines = -1;
+			break;
+		}
+		++lines;
+		line = strtok(NULL, "\n");
+	}
+	free(buf);
+	return lines;
+}
+
+void run(int mode, int num_threads, int num_packets) {
+	FILE* fp = fopen("/dev/null", "w");
+	pthread_t threads[64];
+	bench_arg args[64];
+	double ns = 0;
+	int i;
+
+	setvbuf(fp, NULL, _IOLBF, BUFSIZ);
+	uint64_t lost = trace_lost_lines();
+	trace_set_level((mode == MODE_DISABLED) ? TRACE_INFO : (mode == MODE_ENABLED) ? TRACE_DEBUG : TRACE_PACKET);
+
+	for (i = 0; i < num_threads; ++i) {
+		args[i].fp = fp;
+		args[i].mode = mode;
+		args[i].num_packets = num_packets;
+		args[i].ns = 0;
+		pthread_create(&threads[i], NULL, bench_thread, &args[i]);
+	}
+	for (i = 0; i < num_threads; ++i) {
+		pthread_join(threads[i], NULL);
+		ns += args[i].ns;
+	}
+
+	const char* check = "-";
+	if (mode == MODE_ENABLED) {
+		long expected = num_threads * (long)num_packets;
+		if (expected > TRACE_RING_SLOTS) {
+			expected = TRACE_RING_SLOTS;
+		}
+		lost = trace_lost_lines() - lost;
+		int lines = count_lines();
+		check = ((lines >= 0) && ((lines + (2 * lost)) >= expected)) ? "ok" : "MISMATCH";
+	}
+
+	printf("%-10s %-8i %-10.1f %s\n", mode_names[mode], num_threads, ns / (num_threads * (double)num_packets), check);
+	fclose(fp);
+}
+
+int main(int argc, char** argv)
+{
+	int max_threads = (argc > 1) ? atoi(argv[1]) : 8;
+	int num_packets = (argc > 2) ? atoi(argv[2]) : 200000;
+	int num_threads;
+
+	if (max_threads > 64) {
+		max_threads = 64;
+	}
+
+	printf("%-10s %-8s %-10s %s\n", "Mode", "Threads", "ns/pkt", "Check");
+	for (num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+		run(MODE_PRINTF, num_threads, num_packets);
+		run(MODE_DISABLED, num_threads, num_packets);
+		run(MODE_ENABLED, num_threads, num_packets);
+		run(MODE_DECODE, num_threads, num_packets / 10);
+	}
+
+	return 0;
+}
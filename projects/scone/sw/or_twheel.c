@@ -0,0 +1,179 @@
+/*
+ * Hierarchical timer wheel. Level 0 has one slot per tick, each level above covers
+ * TWHEEL_SLOTS times the span of the one below, and its slots are cascaded down
+ * as the wheel turns into them. Adding, deleting and firing a timer are O(1) no
+ * matter how many are pending. Not thread safe, the owner serializes access.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "or_twheel.h"
+
+#define TWHEEL_SLOT_MASK (TWHEEL_SLOTS - 1)
+
+twheel* twheel_create(uint64_t now) {
+	twheel* w = (twheel*)calloc(1, sizeof(twheel));
+	assert(w);
+	w->now = now;
+	return w;
+}
+
+/* pending timers are left alone, they belong to whoever added them */
+void twheel_destroy(twheel* w) {
+	free(w);
+}
+
+/* links t into the slot its expiry falls in relative to the current tick */
+static void twheel_place(twheel* w, twheel_timer* t) {
+	uint64_t delta = t->expires - w->now;
+	int level;
+
+	if (delta > TWHEEL_MAX_DELTA) {
+		t->expires = w->now + TWHEEL_MAX_DELTA;
+		delta = TWHEEL_MAX_DELTA;
+	}
+
+	for (level = 0; level < TWHEEL_LEVELS - 1; ++level) {
+		if (delta < (1ULL << (TWHEEL_SLOT_BITS * (level + 1)))) {
+			break;
+		}
+	}
+
+	twheel_timer** head = &(w->slots[level][(t->expires >> (TWHEEL_SLOT_BITS * level)) & TWHEEL_SLOT_MASK]);
+	t->next = *head;
+	if (t->next) {
+		t->next->pprev = &(t->next);
+	}
+	t->pprev = head;
+	*head = t;
+}
+
+static void twheel_unlink(twheel_timer* t) {
+	*(t->pprev) = t->next;
+	if (t->next) {
+		t->next->pprev = t->pprev;
+	}
+	t->next = NULL;
+	t->pprev = NULL;
+}
+
+/*
+ * Schedules t to fire once the wheel reaches expires, which is moved to the next
+ * tick if it already passed. A pending timer is rescheduled.
+ */
+void twheel_add(twheel* w, twheel_timer* t, uint64_t expires) {
+	if (t->pprev) {
+		twheel_unlink(t);
+	} else {
+		++w->pending;
+	}
+
+	t->expires = (expires > w->now) ? expires : w->now + 1;
+	twheel_place(w, t);
+}
+
+void twheel_del(twheel* w, twheel_timer* t) {
+	if (t->pprev) {
+		twheel_unlink(t);
+		--w->pending;
+	}
+}
+
+int twheel_pending(twheel_timer* t) {
+	return t->pprev != NULL;
+}
+
+/*
+ * Within a level the slots are looked at in the order the wheel turns into them, so
+ * the first one with a pending timer holds the earliest of that level. An upper level
+ * is not cascaded until the wheel reaches its slot and may hold a timer due before
+ * everything on the levels below, so every level is looked at.
+ * Returns: the tick the next timer fires at, 0 if none is pending
+ */
+uint64_t twheel_next(twheel* w) {
+	uint64_t next = 0;
+	int level, i;
+
+	if (w->pending == 0) {
+		return 0;
+	}
+
+	for (level = 0; level < TWHEEL_LEVELS; ++level) {
+		uint64_t index = w->now >> (TWHEEL_SLOT_BITS * level);
+
+		/* the current slot comes last, anything in it is a full turn ahead */
+		for (i = 1; i <= TWHEEL_SLOTS; ++i) {
+			twheel_timer* t = w->slots[level][(index + i) & TWHEEL_SLOT_MASK];
+			if (t) {
+				for (; t; t = t->next) {
+					if ((next == 0) || (t->expires < next)) {
+						next = t->expires;
+					}
+				}
+				break;
+			}
+		}
+	}
+
+	return next;
+}
+
+/* moves the timers of one upper level slot down to where they now belong */
+static void twheel_cascade(twheel* w, int level, int index) {
+	twheel_timer* t = w->slots[level][index];
+	w->slots[level][index] = NULL;
+
+	while (t) {
+		twheel_timer* next = t->next;
+		twheel_place(w, t);
+		++w->cascaded;
+		t = next;
+	}
+}
+
+/*
+ * Turns the wheel forward to now, calling expire for every timer that comes due.
+ * A timer is no longer pending when expire is called so it may be added again.
+ * Returns: the number of timers fired
+ */
+int twheel_advance(twheel* w, uint64_t now, twheel_expire expire, void* arg) {
+	int fired = 0;
+	int level;
+
+	/* nothing can fire on the way, skip straight there */
+	if (w->pending == 0) {
+		if (now > w->now) {
+			w->now = now;
+		}
+		return 0;
+	}
+
+	while (w->now < now) {
+		++w->now;
+
+		/* crossing into a new block of an upper level brings its slot down */
+		for (level = 1; level < TWHEEL_LEVELS; ++level) {
+			if ((w->now & ((1ULL << (TWHEEL_SLOT_BITS * level)) - 1)) != 0) {
+				break;
+			}
+			twheel_cascade(w, level, (w->now >> (TWHEEL_SLOT_BITS * level)) & TWHEEL_SLOT_MASK);
+		}
+
+		/*
+		 * Pop one at a time rather than detaching the slot, expire may delete other
+		 * timers. Anything it adds lands at least a tick ahead so never in this slot.
+		 */
+		twheel_timer** slot = &(w->slots[0][w->now & TWHEEL_SLOT_MASK]);
+		while (*slot) {
+			twheel_timer* t = *slot;
+			twheel_unlink(t);
+			--w->pending;
+			++w->fired;
+			++fired;
+			expire(t, arg);
+		}
+	}
+
+	return fired;
+}
@@ -0,0 +1,15 @@
+#ifndef OR_TWHEEL_H_
+#define OR_TWHEEL_H_
+
+#include "or_data_types.h"
+
+twheel* twheel_create(uint64_t now);
+void twheel_destroy(twheel* w);
+
+void twheel_add(twheel* w, twheel_timer* t, uint64_t expires);
+void twheel_del(twheel* w, twheel_timer* t);
+int twheel_pending(twheel_timer* t);
+int twheel_advance(twheel* w, uint64_t now, twheel_expire expire, void* arg);
+uint64_t twheel_next(twheel* w);
+
+#endif /*OR_TWHEEL_H_*/
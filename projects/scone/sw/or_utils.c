@@ -310,13 +310,61 @@ void cleanCRLFs(char* c) {
  }
 }
 
+/* output of send_to_socket on this thread goes here instead, see capture_socket_output */
+static __thread out_buf* socket_capture = NULL;
+
 void send_to_socket(int sockfd, char *buf, int len) {
 
+	if (socket_capture) {
+		out_buf_append(socket_capture, buf, len);
+		return;
+	}
+
 	if(send(sockfd, buf, len, 0) == -1 ) {
 		printf("send(cli output) error %d\n", len);
 	}
 }
 
+/*
+ * Collects what send_to_socket is asked to send from this thread in ob, e.g. the
+ * output of a cli command for a web page, until called again with NULL.
+ */
+void capture_socket_output(out_buf* ob) {
+	socket_capture = ob;
+}
+
+void out_buf_init(out_buf* ob, unsigned int size) {
+	ob->data = (char*)malloc(size ? size : 1);
+	if (!ob->data) {
+		perror("failure allocating output buffer");
+		exit(1);
+	}
+	ob->len = 0;
+	ob->size = size ? size : 1;
+}
+
+void out_buf_append(out_buf* ob, const char* data, unsigned int len) {
+	if (ob->len + len > ob->size) {
+		unsigned int size = ob->size;
+		while (ob->len + len > size) {
+			size *= 2;
+		}
+		if ((ob->data = realloc(ob->data, size)) == 0) {
+			perror("failure growing output buffer");
+			exit(1);
+		}
+		ob->size = size;
+	}
+	memcpy(ob->data + ob->len, data, len);
+	ob->len += len;
+}
+
+void out_buf_free(out_buf* ob) {
+	free(ob->data);
+	ob->data = NULL;
+	ob->len = ob->size = 0;
+}
+
 char* my_strncat(char* left, char* right, int* left_alloc_size) {
 	int size = *left_alloc_size;
 	while ((strlen(left) + strlen(right) + 1) > size) {
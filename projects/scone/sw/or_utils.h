@@ -29,6 +29,10 @@ char* mallocCopy(const char* c);
 void register_cli_command(node** head, char* command, cli_command_handler handler);
 void cleanCRLFs(char* c);
 void send_to_socket(int sockfd, char *buf, int len);
+void capture_socket_output(out_buf* ob);
+void out_buf_init(out_buf* ob, unsigned int size);
+void out_buf_append(out_buf* ob, const char* data, unsigned int len);
+void out_buf_free(out_buf* ob);
 char* my_strncat(char* left, char* right, int* left_alloc_size);
 char* urlencode(char* str);
 char* urldecode(char* str);
@@ -9,9 +9,10 @@
 #include "or_vns.h"
 #include "or_utils.h"
 #include "sr_base_internal.h"
+#include "sr_dumper.h"
 
 void cli_show_vns_help(router_state *rs, cli_request* req) {
-	char *usage = "usage: show vns [user server vhost lhost topology]\n";
+	char *usage = "usage: show vns [user server vhost lhost topology log]\n";
 	send_to_socket(req->sockfd, usage, strlen(usage));
 }
 
@@ -130,4 +131,36 @@ void cli_show_vns_topology_help(router_state *rs, cli_request *req){
 
 }
 
+/*
+ * Packets written and dropped per interface since the log was opened
+ */
+void cli_show_vns_log(router_state *rs, cli_request *req) {
+	struct sr_instance* sr = (struct sr_instance*)rs->sr;
+	struct sr_log* log = sr->log;
+	char line[128];
+	int i;
+
+	if (!log) {
+		char *info = "No packet log open\n";
+		send_to_socket(req->sockfd, info, strlen(info));
+		return;
+	}
+
+	snprintf(line, 128, "Format: %s\tWrites: %llu\tBytes: %llu\tDrops: %llu\n",
+		(log->format == SR_LOG_PCAPNG) ? "pcapng" : "pcap", (unsigned long long)log->writes,
+		(unsigned long long)log->bytes, (unsigned long long)sr_log_drops(log));
+	send_to_socket(req->sockfd, line, strlen(line));
+
+	snprintf(line, 128, "%-17s%-14s%s\n", "Interface", "Packets", "Drops");
+	send_to_socket(req->sockfd, line, strlen(line));
+	for (i = 0; i < log->num_ifaces; ++i) {
+		snprintf(line, 128, "%-17s%-14llu%llu\n", log->iface_names[i],
+			(unsigned long long)log->iface_packets[i], (unsigned long long)log->iface_drops[i]);
+		send_to_socket(req->sockfd, line, strlen(line));
+	}
+}
 
+void cli_show_vns_log_help(router_state *rs, cli_request *req){
+	char *show_vns = "Usage: show vns log\n";
+	send_to_socket(req->sockfd, show_vns, strlen(show_vns));
+}
@@ -27,4 +27,7 @@ void cli_show_vns_lhost_help(router_state *rs, cli_request *req);
 void cli_show_vns_topology(router_state *rs, cli_request *req);
 void cli_show_vns_topology_help(router_state *rs, cli_request *req);
 
+void cli_show_vns_log(router_state *rs, cli_request *req);
+void cli_show_vns_log_help(router_state *rs, cli_request *req);
+
 #endif /*OR_VNS_H_*/
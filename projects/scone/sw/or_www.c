@@ -2,6 +2,13 @@
  * Authors: David Erickson, Filip Paun
  * Date: 06/2007
  *
+ * The web interface, HTTP/1.1 with keep-alive and pipelining. Over linux sockets
+ * (_NOLWIP_) one thread serves every connection from an epoll loop and static files
+ * go out with sendfile. The lwip sockets block and have no readiness notification, so
+ * there accepted connections are handed to WWW_THREADS threads that each serve one
+ * connection at a time, closing it once the pipelined requests it sent are answered
+ * or when others are waiting, and static files are served from memory. Pages showing router state are rendered once
+ * and served from the cache until the version of the state they show moves on.
  */
 
 #include "or_www.h"
@@ -9,15 +16,25 @@
 #include "or_utils.h"
 #include "or_cli.h"
 #include "or_output.h"
+#include "or_hwstats.h"
+#include "or_export.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 #ifdef _NOLWIP_
 	#include <netinet/in.h>
 	#include <pthread.h>
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <sys/epoll.h>
+	#include <sys/sendfile.h>
+	#include <sys/socket.h>
 #else
 	#define LWIP_COMPAT_SOCKETS
 	#include "lwip/sockets.h"
@@ -25,416 +42,933 @@
 	#include "lwip/arch.h"
 #endif
 
-int contains_crlfcrlf(uint8_t* buf, int len);
-char* list_commands(router_state* rs, www_client_thread_info* info);
-int send_file(router_state* rs, www_client_thread_info* info, FILE* file);
-int send_all(router_state* rs, www_client_thread_info* info, uint8_t* msg, int len);
-void service_request(www_client_thread_info* info);
+#define WWW_EVENTS 64
 
-void www_main(void* subsystem) {
-	router_state* rs = (router_state*)subsystem;
+char* list_commands(router_state* rs);
+int send_all(int sockfd, const char* msg, int len);
 
-	int sock_len = sizeof(struct sockaddr);
-	int bindfd = -1;
- 	int clientfd = 0;
-	//int ret = 0;
-	struct sockaddr_in addr;
-	struct sockaddr    client_addr;
+/* pages rendered from router state, cached until their version moves on */
+typedef uint64_t (*www_version_fn)(router_state* rs);
 
-	bindfd = socket(AF_INET, SOCK_STREAM, 0);
-
-	addr.sin_port = htons(8080);
-	addr.sin_addr.s_addr = 0;
-	memset(&(addr.sin_zero), 0, sizeof(addr.sin_zero));
-	int on = 1;
-	setsockopt(bindfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
-	if( bind(bindfd, (struct sockaddr*)&addr, sizeof(struct sockaddr)))
-	{
-		printf("error binding to port\n");
-		return;
-  }
+struct www_view {
+	char* url;					/* served at this path, or NULL */
+	char* command;				/* cli command rendering it, asked for through command.html */
+	const char* content_type;
+	www_version_fn version;
+	unsigned int max_age_ms;	/* for output that also changes with time, 0 if it only changes with the version */
+	unsigned int last_len;		/* size of the last rendering, the next starts with a buffer this big */
+};
+typedef struct www_view www_view;
 
-	/* Tell connection to go into listening mode. */
-	listen(bindfd, 10);
+static uint64_t www_static_version(router_state* rs) {
+	return 0;
+}
 
-	/* spawn a 5 threads to handle www connections */
-	#ifndef _NOLWIP_
+static uint64_t www_rtable_version(router_state* rs) {
+	return rs->rtable_version;
+}
 
-	sys_thread_new(www_client_thread_np, subsystem);
-	sys_thread_new(www_client_thread_np, subsystem);
-	sys_thread_new(www_client_thread_np, subsystem);
-	sys_thread_new(www_client_thread_np, subsystem);
-	sys_thread_new(www_client_thread_np, subsystem);
+static uint64_t www_arp_version(router_state* rs) {
+	return rs->arp_cache_version;
+}
 
-	#else
+/* every write to the hardware arp table goes through its shadow, including nuke hw arp */
+static uint64_t www_hw_arp_version(router_state* rs) {
+	return rs->arp_cache_hw ? rs->arp_cache_hw->rows_written : 0;
+}
 
-	pthread_t* t = (pthread_t*)malloc(sizeof(pthread_t));
-  if(pthread_create(t, NULL, www_client_thread, subsystem) != 0) {
-    perror("Thread create error");
-  }
+static uint64_t www_hwstats_version(router_state* rs) {
+	return rs->hw_stats ? rs->hw_stats->sweeps : 0;
+}
 
-	t = (pthread_t*)malloc(sizeof(pthread_t));
-  if(pthread_create(t, NULL, www_client_thread, subsystem) != 0) {
-    perror("Thread create error");
-  }
+static www_view www_views[] = {
+	{ "/list.html", NULL, "text/plain", www_static_version, 0, 0 },
+	{ "/stats.html", NULL, "text/html; charset=UTF-8", www_hwstats_version, 0, 0 },
+	{ NULL, "show ip route", "text/plain", www_rtable_version, 0, 0 },
+	{ NULL, "show hw rtable", "text/plain", www_rtable_version, 0, 0 },
+	{ NULL, "show ip arp", "text/plain", www_arp_version, 1000, 0 },	/* shows the time left on each entry */
+	{ NULL, "show hw arp", "text/plain", www_hw_arp_version, 0, 0 },
+	{ NULL, "show hw stats", "text/plain", www_hwstats_version, 0, 0 },
+	{ NULL, "show hw stats history", "text/plain", www_hwstats_version, 0, 0 },
+};
+#define WWW_NUM_VIEWS (sizeof(www_views) / sizeof(www_views[0]))
+
+static const char* www_not_found =
+	"<html><head><title>404 Not Found</title></head><body><h1>Not Found</h1>"
+	"<p>The requested URL was not found on this server.</p></body></html>";
+
+static uint64_t www_now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000);
+}
 
-	t = (pthread_t*)malloc(sizeof(pthread_t));
-  if(pthread_create(t, NULL, www_client_thread, subsystem) != 0) {
-    perror("Thread create error");
-  }
 
-	t = (pthread_t*)malloc(sizeof(pthread_t));
-  if(pthread_create(t, NULL, www_client_thread, subsystem) != 0) {
-    perror("Thread create error");
-  }
+/** PAGE CACHE **/
+
+/* takes over the data of body */
+static www_page* www_page_create(out_buf* body, const char* content_type, uint64_t version) {
+	www_page* page = (www_page*)calloc(1, sizeof(www_page));
+	page->refs = 1;
+	page->version = version;
+	page->rendered_ms = www_now_ms();
+	page->content_type = content_type;
+	page->data = body->data;
+	page->len = body->len;
+	body->data = NULL;
+	body->len = body->size = 0;
+	return page;
+}
 
-	t = (pthread_t*)malloc(sizeof(pthread_t));
-  if(pthread_create(t, NULL, www_client_thread, subsystem) != 0) {
-    perror("Thread create error");
-  }
-  #endif
+static void www_page_ref(www_page* page) {
+	__sync_fetch_and_add(&(page->refs), 1);
+}
 
+static void www_page_put(www_page* page) {
+	if (page && (__sync_sub_and_fetch(&(page->refs), 1) == 0)) {
+		free(page->data);
+		free(page);
+	}
+}
 
-	while (1) {
- 		/* Grab new connection. */
-		clientfd = accept(bindfd, &client_addr, &sock_len);
+static www_cache* www_cache_create(void) {
+	www_cache* cache = (www_cache*)calloc(1, sizeof(www_cache));
+	if (pthread_mutex_init(&(cache->lock), NULL) != 0) {
+		perror("Mutex init error");
+		exit(1);
+	}
+	return cache;
+}
 
-		/* Build the www thread information */
-		www_client_thread_info* info = (www_client_thread_info*)calloc(1, sizeof(www_client_thread_info));
-		info->sockfd = clientfd;
-		info->rs = rs;
+/*
+ * Returns: a reference to the cached page for key if it is of version and not older
+ * than max_age_ms (0 for any age), NULL otherwise
+ */
+static www_page* www_cache_get(www_cache* cache, const char* key, uint64_t version, unsigned int max_age_ms) {
+	www_page* page = NULL;
+	unsigned int i;
+
+	pthread_mutex_lock(&(cache->lock));
+	for (i = 0; i < cache->num_entries; ++i) {
+		if (strcmp(cache->entries[i].key, key) == 0) {
+			www_page* p = cache->entries[i].page;
+			if ((p->version == version) && ((max_age_ms == 0) || (www_now_ms() - p->rendered_ms < max_age_ms))) {
+				www_page_ref(p);
+				page = p;
+				++cache->hits;
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&(cache->lock));
 
-		node* n = node_create();
-		n->data = info;
+	return page;
+}
 
-		pthread_mutex_lock(rs->www_mutex);
-		if (!rs->www_request_queue) {
-			rs->www_request_queue = n;
+/* replaces the page cached for key, the cache takes its own reference */
+static void www_cache_put(www_cache* cache, const char* key, www_page* page) {
+	www_page* old = NULL;
+	unsigned int i;
+
+	www_page_ref(page);
+	pthread_mutex_lock(&(cache->lock));
+	++cache->renders;
+	for (i = 0; i < cache->num_entries; ++i) {
+		if (strcmp(cache->entries[i].key, key) == 0) {
+			break;
+		}
+	}
+	if (i == cache->num_entries) {
+		if (cache->num_entries < WWW_CACHE_ENTRIES) {
+			cache->entries[cache->num_entries++].key = mallocCopy(key);
 		} else {
-			node_push_back(rs->www_request_queue, n);
+			/* full, replace entries round robin */
+			i = cache->next_evict;
+			cache->next_evict = (cache->next_evict + 1) % WWW_CACHE_ENTRIES;
+			free(cache->entries[i].key);
+			cache->entries[i].key = mallocCopy(key);
 		}
+	}
+	old = cache->entries[i].page;
+	cache->entries[i].page = page;
+	pthread_mutex_unlock(&(cache->lock));
 
-		pthread_mutex_unlock(rs->www_mutex);
-		pthread_cond_broadcast(rs->www_cond);
+	www_page_put(old);
+}
+
+
+/** RENDERING **/
+
+/* runs a cli command, its output collected in body */
+static void www_run_command(router_state* rs, char* command, out_buf* body) {
+	cli_request req;
+
+	req.command = command;
+	req.sockfd = -1;
+
+	capture_socket_output(body);
+	lock_cli_commands_rd(rs);
+
+	cli_command_handler handler = cli_command_lpm(rs, req.command);
+	if (handler == NULL) {
+		char* error = "invalid command\n";
+		send_to_socket(req.sockfd, error, strlen(error));
+	} else {
+		(*handler)(rs, &req);
 	}
+
+	unlock_cli_commands(rs);
+	capture_socket_output(NULL);
 }
 
-void www_client_thread_np(void* arg) {
-	www_client_thread(arg);
+static void www_render_view(router_state* rs, www_view* view, out_buf* body) {
+	if (view->command) {
+		www_run_command(rs, view->command, body);
+	} else if (strcmp(view->url, "/list.html") == 0) {
+		char* list = list_commands(rs);
+		out_buf_append(body, list, strlen(list));
+		free(list);
+	} else {
+		/* all from the sampler, serving the page reads no registers */
+		char* statsBuf;
+		unsigned int statsLen;
+
+		out_buf_append(body, "<pre>", 5);
+		sprint_hwstats(rs, &statsBuf, &statsLen);
+		out_buf_append(body, statsBuf, statsLen);
+		free(statsBuf);
+
+		out_buf_append(body, "\n", 1);
+		sprint_hwstats_history(rs, &statsBuf, &statsLen, 20);
+		out_buf_append(body, statsBuf, statsLen);
+		free(statsBuf);
+		out_buf_append(body, "</pre>", 6);
+	}
 }
 
-void* www_client_thread(void *arg) {
-	router_state* rs = (router_state*)arg;
-	struct timespec wake_up_time;
-	struct timeval now;
+/* Returns: a reference to the current rendering of view */
+static www_page* www_get_view(router_state* rs, www_view* view) {
+	const char* key = view->url ? view->url : view->command;
+	uint64_t version = view->version(rs);
+	www_page* page = www_cache_get(rs->www_cache, key, version, view->max_age_ms);
 
-	while (1) {
-		/* grab mutex, check for pending request, if none go to sleep */
-		pthread_mutex_lock(rs->www_mutex);
-		if (!rs->www_request_queue) {
-			/* wake up one second in the future even if no signal */
-			gettimeofday(&now, NULL);
-			wake_up_time.tv_sec = now.tv_sec + 1;
-			wake_up_time.tv_nsec = now.tv_usec + 1000;
+	if (!page) {
+		out_buf body;
+		out_buf_init(&body, view->last_len + 256);
+		www_render_view(rs, view, &body);
+		view->last_len = body.len;
 
-			pthread_cond_timedwait(rs->www_cond, rs->www_mutex, &wake_up_time);
-			pthread_mutex_unlock(rs->www_mutex);
-			continue;
-		} else {
-			/* pop the top off the queue */
-			node* cur = rs->www_request_queue;
-			rs->www_request_queue = cur->next;
-			if (rs->www_request_queue) {
-				rs->www_request_queue->prev = NULL;
-			}
-			/* unlock our mutex */
-			pthread_mutex_unlock(rs->www_mutex);
+		page = www_page_create(&body, view->content_type, version);
+		www_cache_put(rs->www_cache, key, page);
+	}
 
-			www_client_thread_info* info = cur->data;
-			service_request(info);
+	return page;
+}
 
-			free(info);
-			free(cur);
+static const char* www_content_type(const char* path) {
+	const char* ext = strrchr(path, '.');
+	if (!ext) {
+		return "application/octet-stream";
+	} else if ((strcmp(ext, ".html") == 0) || (strcmp(ext, ".htm") == 0)) {
+		return "text/html";
+	} else if (strcmp(ext, ".css") == 0) {
+		return "text/css";
+	} else if (strcmp(ext, ".js") == 0) {
+		return "application/javascript";
+	} else if (strcmp(ext, ".gif") == 0) {
+		return "image/gif";
+	} else if (strcmp(ext, ".png") == 0) {
+		return "image/png";
+	} else if ((strcmp(ext, ".jpg") == 0) || (strcmp(ext, ".jpeg") == 0)) {
+		return "image/jpeg";
+	}
+	return "text/plain";
+}
+
+
+/** REQUESTS **/
+
+/* drops what is left of the last response, the body keeps its allocation */
+static void www_conn_reset_response(www_conn* c) {
+	www_page_put(c->page);
+	c->page = NULL;
+	c->body.len = 0;
+	c->body_data = NULL;
+	c->head_len = c->head_sent = 0;
+	c->body_len = c->body_sent = 0;
+#ifdef _NOLWIP_
+	if (c->file_fd >= 0) {
+		close(c->file_fd);
+	}
+#endif
+	c->file_fd = -1;
+	c->file_len = c->file_sent = 0;
+}
+
+static www_conn* www_conn_create(router_state* rs, int sockfd) {
+	www_conn* c = (www_conn*)calloc(1, sizeof(www_conn));
+	c->sockfd = sockfd;
+	c->rs = rs;
+	c->file_fd = -1;
+	c->last_active_ms = www_now_ms();
+	out_buf_init(&(c->body), 4096);
+	return c;
+}
+
+static void www_conn_destroy(www_conn* c) {
+	www_conn_reset_response(c);
+	out_buf_free(&(c->body));
+	close(c->sockfd);
+	free(c);
+}
 
+/* Returns: the length of the input up to the end of the first request head after from, 0 if none */
+static unsigned int www_find_head(www_conn* c, unsigned int from) {
+	unsigned int i;
+	for (i = from + 3; i < c->in_len; ++i) {
+		if ((c->in[i] == '\n') && (c->in[i - 1] == '\r') && (c->in[i - 2] == '\n') && (c->in[i - 3] == '\r')) {
+			return i + 1;
 		}
 	}
-	return NULL;
+	return 0;
 }
 
-void service_request(www_client_thread_info* info) {
-	router_state* rs = info->rs;
-	int read = 0;
+static void www_set_head(www_conn* c, int status, const char* reason, const char* content_type,
+		unsigned int content_len) {
+	c->head_len = snprintf(c->head, WWW_HEAD_MAX,
+		"HTTP/1.1 %i %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nCache-Control: no-cache\r\nConnection: %s\r\n\r\n",
+		status, reason, content_type, content_len, c->keep_alive ? "keep-alive" : "close");
+	if (c->head_len >= WWW_HEAD_MAX) {
+		c->head_len = WWW_HEAD_MAX - 1;
+	}
+	c->head_sent = 0;
+}
 
-	int buf_alloc_size = 100;
-	int buf_size = 0;
-	uint8_t* buf = calloc(1,buf_alloc_size);
-	uint8_t* buf_ptr = buf;
+static void www_respond_page(www_conn* c, www_page* page, int head_only) {
+	c->page = page;
+	www_set_head(c, 200, "OK", page->content_type, page->len);
+	if (!head_only) {
+		c->body_data = page->data;
+		c->body_len = page->len;
+	}
+}
 
-	uint8_t received_crlfcrlf = 0;
+static void www_respond_body(www_conn* c, int status, const char* reason, const char* content_type, int head_only) {
+	www_set_head(c, status, reason, content_type, c->body.len);
+	if (!head_only) {
+		c->body_data = c->body.data;
+		c->body_len = c->body.len;
+	}
+}
 
-	/* we need to continue reading until we get a \r\n\r\n from the client */
-	while (!received_crlfcrlf) {
-		read = recv(info->sockfd, buf_ptr, buf_alloc_size - buf_size, 0);
-		if (read > 0) {
-			// increment buf ptr, size
-			buf_size += read;
-			buf_ptr += read;
+static void www_respond_error(www_conn* c, int status, const char* reason) {
+	c->keep_alive = 0;
+	c->body.len = 0;
+	out_buf_append(&(c->body), reason, strlen(reason));
+	out_buf_append(&(c->body), "\n", 1);
+	www_respond_body(c, status, reason, "text/plain", 0);
+}
 
-			if (contains_crlfcrlf(buf, buf_size)) {
-				received_crlfcrlf = 1;
-			}
+/* the value of the first parameter of the query, decoded */
+static char* www_query_value(char* query) {
+	char* value = query ? strchr(query, '=') : NULL;
+	if (!value) {
+		return calloc(1, 2);
+	}
+	++value;
+	char* end = strchr(value, '&');
+	if (end) {
+		*end = '\0';
+	}
+	return urldecode(value);
+}
 
-			// are we at our max allocation?
-			if (buf_size == buf_alloc_size) {
-				uint8_t* new_buf = NULL;
-				if ((new_buf = calloc(1, buf_alloc_size*2)) == 0) {
-					perror("malloc error reading html request");
-					free(buf);
-					return;
-				}
-				memmove(new_buf, buf, buf_alloc_size);
+/* the bulk state export, ?since=version leaves out the tables not changed after it */
+static void www_serve_state(www_conn* c, const char* url, char* query, int head_only) {
+	router_state* rs = c->rs;
+	int binary = (strcmp(url, "/state.bin") == 0);
+	char* value = www_query_value(query);
+	uint64_t since = strtoull(value, NULL, 10);
+	free(value);
+
+	/* a full export only changes with the state version, scrapers share it */
+	www_page* page = since ? NULL : www_cache_get(rs->www_cache, url, rs->state_version, 0);
+	if (!page) {
+		export_snapshot* snap = export_take(rs, since);
+		out_buf body;
+		out_buf_init(&body, 4096);
+		if (binary) {
+			export_binary(snap, &body);
+		} else {
+			export_json(snap, &body);
+		}
+		page = www_page_create(&body, binary ? "application/octet-stream" : "application/json", snap->version);
+		export_free(snap);
 
-				buf_alloc_size *= 2;
-				free(buf);
-				buf = new_buf;
-				buf_ptr = buf + buf_size;
+		if (!since) {
+			www_cache_put(rs->www_cache, url, page);
+		}
+	}
+	www_respond_page(c, page, head_only);
+}
+
+static void www_serve_file(www_conn* c, const char* path, int head_only) {
+	const char* content_type = www_content_type(path);
+	struct stat st;
+
+	if ((stat(path, &st) != 0) || !S_ISREG(st.st_mode)) {
+		c->body.len = 0;
+		out_buf_append(&(c->body), www_not_found, strlen(www_not_found));
+		www_respond_body(c, 404, "Not Found", "text/html", head_only);
+		return;
+	}
+
+#ifdef _NOLWIP_
+	/* the kernel copies it straight from the page cache to the socket */
+	c->file_fd = open(path, O_RDONLY);
+	if (c->file_fd < 0) {
+		www_respond_error(c, 500, "Internal Server Error");
+		return;
+	}
+	www_set_head(c, 200, "OK", content_type, st.st_size);
+	if (head_only) {
+		close(c->file_fd);
+		c->file_fd = -1;
+	} else {
+		c->file_len = st.st_size;
+	}
+#else
+	/* lwip copies whatever it sends, so keep the file in memory until it changes */
+	uint64_t version = (((uint64_t)st.st_mtime) << 32) | (st.st_size & 0xFFFFFFFF);
+	www_page* page = www_cache_get(c->rs->www_cache, path, version, 0);
+	if (!page) {
+		out_buf data;
+		FILE* file = fopen(path, "rb");
+		if (!file) {
+			www_respond_error(c, 500, "Internal Server Error");
+			return;
+		}
+		out_buf_init(&data, st.st_size);
+		data.len = fread(data.data, 1, st.st_size, file);
+		fclose(file);
+		if (data.len != st.st_size) {
+			out_buf_free(&data);
+			www_respond_error(c, 500, "Internal Server Error");
+			return;
+		}
+
+		page = www_page_create(&data, content_type, version);
+		if (st.st_size <= WWW_CACHE_FILE_MAX) {
+			www_cache_put(c->rs->www_cache, path, page);
+		}
+	}
+	www_respond_page(c, page, head_only);
+#endif
+}
+
+/*
+ * Parses the request head at the front of the input and sets up the response to it,
+ * then drops the head from the input. keep_alive is cleared when the connection
+ * should close after this response whatever the client asks for.
+ */
+static void www_handle_request(www_conn* c, unsigned int head_len, int keep_alive) {
+	router_state* rs = c->rs;
+	char* head = c->in;
+	char* method;
+	char* url;
+	char* version;
+	char* line;
+	int head_only = 0;
+	unsigned int i;
+
+	head[head_len - 2] = '\0';
+	++c->requests;
+	c->last_active_ms = www_now_ms();
+	c->body.len = 0;
+
+	/* request line */
+	method = head;
+	url = strchr(method, ' ');
+	version = url ? strchr(url + 1, ' ') : NULL;
+	line = strstr(head, "\r\n");
+	if (!url || !version || !line || (version > line)) {
+		c->keep_alive = 0;
+		www_respond_error(c, 400, "Bad Request");
+		goto consumed;
+	}
+	*url++ = '\0';
+	*version++ = '\0';
+	*line = '\0';
+	line += 2;
+
+	/* HTTP/1.1 keeps the connection by default, 1.0 only when asked */
+	c->keep_alive = (strcmp(version, "HTTP/1.1") == 0);
+	while (*line) {
+		char* next = strstr(line, "\r\n");
+		if (next) {
+			*next = '\0';
+		}
+		if (strncasecmp(line, "Connection:", 11) == 0) {
+			if (strcasestr(line + 11, "close")) {
+				c->keep_alive = 0;
+			} else if (strcasestr(line + 11, "keep-alive")) {
+				c->keep_alive = 1;
 			}
+		}
+		if (!next) {
+			break;
+		}
+		line = next + 2;
+	}
+	if (!keep_alive || (c->requests >= WWW_KEEPALIVE_MAX)) {
+		c->keep_alive = 0;
+	}
 
-		} else if (read == 0) {
-			// other side closed writing
-			if (contains_crlfcrlf(buf, buf_size)) {
-				received_crlfcrlf = 1;
-			} else {
-				// free the buffer and exit
-				free(buf);
-				close(info->sockfd);
-				return;
+	if (strcmp(method, "HEAD") == 0) {
+		head_only = 1;
+	} else if (strcmp(method, "GET") != 0) {
+		www_respond_error(c, 501, "Not Implemented");
+		goto consumed;
+	}
+
+	char* query = strchr(url, '?');
+	if (query) {
+		*query++ = '\0';
+	}
+
+	if (strcmp(url, "/command.html") == 0) {
+		char* command = www_query_value(query);
+		for (i = 0; i < WWW_NUM_VIEWS; ++i) {
+			if (www_views[i].command && (strcmp(www_views[i].command, command) == 0)) {
+				break;
 			}
+		}
+		if (i < WWW_NUM_VIEWS) {
+			www_respond_page(c, www_get_view(rs, &www_views[i]), head_only);
 		} else {
-			// error
-			free(buf);
-			close(info->sockfd);
-			return;
+			www_run_command(rs, command, &(c->body));
+			www_respond_body(c, 200, "OK", "text/plain", head_only);
 		}
+		free(command);
+		goto consumed;
 	}
 
-	// get request line
-	char* method = NULL;
-	char* url = NULL;
-	if (sscanf(buf, "%as %as", &method, &url) != 2) {
-		free(buf);
-		close(info->sockfd);
-		return;
+	if ((strcmp(url, "/state.json") == 0) || (strcmp(url, "/state.bin") == 0)) {
+		www_serve_state(c, url, query, head_only);
+		goto consumed;
 	}
 
-	if (strcmp(url, "/list.html") == 0) {
-		/* check for command list */
-	  char* body = list_commands(rs, info);
-	  int body_len = strlen(body);
+	for (i = 0; i < WWW_NUM_VIEWS; ++i) {
+		if (www_views[i].url && (strcmp(www_views[i].url, url) == 0)) {
+			www_respond_page(c, www_get_view(rs, &www_views[i]), head_only);
+			goto consumed;
+		}
+	}
 
-	  int alloc_size = 512;
-	  char* result = calloc(1, 512);
-	  strcpy(result, "HTTP/1.0 200 OK\r\n");
-	  char content_length[128];
-	  sprintf(content_length, "Content-Length: %u\r\n\r\n", body_len);
-	  result = my_strncat(result, content_length, &alloc_size);
-	  result = my_strncat(result, body, &alloc_size);
+	/* see if a file matches the request */
+	if (strstr(url, "..") || (url[0] != '/')) {
+		c->body.len = 0;
+		out_buf_append(&(c->body), www_not_found, strlen(www_not_found));
+		www_respond_body(c, 404, "Not Found", "text/html", head_only);
+		goto consumed;
+	}
+	char path[512];
+	snprintf(path, sizeof(path), "www%s", (strcmp(url, "/") == 0) ? "/index.html" : url);
+	www_serve_file(c, path, head_only);
 
-	  send_all(rs, info, result, strlen(result));
+consumed:
+	c->in_len -= head_len;
+	memmove(c->in, c->in + head_len, c->in_len);
+}
 
-	  free(body);
-	  free(result);
 
-	} else if (strncmp(url, "/stats.html", 11) == 0) {
-	  int alloc_size = 512;
-	  char* result = calloc(1, alloc_size);
-  	strcpy(result, "HTTP/1.0 200 OK\r\nContent-Type: text/html; charset=UTF-8\r\n\r\n");
+#ifdef _NOLWIP_
 
-		char* statsBuf;
-		int statsLen;
-		sprint_hw_stats(rs, &statsBuf, &statsLen);
-		strcpy(result, statsBuf);
-		//strcpy(result, "</pre>");
-		send_all(rs, info, result, strlen(result));
+/** ONE EPOLL LOOP OVER LINUX SOCKETS **/
 
-		free(statsBuf);
-		free(result);
-	}	else if (strncmp(url, "/command.html", 13) == 0) {
-	  int alloc_size = 512;
-	  char* result = calloc(1, alloc_size);
-		/*
-    <SCRIPT LANGUAGE="JavaScript" SRC="prototype.js"/>
-    <SCRIPT LANGUAGE="JavaScript" SRC="our_router.js"/>
-		*/
-	  if (strstr(url, "refresh=1")) {
-	  	strcpy(result, "HTTP/1.0 200 OK\r\n\r\n");
-	  } else {
-	  	strcpy(result, "HTTP/1.0 200 OK\r\n\r\n");
-	  }
-
-		// get the command
-		char* command = strtok(url, "=&");
-		command = strtok(NULL, "=&");
-		char* decodedCommand;
-
-		if (!command) {
-			decodedCommand = calloc(1, 2);
-		} else {
-			decodedCommand = urldecode(command);
-		}
+static int www_conn_sending(www_conn* c) {
+	return c->head_len > 0;
+}
+
+/* Returns: 1 once the response is out, 0 if the socket is full, -1 on error */
+static int www_conn_write(www_conn* c) {
+	ssize_t s;
 
+	while (c->head_sent < c->head_len) {
+		int more = ((c->body_sent < c->body_len) || (c->file_sent < c->file_len)) ? MSG_MORE : 0;
+		s = send(c->sockfd, c->head + c->head_sent, c->head_len - c->head_sent, MSG_NOSIGNAL | more);
+		if (s < 0) {
+			return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+		}
+		c->head_sent += s;
+	}
+	while (c->body_sent < c->body_len) {
+		s = send(c->sockfd, c->body_data + c->body_sent, c->body_len - c->body_sent, MSG_NOSIGNAL);
+		if (s < 0) {
+			return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+		}
+		c->body_sent += s;
+	}
+	while (c->file_sent < c->file_len) {
+		off_t off = c->file_sent;
+		s = sendfile(c->sockfd, c->file_fd, &off, c->file_len - c->file_sent);
+		if (s < 0) {
+			return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+		}
+		if (s == 0) {
+			return -1;		/* the file shrank under us */
+		}
+		c->file_sent += s;
+	}
 
-	  //result = my_strncat(result, "<h2>Command: ", &alloc_size);
-	  //result = my_strncat(result, decodedCommand, &alloc_size);
-	  //result = my_strncat(result, "<pre>", &alloc_size);
-		send_all(rs, info, result, strlen(result));
-		free(result);
+	c->last_active_ms = www_now_ms();
+	www_conn_reset_response(c);
+	return 1;
+}
 
-		/* build the cli_request object */
-		cli_request* req = (cli_request *)malloc(sizeof(cli_request));
-		req->command = mallocCopy(decodedCommand);
-		free(decodedCommand);
-		req->sockfd = info->sockfd;
+/* Returns: 0 to keep the connection, -1 to close it */
+static int www_conn_process(www_conn* c) {
+	while (!www_conn_sending(c)) {
+		unsigned int head_len = www_find_head(c, 0);
+		if (head_len == 0) {
+			if (c->in_len == WWW_REQ_MAX) {
+				www_respond_error(c, 400, "Bad Request");
+				c->in_len = 0;
+				www_conn_write(c);
+				return -1;
+			}
+			return c->eof ? -1 : 0;
+		}
 
-		lock_cli_commands_rd(rs);
+		/* a client that has half closed gets its last answer with Connection: close */
+		www_handle_request(c, head_len, !c->eof || (www_find_head(c, head_len) != 0));
+		int keep_alive = c->keep_alive;
+		int r = www_conn_write(c);
+		if (r <= 0) {
+			return r;
+		}
+		if (!keep_alive) {
+			return -1;
+		}
+	}
+	return 0;
+}
 
-		cli_command_handler handler = cli_command_lpm(rs, req->command);
-		if (handler == NULL) {
-			char *error = "invalid command\n";
-			send_to_socket(req->sockfd, error, strlen(error));
+/* Returns: 0 to keep the connection, -1 to close it */
+static int www_conn_read(www_conn* c) {
+	while (c->in_len < WWW_REQ_MAX) {
+		ssize_t r = recv(c->sockfd, c->in + c->in_len, WWW_REQ_MAX - c->in_len, 0);
+		if (r > 0) {
+			c->in_len += r;
+			c->last_active_ms = www_now_ms();
+		} else if (r == 0) {
+			/* answer what came with the FIN, then close */
+			c->eof = 1;
+			break;
+		} else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+			break;
 		} else {
-			(*handler)(rs, req);
+			return -1;
 		}
+	}
+	return www_conn_process(c);
+}
 
-		free(req->command);
-		free(req);
+static void www_conn_watch(int epfd, www_conn* c) {
+	struct epoll_event ev;
+	int want_out = www_conn_sending(c);
 
-		unlock_cli_commands(rs);
+	if (want_out != c->want_out) {
+		ev.events = want_out ? EPOLLOUT : EPOLLIN;
+		ev.data.ptr = c;
+		epoll_ctl(epfd, EPOLL_CTL_MOD, c->sockfd, &ev);
+		c->want_out = want_out;
+	}
+}
 
-		//strcpy(result, "</pre></body>");
-		//send_all(rs, info, result, strlen(result));
+static void www_conn_close(int epfd, www_conn** conns, www_conn* c) {
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->sockfd, NULL);
+	if (c->prev) {
+		c->prev->next = c->next;
 	} else {
+		*conns = c->next;
+	}
+	if (c->next) {
+		c->next->prev = c->prev;
+	}
+	www_conn_destroy(c);
+}
 
-		/* see if a file matches the request */
-		char fileName[512]; // super long path
-		bzero(fileName, 512);
-		getcwd(fileName, 512);
-		strncat(fileName, "/www", 511 - strlen(fileName));
+static void www_epoll_loop(router_state* rs, int bindfd) {
+	struct epoll_event ev, events[WWW_EVENTS];
+	www_conn* conns = NULL;
+	uint64_t last_sweep = www_now_ms();
+	int epfd, n, i;
 
-		if (strcmp(url, "/") == 0) {
-			strncat(fileName, "/index.html", 511 - strlen(fileName));
-		} else {
-			strncat(fileName, url, 511 - strlen(fileName));
+	epfd = epoll_create(WWW_EVENTS);
+	if (epfd < 0) {
+		perror("epoll_create");
+		return;
+	}
+	fcntl(bindfd, F_SETFL, fcntl(bindfd, F_GETFL, 0) | O_NONBLOCK);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, bindfd, &ev);
+
+	while (1) {
+		n = epoll_wait(epfd, events, WWW_EVENTS, 1000);
+		if ((n < 0) && (errno != EINTR)) {
+			perror("epoll_wait");
+			break;
 		}
 
-		/* try and get a file */
-		FILE* file = fopen(fileName, "rb");
-	  if (file == NULL) {
-	  	char* msg = "HTTP/1.0 404 Not Found\r\n\r\n";
-	  	send(info->sockfd, msg, strlen(msg), 0);
-	  	msg = "<html><head><title>404 Not Found</title></head><body><h1>Not Found</h1><p>The requested URL was not found on this server.</p></body></html>";
-	  	send(info->sockfd, msg, strlen(msg), 0);
-	  } else {
-	  	char* msg = "HTTP/1.0 200 OK\r\n";
-	  	send(info->sockfd, msg, strlen(msg), 0);
+		for (i = 0; i < n; ++i) {
+			www_conn* c = (www_conn*)events[i].data.ptr;
+
+			if (!c) {
+				int clientfd;
+				while ((clientfd = accept(bindfd, NULL, NULL)) >= 0) {
+					fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL, 0) | O_NONBLOCK);
+					c = www_conn_create(rs, clientfd);
+					c->next = conns;
+					if (conns) {
+						conns->prev = c;
+					}
+					conns = c;
+					ev.events = EPOLLIN;
+					ev.data.ptr = c;
+					epoll_ctl(epfd, EPOLL_CTL_ADD, clientfd, &ev);
+				}
+				continue;
+			}
 
-	  	send_file(rs, info, file);
+			int r;
+			if (c->want_out) {
+				r = (events[i].events & (EPOLLERR | EPOLLHUP)) ? -1 : www_conn_write(c);
+				if (r > 0) {
+					r = c->keep_alive ? www_conn_process(c) : -1;
+				}
+			} else {
+				r = www_conn_read(c);
+			}
 
-	  	fclose(file);
-	  }
+			if (r < 0) {
+				www_conn_close(epfd, &conns, c);
+			} else {
+				www_conn_watch(epfd, c);
+			}
+		}
+
+		/* close keep-alive connections that have gone quiet */
+		uint64_t now = www_now_ms();
+		if (now - last_sweep >= 1000) {
+			www_conn* c = conns;
+			while (c) {
+				www_conn* next = c->next;
+				if (now - c->last_active_ms >= WWW_IDLE_MS) {
+					www_conn_close(epfd, &conns, c);
+				}
+				c = next;
+			}
+			last_sweep = now;
+		}
 	}
 
-	free(buf);
-	free(method);
-	free(url);
-	close(info->sockfd);
-	return;
+	close(epfd);
 }
 
-int contains_crlfcrlf(uint8_t* buf, int len) {
-	if (len < 4) {
-		return 0;
+#else
+
+/** BLOCKING LWIP SOCKETS, ONE CONNECTION PER THREAD **/
+
+static int www_send_blocking(www_conn* c) {
+	if (send_all(c->sockfd, c->head, c->head_len) < 0) {
+		return -1;
 	}
+	if ((c->body_len > 0) && (send_all(c->sockfd, c->body_data, c->body_len) < 0)) {
+		return -1;
+	}
+	www_conn_reset_response(c);
+	return 0;
+}
 
-	int i = 0;
+/* serves the requests on one connection until it closes or it is its turn to give way */
+static void www_serve_connection(router_state* rs, int sockfd) {
+	www_conn* c = www_conn_create(rs, sockfd);
 
-	for (i = 0; i < (len - 3); ++i) {
-		if (buf[i] == '\r') {
-			if (buf[i+1] == '\n') {
-				if (buf[i+2] == '\r') {
-					if (buf[i+3] == '\n') {
-						return 1;
-					}
-				}
+	while (1) {
+		unsigned int head_len = www_find_head(c, 0);
+		if (head_len == 0) {
+			if (c->in_len == WWW_REQ_MAX) {
+				www_respond_error(c, 400, "Bad Request");
+				www_send_blocking(c);
+				break;
+			}
+			int r = recv(c->sockfd, c->in + c->in_len, WWW_REQ_MAX - c->in_len, 0);
+			if (r <= 0) {
+				break;
 			}
+			c->in_len += r;
+			continue;
+		}
+
+		/*
+		 * recv blocks with no timeout here and a thread held by an idle client serves no
+		 * one else, so only keep the connection for requests already pipelined behind
+		 * this one and while no other connection is waiting
+		 */
+		www_handle_request(c, head_len, (rs->www_request_queue == NULL) && (www_find_head(c, head_len) != 0));
+		if ((www_send_blocking(c) < 0) || !c->keep_alive) {
+			break;
 		}
 	}
 
-	return 0;
+	www_conn_destroy(c);
 }
 
-char* list_commands(router_state* rs, www_client_thread_info* info) {
-	int alloc_size = 256;
-	char* msg = calloc(1, alloc_size);
-	strncpy(msg, "", 255);
+#endif /* _NOLWIP_ */
 
-	/* lock the cli read lock */
-	lock_cli_commands_rd(rs);
 
-	node* cur = rs->cli_commands;
-	while (cur) {
-		cli_entry* entry = (cli_entry*)cur->data;
-		//msg = my_strncat(msg, "<a href=\"command.html?command=", &alloc_size);
-		//char* encoded = urlencode(entry->command);
-		//msg = my_strncat(msg, encoded, &alloc_size);
-		//free(encoded);
-		//msg = my_strncat(msg, "\">", &alloc_size);
-		msg = my_strncat(msg, entry->command, &alloc_size);
-		msg = my_strncat(msg, "\n", &alloc_size);
-		//msg = my_strncat(msg, "</a><br/>\n", &alloc_size);
-		cur = cur->next;
+void www_main(void* subsystem) {
+	router_state* rs = (router_state*)subsystem;
+
+	int bindfd = -1;
+	struct sockaddr_in addr;
+
+	rs->www_cache = www_cache_create();
+
+	bindfd = socket(AF_INET, SOCK_STREAM, 0);
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(WWW_PORT);
+	addr.sin_addr.s_addr = 0;
+	memset(&(addr.sin_zero), 0, sizeof(addr.sin_zero));
+	int on = 1;
+	setsockopt(bindfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if( bind(bindfd, (struct sockaddr*)&addr, sizeof(struct sockaddr)))
+	{
+		printf("error binding to port\n");
+		return;
 	}
 
-	/* unlock the cli read lock */
-	unlock_cli_commands(rs);
+	/* Tell connection to go into listening mode. */
+	listen(bindfd, 10);
+
+#ifdef _NOLWIP_
+
+	www_epoll_loop(rs, bindfd);
+
+#else
+
+	/* spawn threads to handle www connections */
+	int sock_len = sizeof(struct sockaddr);
+	int i;
+	for (i = 0; i < WWW_THREADS; ++i) {
+		sys_thread_new(www_client_thread_np, subsystem);
+	}
+
+	while (1) {
+		/* Grab new connection. */
+		struct sockaddr client_addr;
+		int clientfd = accept(bindfd, &client_addr, &sock_len);
+		if (clientfd < 0) {
+			continue;
+		}
+
+		/* Build the www thread information */
+		www_client_thread_info* info = (www_client_thread_info*)calloc(1, sizeof(www_client_thread_info));
+		info->sockfd = clientfd;
+		info->rs = rs;
+
+		node* n = node_create();
+		n->data = info;
+
+		pthread_mutex_lock(rs->www_mutex);
+		if (!rs->www_request_queue) {
+			rs->www_request_queue = n;
+		} else {
+			node_push_back(rs->www_request_queue, n);
+		}
 
-	//msg = my_strncat(msg, "</div></body>", &alloc_size);
+		pthread_mutex_unlock(rs->www_mutex);
+		pthread_cond_signal(rs->www_cond);
+	}
 
-	return msg;
+#endif
 }
 
-int send_file(router_state* rs, www_client_thread_info* info, FILE* file) {
-	// get file size
-	fseek(file, 0, SEEK_END);
-	int size = ftell(file);
+void www_client_thread_np(void* arg) {
+	www_client_thread(arg);
+}
 
-	/* send Content-Length */
-	char content_length_header[128];
-	bzero(content_length_header, 128);
-	snprintf(content_length_header, 127, "Content-Length: %u\r\n\r\n", size);
-	send_all(rs, info, content_length_header, strlen(content_length_header));
+void* www_client_thread(void *arg) {
+#ifndef _NOLWIP_
+	router_state* rs = (router_state*)arg;
+	struct timespec wake_up_time;
+	struct timeval now;
 
-	rewind(file);
-	char* fbuf = malloc(size);
-	int r = fread(fbuf, 1, size, file);
-	if (r != size) {
-		printf("error reading file in\n");
-		return -1;
+	while (1) {
+		/* grab mutex, check for pending request, if none go to sleep */
+		pthread_mutex_lock(rs->www_mutex);
+		if (!rs->www_request_queue) {
+			/* wake up one second in the future even if no signal */
+			gettimeofday(&now, NULL);
+			wake_up_time.tv_sec = now.tv_sec + 1;
+			wake_up_time.tv_nsec = now.tv_usec * 1000;
+
+			pthread_cond_timedwait(rs->www_cond, rs->www_mutex, &wake_up_time);
+			pthread_mutex_unlock(rs->www_mutex);
+			continue;
+		} else {
+			/* pop the top off the queue */
+			node* cur = rs->www_request_queue;
+			rs->www_request_queue = cur->next;
+			if (rs->www_request_queue) {
+				rs->www_request_queue->prev = NULL;
+			}
+			/* unlock our mutex */
+			pthread_mutex_unlock(rs->www_mutex);
+
+			www_client_thread_info* info = cur->data;
+			www_serve_connection(info->rs, info->sockfd);
+
+			free(info);
+			free(cur);
+		}
 	}
+#endif
+	return NULL;
+}
 
-	int retval = send_all(rs, info, fbuf, size);
-	free(fbuf);
+char* list_commands(router_state* rs) {
+	out_buf msg;
+	out_buf_init(&msg, 2048);
+
+	/* lock the cli read lock */
+	lock_cli_commands_rd(rs);
+
+	node* cur = rs->cli_commands;
+	while (cur) {
+		cli_entry* entry = (cli_entry*)cur->data;
+		out_buf_append(&msg, entry->command, strlen(entry->command));
+		out_buf_append(&msg, "\n", 1);
+		cur = cur->next;
+	}
+
+	/* unlock the cli read lock */
+	unlock_cli_commands(rs);
 
-	return retval;
+	out_buf_append(&msg, "", 1);
+	return msg.data;
 }
 
-int send_all(router_state* rs, www_client_thread_info* info, uint8_t* msg, int len) {
+int send_all(int sockfd, const char* msg, int len) {
 	int s = 0;
 	int totalSent = 0;
-	uint8_t* ptr = msg;
+	const char* ptr = msg;
 	while (totalSent != len) {
 		// send a multiple of the MSS because the buffers in lwip suck
-		s = send(info->sockfd, ptr, ((len - totalSent) > 8400) ? 8400 : (len - totalSent), 0);
+		s = send(sockfd, (void*)ptr, ((len - totalSent) > 8400) ? 8400 : (len - totalSent), 0);
 		if (s < 0) {
 			perror("sending");
 			return -1;
@@ -48,6 +48,8 @@
 
 #include "lwip/tcp.h"
 #include "lwip/memp.h"
+#include "lwip/pbuf.h"
+#include "lwip/stats.h"
 #include "lwip/transport_subsys.h"
 
 #include "sr_vns.h"
@@ -111,7 +113,7 @@ void* sr_init_low_level_subystem(int argc, char **argv)
 
     sr = (struct sr_instance*) malloc(sizeof(struct sr_instance));
 
-    while ((c = getopt(argc, argv, "hs:v:p:c:t:r:l:i:m:")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:c:t:r:l:i:m:P:R:")) != EOF)
     {
         switch (c)
         {
@@ -150,6 +152,31 @@ void* sr_init_low_level_subystem(int argc, char **argv)
                         exit(1);
                 }
                 break;
+            case 'P':
+                {
+                    /* -- lwip pbuf pool: count[:bufsize] -- */
+                    unsigned int num = 0, bufsize = PBUF_POOL_BUFSIZE;
+                    if (sscanf(optarg, "%u:%u", &num, &bufsize) < 1 ||
+                        num > 0xffff || bufsize < PBUF_POOL_BUFSIZE_MIN ||
+                        bufsize > PBUF_POOL_BUFSIZE_MAX) {
+                        usage(argv[0]);
+                        exit(1);
+                    }
+                    pbuf_pool_configure(num, bufsize);
+                }
+                break;
+            case 'R':
+                {
+                    /* -- pbuf structures for PBUF_REF/ROM pbufs, one per
+                          received segment lwip holds on to             -- */
+                    unsigned int num = 0;
+                    if (sscanf(optarg, "%u", &num) != 1 || num > 0xffff) {
+                        usage(argv[0]);
+                        exit(1);
+                    }
+                    memp_configure(MEMP_PBUF, num);
+                }
+                break;
         } /* switch */
     } /* -- while -- */
 
@@ -318,6 +345,19 @@ static int sr_lwip_transport_startup(void)
     return 0;
 } /* -- sr_lwip_transport_startup -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_lwip_sprint_stats(..)
+ * Scope: global
+ *
+ * Prints the lwip pool and heap usage for the cli, which can't include the
+ * lwip headers itself.  Returns as snprintf(..) does.
+ *---------------------------------------------------------------------------*/
+
+int sr_lwip_sprint_stats(char* buf, int size)
+{
+    return stats_sprint(buf, size);
+} /* -- sr_lwip_sprint_stats -- */
+
 
 /*-----------------------------------------------------------------------------
  * Method: sr_set_user(..)
@@ -358,7 +398,7 @@ void sr_init_instance(struct sr_instance* sr)
     sr->user[0]  = 0;
     sr->vhost[0] = 0;
     sr->topo_id  = 0;
-    sr->logfile  = 0;
+    sr->log      = 0;
     sr->hw_init  = 0;
 
     sr->interface_subsystem = 0;
@@ -396,4 +436,7 @@ static void usage(char* argv0)
     printf("     -l log.file\n");
     printf("     -i nf2cX (X being the first port of the NetFPGA card desired)\n");
     printf("     -u cpuhw.file\n");
+    printf("     -P count[:bufsize] (lwip pbuf pool, default %d:%d, bufsize %d to %d)\n",
+           PBUF_POOL_SIZE, PBUF_POOL_BUFSIZE, PBUF_POOL_BUFSIZE_MIN, PBUF_POOL_BUFSIZE_MAX);
+    printf("     -R count (lwip pbufs wrapping received packets, default %d)\n", MEMP_NUM_PBUF);
 } /* -- usage -- */
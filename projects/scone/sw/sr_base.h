@@ -12,5 +12,6 @@
 #define SR_BASE_H
 
 void* sr_init_low_level_subystem(int argc, char **argv);
+int   sr_lwip_sprint_stats(char* buf, int size);
 
 #endif  /* -- SR_BASE_H -- */
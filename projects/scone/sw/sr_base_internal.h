@@ -87,7 +87,7 @@ struct sr_instance
     char rtable[32];/* filename for routing table          */
     unsigned short topo_id; /* topology id */
     struct sockaddr_in sr_addr; /* address to server */
-    FILE* logfile; /* file to log all received/sent packets to */
+    struct sr_log* log; /* log of all received/sent packets */
     volatile uint8_t  hw_init; /* bool : hardware has been initialized */
     pthread_mutex_t   send_lock; /* experimental */
 
@@ -140,6 +140,9 @@ int sr_integ_low_level_output(struct sr_instance* sr /* borrowed */,
                              unsigned int len,
                              const char* iface /* borrowed */);
 uint32_t sr_integ_findsrcip(uint32_t dest /* nbo */);
+uint8_t* sr_integ_hold_packet(const uint8_t* packet /* borrowed */,
+                              unsigned int len);
+void sr_integ_release_packet(uint8_t* packet /* given */);
 
 
 #endif  /* -- SR_BASE_INTERNAL_H -- */
@@ -2,6 +2,9 @@
 #include <sys/types.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <assert.h>
 
 #include "sr_dumper.h"
@@ -9,6 +12,108 @@
 #include "sr_base_internal.h"
 
 
+/* the ring of the calling thread, made on its first packet */
+static __thread struct sr_log_ring* sr_log_thread_ring = 0;
+static __thread unsigned int sr_log_thread_owner = 0;
+
+/* the timestamp of the batch the calling thread is in */
+static __thread struct timeval sr_log_batch_ts;
+static __thread int sr_log_in_batch = 0;
+
+/* logs open, nobody takes batch timestamps while it is 0 */
+static volatile int sr_log_open_count = 0;
+
+/* tells the logs apart for the thread rings, a closed one's address may be reused */
+static volatile unsigned int sr_log_next_id = 0;
+
+static struct sr_log* sr_log_atexit_log = 0;
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_batch_begin()
+ * Scope:  Global
+ *
+ * Called by the I/O threads each time they pick up a batch of packets, so the
+ * clock is read once for all of them instead of once per packet.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_batch_begin(void)
+{
+    if (!sr_log_open_count)
+    { return; }
+
+    gettimeofday(&sr_log_batch_ts, 0);
+    sr_log_in_batch = 1;
+} /* -- sr_log_batch_begin -- */
+
+void sr_log_batch_end(void)
+{
+    sr_log_in_batch = 0;
+} /* -- sr_log_batch_end -- */
+
+/*
+ * Returns: the interface id of name, a new one if it has not been logged before,
+ * SR_LOG_MAX_IFACES - 1 is shared by everything past the limit
+ */
+static int sr_log_iface(struct sr_log* log, const char* name)
+{
+    int i;
+
+    if (!name)
+    { name = "unknown"; }
+
+    /* names are only ever appended, and published after they are written */
+    for (i = 0; i < log->num_ifaces; ++i)
+    {
+        if (strncmp(log->iface_names[i], name, SR_LOG_IFACE_LEN) == 0)
+        { return i; }
+    }
+
+    pthread_mutex_lock(&log->iface_lock);
+    for (i = 0; i < log->num_ifaces; ++i)
+    {
+        if (strncmp(log->iface_names[i], name, SR_LOG_IFACE_LEN) == 0)
+        { break; }
+    }
+    if ((i == log->num_ifaces) && (i < SR_LOG_MAX_IFACES))
+    {
+        strncpy(log->iface_names[i], name, SR_LOG_IFACE_LEN - 1);
+        __sync_synchronize();
+        log->num_ifaces = i + 1;
+    }
+    pthread_mutex_unlock(&log->iface_lock);
+
+    return (i < SR_LOG_MAX_IFACES) ? i : SR_LOG_MAX_IFACES - 1;
+}
+
+static struct sr_log_ring* sr_log_ring_get(struct sr_log* log)
+{
+    if (sr_log_thread_owner == log->id)
+    { return sr_log_thread_ring; }
+
+    /* first packet from this thread, a thread that gets no ring keeps dropping */
+    sr_log_thread_owner = log->id;
+    sr_log_thread_ring = 0;
+
+    int index = __sync_fetch_and_add(&log->num_rings, 1);
+    if (index < SR_LOG_MAX_RINGS)
+    {
+        struct sr_log_ring* ring = (struct sr_log_ring*)calloc(1, sizeof(struct sr_log_ring));
+        if (ring)
+        {
+            __sync_synchronize();
+            log->rings[index] = ring;
+            sr_log_thread_ring = ring;
+        }
+    }
+    else
+    {
+        __sync_fetch_and_sub(&log->num_rings, 1);
+    }
+
+    return sr_log_thread_ring;
+}
+
 /*-----------------------------------------------------------------------------
  * Method: sr_log_packet()
  * Scope:  Global
@@ -17,24 +122,398 @@
 
 void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
 {
-    struct pcap_pkthdr h;
-    int size;
+    sr_log_packet_iface(sr, buf, len, 0, SR_LOG_DIR_UNKNOWN);
+} /* -- sr_log_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_packet_iface()
+ * Scope:  Global
+ *
+ * Copies the packet into the calling thread's ring and returns, the writer
+ * thread puts it in the file. Never blocks, a full ring drops the packet and
+ * counts it against the interface.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_packet_iface(struct sr_instance* sr, uint8_t* buf, int len, const char* iface, int dir)
+{
+    struct sr_log* log;
+    struct sr_log_ring* ring;
+    struct sr_log_record* rec;
+    uint32_t head;
+    int id;
 
     /* REQUIRES */
     assert(sr);
 
-    if(!sr->logfile)
+    log = sr->log;
+    if(!log)
     {return; }
 
-    size = min(SR_PACKET_DUMP_SIZE, len);
+    id = sr_log_iface(log, iface);
+    ring = sr_log_ring_get(log);
+    if (!ring)
+    {
+        __sync_fetch_and_add(&log->iface_drops[id], 1);
+        return;
+    }
 
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < SR_PACKET_DUMP_SIZE) ? size : SR_PACKET_DUMP_SIZE;
+    head = ring->head;
+    if ((head - ring->tail) >= SR_LOG_RING_SLOTS)
+    {
+        __sync_fetch_and_add(&log->iface_drops[id], 1);
+        return;
+    }
 
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
-} /* -- sr_log_packet -- */
+    rec = &ring->slots[head & (SR_LOG_RING_SLOTS - 1)];
+    if (sr_log_in_batch)
+    { rec->ts = sr_log_batch_ts; }
+    else
+    { gettimeofday(&rec->ts, 0); }
+    rec->len = len;
+    rec->caplen = min(SR_PACKET_DUMP_SIZE, len);
+    rec->iface = id;
+    rec->dir = dir;
+    memcpy(rec->data, buf, rec->caplen);
+
+    /* the record has to be complete before the writer can see it */
+    __sync_synchronize();
+    ring->head = head + 1;
+} /* -- sr_log_packet_iface -- */
+
+static void sr_log_append(struct sr_log* log, const void* data, unsigned int len)
+{
+    memcpy(log->buf + log->buf_len, data, len);
+    log->buf_len += len;
+}
+
+static void sr_log_write(struct sr_log* log)
+{
+    if (log->buf_len > 0)
+    {
+        if (fwrite(log->buf, log->buf_len, 1, log->fp) != 1)
+        { fprintf(stderr, "sr_log_write: can't write %u bytes\n", log->buf_len); }
+        fflush(log->fp);
+        log->bytes += log->buf_len;
+        ++log->writes;
+        log->buf_len = 0;
+    }
+    gettimeofday(&log->last_write, 0);
+}
+
+/* a pcapng option, the value padded out to 32 bits */
+static void sr_log_append_option(struct sr_log* log, uint16_t code, const void* value, uint16_t len)
+{
+    uint32_t zero = 0;
+
+    sr_log_append(log, &code, sizeof(code));
+    sr_log_append(log, &len, sizeof(len));
+    sr_log_append(log, value, len);
+    sr_log_append(log, &zero, (4 - (len & 3)) & 3);
+}
+
+/* interface description blocks for every interface up to and including id */
+static void sr_log_append_idbs(struct sr_log* log, int id)
+{
+    while (log->ifaces_written <= id)
+    {
+        const char* name = log->iface_names[log->ifaces_written];
+        uint16_t name_len = strlen(name);
+        uint32_t hdr[4];
+        uint32_t end = 0;
+        uint32_t total = sizeof(hdr) + 4 + ((name_len + 3) & ~3) + sizeof(end) + 4;
+
+        if (log->buf_len + total > SR_LOG_WRITE_LEN)
+        { sr_log_write(log); }
+
+        hdr[0] = PCAPNG_IDB;
+        hdr[1] = total;
+        hdr[2] = LINKTYPE_ETHERNET;   /* and 16 reserved bits */
+        hdr[3] = SR_PACKET_DUMP_SIZE;
+        sr_log_append(log, hdr, sizeof(hdr));
+        sr_log_append_option(log, 2 /* if_name */, name, name_len);
+        sr_log_append(log, &end, sizeof(end));
+        sr_log_append(log, &total, sizeof(total));
+
+        ++log->ifaces_written;
+    }
+}
+
+static void sr_log_append_record(struct sr_log* log, struct sr_log_record* rec)
+{
+    if (log->format == SR_LOG_PCAPNG)
+    {
+        uint32_t hdr[7];
+        uint32_t end = 0;
+        uint32_t flags = rec->dir;    /* 01 inbound, 10 outbound */
+        uint32_t pad = (4 - (rec->caplen & 3)) & 3;
+        uint64_t usec = ((uint64_t)rec->ts.tv_sec * 1000000) + rec->ts.tv_usec;
+        uint32_t total = sizeof(hdr) + rec->caplen + pad + 4;
+
+        if (rec->dir != SR_LOG_DIR_UNKNOWN)
+        { total += 8 + sizeof(end); }
+
+        sr_log_append_idbs(log, rec->iface);
+        if (log->buf_len + total > SR_LOG_WRITE_LEN)
+        { sr_log_write(log); }
+
+        hdr[0] = PCAPNG_EPB;
+        hdr[1] = total;
+        hdr[2] = rec->iface;
+        hdr[3] = (uint32_t)(usec >> 32);
+        hdr[4] = (uint32_t)usec;
+        hdr[5] = rec->caplen;
+        hdr[6] = rec->len;
+        sr_log_append(log, hdr, sizeof(hdr));
+        sr_log_append(log, rec->data, rec->caplen);
+        sr_log_append(log, &end, pad);
+        if (rec->dir != SR_LOG_DIR_UNKNOWN)
+        {
+            sr_log_append_option(log, 2 /* epb_flags */, &flags, sizeof(flags));
+            sr_log_append(log, &end, sizeof(end));
+        }
+        sr_log_append(log, &total, sizeof(total));
+    }
+    else
+    {
+        struct pcap_sf_pkthdr sf_hdr;
+
+        if (log->buf_len + sizeof(sf_hdr) + rec->caplen > SR_LOG_WRITE_LEN)
+        { sr_log_write(log); }
+
+        sf_hdr.ts.tv_sec  = rec->ts.tv_sec;
+        sf_hdr.ts.tv_usec = rec->ts.tv_usec;
+        sf_hdr.caplen     = rec->caplen;
+        sf_hdr.len        = rec->len;
+        sr_log_append(log, &sf_hdr, sizeof(sf_hdr));
+        sr_log_append(log, rec->data, rec->caplen);
+    }
+
+    ++log->iface_packets[rec->iface];
+}
+
+/*
+ * Moves everything waiting in the rings into the write buffer, each slot is
+ * handed back as soon as it is copied.
+ * Returns: the number of packets drained
+ */
+static int sr_log_drain(struct sr_log* log)
+{
+    int drained = 0;
+    int i;
+
+    for (i = 0; (i < log->num_rings) && (i < SR_LOG_MAX_RINGS); ++i)
+    {
+        struct sr_log_ring* ring = log->rings[i];
+        if (!ring)
+        { continue; }
+
+        uint32_t tail = ring->tail;
+        uint32_t head = ring->head;
+        __sync_synchronize();
+
+        while (tail != head)
+        {
+            sr_log_append_record(log, &ring->slots[tail & (SR_LOG_RING_SLOTS - 1)]);
+            __sync_synchronize();
+            ring->tail = ++tail;
+            ++drained;
+        }
+    }
+
+    return drained;
+}
+
+static void* sr_log_writer(void* arg)
+{
+    struct sr_log* log = (struct sr_log*)arg;
+    struct timeval now;
+
+    while (log->running)
+    {
+        int drained = sr_log_drain(log);
+
+        gettimeofday(&now, 0);
+        if ((((now.tv_sec - log->last_write.tv_sec) * 1000) +
+                ((now.tv_usec - log->last_write.tv_usec) / 1000)) >= SR_LOG_FLUSH_MSEC)
+        { sr_log_write(log); }
+
+        if (!drained)
+        { usleep(SR_LOG_IDLE_USEC); }
+    }
+
+    return 0;
+}
+
+/*
+ * Stops the writer and writes out the rest, pcapng logs end with the drop count
+ * of every interface.
+ */
+static void sr_log_finish(struct sr_log* log)
+{
+    int i;
+
+    log->running = 0;
+    pthread_join(log->writer, 0);
+    sr_log_drain(log);
+
+    if (log->format == SR_LOG_PCAPNG)
+    {
+        struct timeval now;
+        gettimeofday(&now, 0);
+        uint64_t usec = ((uint64_t)now.tv_sec * 1000000) + now.tv_usec;
+
+        for (i = 0; i < log->num_ifaces; ++i)
+        {
+            uint32_t hdr[5];
+            uint32_t end = 0;
+            uint64_t drops = log->iface_drops[i];
+            uint32_t total = sizeof(hdr) + 4 + sizeof(drops) + sizeof(end) + 4;
+
+            sr_log_append_idbs(log, i);
+            if (log->buf_len + total > SR_LOG_WRITE_LEN)
+            { sr_log_write(log); }
+
+            hdr[0] = PCAPNG_ISB;
+            hdr[1] = total;
+            hdr[2] = i;
+            hdr[3] = (uint32_t)(usec >> 32);
+            hdr[4] = (uint32_t)usec;
+            sr_log_append(log, hdr, sizeof(hdr));
+            sr_log_append_option(log, 5 /* isb_ifdrop */, &drops, sizeof(drops));
+            sr_log_append(log, &end, sizeof(end));
+            sr_log_append(log, &total, sizeof(total));
+        }
+    }
+    sr_log_write(log);
+}
+
+/* other threads may still be logging, so the rings stay where they are */
+static void sr_log_atexit(void)
+{
+    if (sr_log_atexit_log)
+    {
+        sr_log_finish(sr_log_atexit_log);
+        sr_log_atexit_log = 0;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_open()
+ * Scope:  Global
+ *
+ * Opens fname ("-" for stdout) as a pcap or pcapng log and starts the writer.
+ * Whatever is still buffered is written out on exit.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_log* sr_log_open(const char* fname, int format)
+{
+    struct sr_log* log = (struct sr_log*)calloc(1, sizeof(struct sr_log));
+    assert(log);
+
+    log->id = __sync_add_and_fetch(&sr_log_next_id, 1);
+    log->format = format;
+    log->buf = (unsigned char*)malloc(SR_LOG_WRITE_LEN);
+    assert(log->buf);
+    pthread_mutex_init(&log->iface_lock, 0);
+
+    if (format == SR_LOG_PCAPNG)
+    {
+        uint32_t shb[7];
+
+        if (fname[0] == '-' && fname[1] == '\0')
+        { log->fp = stdout; }
+        else
+        { log->fp = fopen(fname, "w"); }
+
+        if (log->fp)
+        {
+            shb[0] = PCAPNG_SHB;
+            shb[1] = sizeof(shb);
+            shb[2] = PCAPNG_BYTE_ORDER_MAGIC;
+            shb[3] = 1;             /* version 1.0 */
+            shb[4] = 0xFFFFFFFF;    /* section length not known */
+            shb[5] = 0xFFFFFFFF;
+            shb[6] = sizeof(shb);
+            if (fwrite(shb, sizeof(shb), 1, log->fp) != 1)
+            { fprintf(stderr, "sr_log_open: can't write header\n"); }
+        }
+        else
+        { fprintf(stderr, "sr_log_open: can't open %s", fname); }
+    }
+    else
+    { log->fp = sr_dump_open(fname, 0, SR_PACKET_DUMP_SIZE); }
+
+    if (!log->fp)
+    {
+        pthread_mutex_destroy(&log->iface_lock);
+        free(log->buf);
+        free(log);
+        return 0;
+    }
+
+    gettimeofday(&log->last_write, 0);
+    log->running = 1;
+    if (pthread_create(&log->writer, 0, sr_log_writer, log) != 0)
+    {
+        perror("sr_log_open: pthread_create");
+        exit(1);
+    }
+
+    __sync_fetch_and_add(&sr_log_open_count, 1);
+    if (!sr_log_atexit_log)
+    {
+        sr_log_atexit_log = log;
+        atexit(sr_log_atexit);
+    }
+
+    return log;
+} /* -- sr_log_open -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_close()
+ * Scope:  Global
+ *
+ * Writes out the rest and frees the log. The caller makes sure nobody logs to
+ * it any more.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_close(struct sr_log* log)
+{
+    int i;
+
+    if (!log)
+    { return; }
+
+    if (sr_log_atexit_log == log)
+    { sr_log_atexit_log = 0; }
+
+    sr_log_finish(log);
+
+    if (log->fp != stdout)
+    { sr_dump_close(log->fp); }
+
+    for (i = 0; (i < log->num_rings) && (i < SR_LOG_MAX_RINGS); ++i)
+    { free(log->rings[i]); }
+    pthread_mutex_destroy(&log->iface_lock);
+    free(log->buf);
+    free(log);
+
+    __sync_fetch_and_sub(&sr_log_open_count, 1);
+} /* -- sr_log_close -- */
+
+uint64_t sr_log_drops(struct sr_log* log)
+{
+    uint64_t drops = 0;
+    int i;
+
+    for (i = 0; i < SR_LOG_MAX_IFACES; ++i)
+    { drops += log->iface_drops[i]; }
+
+    return drops;
+}
 
 static void
 sf_write_header(FILE *fp, int linktype, int thiszone, int snaplen)
@@ -3,6 +3,9 @@
  * format as well as a set of operations for logging.
  */
 
+#ifndef SR_DUMPER_H
+#define SR_DUMPER_H
+
 
 #ifdef _LINUX_
 #include <stdint.h>
@@ -13,6 +16,8 @@
 #endif /* _DARWIN_ */
 
 #include <sys/time.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <pcap.h>
 
 #define PCAP_VERSION_MAJOR 2
@@ -28,6 +33,28 @@
 
 #define SR_PACKET_DUMP_SIZE 1514
 
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_SHB 0x0A0D0D0A   /* section header block */
+#define PCAPNG_IDB 0x00000001   /* interface description block */
+#define PCAPNG_ISB 0x00000005   /* interface statistics block */
+#define PCAPNG_EPB 0x00000006   /* enhanced packet block */
+
+/* what the log is written as, a file name ending in .pcapng picks pcapng */
+#define SR_LOG_PCAP   0
+#define SR_LOG_PCAPNG 1
+
+#define SR_LOG_DIR_UNKNOWN 0
+#define SR_LOG_DIR_IN      1
+#define SR_LOG_DIR_OUT     2
+
+#define SR_LOG_RING_SLOTS 1024      /* packets a thread can have waiting, power of two */
+#define SR_LOG_MAX_RINGS  32        /* logging threads, packets from any more are dropped */
+#define SR_LOG_MAX_IFACES 16
+#define SR_LOG_IFACE_LEN  16
+#define SR_LOG_WRITE_LEN  (1 << 20) /* the writer buffers up to this much per write */
+#define SR_LOG_FLUSH_MSEC 100       /* and writes out anything older than this */
+#define SR_LOG_IDLE_USEC  1000      /* writer sleep when every ring is empty */
+
 
 /*
  * This is a timeval as stored in disk in a dumpfile.
@@ -49,9 +76,72 @@ struct pcap_sf_pkthdr {
     uint32_t len;            /* length this packet (off wire) */
 };
 
+/*
+ * One packet waiting in a ring. The timestamp is the one taken for the batch the
+ * packet was received or sent in.
+ */
+struct sr_log_record {
+    struct timeval ts;
+    uint32_t len;               /* length on the wire */
+    uint32_t caplen;            /* length kept in data */
+    uint16_t iface;             /* index into sr_log.iface_names */
+    uint16_t dir;               /* SR_LOG_DIR_ */
+    unsigned char data[SR_PACKET_DUMP_SIZE];
+};
+
+/*
+ * Single producer, single consumer ring. head is only written by the thread that
+ * owns the ring and tail only by the writer thread, so neither side takes a lock.
+ */
+struct sr_log_ring {
+    volatile uint32_t head;
+    char pad[60];               /* keep head and tail on their own cache lines */
+    volatile uint32_t tail;
+    char pad2[60];
+    struct sr_log_record slots[SR_LOG_RING_SLOTS];
+};
+
+struct sr_log {
+    unsigned int id;
+    FILE* fp;
+    int format;
+    struct sr_log_ring* rings[SR_LOG_MAX_RINGS];
+    volatile int num_rings;
+
+    /* interfaces by the order they were first logged, the pcapng interface ids */
+    char iface_names[SR_LOG_MAX_IFACES][SR_LOG_IFACE_LEN];
+    volatile int num_ifaces;
+    int ifaces_written;         /* interface blocks already in the file, writer only */
+    pthread_mutex_t iface_lock; /* taken only to add an interface */
+    volatile uint64_t iface_drops[SR_LOG_MAX_IFACES];  /* full ring or no ring */
+    uint64_t iface_packets[SR_LOG_MAX_IFACES];         /* written, writer only */
+
+    pthread_t writer;
+    volatile int running;
+    unsigned char* buf;         /* what the writer has drained, SR_LOG_WRITE_LEN */
+    unsigned int buf_len;
+    struct timeval last_write;
+    uint64_t bytes;
+    uint64_t writes;
+};
+
 /* Given sr instance, log packet to logfile */
 struct sr_instance; /* forward declare */
 void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len );
+void sr_log_packet_iface(struct sr_instance* sr, uint8_t* buf, int len, const char* iface, int dir);
+
+/**
+ * Packets this thread logs until sr_log_batch_end share one timestamp, taken now.
+ */
+void sr_log_batch_begin(void);
+void sr_log_batch_end(void);
+
+/**
+ * Open a log and start its writer thread, sr_log_close drains and closes it.
+ */
+struct sr_log* sr_log_open(const char* fname, int format);
+void sr_log_close(struct sr_log* log);
+uint64_t sr_log_drops(struct sr_log* log);
 
 /**
  * Open a dump file and initialize the file.
@@ -67,3 +157,5 @@ void sr_dump(FILE *fp, const struct pcap_pkthdr *h, const unsigned char *sp);
  * Close the file
  */
 void sr_dump_close(FILE *fp);
+
+#endif /* SR_DUMPER_H */
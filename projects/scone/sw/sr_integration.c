@@ -20,6 +20,7 @@
 #include "sr_base_internal.h"
 #include "or_data_types.h"
 #include "or_main.h"
+#include "or_pktbuf.h"
 
 #ifdef _CPUMODE_
 #include "sr_cpu_extension_nf2.h"
@@ -171,6 +172,36 @@ uint32_t sr_integ_findsrcip(uint32_t dest /* nbo */)
     return find_srcip(dest);
 } /* -- ip_findsrcip -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_integ_hold_packet(..)
+ * Scope: global
+ *
+ * Called by the transport layer to keep a received packet past the input
+ * call without copying it.  Returns a pointer to the same bytes that stays
+ * valid until sr_integ_release_packet(..), or to a copy if the packet was
+ * not in a packet buffer.
+ *
+ *---------------------------------------------------------------------------*/
+
+uint8_t* sr_integ_hold_packet(const uint8_t* packet /* borrowed */,
+                              unsigned int len)
+{
+    return pktbuf_hold(packet, len);
+} /* -- sr_integ_hold_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_integ_release_packet(..)
+ * Scope: global
+ *
+ * Drops the reference taken by sr_integ_hold_packet(..).
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_integ_release_packet(uint8_t* packet /* given */)
+{
+    pkt_free(packet);
+} /* -- sr_integ_release_packet -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_integ_ip_output(..)
  * Scope: global
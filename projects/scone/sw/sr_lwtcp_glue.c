@@ -33,13 +33,29 @@
 /* unsightly global variable, avert your eyes */
 struct netif* inp = NULL;
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_transport_release(..)
+ * Scope:  Local
+ *
+ * Called by lwip when it frees a pbuf wrapping a packet handed to it by
+ * sr_transport_input(..), payload points somewhere into the packet.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_transport_release(void* payload)
+{
+    sr_integ_release_packet((uint8_t*)payload);
+} /* -- sr_transport_release -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_transport_input(..)
  * Scope:  Global
  *
  * Called by sr to send a packet to the transport layer.  Packet is assumed
  * to have a header with a correct ip length.  The memory holding packet is
- * left untouched.
+ * left untouched: lwip gets a reference to its packet buffer, or a copy
+ * when packet is not pooled, wrapped in a PBUF_REF pbuf. Only when lwip is
+ * out of pbuf structures is packet copied into its heap.
  *
  *---------------------------------------------------------------------------*/
 
@@ -49,6 +65,7 @@ void sr_transport_input(uint8_t* packet /* borrowed */)
 
     if (inp == NULL) {
     	inp = (struct netif*)calloc(1, sizeof(struct netif));
+    	pbuf_ref_release = sr_transport_release;
     }
 
     /* -- this is sort of a hack for now, in the future we should
@@ -58,12 +75,19 @@ void sr_transport_input(uint8_t* packet /* borrowed */)
     //memset(&inp, sizeof(struct netif), 0);
 
     struct ip* header = (struct ip*)packet;
-
-    pb = pbuf_alloc(PBUF_RAW, ntohs(header->ip_len), PBUF_RAM);
-
-    pb->len = pb->tot_len = ntohs(header->ip_len);
-
-    memcpy(pb->payload,packet,pb->tot_len);
+    uint16_t len = ntohs(header->ip_len);
+
+    pb = pbuf_alloc(PBUF_RAW, len, PBUF_REF);
+    if (pb) {
+        pb->payload = sr_integ_hold_packet(packet, len);
+    } else {
+        pb = pbuf_alloc(PBUF_RAW, len, PBUF_RAM);
+        if (pb == NULL) {
+            return;
+        }
+        pb->len = pb->tot_len = len;
+        memcpy(pb->payload,packet,pb->tot_len);
+    }
 
     tcp_msg_input(pb, inp);
 } /* -- sr_transport_input -- */
@@ -41,8 +41,13 @@ void sr_vns_init_log(struct sr_instance* sr, char* logfile)
     if (!logfile)
     { return; }
 
-    sr->logfile = sr_dump_open(logfile, 0, SR_PACKET_DUMP_SIZE);
-    if(!sr->logfile)
+    /* -- pcapng if asked for by name -- */
+    int len = strlen(logfile);
+    int format = ((len > 7) && (strcmp(logfile + len - 7, ".pcapng") == 0)) ?
+        SR_LOG_PCAPNG : SR_LOG_PCAP;
+
+    sr->log = sr_log_open(logfile, format);
+    if(!sr->log)
     {
         fprintf(stderr,"Error opening up dump file %s\n",
                 logfile);
@@ -59,8 +64,8 @@ void sr_close_instance(struct sr_instance* sr)
 {
     close(sr->sockfd);
 
-    if(sr->logfile)
-    { sr_dump_close(sr->logfile); }
+    if(sr->log)
+    { sr_log_close(sr->log); sr->log = 0; }
 
     sr->hw_init = 0;
 } /* -- sr_close_instance -- */
@@ -337,8 +342,9 @@ int sr_vns_read_from_server(struct sr_instance* sr /* borrowed */)
             sr_pkt = (c_packet_ethernet_header *)buf;
 
             /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
+            sr_log_packet_iface(sr, buf + sizeof(c_packet_header),
+                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header),
+                    sr_pkt->mInterfaceName, SR_LOG_DIR_IN);
 
             /* -- pass to router, student's code should take over here -- */
             sr_integ_input(sr,
@@ -418,7 +424,7 @@ int sr_vns_send_packet(struct sr_instance* sr /* borrowed */,
             buf,len);
 
     /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
+    sr_log_packet_iface(sr,buf,len,iface,SR_LOG_DIR_OUT);
 
     if ( pthread_mutex_lock(&(sr->send_lock)) )
     { assert (0); }